@@ -0,0 +1,540 @@
+/**
+ * @file 3lnn-batch.c
+ * @brief Mini-batch training: feed forward and back propagation of a whole batch of samples as matrix-matrix products
+ * @details Within a batch all samples are computed with the same (pre-update) weights. The gradients
+ * of all samples are summed up and applied once, so a batch of size 1 behaves like per-sample training
+ * except that the error of every HIDDEN layer is always derived from the weights above it before their update.
+ * The inner loops run on the vector kernels of 3lnn-kernels.c.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "util/mnist-utils.h"
+#include "util/profile-stats.h"
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-batch.h"
+
+
+
+
+/**
+ * @details Returns the number of values of all matrices of a batch (rows are padded to full cache lines)
+ */
+
+size_t getBatchBlockSize(const Network *nn, int capacity){
+    
+    size_t blockSize = 0;
+    for (int l=0; l<nn->layerCount; l++){
+        blockSize += (size_t)capacity * padToAlignment(nn->dense[l].ncount) * ((l==INPUT) ? 1 : 2);
+    }
+    
+    return blockSize;
+}
+
+
+
+
+/**
+ * @details Reserves the batch, its matrices and its labels in the same order as createBatchInArena() allocates them
+ */
+
+size_t reserveBatch(size_t used, const Network *nn, int capacity){
+    
+    used = reserveArenaSize(used, sizeof(Batch), NN_ALIGNMENT);
+    used = reserveArenaSize(used, getBatchBlockSize(nn, capacity) * sizeof(NNReal), NN_ALIGNMENT);
+    
+    return reserveArenaSize(used, capacity * sizeof(int), sizeof(int));
+}
+
+
+
+
+/**
+ * @details Creates a batch that can hold up to capacity samples for the given NN in an arena
+ */
+
+Batch *createBatchInArena(Arena *arena, const Network *nn, int capacity){
+    
+    size_t blockSize = getBatchBlockSize(nn, capacity);
+    
+    Batch *b = (Batch*)allocArena(arena, sizeof(Batch), NN_ALIGNMENT);
+    
+    b->arena = NULL;
+    b->capacity = capacity;
+    b->count = 0;
+    b->layerCount = nn->layerCount;
+    for (int l=0; l<b->layerCount; l++){
+        b->ncount[l] = nn->dense[l].ncount;
+        b->stride[l] = padToAlignment(b->ncount[l]);
+    }
+    
+    b->block = (NNReal*)allocArena(arena, blockSize * sizeof(NNReal), NN_ALIGNMENT);
+    
+    NNReal *ptr = b->block;
+    for (int l=0; l<b->layerCount; l++){
+        b->output[l] = ptr;
+        ptr += (size_t)capacity * b->stride[l];
+        if (l==INPUT) {
+            b->delta[l] = NULL;
+            continue;
+        }
+        b->delta[l] = ptr;
+        ptr += (size_t)capacity * b->stride[l];
+    }
+    
+    b->labels = (int*)allocArena(arena, capacity * sizeof(int), sizeof(int));
+    
+    return b;
+}
+
+
+
+
+/**
+ * @details Creates a batch that can hold up to capacity samples for the given NN
+ */
+
+Batch *createBatch(const Network *nn, int capacity){
+    
+    // The batch, its matrices and its labels share one arena (= one heap allocation)
+    Arena *arena = createArena(reserveBatch(0, nn, capacity));
+    
+    Batch *b = createBatchInArena(arena, nn, capacity);
+    b->arena = arena;
+    
+    return b;
+}
+
+
+
+
+/**
+ * @details Frees a batch created via createBatch()
+ */
+
+void freeBatch(Batch *b){
+    
+    freeArena(b->arena);
+    
+}
+
+
+
+
+/**
+ * @details Appends a sample (input vector and target classification) to a batch
+ */
+
+void addToBatch(Batch *b, Vector *v, int label){
+    
+    NNReal *row = b->output[INPUT] + (size_t)b->count * b->stride[INPUT];
+    
+    memcpy(row, v->vals, v->size * sizeof(NNReal));
+    b->labels[b->count] = label;
+    
+    b->count++;
+}
+
+
+
+
+/**
+ * @details Appends a sample given as bitset to a batch, writing it straight into the batch
+ */
+
+void addBitsetToBatch(Batch *b, const uint64_t *bits, int label){
+    
+    PROFILE_START(startTime);
+    
+    NNReal *row = b->output[INPUT] + (size_t)b->count * b->stride[INPUT];
+    
+    for (int i=0; i<b->ncount[INPUT]; i++) row[i] = (bits[i/64] >> (i%64)) & 1;
+    b->labels[b->count] = label;
+    
+    b->count++;
+    
+    PROFILE_STOP(PROFILE_FEED_INPUT, startTime);
+}
+
+
+
+
+/**
+ * @details Appends a sample given as gray values to a batch, writing it straight into the batch
+ */
+
+void addPixelsToBatch(Batch *b, const uint8_t *pixel, int label){
+    
+    PROFILE_START(startTime);
+    
+    NNReal *row = b->output[INPUT] + (size_t)b->count * b->stride[INPUT];
+    
+    for (int i=0; i<b->ncount[INPUT]; i++) row[i] = pixel[i] * (NNReal)(1.0 / 255);
+    b->labels[b->count] = label;
+    
+    b->count++;
+    
+    PROFILE_STOP(PROFILE_FEED_INPUT, startTime);
+}
+
+
+
+
+/**
+ * @details Removes all samples from a batch
+ */
+
+void clearBatch(Batch *b){
+    
+    b->count = 0;
+    
+}
+
+
+
+
+/**
+ * @details Sets up a batch that refers to a subset of rows of another batch (without copying any data)
+ */
+
+void getSubBatch(Batch *b, int first, int count, Batch *view){
+    
+    *view = *b;
+    
+    view->capacity = count;
+    view->count = count;
+    view->labels = b->labels + first;
+    view->block = NULL;
+    
+    for (int l=0; l<b->layerCount; l++){
+        view->output[l] = b->output[l] + (size_t)first * b->stride[l];
+        if (l!=INPUT) view->delta[l] = b->delta[l] + (size_t)first * b->stride[l];
+    }
+    
+}
+
+
+
+
+/**
+ * @details Feeds all samples of a batch forward, layer by layer (outputs = act(previous outputs * W^T))
+ */
+
+void feedForwardBatch(const Network *nn, Batch *b){
+    
+    for (int l=1; l<b->layerCount; l++){
+        PROFILE_START(startTime);
+        calcDenseLayerBatch(&nn->dense[l], b->output[l-1], b->stride[l-1], b->count, b->output[l], b->stride[l], getActFctType(nn, l), nn->actPrecision);
+        PROFILE_STOP((l==b->layerCount-1) ? PROFILE_OUTPUT_FORWARD : PROFILE_HIDDEN_FORWARD, startTime);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Returns the ID of the output node with the highest output for one sample of the batch
+ */
+
+int getBatchClassification(Batch *b, int id){
+    
+    PROFILE_START(startTime);
+    
+    int out = b->layerCount-1;
+    NNReal *output = b->output[out] + (size_t)id * b->stride[out];
+    
+    NNReal maxOut = 0;
+    int maxInd = 0;
+    
+    for (int i=0; i<b->ncount[out]; i++){
+        
+        if (output[i] > maxOut){
+            maxOut = output[i];
+            maxInd = i;
+        }
+    }
+    
+    PROFILE_STOP(PROFILE_CLASSIFY, startTime);
+    
+    return maxInd;
+}
+
+
+
+
+/**
+ * @details Reserves the buffer and its gradients in the same order as createGradientsInArena() allocates them
+ */
+
+size_t reserveGradients(size_t used, const Network *nn){
+    
+    int ncount[NN_MAX_LAYERS];
+    for (int l=0; l<nn->layerCount; l++) ncount[l] = nn->dense[l].ncount;
+    
+    used = reserveArenaSize(used, sizeof(Gradients), NN_ALIGNMENT);
+    
+    return reserveDenseLayers(used, nn->layerCount, ncount);
+}
+
+
+
+
+/**
+ * @details Creates a zeroed gradient buffer matching the layout of the given NN in an arena
+ */
+
+Gradients *createGradientsInArena(Arena *arena, const Network *nn){
+    
+    int ncount[NN_MAX_LAYERS];
+    for (int l=0; l<nn->layerCount; l++) ncount[l] = nn->dense[l].ncount;
+    
+    Gradients *g = (Gradients*)allocArena(arena, sizeof(Gradients), NN_ALIGNMENT);
+    
+    g->arena = NULL;
+    g->layerCount = nn->layerCount;
+    g->block = createDenseLayers(arena, g->layer, g->layerCount, ncount);
+    
+    return g;
+}
+
+
+
+
+/**
+ * @details Creates a zeroed gradient buffer matching the layout of the given NN
+ */
+
+Gradients *createGradients(const Network *nn){
+    
+    // The buffer and its gradients share one arena (= one heap allocation)
+    Arena *arena = createArena(reserveGradients(0, nn));
+    
+    Gradients *g = createGradientsInArena(arena, nn);
+    g->arena = arena;
+    
+    return g;
+}
+
+
+
+
+/**
+ * @details Frees a gradient buffer created via createGradients()
+ */
+
+void freeGradients(Gradients *g){
+    
+    freeArena(g->arena);
+    
+}
+
+
+
+
+/**
+ * @details Resets all gradients to 0
+ */
+
+void clearGradients(Gradients *g){
+    
+    for (int l=1; l<g->layerCount; l++){
+        DenseLayer *gl = &g->layer[l];
+        memset(gl->weights, 0, (size_t)gl->ncount * gl->stride * sizeof(NNReal));
+        memset(gl->bias, 0, gl->ncount * sizeof(NNReal));
+    }
+    
+}
+
+
+
+
+/**
+ * @details Adds the gradients of one buffer to another: dst += src
+ */
+
+void addGradients(Gradients *dst, Gradients *src){
+    
+    for (int l=1; l<dst->layerCount; l++){
+        DenseLayer *dl = &dst->layer[l];
+        DenseLayer *sl = &src->layer[l];
+        addScaledVector(dl->ncount * dl->stride, 1, sl->weights, dl->weights);
+        addScaledVector(dl->ncount, 1, sl->bias, dl->bias);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Calculates the error signals of the OUTPUT layer for all samples of the batch
+ */
+
+void calcBatchOutputDeltas(Network *nn, Batch *b){
+    
+    PROFILE_START(startTime);
+    
+    int out = getOutputLayer(nn);
+    
+    for (int s=0; s<b->count; s++){
+        
+        NNReal *output = b->output[out] + (size_t)s * b->stride[out];
+        NNReal *delta  = b->delta[out]  + (size_t)s * b->stride[out];
+        
+        for (int o=0; o<b->ncount[out]; o++){
+            
+            int targetOutput = (o==b->labels[s])?1:0;
+            
+            NNReal errorDelta = targetOutput - output[o];
+            delta[o] = errorDelta * getActFctDerivative(nn, out, output[o]);
+        }
+    }
+    
+    PROFILE_STOP(PROFILE_OUTPUT_BACKPROP, startTime);
+}
+
+
+
+
+/**
+ * @details Calculates the error signals of a HIDDEN layer for all samples of the batch
+ * (hidden delta = delta above * W_above, multiplied with the derivative of the hidden outputs)
+ */
+
+void calcBatchHiddenDeltas(Network *nn, Batch *b, int layer){
+    
+    PROFILE_START(startTime);
+    
+    DenseLayer *ol = &nn->dense[layer+1];
+    
+    for (int s=0; s<b->count; s++){
+        
+        NNReal *outDelta  = b->delta[layer+1] + (size_t)s * b->stride[layer+1];
+        NNReal *hidDelta  = b->delta[layer]   + (size_t)s * b->stride[layer];
+        NNReal *hidOutput = b->output[layer]  + (size_t)s * b->stride[layer];
+        
+        memset(hidDelta, 0, b->ncount[layer] * sizeof(NNReal));
+        
+        // Sum up the weighted error signals of all nodes of the layer above, one weight row at a time
+        for (int o=0; o<ol->ncount; o++){
+            addScaledVector(ol->wcount, outDelta[o], ol->weights + (size_t)o * ol->stride, hidDelta);
+        }
+        
+        for (int h=0; h<b->ncount[layer]; h++){
+            hidDelta[h] *= getActFctDerivative(nn, layer, hidOutput[h]);
+        }
+    }
+    
+    PROFILE_STOP(PROFILE_HIDDEN_BACKPROP, startTime);
+}
+
+
+
+
+/**
+ * @details Calculates the error signals of all layers for all samples of the batch, from the OUTPUT layer down
+ */
+
+void calcBatchDeltas(Network *nn, Batch *b){
+    
+    calcBatchOutputDeltas(nn, b);
+    for (int l=getOutputLayer(nn)-1; l>=1; l--) calcBatchHiddenDeltas(nn, b, l);
+    
+}
+
+
+
+
+/**
+ * @details Adds the updates of a range of rows of all layers for all samples of the batch to a set of
+ * dense layers: weights += scale * delta^T * previous layer's outputs (one rank-B update per layer)
+ */
+
+void updateBatchLayers(Batch *b, DenseLayer *dense, NNReal scale, int threadId, int threadCount){
+    
+    for (int l=b->layerCount-1; l>=1; l--){
+        
+        PROFILE_START(startTime);
+        
+        int first = (int)(((long)dense[l].ncount * threadId) / threadCount);
+        int last  = (int)(((long)dense[l].ncount * (threadId+1)) / threadCount);
+        
+        updateDenseLayerBatch(&dense[l], scale, b->delta[l], b->stride[l], b->output[l-1], b->stride[l-1], b->count, first, last);
+        
+        PROFILE_STOP((l==b->layerCount-1) ? PROFILE_OUTPUT_BACKPROP : PROFILE_HIDDEN_BACKPROP, startTime);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Calculates the error gradients of all samples of a batch and adds them to a gradient buffer
+ */
+
+void accumulateGradients(Network *nn, Batch *b, Gradients *g){
+    
+    calcBatchDeltas(nn, b);
+    
+    updateBatchLayers(b, g->layer, 1, 0, 1);
+    
+}
+
+
+
+
+/**
+ * @details Applies accumulated gradients to the network's weights: weights += learningRate * scale * gradients
+ */
+
+void applyGradients(Network *nn, Gradients *g, double scale){
+    
+    for (int l=1; l<nn->layerCount; l++){
+        
+        PROFILE_START(startTime);
+        
+        DenseLayer *dl = &nn->dense[l];
+        DenseLayer *gl = &g->layer[l];
+        
+        // The padding of the weight rows is 0 in both matrices, so the whole matrix is updated in one go
+        addScaledVector(dl->ncount * dl->stride, nn->learningRate * scale, gl->weights, dl->weights);
+        addScaledVector(dl->ncount, nn->learningRate * scale, gl->bias, dl->bias);
+        
+        PROFILE_STOP((l==getOutputLayer(nn)) ? PROFILE_OUTPUT_BACKPROP : PROFILE_HIDDEN_BACKPROP, startTime);
+    }
+    
+}
+
+
+
+
+/**
+ * @details 1/sqrt(count)
+ */
+
+double getBatchGradientScale(int count){
+    
+    return 1 / sqrt(count);
+}
+
+
+
+
+/**
+ * @details Back propagates the error of all samples of a batch and updates the weights once. The summed
+ * gradients are added to the weights right away instead of going through a gradient buffer, which gives
+ * the same result (see updateDenseLayerBatch()).
+ */
+
+void backPropagateBatch(Network *nn, Batch *b){
+    
+    calcBatchDeltas(nn, b);
+    
+    updateBatchLayers(b, nn->dense, nn->learningRate * getBatchGradientScale(b->count), 0, 1);
+    
+}
@@ -0,0 +1,319 @@
+/**
+ * @file 3lnn-batch.h
+ * @brief Mini-batch training: feed forward and back propagation of a whole batch of samples as matrix-matrix products
+ * @details The inputs of a batch are packed into a B x INPUT matrix. The error gradients of all
+ * samples are accumulated in a Gradients buffer and applied to the network's weights once per batch.
+ */
+
+#ifndef MNIST_3LNN_BATCH_H
+#define MNIST_3LNN_BATCH_H
+
+#include "3lnn.h"
+
+
+typedef struct Batch Batch;
+typedef struct Gradients Gradients;
+
+
+
+
+/**
+ * @brief Data structure holding the inputs, activations and error signals of a batch of samples
+ * @details All matrices are row-major with one sample per row. Rows are padded to full cache lines.
+ */
+
+struct Batch{
+    int capacity;               ///< Maximum number of samples in the batch
+    int count;                  ///< Number of samples currently in the batch
+    int layerCount;             ///< Number of layers of the NN the batch was created for
+    int ncount[NN_MAX_LAYERS];  ///< Number of nodes per layer, from INPUT to OUTPUT
+    int stride[NN_MAX_LAYERS];  ///< Number of values from one row to the next, per layer
+    NNReal *output[NN_MAX_LAYERS];  ///< Per layer: capacity x stride matrix of outputs (INPUT holds the packed input vectors)
+    NNReal *delta[NN_MAX_LAYERS];   ///< Per layer: capacity x stride matrix of error signals (NULL for INPUT)
+    int *labels;                ///< Target classification of each sample
+    NNReal *block;              ///< Single aligned memory block holding all matrices
+    Arena *arena;               ///< Arena holding the batch, its matrices and labels (NULL = part of the caller's arena)
+};
+
+
+
+
+/**
+ * @brief Buffer holding accumulated weight and bias gradients in the same layout as the network's dense layers
+ */
+
+struct Gradients{
+    int layerCount;             ///< Number of layers of the NN the buffer was created for
+    DenseLayer layer[NN_MAX_LAYERS];  ///< Gradients of the HIDDEN and OUTPUT layers (weights and bias fields), from INPUT to OUTPUT
+    NNReal *block;              ///< Aligned memory block holding all gradients
+    Arena *arena;               ///< Arena holding the buffer and its gradients (NULL = part of the caller's arena)
+};
+
+
+
+
+/**
+ * @brief Creates a batch that can hold up to capacity samples for the given NN
+ * @param nn A pointer to the NN
+ * @param capacity Maximum number of samples in the batch
+ */
+
+Batch *createBatch(const Network *nn, int capacity);
+
+
+
+
+/**
+ * @brief Returns the arena fill level after reserving a batch, for planning the size of an arena
+ * @param used Number of bytes used before the batch
+ * @param nn A pointer to the NN
+ * @param capacity Maximum number of samples in the batch
+ */
+
+size_t reserveBatch(size_t used, const Network *nn, int capacity);
+
+
+
+
+/**
+ * @brief Creates a batch in an arena (with the space reserved via reserveBatch()), released together with the arena
+ * @param arena A pointer to the arena
+ * @param nn A pointer to the NN
+ * @param capacity Maximum number of samples in the batch
+ */
+
+Batch *createBatchInArena(Arena *arena, const Network *nn, int capacity);
+
+
+
+
+/**
+ * @brief Frees a batch created via createBatch()
+ * @param b A pointer to the batch
+ */
+
+void freeBatch(Batch *b);
+
+
+
+
+/**
+ * @brief Appends a sample (input vector and target classification) to a batch
+ * @param b A pointer to the batch
+ * @param v A pointer to the input vector
+ * @param label Correct classification (=label) of the input
+ */
+
+void addToBatch(Batch *b, Vector *v, int label);
+
+
+
+
+/**
+ * @brief Appends a sample given as bitset (bit set = 1, bit clear = 0) to a batch, writing it straight into the batch
+ * @param b A pointer to the batch
+ * @param bits Bitset holding one bit per input value, starting at the lowest bit of bits[0]
+ * @param label Correct classification (=label) of the input
+ */
+
+void addBitsetToBatch(Batch *b, const uint64_t *bits, int label);
+
+
+
+
+/**
+ * @brief Appends a sample given as gray values (0 to 255 -> 0 to 1) to a batch, writing it straight into the batch
+ * @param b A pointer to the batch
+ * @param pixel One gray value per input value
+ * @param label Correct classification (=label) of the input
+ */
+
+void addPixelsToBatch(Batch *b, const uint8_t *pixel, int label);
+
+
+
+
+/**
+ * @brief Removes all samples from a batch
+ * @param b A pointer to the batch
+ */
+
+void clearBatch(Batch *b);
+
+
+
+
+/**
+ * @brief Sets up a batch that refers to a subset of rows of another batch (without copying any data)
+ * @param b A pointer to the batch
+ * @param first Index of the first sample of the subset
+ * @param count Number of samples in the subset
+ * @param view A pointer to the batch that is set up to refer to the subset
+ */
+
+void getSubBatch(Batch *b, int first, int count, Batch *view);
+
+
+
+
+/**
+ * @brief Feeds all samples of a batch forward from input to hidden to output layer
+ * @param nn A pointer to the NN
+ * @param b A pointer to the batch
+ */
+
+void feedForwardBatch(const Network *nn, Batch *b);
+
+
+
+
+/**
+ * @brief Returns the factor the summed gradients of a batch are scaled by, on top of the learning rate
+ * @details 1/sqrt(count), which is neither the sum (1) nor the mean (1/count) of the gradients: the sum grows
+ * with the batch size, so one learning rate would diverge on large batches, while the mean makes each update
+ * as small as a single sample's and slows training down on large batches. The square root keeps the learning
+ * rate of per-sample training usable for all batch sizes, and leaves a batch of size 1 unchanged.
+ * @param count Number of samples whose gradients are summed up
+ */
+
+double getBatchGradientScale(int count);
+
+
+
+
+/**
+ * @brief Back propagates the error of all samples of a batch and updates the weights once
+ * @details The summed gradients are applied with the learning rate scaled by getBatchGradientScale().
+ * @param nn A pointer to the NN
+ * @param b A pointer to the batch (after feedForwardBatch())
+ */
+
+void backPropagateBatch(Network *nn, Batch *b);
+
+
+
+
+/**
+ * @brief Returns the network's classification of one sample of a batch (after feedForwardBatch())
+ * @param b A pointer to the batch
+ * @param id Index of the sample in the batch
+ */
+
+int getBatchClassification(Batch *b, int id);
+
+
+
+
+/**
+ * @brief Creates a zeroed gradient buffer matching the layout of the given NN
+ * @param nn A pointer to the NN
+ */
+
+Gradients *createGradients(const Network *nn);
+
+
+
+
+/**
+ * @brief Returns the arena fill level after reserving a gradient buffer, for planning the size of an arena
+ * @param used Number of bytes used before the buffer
+ * @param nn A pointer to the NN
+ */
+
+size_t reserveGradients(size_t used, const Network *nn);
+
+
+
+
+/**
+ * @brief Creates a zeroed gradient buffer in an arena (with the space reserved via reserveGradients()), released together with the arena
+ * @param arena A pointer to the arena
+ * @param nn A pointer to the NN
+ */
+
+Gradients *createGradientsInArena(Arena *arena, const Network *nn);
+
+
+
+
+/**
+ * @brief Frees a gradient buffer created via createGradients()
+ * @param g A pointer to the gradient buffer
+ */
+
+void freeGradients(Gradients *g);
+
+
+
+
+/**
+ * @brief Resets all gradients to 0
+ * @param g A pointer to the gradient buffer
+ */
+
+void clearGradients(Gradients *g);
+
+
+
+
+/**
+ * @brief Adds the gradients of one buffer to another: dst += src
+ * @param dst A pointer to the gradient buffer that is updated
+ * @param src A pointer to the gradient buffer that is added
+ */
+
+void addGradients(Gradients *dst, Gradients *src);
+
+
+
+
+/**
+ * @brief Calculates the error signals (deltas) of all layers for all samples of a batch
+ * @param nn A pointer to the NN
+ * @param b A pointer to the batch (after feedForwardBatch())
+ */
+
+void calcBatchDeltas(Network *nn, Batch *b);
+
+
+
+
+/**
+ * @brief Adds scale times the summed gradients of all samples of a batch to one slice of the rows of every layer
+ * @details The rows of every layer are split into threadCount slices, so the threads of a pool can
+ * update disjoint slices of the same weights at the same time.
+ * @param b A pointer to the batch (after calcBatchDeltas())
+ * @param dense Dense layers that are updated (the NN's layers or the layers of a gradient buffer)
+ * @param scale Factor applied to the summed gradients
+ * @param threadId Index of the slice (0 to threadCount-1)
+ * @param threadCount Number of slices
+ */
+
+void updateBatchLayers(Batch *b, DenseLayer *dense, NNReal scale, int threadId, int threadCount);
+
+
+
+
+/**
+ * @brief Calculates the error gradients of all samples of a batch and adds them to a gradient buffer
+ * @param nn A pointer to the NN
+ * @param b A pointer to the batch (after feedForwardBatch())
+ * @param g A pointer to the gradient buffer
+ */
+
+void accumulateGradients(Network *nn, Batch *b, Gradients *g);
+
+
+
+
+/**
+ * @brief Applies accumulated gradients to the network's weights: weights += learningRate * scale * gradients
+ * @param nn A pointer to the NN
+ * @param g A pointer to the gradient buffer
+ * @param scale Factor applied on top of the network's learning rate
+ */
+
+void applyGradients(Network *nn, Gradients *g, double scale);
+
+
+#endif
@@ -0,0 +1,374 @@
+/**
+ * @file 3lnn-bf16.c
+ * @brief Mixed-precision inference: a copy of a trained NN with bfloat16 weights and fp32 accumulation
+ * @details A bfloat16 value is the upper half of a float, so widening it is a 16bit shift: the AVX2 and
+ * AVX-512 kernels zero-extend 8 or 16 weights to 32bit lanes, shift them and add or multiply them as
+ * floats. The kernel is chosen according to the instruction set selected in 3lnn-kernels.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BF16_X86
+#endif
+
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-bf16.h"
+
+
+#define BF16_LANES 8        ///< Number of values the rows are padded to (fp32 sums of 1 AVX2 register, half an AVX-512 register)
+
+
+/**
+ * @brief Kernels of one instruction set, see the scalar versions for what they calculate
+ */
+
+typedef struct Bf16Kernels{
+    void  (*sumRows)(const uint16_t *w, int stride, const uint64_t *bits, int count, float *sum);
+    float (*dotRow)(const uint16_t *w, const float *x, int n);
+} Bf16Kernels;
+
+static Bf16Kernels bf16Kernels = {NULL, NULL};
+
+
+
+
+/**
+ * @details Scalar sum += row i of w for every set bit i of the first count bits, stride values per row
+ */
+
+void sumRowsBf16Scalar(const uint16_t *w, int stride, const uint64_t *bits, int count, float *sum){
+    
+    for (int k=0; k*64<count; k++){
+        for (uint64_t word = bits[k]; word!=0; word &= word-1){
+            const uint16_t *row = w + (size_t)(k*64 + __builtin_ctzll(word)) * stride;
+            for (int j=0; j<stride; j++) sum[j] += bf16ToFloat(row[j]);
+        }
+    }
+    
+}
+
+
+
+
+/**
+ * @details Scalar dot product of n bfloat16 weights with n fp32 values
+ */
+
+float dotRowBf16Scalar(const uint16_t *w, const float *x, int n){
+    
+    float sum = 0;
+    for (int i=0; i<n; i++) sum += bf16ToFloat(w[i]) * x[i];
+    
+    return sum;
+}
+
+
+
+
+#ifdef BF16_X86
+
+/**
+ * @details AVX2 version of the columns from first to stride, 8 sums per register (both multiples of BF16_LANES)
+ */
+
+__attribute__((target("avx2,fma")))
+void sumRowsBf16Avx2Columns(const uint16_t *w, int stride, int first, const uint64_t *bits, int count, float *sum){
+    
+    for (int j=first; j<stride; j+=8){
+        
+        __m256 s = _mm256_loadu_ps(sum+j);
+        
+        for (int k=0; k*64<count; k++){
+            for (uint64_t word = bits[k]; word!=0; word &= word-1){
+                const uint16_t *row = w + (size_t)(k*64 + __builtin_ctzll(word)) * stride;
+                __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(row+j)));
+                s = _mm256_add_ps(s, _mm256_castsi256_ps(_mm256_slli_epi32(v, 16)));
+            }
+        }
+        
+        _mm256_storeu_ps(sum+j, s);
+    }
+    
+}
+
+
+
+
+/**
+ * @details AVX2 version, 8 sums per register (stride is a multiple of BF16_LANES)
+ */
+
+__attribute__((target("avx2,fma")))
+void sumRowsBf16Avx2(const uint16_t *w, int stride, const uint64_t *bits, int count, float *sum){
+    
+    sumRowsBf16Avx2Columns(w, stride, 0, bits, count, sum);
+    
+}
+
+
+
+
+/**
+ * @details AVX2 version, n is a multiple of 8
+ */
+
+__attribute__((target("avx2,fma")))
+float dotRowBf16Avx2(const uint16_t *w, const float *x, int n){
+    
+    __m256 s = _mm256_setzero_ps();
+    
+    for (int i=0; i<n; i+=8){
+        __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(w+i)));
+        s = _mm256_fmadd_ps(_mm256_castsi256_ps(_mm256_slli_epi32(v, 16)), _mm256_loadu_ps(x+i), s);
+    }
+    
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    
+    return _mm_cvtss_f32(_mm_add_ss(lo, _mm_movehdup_ps(lo)));
+}
+
+
+
+
+/**
+ * @details AVX-512 version, 16 sums per register (stride is a multiple of BF16_LANES, the last 8 sums are
+ * left to the AVX2 version)
+ */
+
+__attribute__((target("avx512f")))
+void sumRowsBf16Avx512(const uint16_t *w, int stride, const uint64_t *bits, int count, float *sum){
+    
+    int j = 0;
+    
+    for (; j+16<=stride; j+=16){
+        
+        __m512 s = _mm512_loadu_ps(sum+j);
+        
+        for (int k=0; k*64<count; k++){
+            for (uint64_t word = bits[k]; word!=0; word &= word-1){
+                const uint16_t *row = w + (size_t)(k*64 + __builtin_ctzll(word)) * stride;
+                __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(row+j)));
+                s = _mm512_add_ps(s, _mm512_castsi512_ps(_mm512_slli_epi32(v, 16)));
+            }
+        }
+        
+        _mm512_storeu_ps(sum+j, s);
+    }
+    
+    if (j<stride) sumRowsBf16Avx2Columns(w, stride, j, bits, count, sum);
+    
+}
+
+
+
+
+/**
+ * @details AVX-512 version, n is a multiple of 8 (the last 8 products, if any, are left to the AVX2 version)
+ */
+
+__attribute__((target("avx512f")))
+float dotRowBf16Avx512(const uint16_t *w, const float *x, int n){
+    
+    __m512 s = _mm512_setzero_ps();
+    
+    int i = 0;
+    for (; i+16<=n; i+=16){
+        __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(w+i)));
+        s = _mm512_fmadd_ps(_mm512_castsi512_ps(_mm512_slli_epi32(v, 16)), _mm512_loadu_ps(x+i), s);
+    }
+    
+    float sum = _mm512_reduce_add_ps(s);
+    if (i<n) sum += dotRowBf16Avx2(w+i, x+i, n-i);
+    
+    return sum;
+}
+
+#endif
+
+
+
+
+/**
+ * @details Picks the kernels matching the instruction set of 3lnn-kernels
+ */
+
+void initBf16Kernels(void){
+    
+    switch (getKernelIsa()) {
+#ifdef BF16_X86
+        case ISA_AVX512:
+            bf16Kernels = (Bf16Kernels){sumRowsBf16Avx512, dotRowBf16Avx512};
+            break;
+        case ISA_AVX2:
+            bf16Kernels = (Bf16Kernels){sumRowsBf16Avx2, dotRowBf16Avx2};
+            break;
+#endif
+        default:
+            bf16Kernels = (Bf16Kernels){sumRowsBf16Scalar, dotRowBf16Scalar};
+            break;
+    }
+    
+}
+
+
+
+
+/**
+ * @details Copies the dense layers of the NN into one aligned block, converting every weight to bfloat16.
+ * All padding values are 0, so the kernels can always process whole rows.
+ */
+
+Bf16Network *createBf16Network(const Network *nn){
+    
+    initBf16Kernels();
+    
+    Bf16Network *bn = (Bf16Network*)malloc(sizeof(Bf16Network));
+    if (bn==NULL){
+        printf("Abort! Could not allocate memory for the bfloat16 network\n");
+        exit(1);
+    }
+    
+    bn->layerCount = nn->layerCount;
+    for (int l=0; l<bn->layerCount; l++){
+        bn->ncount[l]  = nn->dense[l].ncount;
+        bn->stride[l]  = ((bn->ncount[l] + BF16_LANES - 1) / BF16_LANES) * BF16_LANES;
+        bn->actType[l] = getActFctType(nn, l);
+    }
+    
+    // Weights and biases of every layer (the kernels load them unaligned, so the rows are only padded to BF16_LANES)
+    size_t weightsSize[NN_MAX_LAYERS];
+    size_t blockSize = 0;
+    for (int l=1; l<bn->layerCount; l++){
+        weightsSize[l] = (size_t)((l==1) ? bn->ncount[0] * bn->stride[1] : bn->ncount[l] * bn->stride[l-1]) * sizeof(uint16_t);
+        blockSize += weightsSize[l] + (size_t)bn->stride[l] * sizeof(float);
+    }
+    
+    if (posix_memalign(&bn->block, NN_ALIGNMENT, blockSize) != 0){
+        printf("Abort! Could not allocate memory for the bfloat16 network\n");
+        exit(1);
+    }
+    memset(bn->block, 0, blockSize);
+    
+    uint8_t *ptr = (uint8_t*)bn->block;
+    bn->weights[INPUT] = NULL;
+    bn->bias[INPUT]    = NULL;
+    for (int l=1; l<bn->layerCount; l++){
+        bn->weights[l] = (uint16_t*)ptr;  ptr += weightsSize[l];
+        bn->bias[l]    = (float*)ptr;     ptr += (size_t)bn->stride[l] * sizeof(float);
+    }
+    
+    for (int l=1; l<bn->layerCount; l++){
+        const DenseLayer *dl = &nn->dense[l];
+        for (int n=0; n<dl->ncount; n++){
+            const NNReal *w = dl->weights + (size_t)n * dl->stride;
+            for (int i=0; i<dl->wcount; i++){
+                if (l==1) bn->weights[l][(size_t)i * bn->stride[1] + n] = floatToBf16((float)w[i]);
+                     else bn->weights[l][(size_t)n * bn->stride[l-1] + i] = floatToBf16((float)w[i]);
+            }
+            bn->bias[l][n] = (float)dl->bias[n];
+        }
+    }
+    
+    return bn;
+}
+
+
+
+
+/**
+ * @details Frees a bfloat16 NN
+ */
+
+void freeBf16Network(Bf16Network *bn){
+    
+    free(bn->block);
+    free(bn);
+}
+
+
+
+
+/**
+ * @details Returns the byte size of the arrays holding a bfloat16 NN's weights and biases (including padding)
+ */
+
+size_t getBf16NetworkSize(const Bf16Network *bn){
+    
+    size_t size = (size_t)bn->ncount[0] * bn->stride[1] * sizeof(uint16_t);
+    for (int l=2; l<bn->layerCount; l++) size += (size_t)bn->ncount[l] * bn->stride[l-1] * sizeof(uint16_t);
+    for (int l=1; l<bn->layerCount; l++) size += (size_t)bn->stride[l] * sizeof(float);
+    
+    return size;
+}
+
+
+
+
+/**
+ * @details The workspace holds stride[l] fp32 output values per layer, from the first HIDDEN layer to OUTPUT
+ */
+
+float *createBf16Workspace(const Bf16Network *bn){
+    
+    size_t count = 0;
+    for (int l=1; l<bn->layerCount; l++) count += bn->stride[l];
+    
+    void *work = NULL;
+    if (posix_memalign(&work, NN_ALIGNMENT, count * sizeof(float)) != 0){
+        printf("Abort! Could not allocate memory for the bfloat16 workspace\n");
+        exit(1);
+    }
+    memset(work, 0, count * sizeof(float));
+    
+    return (float*)work;
+}
+
+
+
+
+/**
+ * @details Starts every sum of the first HIDDEN layer with its bias and adds the (transposed) weight row of
+ * each set pixel. All following layers are dense dot products of every weight row with the previous layer's outputs.
+ */
+
+int classifyInputBitsetBf16(const Bf16Network *bn, float *work, const uint64_t *bits, float *scores){
+    
+    float *hidden = work;
+    
+    memcpy(hidden, bn->bias[1], bn->stride[1] * sizeof(float));
+    bf16Kernels.sumRows(bn->weights[1], bn->stride[1], bits, bn->ncount[0], hidden);
+    
+    // The padding values stay 0 (instead of activation(0)) since they are multiplied with 0 weights
+    for (int h=0; h<bn->ncount[1]; h++) hidden[h] = (float)activate(bn->actType[1], hidden[h]);
+    
+    for (int l=2; l<bn->layerCount; l++){
+        float *output = hidden + bn->stride[l-1];
+        for (int o=0; o<bn->ncount[l]; o++){
+            float sum = bn->bias[l][o] + bf16Kernels.dotRow(bn->weights[l] + (size_t)o * bn->stride[l-1], hidden, bn->stride[l-1]);
+            output[o] = (float)activate(bn->actType[l], sum);
+        }
+        hidden = output;
+    }
+    
+    int out = bn->layerCount-1;
+    
+    float maxOut = 0;
+    int maxInd = 0;
+    
+    for (int o=0; o<bn->ncount[out]; o++){
+        if (hidden[o] > maxOut){
+            maxOut = hidden[o];
+            maxInd = o;
+        }
+    }
+    
+    if (scores!=NULL) memcpy(scores, hidden, bn->ncount[out] * sizeof(float));
+    
+    return maxInd;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file 3lnn-bf16.h
+ * @brief Mixed-precision inference: a copy of a trained NN with bfloat16 weights and fp32 accumulation
+ * @details bfloat16 keeps the 8bit exponent of a float but only 7 bits of its mantissa. The weights are widened
+ * to fp32 when they are loaded, all sums and activations are calculated in fp32. bfloat16 is only used by this
+ * read-only inference copy: the NN itself is still stored, trained and saved in NNReal (float or double).
+ * The weights of the first HIDDEN layer are stored transposed (one row per INPUT node), so that a binarized
+ * input is classified by adding up one contiguous row of weights per set pixel. Every row is padded to a
+ * multiple of 8 values, so a value is 2 bytes instead of 4 or 8, but small layers pay for their padding: the
+ * first layer of 784-20-10 takes 784x24x2 = 37.6 KB against 62.7 KB in float and 125.4 KB in double.
+ */
+
+#ifndef MNIST_3LNN_BF16_H
+#define MNIST_3LNN_BF16_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "3lnn.h"
+
+
+typedef struct Bf16Network Bf16Network;
+
+
+
+
+/**
+ * @brief Rounds a float to the nearest bfloat16 (ties to even)
+ * @param f Value to round
+ */
+
+static inline uint16_t floatToBf16(float f){
+    
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += 0x7FFF + ((u >> 16) & 1);
+    
+    return (uint16_t)(u >> 16);
+}
+
+
+
+
+/**
+ * @brief Widens a bfloat16 to a float (exact)
+ * @param b Value to widen
+ */
+
+static inline float bf16ToFloat(uint16_t b){
+    
+    uint32_t u = (uint32_t)b << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    
+    return f;
+}
+
+
+
+
+/**
+ * @brief Read-only copy of a NN's weights in bfloat16 (biases stay fp32)
+ */
+
+struct Bf16Network{
+    int layerCount;                 ///< Number of layers, from INPUT to OUTPUT
+    int ncount[NN_MAX_LAYERS];      ///< Number of nodes per layer
+    int stride[NN_MAX_LAYERS];      ///< ncount padded to a multiple of 8 = number of values of a layer's outputs and biases
+    uint16_t *weights[NN_MAX_LAYERS];   ///< First HIDDEN layer: ncount[0] x stride[1] transposed matrix (row i = weights of INPUT node i),
+                                        ///< other layers: row-major ncount[l] x stride[l-1] matrix (NULL for INPUT)
+    float *bias[NN_MAX_LAYERS];     ///< stride[l] biases per layer (NULL for INPUT)
+    ActFctType actType[NN_MAX_LAYERS];  ///< Activation function per layer
+    void *block;                    ///< Single NN_ALIGNMENT-aligned memory block holding all arrays
+};
+
+
+
+
+/**
+ * @brief Creates a bfloat16 copy of a NN (weights rounded to nearest even)
+ * @param nn A pointer to the NN
+ */
+
+Bf16Network *createBf16Network(const Network *nn);
+
+
+
+
+/**
+ * @brief Frees a bfloat16 NN
+ * @param bn A pointer to the bfloat16 NN
+ */
+
+void freeBf16Network(Bf16Network *bn);
+
+
+
+
+/**
+ * @brief Returns the byte size of a bfloat16 NN's weights and biases
+ * @param bn A pointer to the bfloat16 NN
+ */
+
+size_t getBf16NetworkSize(const Bf16Network *bn);
+
+
+
+
+/**
+ * @brief Allocates the fp32 workspace a thread needs for classifyInputBitsetBf16() (released via free())
+ * @param bn A pointer to the bfloat16 NN
+ */
+
+float *createBf16Workspace(const Bf16Network *bn);
+
+
+
+
+/**
+ * @brief Classifies one binarized input with a bfloat16 NN
+ * @param bn A pointer to the (read-only) bfloat16 NN
+ * @param work Workspace created via createBf16Workspace(), used by one thread at a time
+ * @param bits Bitset holding one bit per INPUT node (bit set = 1, bit clear = 0)
+ * @param scores Array receiving the output value of every OUTPUT node (may be NULL)
+ * @return ID of the output node with the highest output
+ */
+
+int classifyInputBitsetBf16(const Bf16Network *bn, float *work, const uint64_t *bits, float *scores);
+
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * @file 3lnn-checkpoint.c
+ * @brief Saving and loading a trained NN as versioned binary checkpoint file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "3lnn.h"
+#include "3lnn-checkpoint.h"
+
+
+#define NN_CHECKPOINT_MAGIC "3LNNCKPT"                      ///< First 8 bytes of every checkpoint file
+#define NN_CHECKPOINT_BYTE_ORDER 0x01020304u                ///< Written in native byte order to detect foreign files
+#define NN_CHECKPOINT_HEADER_SIZE 128                       ///< Byte size of the header (a multiple of NN_ALIGNMENT)
+
+
+typedef struct CheckpointHeader CheckpointHeader;
+
+
+
+
+/**
+ * @brief Data block defining the header at the beginning of a checkpoint file
+ */
+
+struct CheckpointHeader{
+    char magic[8];              ///< NN_CHECKPOINT_MAGIC
+    uint32_t version;           ///< NN_CHECKPOINT_VERSION
+    uint32_t byteOrder;         ///< NN_CHECKPOINT_BYTE_ORDER
+    uint32_t headerSize;        ///< NN_CHECKPOINT_HEADER_SIZE = byte offset of the dense block
+    uint32_t alignment;         ///< NN_ALIGNMENT the row strides were padded to
+    int32_t layerCount;         ///< Number of layers, 2 to NN_MAX_LAYERS
+    int32_t hidLayerActType;    ///< ActFctType of the HIDDEN layers
+    int32_t outLayerActType;    ///< ActFctType of the OUTPUT layer
+    double learningRate;
+    uint64_t denseSize;         ///< Byte size of the dense block following the header
+    uint32_t valueSize;         ///< sizeof(NNReal) of the dense block's values
+    int32_t ncount[NN_MAX_LAYERS];  ///< Number of nodes per layer, from INPUT to OUTPUT
+    int32_t stride[NN_MAX_LAYERS];  ///< Number of values per weight row, from INPUT to OUTPUT
+};
+
+
+
+
+_Static_assert(sizeof(CheckpointHeader) <= NN_CHECKPOINT_HEADER_SIZE, "checkpoint header does not fit into NN_CHECKPOINT_HEADER_SIZE");
+_Static_assert(NN_CHECKPOINT_HEADER_SIZE % NN_ALIGNMENT == 0, "checkpoint header size must keep the dense block aligned");
+
+
+
+
+/**
+ * @details Writes the header followed by the dense block. The dense block is written in one piece since
+ * its layout in memory is the file format.
+ */
+
+void saveNetwork(const Network *nn, const char *fileName){
+    
+    size_t denseSize = getDenseBlockSize(nn);
+    
+    uint8_t headerBlock[NN_CHECKPOINT_HEADER_SIZE];
+    memset(headerBlock, 0, sizeof(headerBlock));
+    
+    CheckpointHeader *h = (CheckpointHeader*)headerBlock;
+    memcpy(h->magic, NN_CHECKPOINT_MAGIC, sizeof(h->magic));
+    h->version         = NN_CHECKPOINT_VERSION;
+    h->byteOrder       = NN_CHECKPOINT_BYTE_ORDER;
+    h->headerSize      = NN_CHECKPOINT_HEADER_SIZE;
+    h->alignment       = NN_ALIGNMENT;
+    h->layerCount      = nn->layerCount;
+    for (int l=0; l<nn->layerCount; l++){
+        h->ncount[l]   = nn->dense[l].ncount;
+        h->stride[l]   = nn->dense[l].stride;
+    }
+    h->hidLayerActType = nn->hidLayerActType;
+    h->outLayerActType = nn->outLayerActType;
+    h->learningRate    = nn->learningRate;
+    h->denseSize       = denseSize;
+    h->valueSize       = sizeof(NNReal);
+    
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) {
+        printf("Abort! Could not create checkpoint file: %s\n",fileName);
+        exit(1);
+    }
+    
+    if (fwrite(headerBlock, sizeof(headerBlock), 1, file)!=1 ||
+        (denseSize>0 && fwrite(nn->denseBlock, denseSize, 1, file)!=1) ||
+        fclose(file)!=0) {
+        printf("Abort! Could not write checkpoint file: %s\n",fileName);
+        exit(1);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Maps the checkpoint file, checks that its header matches the format (and layout) of this build
+ * and creates a network whose dense arrays point directly into the mapping
+ */
+
+Network *loadNetwork(const char *fileName){
+    
+    int fd = open(fileName, O_RDONLY);
+    if (fd<0) {
+        printf("Abort! Could not find checkpoint file: %s\n",fileName);
+        exit(1);
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st)!=0 || (size_t)st.st_size<NN_CHECKPOINT_HEADER_SIZE) {
+        printf("Abort! Not a checkpoint file: %s\n",fileName);
+        exit(1);
+    }
+    
+    // Private writable mapping: training a loaded network modifies its own copy of the pages, not the file
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map==MAP_FAILED) {
+        printf("Abort! Could not map checkpoint file: %s\n",fileName);
+        exit(1);
+    }
+    
+    const CheckpointHeader *h = (const CheckpointHeader*)map;
+    
+    if (memcmp(h->magic, NN_CHECKPOINT_MAGIC, sizeof(h->magic))!=0) {
+        printf("Abort! Not a checkpoint file: %s\n",fileName);
+        exit(1);
+    }
+    if (h->byteOrder!=NN_CHECKPOINT_BYTE_ORDER || h->version!=NN_CHECKPOINT_VERSION || h->headerSize!=NN_CHECKPOINT_HEADER_SIZE) {
+        printf("Abort! Unsupported checkpoint version or byte order in file: %s\n",fileName);
+        exit(1);
+    }
+    
+    CheckpointHeader hdr = *h;
+    
+    if (hdr.valueSize!=sizeof(NNReal)) {
+        printf("Abort! Checkpoint file holds %u-byte values, this build uses %u-byte values: %s\n",hdr.valueSize,(unsigned)sizeof(NNReal),fileName);
+        exit(1);
+    }
+    int validCounts = (hdr.layerCount>=2 && hdr.layerCount<=NN_MAX_LAYERS);
+    for (int l=0; validCounts && l<hdr.layerCount; l++) if (hdr.ncount[l]<1) validCounts = 0;
+    if (!validCounts ||
+        (hdr.hidLayerActType!=SIGMOID && hdr.hidLayerActType!=TANH) ||
+        (hdr.outLayerActType!=SIGMOID && hdr.outLayerActType!=TANH)) {
+        printf("Abort! Invalid network parameters in checkpoint file: %s\n",fileName);
+        exit(1);
+    }
+    
+    int ncount[NN_MAX_LAYERS];
+    for (int l=0; l<hdr.layerCount; l++) ncount[l] = hdr.ncount[l];
+    
+    Network *nn = createEmptyNetwork(hdr.layerCount, ncount);
+    
+    // The dense block is used in place, so its layout must match what this build computes
+    size_t denseSize = getDenseBlockSize(nn);
+    for (int l=0; l<hdr.layerCount; l++){
+        if (hdr.stride[l]!=nn->dense[l].stride) {
+            printf("Abort! Checkpoint file uses a different memory alignment (%u bytes): %s\n",hdr.alignment,fileName);
+            exit(1);
+        }
+    }
+    if (hdr.denseSize!=denseSize) {
+        printf("Abort! Checkpoint file's dense block (%llu bytes) does not match the layout of its topology (%zu bytes): %s\n",(unsigned long long)hdr.denseSize,denseSize,fileName);
+        exit(1);
+    }
+    if ((size_t)st.st_size < NN_CHECKPOINT_HEADER_SIZE + denseSize) {
+        printf("Abort! Checkpoint file is truncated: %s\n",fileName);
+        exit(1);
+    }
+    
+    nn->hidLayerActType = (ActFctType)hdr.hidLayerActType;
+    nn->outLayerActType = (ActFctType)hdr.outLayerActType;
+    nn->learningRate    = hdr.learningRate;
+    
+    nn->denseMap     = map;
+    nn->denseMapSize = (size_t)st.st_size;
+    nn->denseBlock   = (NNReal*)((uint8_t*)map + NN_CHECKPOINT_HEADER_SIZE);
+    setDenseLayersBlock(nn->dense, nn->layerCount, nn->denseBlock);
+    
+    return nn;
+}
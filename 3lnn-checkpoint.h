@@ -0,0 +1,43 @@
+/**
+ * @file 3lnn-checkpoint.h
+ * @brief Saving and loading a trained NN as versioned binary checkpoint file
+ * @details A checkpoint consists of a fixed-size header (number of layers, layer sizes, row strides, activation
+ * function types, learning rate) followed by the network's dense block (weights and biases of every layer from the
+ * first HIDDEN layer to OUTPUT) exactly as it is laid out in memory. Since the header size is a multiple of NN_ALIGNMENT,
+ * loading a checkpoint is a single mmap of the file; the weights are used right where they are mapped.
+ * The weights are stored as NNReal, so a checkpoint can only be loaded by a build of the same precision.
+ */
+
+#ifndef MNIST_3LNN_CHECKPOINT_H
+#define MNIST_3LNN_CHECKPOINT_H
+
+#include "3lnn.h"
+
+
+#define NN_CHECKPOINT_VERSION 1                             ///< Version of the checkpoint format written by saveNetwork()
+
+
+
+
+/**
+ * @brief Saves the layer sizes, parameters and weights of a NN into a checkpoint file
+ * @param nn A pointer to the NN
+ * @param fileName Name of the checkpoint file (is overwritten)
+ */
+
+void saveNetwork(const Network *nn, const char *fileName);
+
+
+
+
+/**
+ * @brief Creates a NN from a checkpoint file by mapping the file into memory
+ * @details The file is mapped copy-on-write, so the NN can be trained further without changing the file.
+ * The NN is released via freeNetwork(). Its Layer/Node view is only filled on demand by syncNetworkView().
+ * @param fileName Name of the checkpoint file
+ */
+
+Network *loadNetwork(const char *fileName);
+
+
+#endif
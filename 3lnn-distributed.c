@@ -0,0 +1,559 @@
+/**
+ * @file 3lnn-distributed.c
+ * @brief Data-parallel training across several processes (nodes) that sum up their gradients over TCP
+ * @details The gradients of a NN are one contiguous block, which is all-reduced as a flat array of values
+ * (the zero padding of the rows included, it stays 0). Every step of the ring sends one chunk to the next
+ * node while receiving one from the node before. Both sockets are non-blocking and served by one poll()
+ * loop, so a node never blocks on a full send buffer while the node it waits for does the same.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "util/screen.h"
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-batch.h"
+#include "3lnn-bf16.h"
+#include "3lnn-distributed.h"
+
+
+#define DIST_MAGIC 0x4D4E3344           ///< "MN3D", also tells nodes of a different byte order apart
+#define DIST_RETRY_USEC 100000          ///< Number of usec between two attempts to connect to the next node
+
+
+/**
+ * @brief Data structure holding the connections, buffers and statistics of a node
+ */
+
+struct DistributedGroup{
+    int rank;                       ///< Index of this node
+    int size;                       ///< Number of nodes
+    int compress;                   ///< 1 = the chunks are sent as bfloat16
+    int nextFd;                     ///< Socket connected to the next node (rank+1), only sent to
+    int prevFd;                     ///< Socket connected to the node before (rank-1), only received from
+    size_t valueCount;              ///< Number of values of the gradients
+    NNReal *recvValues;             ///< Received chunk (uncompressed)
+    uint16_t *sendBf16;             ///< Chunk to send (compressed)
+    uint16_t *recvBf16;             ///< Received chunk (compressed)
+    NNReal *residual;               ///< Rounding error of the own gradients, added to the next ones (compressed)
+    uint64_t bytesSent;             ///< Number of bytes sent to the next node
+    uint64_t reduceTime;            ///< Number of nanoseconds spent in allReduceGradients()
+    long reduceCount;               ///< Number of calls of allReduceGradients()
+};
+
+
+/**
+ * @brief Message every node sends to the next one after connecting
+ */
+
+typedef struct DistributedHello{
+    int32_t magic;
+    int32_t rank;
+    int32_t size;
+    int32_t valueSize;              ///< sizeof(NNReal)
+    int32_t compress;
+    int32_t layerCount;
+    int32_t ncount[NN_MAX_LAYERS];
+} DistributedHello;
+
+
+
+
+/**
+ * @details Returns the current value of the monotonic clock in nanoseconds
+ */
+
+uint64_t getDistributedTime(void){
+    
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    
+    return (uint64_t)t.tv_sec*1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+
+
+
+/**
+ * @details Resolves the address of the node with the given rank in a comma-separated list of host:port entries
+ */
+
+struct addrinfo *resolveDistributedNode(const char *nodes, int rank){
+    
+    const char *entry = nodes;
+    for (int r=0; r<rank; r++) entry = strchr(entry, ',') + 1;
+    
+    size_t len = strcspn(entry, ",");
+    char host[256];
+    if (len>=sizeof(host)) len = sizeof(host)-1;
+    memcpy(host, entry, len);
+    host[len] = '\0';
+    
+    char *port = strrchr(host, ':');
+    if (port==NULL || port[1]=='\0'){
+        printf("Abort! Nodes are given as host:port (not '%s')\n", host);
+        exit(1);
+    }
+    *port++ = '\0';
+    
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    struct addrinfo *addr = NULL;
+    int err = getaddrinfo(host, port, &hints, &addr);
+    if (err!=0){
+        printf("Abort! Could not resolve node %d (%s:%s): %s\n", rank, host, port, gai_strerror(err));
+        exit(1);
+    }
+    
+    return addr;
+}
+
+
+
+
+/**
+ * @details Listens on the node's own address (aborts if it cannot be opened)
+ */
+
+int openDistributedListener(const char *nodes, int rank){
+    
+    struct addrinfo *addr = resolveDistributedNode(nodes, rank);
+    
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    
+    if (listenFd<0 || bind(listenFd, addr->ai_addr, addr->ai_addrlen)!=0 || listen(listenFd, 1)!=0){
+        printf("Abort! Node %d could not listen on its address: %s\n", rank, strerror(errno));
+        exit(1);
+    }
+    
+    freeaddrinfo(addr);
+    
+    return listenFd;
+}
+
+
+
+
+/**
+ * @details Retries until the node listens, so the nodes can be started in any order within DIST_CONNECT_TIMEOUT seconds
+ */
+
+int connectDistributedNode(const char *nodes, int rank){
+    
+    struct addrinfo *addr = resolveDistributedNode(nodes, rank);
+    uint64_t deadline = getDistributedTime() + DIST_CONNECT_TIMEOUT * 1000000000ull;
+    
+    for (;;){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd>=0 && connect(fd, addr->ai_addr, addr->ai_addrlen)==0){
+            freeaddrinfo(addr);
+            return fd;
+        }
+        int err = errno;
+        if (fd>=0) close(fd);
+        
+        if (getDistributedTime()>deadline){
+            printf("Abort! Could not connect to node %d: %s\n", rank, strerror(err));
+            exit(1);
+        }
+        usleep(DIST_RETRY_USEC);
+    }
+}
+
+
+
+
+/**
+ * @details Sends or receives a whole message on a blocking socket, aborting if the node has gone
+ */
+
+void transferDistributedHello(int fd, DistributedHello *hello, int sending, int rank){
+    
+    uint8_t *buf = (uint8_t*)hello;
+    size_t done = 0;
+    
+    while (done<sizeof(DistributedHello)){
+        ssize_t n = sending ? send(fd, buf + done, sizeof(DistributedHello) - done, MSG_NOSIGNAL)
+                            : recv(fd, buf + done, sizeof(DistributedHello) - done, 0);
+        if (n<0 && errno==EINTR) continue;
+        if (n<=0){
+            printf("Abort! Lost the connection to node %d while connecting\n", rank);
+            exit(1);
+        }
+        done += (size_t)n;
+    }
+}
+
+
+
+
+/**
+ * @details Describes this node and the NN it trains
+ */
+
+void initDistributedHello(DistributedHello *hello, const DistributedGroup *g, const Network *nn){
+    
+    memset(hello, 0, sizeof(DistributedHello));
+    hello->magic = DIST_MAGIC;
+    hello->rank = g->rank;
+    hello->size = g->size;
+    hello->valueSize = (int32_t)sizeof(NNReal);
+    hello->compress = g->compress;
+    hello->layerCount = nn->layerCount;
+    for (int l=0; l<nn->layerCount; l++) hello->ncount[l] = nn->dense[l].ncount;
+}
+
+
+
+
+/**
+ * @details Switches a connected socket to non-blocking mode without send delay (every chunk is waited for)
+ */
+
+void setDistributedSocketOptions(int fd){
+    
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+
+
+
+/**
+ * @details The listener is opened before connecting, so the connections of all nodes are queued by the
+ * kernel until accepted, whichever node comes first. The node before is then checked to be the expected
+ * one with the same settings, which checks every pair of neighbours and so the whole ring.
+ */
+
+DistributedGroup *createDistributedGroup(const char *nodes, int rank, int compress, const Network *nn){
+    
+    int size = 1;
+    for (const char *c=nodes; *c!='\0'; c++) if (*c==',') size++;
+    
+    if (size>DIST_MAX_NODES){
+        printf("Abort! At most %d nodes can train together (not %d)\n", DIST_MAX_NODES, size);
+        exit(1);
+    }
+    if (rank<0 || rank>=size){
+        printf("Abort! The rank must be between 0 and %d for %d nodes (not %d)\n", size-1, size, rank);
+        exit(1);
+    }
+    
+    DistributedGroup *g = (DistributedGroup*)calloc(1, sizeof(DistributedGroup));
+    g->rank = rank;
+    g->size = size;
+    g->compress = compress;
+    g->nextFd = -1;
+    g->prevFd = -1;
+    g->valueCount = getDenseBlockSize(nn) / sizeof(NNReal);
+    
+    if (size==1) return g;
+    
+    int listenFd = openDistributedListener(nodes, rank);
+    g->nextFd = connectDistributedNode(nodes, (rank+1) % size);
+    
+    DistributedHello hello, prevHello;
+    initDistributedHello(&hello, g, nn);
+    transferDistributedHello(g->nextFd, &hello, 1, (rank+1) % size);
+    
+    do g->prevFd = accept(listenFd, NULL, NULL);
+    while (g->prevFd<0 && (errno==EINTR || errno==ECONNABORTED));
+    if (g->prevFd<0){
+        printf("Abort! Could not accept the connection of node %d: %s\n", (rank+size-1) % size, strerror(errno));
+        exit(1);
+    }
+    close(listenFd);
+    
+    transferDistributedHello(g->prevFd, &prevHello, 0, (rank+size-1) % size);
+    prevHello.rank = (prevHello.rank+1) % size;
+    if (memcmp(&hello, &prevHello, sizeof(DistributedHello))!=0){
+        printf("Abort! Node %d was started with a different node list, precision, compression or topology\n", (rank+size-1) % size);
+        exit(1);
+    }
+    
+    setDistributedSocketOptions(g->nextFd);
+    setDistributedSocketOptions(g->prevFd);
+    
+    // Buffers for the largest chunk
+    size_t chunkCount = (g->valueCount + size - 1) / size;
+    if (compress){
+        g->sendBf16 = (uint16_t*)malloc(chunkCount * sizeof(uint16_t));
+        g->recvBf16 = (uint16_t*)malloc(chunkCount * sizeof(uint16_t));
+        g->residual = (NNReal*)calloc(g->valueCount, sizeof(NNReal));
+    }
+    else g->recvValues = (NNReal*)malloc(chunkCount * sizeof(NNReal));
+    
+    return g;
+}
+
+
+
+
+/**
+ * @details Closes the connections and frees the buffers of a group
+ */
+
+void freeDistributedGroup(DistributedGroup *g){
+    
+    if (g->nextFd>=0) close(g->nextFd);
+    if (g->prevFd>=0) close(g->prevFd);
+    
+    free(g->recvValues);
+    free(g->sendBf16);
+    free(g->recvBf16);
+    free(g->residual);
+    free(g);
+    
+}
+
+
+
+
+/**
+ * @details Returns the index of this node
+ */
+
+int getDistributedRank(const DistributedGroup *g){
+    
+    return g->rank;
+}
+
+
+
+
+/**
+ * @details Returns the number of nodes
+ */
+
+int getDistributedSize(const DistributedGroup *g){
+    
+    return g->size;
+}
+
+
+
+
+/**
+ * @details Images rank, rank+size, rank+2*size, ...
+ */
+
+int getDistributedShardCount(const DistributedGroup *g, int rank, int count){
+    
+    return (rank<count) ? (count - rank + g->size - 1) / g->size : 0;
+}
+
+
+
+
+/**
+ * @details Adds up what is left of every node's shard, at most batchSize images each
+ */
+
+int getDistributedBatchCount(const DistributedGroup *g, int count, int batchSize, int step){
+    
+    int total = 0;
+    
+    for (int r=0; r<g->size; r++){
+        int left = getDistributedShardCount(g, r, count) - step * batchSize;
+        total += (left<0) ? 0 : (left>batchSize) ? batchSize : left;
+    }
+    
+    return total;
+}
+
+
+
+
+/**
+ * @details Sends sendSize bytes to the next node while receiving recvSize bytes from the node before,
+ * aborting if either node has gone
+ */
+
+void exchangeDistributed(DistributedGroup *g, const void *sendBuf, size_t sendSize, void *recvBuf, size_t recvSize){
+    
+    const uint8_t *out = (const uint8_t*)sendBuf;
+    uint8_t *in = (uint8_t*)recvBuf;
+    size_t put = 0, got = 0;
+    
+    while (put<sendSize || got<recvSize){
+        
+        struct pollfd pfd[2] = {{g->nextFd, (put<sendSize) ? POLLOUT : 0, 0}, {g->prevFd, (got<recvSize) ? POLLIN : 0, 0}};
+        if (poll(pfd, 2, -1)<0){
+            if (errno==EINTR) continue;
+            printf("Abort! Could not wait for the other nodes: %s\n", strerror(errno));
+            exit(1);
+        }
+        
+        if (put<sendSize && pfd[0].revents!=0){
+            ssize_t n = send(g->nextFd, out + put, sendSize - put, MSG_NOSIGNAL);
+            if (n>0) put += (size_t)n;
+            else if (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR){
+                printf("Abort! Lost the connection to node %d: %s\n", (g->rank+1) % g->size, strerror(errno));
+                exit(1);
+            }
+        }
+        
+        if (got<recvSize && pfd[1].revents!=0){
+            ssize_t n = recv(g->prevFd, in + got, recvSize - got, 0);
+            if (n>0) got += (size_t)n;
+            else if (n==0 || (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)){
+                printf("Abort! Lost the connection to node %d\n", (g->rank+g->size-1) % g->size);
+                exit(1);
+            }
+        }
+    }
+    
+    g->bytesSent += sendSize;
+    
+}
+
+
+
+
+/**
+ * @details Node 0 sends its weights to node 1, every further node passes them on as soon as it has them
+ */
+
+void broadcastNetwork(DistributedGroup *g, Network *nn){
+    
+    if (g->size==1) return;
+    
+    size_t size = getDenseBlockSize(nn);
+    
+    if (g->rank>0) exchangeDistributed(g, NULL, 0, nn->denseBlock, size);
+    if (g->rank<g->size-1) exchangeDistributed(g, nn->denseBlock, size, NULL, 0);
+    
+}
+
+
+
+
+/**
+ * @details Returns the index of the first value of a chunk (chunk size = end of the last chunk)
+ */
+
+static inline size_t getDistributedChunkStart(const DistributedGroup *g, int chunk){
+    
+    return g->valueCount * (size_t)chunk / (size_t)g->size;
+}
+
+
+
+
+/**
+ * @details Rounds values to bfloat16 in place
+ */
+
+void roundDistributedValues(NNReal *v, size_t count){
+    
+    for (size_t i=0; i<count; i++) v[i] = bf16ToFloat(floatToBf16((float)v[i]));
+    
+}
+
+
+
+
+/**
+ * @details Sends one chunk of the values while receiving another one, which is either added to the values
+ * (reduce-scatter) or replaces them (all-gather)
+ */
+
+void exchangeDistributedChunks(DistributedGroup *g, NNReal *v, int sendChunk, int recvChunk, int add){
+    
+    size_t sendFirst = getDistributedChunkStart(g, sendChunk);
+    size_t sendCount = getDistributedChunkStart(g, sendChunk+1) - sendFirst;
+    size_t recvFirst = getDistributedChunkStart(g, recvChunk);
+    size_t recvCount = getDistributedChunkStart(g, recvChunk+1) - recvFirst;
+    
+    NNReal *dst = v + recvFirst;
+    
+    if (g->compress){
+        for (size_t i=0; i<sendCount; i++) g->sendBf16[i] = floatToBf16((float)v[sendFirst+i]);
+        exchangeDistributed(g, g->sendBf16, sendCount * sizeof(uint16_t), g->recvBf16, recvCount * sizeof(uint16_t));
+        if (add) for (size_t i=0; i<recvCount; i++) dst[i] += bf16ToFloat(g->recvBf16[i]);
+        else for (size_t i=0; i<recvCount; i++) dst[i] = bf16ToFloat(g->recvBf16[i]);
+    }
+    else if (add){
+        exchangeDistributed(g, v + sendFirst, sendCount * sizeof(NNReal), g->recvValues, recvCount * sizeof(NNReal));
+        addScaledVector((int)recvCount, 1, g->recvValues, dst);
+    }
+    else exchangeDistributed(g, v + sendFirst, sendCount * sizeof(NNReal), dst, recvCount * sizeof(NNReal));
+    
+}
+
+
+
+
+/**
+ * @details After step s of the reduce-scatter, the chunk a node receives holds the sum of s+2 nodes, after
+ * size-1 steps node r holds the complete sum of chunk r+1. Each sum is only calculated once, by its owner,
+ * so all nodes end up with the same bits even though floating-point addition is not associative.
+ */
+
+void allReduceGradients(DistributedGroup *g, Gradients *grad){
+    
+    if (g->size==1) return;
+    
+    uint64_t startTime = getDistributedTime();
+    
+    NNReal *v = grad->block;
+    int rank = g->rank, size = g->size;
+    
+    // Error feedback: the gradients that are sent are rounded, what is lost is sent along with the next ones
+    if (g->compress){
+        for (size_t i=0; i<g->valueCount; i++){
+            NNReal x = v[i] + g->residual[i];
+            v[i] = bf16ToFloat(floatToBf16((float)x));
+            g->residual[i] = x - v[i];
+        }
+    }
+    
+    for (int s=0; s<size-1; s++) exchangeDistributedChunks(g, v, (rank - s + size) % size, (rank - s - 1 + size) % size, 1);
+    
+    // The owner rounds its sum like every other node will when receiving it
+    if (g->compress){
+        int own = (rank+1) % size;
+        size_t first = getDistributedChunkStart(g, own);
+        roundDistributedValues(v + first, getDistributedChunkStart(g, own+1) - first);
+    }
+    
+    for (int s=0; s<size-1; s++) exchangeDistributedChunks(g, v, (rank + 1 - s + size) % size, (rank - s + size) % size, 0);
+    
+    g->reduceTime += getDistributedTime() - startTime;
+    g->reduceCount++;
+    
+}
+
+
+
+
+/**
+ * @details Displays the statistics of this node
+ */
+
+void displayDistributedStats(const DistributedGroup *g, int row, int col){
+    
+    locateCursor(row, col);
+    
+    double time = g->reduceTime / 1e9;
+    printf("   NODE %d of %d: %ld all-reduces of %zu KB%s, %.1f MB sent in %.3f sec (%.1f usec each)\n",
+           g->rank, g->size, g->reduceCount, g->valueCount * sizeof(NNReal) / 1024, g->compress ? " (sent as bfloat16)" : "",
+           g->bytesSent / 1e6, time, (g->reduceCount>0) ? time * 1e6 / g->reduceCount : 0);
+}
@@ -0,0 +1,141 @@
+/**
+ * @file 3lnn-distributed.h
+ * @brief Data-parallel training across several processes (nodes) that sum up their gradients over TCP
+ * @details Every node holds a replica of the NN and trains on its own shard of the training images. After
+ * every mini-batch, the nodes sum up their gradients with a ring all-reduce, so all replicas take the same
+ * optimizer step and keep the same weights. The nodes form a ring in the order they are listed: every node
+ * sends to the next node and receives from the one before. The gradients are split into one chunk per node;
+ * a reduce-scatter (size-1 steps, each adding one received chunk) leaves every node with the sum of one
+ * chunk, an all-gather (size-1 steps, each copying one received chunk) hands the sums around. Every node
+ * sends 2*(size-1)/size times the size of the gradients per step, however many nodes there are.
+ *
+ * Optionally, the chunks are sent as bfloat16 (half the bytes of float, a quarter of double). What a node
+ * loses by rounding its own gradients is kept and added to its next gradients (error feedback), and every
+ * sum is rounded by the node that owns it before it is handed around, so the replicas stay identical.
+ *
+ * The connections are neither authenticated nor encrypted: the nodes are meant to run on a trusted network.
+ */
+
+#ifndef MNIST_3LNN_DISTRIBUTED_H
+#define MNIST_3LNN_DISTRIBUTED_H
+
+#include <stdint.h>
+
+#include "3lnn.h"
+#include "3lnn-batch.h"
+
+
+#define DIST_MAX_NODES 64               ///< Maximum number of nodes
+#define DIST_CONNECT_TIMEOUT 60         ///< Number of seconds to wait for the next node to listen
+
+
+typedef struct DistributedGroup DistributedGroup;
+
+
+
+
+/**
+ * @brief Connects this process to the ring of nodes, aborting if a node cannot be reached or does not match
+ * @details Every node listens on its own address and connects to the next node; all nodes are expected to be
+ * started with the same list and the same topology (checked when connecting).
+ * @param nodes Comma-separated list of host:port addresses, in the order of the ranks
+ * @param rank Index of this node in the list (0 to size-1)
+ * @param compress 1 = send the gradients as bfloat16, 0 = in the precision of NNReal
+ * @param nn A pointer to the NN the gradients are summed up for
+ */
+
+DistributedGroup *createDistributedGroup(const char *nodes, int rank, int compress, const Network *nn);
+
+
+
+
+/**
+ * @brief Closes the connections and frees the buffers of a group
+ * @param g A pointer to the group
+ */
+
+void freeDistributedGroup(DistributedGroup *g);
+
+
+
+
+/**
+ * @brief Returns the index of this node (0 to size-1)
+ * @param g A pointer to the group
+ */
+
+int getDistributedRank(const DistributedGroup *g);
+
+
+
+
+/**
+ * @brief Returns the number of nodes
+ * @param g A pointer to the group
+ */
+
+int getDistributedSize(const DistributedGroup *g);
+
+
+
+
+/**
+ * @brief Returns the number of training images of a node's shard (every size-th image, starting at its rank)
+ * @param g A pointer to the group
+ * @param rank Index of the node
+ * @param count Number of training images
+ */
+
+int getDistributedShardCount(const DistributedGroup *g, int rank, int count);
+
+
+
+
+/**
+ * @brief Returns the number of images all nodes together train in a step of an epoch
+ * @details Every node trains batchSize images of its shard per step, and fewer (or none) once its shard runs out.
+ * @param g A pointer to the group
+ * @param count Number of training images
+ * @param batchSize Number of images per node and step
+ * @param step Index of the step in the epoch
+ */
+
+int getDistributedBatchCount(const DistributedGroup *g, int count, int batchSize, int step);
+
+
+
+
+/**
+ * @brief Overwrites the weights of all nodes with those of node 0
+ * @param g A pointer to the group
+ * @param nn A pointer to the NN
+ */
+
+void broadcastNetwork(DistributedGroup *g, Network *nn);
+
+
+
+
+/**
+ * @brief Replaces the gradients of every node with their sum over all nodes
+ * @details Blocks until every node has called it; all nodes have the same sums afterwards.
+ * @param g A pointer to the group
+ * @param grad A pointer to the gradients of this node
+ */
+
+void allReduceGradients(DistributedGroup *g, Gradients *grad);
+
+
+
+
+/**
+ * @brief Displays the number of bytes sent by this node and the time spent in the all-reduces
+ * @param g A pointer to the group
+ * @param row Row on screen
+ * @param col Column on screen
+ */
+
+void displayDistributedStats(const DistributedGroup *g, int row, int col);
+
+
+#endif
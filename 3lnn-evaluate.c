@@ -0,0 +1,265 @@
+/**
+ * @file 3lnn-evaluate.c
+ * @brief Multi-threaded evaluation of a read-only NN on a data set, with a per-class confusion matrix
+ * @details Every thread's counters are padded to whole cache lines and only written by that thread, the shared
+ * counters (next chunk, progress) are touched once per chunk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util/mnist-utils.h"
+#include "util/mnist-dataset.h"
+#include "util/progress-report.h"
+#include "util/thread-pool.h"
+#include "util/screen.h"
+#include "3lnn.h"
+#include "3lnn-inference.h"
+#include "3lnn-evaluate.h"
+
+
+#define EVAL_CHUNK_SIZE 256             ///< Number of images a thread takes at once
+
+
+typedef struct EvaluatorThread EvaluatorThread;
+
+
+
+
+/**
+ * @brief Private state of one evaluation thread (a multiple of NN_ALIGNMENT bytes, so no cache line is shared)
+ */
+
+struct EvaluatorThread{
+    Activations *act;                           ///< Activation context of the thread
+    int errCount;                               ///< Number of images incorrectly classified by the thread
+    int confusion[EVAL_CLASS_COUNT][EVAL_CLASS_COUNT];  ///< Counts of the thread per label and classification
+    uint64_t bits[MNIST_BITSET_WORDS];          ///< Image binarized on the fly (if the data set is not binarized)
+} __attribute__((aligned(NN_ALIGNMENT)));
+
+
+
+
+/**
+ * @brief Data structure holding the worker threads and the task they currently work on
+ */
+
+struct Evaluator{
+    ThreadPool *pool;               ///< Worker threads (the calling thread is thread 0)
+    EvaluatorThread *threads;       ///< One private state per thread
+    const Network *nn;              ///< NN of the current evaluation
+    const MNIST_Dataset *ds;        ///< Data set of the current evaluation
+    const int *order;               ///< Indices of the images to classify (NULL = file order)
+    int count;                      ///< Number of images to classify
+    int nextImage;                  ///< First image of the next chunk (taken atomically)
+    int doneCount;                  ///< Number of images classified by all threads (published as progress)
+    int doneErrCount;               ///< Number of errors of all threads (published as progress)
+    int grayscale;                  ///< 1 = feed the gray values of the images instead of their bitsets
+};
+
+
+
+
+/**
+ * @details Creates an evaluator with threadCount threads and one activation context per thread
+ */
+
+Evaluator *createEvaluator(const Network *nn, int threadCount){
+    
+    if (nn->dense[getOutputLayer(nn)].ncount!=EVAL_CLASS_COUNT){
+        printf("Abort! Evaluation expects %d OUTPUT nodes (one per class), not %d\n", EVAL_CLASS_COUNT, nn->dense[getOutputLayer(nn)].ncount);
+        exit(1);
+    }
+    
+    Evaluator *ev = (Evaluator*)malloc(sizeof(Evaluator));
+    
+    ev->pool = createThreadPool(threadCount);
+    threadCount = getThreadPoolSize(ev->pool);
+    
+    void *threads;
+    if (posix_memalign(&threads, NN_ALIGNMENT, threadCount * sizeof(EvaluatorThread)) != 0){
+        printf("Abort! Could not allocate memory for the evaluation threads\n");
+        exit(1);
+    }
+    ev->threads = (EvaluatorThread*)threads;
+    
+    for (int t=0; t<threadCount; t++) ev->threads[t].act = createActivations(nn);
+    ev->grayscale = 0;
+    
+    return ev;
+}
+
+
+
+
+/**
+ * @details Stops the worker threads and frees an evaluator
+ */
+
+void freeEvaluator(Evaluator *ev){
+    
+    int threadCount = getThreadPoolSize(ev->pool);
+    
+    freeThreadPool(ev->pool);
+    
+    for (int t=0; t<threadCount; t++) freeActivations(ev->threads[t].act);
+    free(ev->threads);
+    
+    free(ev);
+    
+}
+
+
+
+
+/**
+ * @details Selects how the images are fed into the NN
+ */
+
+void setEvaluatorGrayscale(Evaluator *ev, int grayscale){
+    
+    ev->grayscale = grayscale;
+    
+}
+
+
+
+
+/**
+ * @details Evaluation step executed by every thread: classifies chunks of images until none are left
+ */
+
+void runEvaluationStep(void *arg, int threadId, int threadCount){
+    
+    (void)threadCount;
+    
+    Evaluator *ev = (Evaluator*)arg;
+    EvaluatorThread *t = &ev->threads[threadId];
+    const MNIST_Dataset *ds = ev->ds;
+    
+    memset(t->confusion, 0, sizeof(t->confusion));
+    t->errCount = 0;
+    
+    int first;
+    while ((first = __atomic_fetch_add(&ev->nextImage, EVAL_CHUNK_SIZE, __ATOMIC_RELAXED)) < ev->count){
+        
+        int last = (first + EVAL_CHUNK_SIZE < ev->count) ? first + EVAL_CHUNK_SIZE : ev->count;
+        int chunkErrCount = 0;
+        
+        for (int i=first; i<last; i++){
+            
+            int imgId = (ev->order!=NULL) ? ev->order[i] : i;
+            MNIST_Label lbl = getDatasetLabel(ds, imgId);
+            int classification;
+            
+            if (ev->grayscale) classification = classifyInputPixels(ev->nn, t->act, getDatasetImage(ds, imgId)->pixel, NULL);
+            else {
+                const uint64_t *bits;
+                if (ds->bits!=NULL) bits = getDatasetBitset(ds, imgId);
+                else {
+                    binarizeMNISTImage(getDatasetImage(ds, imgId), t->bits);
+                    bits = t->bits;
+                }
+                classification = classifyInputBitset(ev->nn, t->act, bits, NULL);
+            }
+            
+            t->confusion[lbl][classification]++;
+            if (classification!=lbl) chunkErrCount++;
+        }
+        
+        t->errCount += chunkErrCount;
+        
+        // Publish progress once per chunk (the counters of concurrent chunks may be rendered slightly out of order)
+        int errCount = __atomic_add_fetch(&ev->doneErrCount, chunkErrCount, __ATOMIC_RELAXED);
+        int doneCount = __atomic_add_fetch(&ev->doneCount, last-first, __ATOMIC_RELAXED);
+        updateProgress(doneCount, errCount);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Runs the threads on the images, then adds up their counters into the report
+ */
+
+void evaluateNetwork(Evaluator *ev, const Network *nn, const MNIST_Dataset *ds, const int *order, int count, EvaluationReport *r){
+    
+    struct timespec startTime, endTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    
+    ev->nn = nn;
+    ev->ds = ds;
+    ev->order = order;
+    ev->count = count;
+    ev->nextImage = 0;
+    ev->doneCount = 0;
+    ev->doneErrCount = 0;
+    
+    runOnThreadPool(ev->pool, runEvaluationStep, ev);
+    
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    
+    int threadCount = getThreadPoolSize(ev->pool);
+    
+    memset(r, 0, sizeof(EvaluationReport));
+    r->count = count;
+    r->threadCount = threadCount;
+    
+    for (int t=0; t<threadCount; t++){
+        r->errCount += ev->threads[t].errCount;
+        for (int l=0; l<EVAL_CLASS_COUNT; l++){
+            for (int c=0; c<EVAL_CLASS_COUNT; c++) r->confusion[l][c] += ev->threads[t].confusion[l][c];
+        }
+    }
+    
+    for (int k=0; k<EVAL_CLASS_COUNT; k++){
+        int labelCount = 0, classifiedCount = 0;
+        for (int j=0; j<EVAL_CLASS_COUNT; j++){
+            labelCount      += r->confusion[k][j];
+            classifiedCount += r->confusion[j][k];
+        }
+        r->precision[k] = (classifiedCount>0) ? (double)r->confusion[k][k]/classifiedCount : 0;
+        r->recall[k]    = (labelCount>0)      ? (double)r->confusion[k][k]/labelCount : 0;
+    }
+    
+    r->time = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec)/1e9;
+    r->samplesPerSec = (r->time>0) ? count / r->time : 0;
+    
+    // The final counters, now complete and in order
+    updateProgress(count, r->errCount);
+    
+}
+
+
+
+
+/**
+ * @details Outputs one row per label and a last row with the precision per classification
+ */
+
+void displayEvaluationReport(const EvaluationReport *r, int y, int x){
+    
+    if (x!=0 && y!=0) locateCursor(y, x);
+    
+    printf("7: EVALUATION: %d images in %.1f msec (%.0f images/sec) using %d thread%s\n", r->count, r->time*1000, r->samplesPerSec,
+           r->threadCount, (r->threadCount==1) ? "" : "s");
+    
+    printf("    label \\ classified");
+    for (int c=0; c<EVAL_CLASS_COUNT; c++) printf(" %5d", c);
+    printf("   recall\n");
+    
+    for (int l=0; l<EVAL_CLASS_COUNT; l++){
+        printf("    %20d", l);
+        for (int c=0; c<EVAL_CLASS_COUNT; c++) printf(" %5d", r->confusion[l][c]);
+        printf("  %6.2f%%\n", 100 * r->recall[l]);
+    }
+    
+    printf("    %20s", "precision");
+    for (int c=0; c<EVAL_CLASS_COUNT; c++) printf(" %5.1f", 100 * r->precision[c]);
+    printf("\n");
+    
+}
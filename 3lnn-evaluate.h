@@ -0,0 +1,103 @@
+/**
+ * @file 3lnn-evaluate.h
+ * @brief Multi-threaded evaluation of a read-only NN on a data set, with a per-class confusion matrix
+ * @details The network is shared by all threads, every thread classifies with its own Activations and counts
+ * into its own confusion matrix. Images are handed out in chunks via an atomic counter, so threads that are
+ * slowed down take fewer chunks. The per-thread matrices are added up once all images are classified.
+ */
+
+#ifndef MNIST_3LNN_EVALUATE_H
+#define MNIST_3LNN_EVALUATE_H
+
+#include "3lnn.h"
+#include "util/mnist-dataset.h"
+
+
+#define EVAL_CLASS_COUNT 10             ///< Number of classes (MNIST digits 0-9)
+
+
+typedef struct Evaluator Evaluator;
+typedef struct EvaluationReport EvaluationReport;
+
+
+
+
+/**
+ * @brief Result of evaluating a NN on a set of images
+ */
+
+struct EvaluationReport{
+    int count;                      ///< Number of images classified
+    int errCount;                   ///< Number of images incorrectly classified
+    int confusion[EVAL_CLASS_COUNT][EVAL_CLASS_COUNT];  ///< Number of images per label (row) and classification (column)
+    double precision[EVAL_CLASS_COUNT]; ///< Share of the images classified as a class that have its label
+    double recall[EVAL_CLASS_COUNT];    ///< Share of the images with a label that are classified as its class
+    double time;                    ///< Duration of the evaluation (sec)
+    double samplesPerSec;           ///< Number of images classified per second
+    int threadCount;                ///< Number of threads that classified the images
+};
+
+
+
+
+/**
+ * @brief Creates an evaluator with threadCount threads and one activation context per thread for the given NN
+ * @param nn A pointer to the NN (or any NN with the same topology)
+ * @param threadCount Number of threads (including the calling thread)
+ */
+
+Evaluator *createEvaluator(const Network *nn, int threadCount);
+
+
+
+
+/**
+ * @brief Stops the worker threads and frees an evaluator
+ * @param ev A pointer to the evaluator
+ */
+
+void freeEvaluator(Evaluator *ev);
+
+
+
+
+/**
+ * @brief Selects how the images are fed into the NN: binarized (default) or as gray values (0 to 255 -> 0 to 1)
+ * @param ev A pointer to the evaluator
+ * @param grayscale 1 = feed the gray values, 0 = feed the binarized images
+ */
+
+void setEvaluatorGrayscale(Evaluator *ev, int grayscale);
+
+
+
+
+/**
+ * @brief Classifies a subset of a data set WITHOUT updating weights, using all threads of the evaluator
+ * @details Images that are not binarized (ds->bits==NULL) are binarized on the fly, unless the evaluator
+ * feeds gray values. The counters of the
+ * current progress phase are published while the images are classified.
+ * @param ev A pointer to the evaluator
+ * @param nn A pointer to the (read-only) NN
+ * @param ds A pointer to the data set
+ * @param order Indices of the images to classify (NULL = the first count images in file order)
+ * @param count Number of images to classify
+ * @param r A pointer to the report receiving the results
+ */
+
+void evaluateNetwork(Evaluator *ev, const Network *nn, const MNIST_Dataset *ds, const int *order, int count, EvaluationReport *r);
+
+
+
+
+/**
+ * @brief Outputs the throughput, the confusion matrix and the precision and recall of every class
+ * @param r A pointer to the report
+ * @param y Row of terminal screen
+ * @param x Column of terminal screen
+ */
+
+void displayEvaluationReport(const EvaluationReport *r, int y, int x);
+
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ * @file 3lnn-export.c
+ * @brief Exporting a trained NN as generated C source for embedded inference
+ * @details The values are written in scientific notation with enough digits to read back exactly
+ * (9 significant digits for float, 17 for double), so the generated arrays hold the NN's weights bit for bit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "3lnn.h"
+#include "3lnn-export.h"
+
+
+#ifdef NN_FLOAT32
+#define EXPORT_TYPE "float"
+#define EXPORT_FORMAT "%.8ef"
+#else
+#define EXPORT_TYPE "double"
+#define EXPORT_FORMAT "%.16e"
+#endif
+
+#define EXPORT_VALUES_PER_LINE 8        ///< Number of array values per line of the generated source
+
+
+
+
+/**
+ * @details Opens a generated file for writing, aborting if it cannot be created
+ */
+
+FILE *createExportFile(const char *baseName, const char *extension){
+    
+    char fileName[1024];
+    snprintf(fileName, sizeof(fileName), "%s%s", baseName, extension);
+    
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL) {
+        printf("Abort! Could not create export file: %s\n",fileName);
+        exit(1);
+    }
+    
+    return file;
+}
+
+
+
+
+/**
+ * @details Writes count values as the body of a C array initializer, EXPORT_VALUES_PER_LINE per line
+ */
+
+void writeExportValues(FILE *file, const NNReal *values, int count, const char *indent){
+    
+    for (int i=0; i<count; i++){
+        if (i%EXPORT_VALUES_PER_LINE==0) fprintf(file, "%s", indent);
+        fprintf(file, EXPORT_FORMAT, values[i]);
+        if (i<count-1) fprintf(file, (i%EXPORT_VALUES_PER_LINE==EXPORT_VALUES_PER_LINE-1) ? ",\n" : ", ");
+    }
+    fprintf(file, "\n");
+}
+
+
+
+
+/**
+ * @details The header only declares classify() and the topology, guarded by the file name in upper case
+ */
+
+void writeExportHeader(const Network *nn, const char *baseName, const char *name, const char *topology){
+    
+    FILE *file = createExportFile(baseName, ".h");
+    
+    char guard[256];
+    int len = 0;
+    for (const char *c=name; *c!='\0' && len<(int)sizeof(guard)-3; c++) guard[len++] = isalnum((unsigned char)*c) ? toupper((unsigned char)*c) : '_';
+    strcpy(guard+len, "_H");
+    
+    fprintf(file, "/**\n * @file %s.h\n", name);
+    fprintf(file, " * @brief MNIST classifier generated from a trained %s network by mnist-3lnn (do not edit)\n */\n\n", topology);
+    fprintf(file, "#ifndef %s\n#define %s\n\n#include <stdint.h>\n\n\n", guard, guard);
+    
+    fprintf(file, "#define CLASSIFY_LAYER_COUNT %d            ///< Number of layers (INPUT, HIDDEN layers, OUTPUT)\n", nn->layerCount);
+    fprintf(file, "#define CLASSIFY_INPUT_COUNT %d          ///< Number of pixels per image\n", nn->dense[INPUT].ncount);
+    fprintf(file, "#define CLASSIFY_OUTPUT_COUNT %d          ///< Number of classes\n\n\n\n\n", nn->dense[getOutputLayer(nn)].ncount);
+    
+    fprintf(file, "/**\n * @brief Returns the classification (0 to CLASSIFY_OUTPUT_COUNT-1) of an image\n");
+    fprintf(file, " * @param pixel One uint8 value per pixel (pixel!=0 -> 1)\n */\n\n");
+    fprintf(file, "int classify(const uint8_t pixel[CLASSIFY_INPUT_COUNT]);\n\n\n#endif\n");
+    
+    fclose(file);
+}
+
+
+
+
+/**
+ * @details Every layer is one loop nest with constant bounds: the first reads the pixels directly, the later ones the
+ * outputs of the layer before. The arg max keeps the first maximum above 0, as getNetworkClassification() does.
+ */
+
+void writeExportSource(const Network *nn, const char *baseName, const char *name, const char *topology){
+    
+    FILE *file = createExportFile(baseName, ".c");
+    int out = getOutputLayer(nn);
+    
+    fprintf(file, "/**\n * @file %s.c\n", name);
+    fprintf(file, " * @brief MNIST classifier generated from a trained %s network by mnist-3lnn (do not edit)\n */\n\n", topology);
+    fprintf(file, "#include <stdint.h>\n#include <math.h>\n\n#include \"%s.h\"\n\n", name);
+    
+    // Weights (one row per node, without padding) and biases of every layer
+    for (int l=1; l<nn->layerCount; l++){
+        const DenseLayer *dl = &nn->dense[l];
+        fprintf(file, "\nstatic const %s weights%d[%d][%d] = {\n", EXPORT_TYPE, l, dl->ncount, dl->wcount);
+        for (int n=0; n<dl->ncount; n++){
+            fprintf(file, "    {\n");
+            writeExportValues(file, dl->weights + (size_t)n * dl->stride, dl->wcount, "        ");
+            fprintf(file, "    }%s\n", (n<dl->ncount-1) ? "," : "");
+        }
+        fprintf(file, "};\n\nstatic const %s bias%d[%d] = {\n", EXPORT_TYPE, l, dl->ncount);
+        writeExportValues(file, dl->bias, dl->ncount, "    ");
+        fprintf(file, "};\n");
+    }
+    
+    // Activation functions (computed in double, as by the NN itself)
+    int usesAct[2] = {0, 0};
+    for (int l=1; l<nn->layerCount; l++) usesAct[getActFctType(nn, l)] = 1;
+    if (usesAct[SIGMOID]) fprintf(file, "\nstatic inline %s sigmoid(%s x){\n    return 1 / (1 + exp(-(double)x));\n}\n", EXPORT_TYPE, EXPORT_TYPE);
+    if (usesAct[TANH])    fprintf(file, "\nstatic inline %s activateTanh(%s x){\n    return tanh((double)x);\n}\n", EXPORT_TYPE, EXPORT_TYPE);
+    
+    fprintf(file, "\nint classify(const uint8_t pixel[CLASSIFY_INPUT_COUNT]){\n\n");
+    for (int l=1; l<nn->layerCount; l++) fprintf(file, "    %s output%d[%d];\n", EXPORT_TYPE, l, nn->dense[l].ncount);
+    
+    for (int l=1; l<nn->layerCount; l++){
+        const DenseLayer *dl = &nn->dense[l];
+        fprintf(file, "\n    for (int n=0; n<%d; n++){\n", dl->ncount);
+        fprintf(file, "        %s sum = bias%d[n];\n", EXPORT_TYPE, l);
+        if (l==1) fprintf(file, "        for (int i=0; i<%d; i++) sum += weights1[n][i] * (pixel[i]!=0);\n", dl->wcount);
+        else fprintf(file, "        for (int i=0; i<%d; i++) sum += weights%d[n][i] * output%d[i];\n", dl->wcount, l, l-1);
+        fprintf(file, "        output%d[n] = %s(sum);\n    }\n", l, (getActFctType(nn, l)==TANH) ? "activateTanh" : "sigmoid");
+    }
+    
+    fprintf(file, "\n    %s maxOut = 0;\n    int maxInd = 0;\n", EXPORT_TYPE);
+    fprintf(file, "    for (int n=0; n<%d; n++){\n", nn->dense[out].ncount);
+    fprintf(file, "        int greater = output%d[n] > maxOut;\n", out);
+    fprintf(file, "        maxOut = greater ? output%d[n] : maxOut;\n", out);
+    fprintf(file, "        maxInd = greater ? n : maxInd;\n    }\n\n    return maxInd;\n}\n");
+    
+    fclose(file);
+}
+
+
+
+
+/**
+ * @details Writes the header and the source, naming both after the last component of baseName
+ */
+
+void exportNetworkSource(const Network *nn, const char *baseName){
+    
+    const char *name = strrchr(baseName, '/');
+    name = (name==NULL) ? baseName : name+1;
+    
+    char topology[128];
+    int len = 0;
+    for (int l=0; l<nn->layerCount && len<(int)sizeof(topology)-12; l++){
+        len += snprintf(topology+len, sizeof(topology)-len, (l==0) ? "%d" : "-%d", nn->dense[l].ncount);
+    }
+    
+    writeExportHeader(nn, baseName, name, topology);
+    writeExportSource(nn, baseName, name, topology);
+    
+}
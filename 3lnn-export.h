@@ -0,0 +1,31 @@
+/**
+ * @file 3lnn-export.h
+ * @brief Exporting a trained NN as generated C source for embedded inference
+ * @details The export writes a header and a source file that only depend on <stdint.h> and <math.h>. The weights and
+ * biases become static const arrays (unpadded, in the precision of the NNReal build), the topology becomes
+ * compile-time constants, and classify() is a forward pass with fixed loop bounds on the stack: no heap, no
+ * startup cost, no Network/Layer/Node indirection. Branches only appear as loop conditions: the binarization of
+ * the pixels and the arg max are written as selects. The activation functions are the exact libm ones
+ * (ACT_EXACT), whatever the precision the NN was trained with.
+ */
+
+#ifndef MNIST_3LNN_EXPORT_H
+#define MNIST_3LNN_EXPORT_H
+
+#include "3lnn.h"
+
+
+
+
+/**
+ * @brief Writes a NN as C source <baseName>.c and header <baseName>.h defining int classify(const uint8_t pixel[784])
+ * @details classify() returns the same classification as getNetworkClassification() after feeding the binarized
+ * pixels (pixel!=0 -> 1) forward through the NN, up to rounding differences of the sums.
+ * @param nn A pointer to the NN
+ * @param baseName Path of the generated files without extension (both are overwritten)
+ */
+
+void exportNetworkSource(const Network *nn, const char *baseName);
+
+
+#endif
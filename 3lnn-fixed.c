@@ -0,0 +1,238 @@
+/**
+ * @file 3lnn-fixed.c
+ * @brief Forward passes specialized at compile time for a few fixed NN topologies (e.g. 784-20-10, 784-128-64-10)
+ * @details The layer helper is always inlined into the generated forward passes, so the compiler sees the
+ * constant node counts and strides of every layer. It computes 4 rows at a time on GCC vector types of
+ * NN_ALIGNMENT bytes, which the compiler maps onto the instruction set of the function it is inlined into
+ * (1 AVX-512, 2 AVX2 or 4 SSE2/NEON registers per vector). The padding of all weight rows and outputs is 0,
+ * so every row is processed as a whole number of vectors. As in the vector kernels, the products are summed
+ * up in a different order than by the scalar kernel.
+ */
+
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FIXED_X86
+#endif
+
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-fixed.h"
+#include "util/profile-stats.h"
+
+
+#define FIXED_LANES (NN_ALIGNMENT / (int)sizeof(NNReal))                          ///< Number of values per vector
+#define FIXED_STRIDE(count) ((((count) + FIXED_LANES - 1) / FIXED_LANES) * FIXED_LANES)  ///< Same as padToAlignment(), but a constant expression
+
+typedef NNReal FixedVec __attribute__((vector_size(NN_ALIGNMENT)));
+typedef void (*FixedForwardFct)(const Network *nn, Activations *a);
+
+
+/**
+ * @brief Forward passes of one topology, one per instruction set
+ */
+
+typedef struct FixedTopology{
+    int layerCount;
+    int ncount[NN_MAX_LAYERS];
+    FixedForwardFct forward;        ///< Baseline instruction set
+    FixedForwardFct forwardAvx2;
+    FixedForwardFct forwardAvx512;
+} FixedTopology;
+
+
+
+
+/**
+ * @details Adds up all lanes of a vector
+ */
+
+static inline __attribute__((always_inline)) NNReal hsumFixed(const FixedVec *v){
+    
+    NNReal sum = 0;
+    for (int i=0; i<FIXED_LANES; i++) sum += (*v)[i];
+    
+    return sum;
+}
+
+
+
+
+/**
+ * @details Calculates the activated outputs of a dense layer with ncount nodes and wcount inputs.
+ * Both counts are compile-time constants at every call site.
+ */
+
+static inline __attribute__((always_inline)) void calcFixedLayer(const DenseLayer *l, const NNReal *input, NNReal *output, const int ncount, const int wcount, ActFctType actFct, ActPrecision prec){
+    
+    const int chunks = FIXED_STRIDE(wcount) / FIXED_LANES;
+    
+    const FixedVec *x = (const FixedVec*)__builtin_assume_aligned(input, NN_ALIGNMENT);
+    const FixedVec *w = (const FixedVec*)__builtin_assume_aligned(l->weights, NN_ALIGNMENT);
+    
+    int n = 0;
+    
+    for (; n+4<=ncount; n+=4){
+        
+        const FixedVec *w0 = w + (size_t)n * chunks;
+        const FixedVec *w1 = w0 + chunks;
+        const FixedVec *w2 = w1 + chunks;
+        const FixedVec *w3 = w2 + chunks;
+        FixedVec s0 = {0}, s1 = {0}, s2 = {0}, s3 = {0};
+        
+        // Every input vector that is loaded is reused for 4 rows
+        #pragma GCC unroll 4
+        for (int c=0; c<chunks; c++){
+            s0 += w0[c] * x[c];
+            s1 += w1[c] * x[c];
+            s2 += w2[c] * x[c];
+            s3 += w3[c] * x[c];
+        }
+        
+        output[n]   = l->bias[n]   + hsumFixed(&s0);
+        output[n+1] = l->bias[n+1] + hsumFixed(&s1);
+        output[n+2] = l->bias[n+2] + hsumFixed(&s2);
+        output[n+3] = l->bias[n+3] + hsumFixed(&s3);
+    }
+    
+    // remaining nodes one at a time
+    for (; n<ncount; n++){
+        
+        const FixedVec *w0 = w + (size_t)n * chunks;
+        FixedVec s0 = {0};
+        
+        #pragma GCC unroll 4
+        for (int c=0; c<chunks; c++) s0 += w0[c] * x[c];
+        
+        output[n] = l->bias[n] + hsumFixed(&s0);
+    }
+    
+    activateVector(actFct, prec, ncount, output);
+    
+}
+
+
+
+
+/**
+ * @details Calculates layer l (ncount nodes) of a fixed topology from the outputs of layer l-1 (wcount nodes).
+ * The first HIDDEN layer of a sparse input is left to the generic kernel, which only visits the non-zero inputs.
+ */
+
+static inline __attribute__((always_inline)) void calcFixedNetworkLayer(const Network *nn, Activations *a, int l, const int ncount, const int wcount){
+    
+    if (l==1 && isInputSparse(nn, a)) calcLayer(nn, a, l);
+    else {
+        PROFILE_START(startTime);
+        calcFixedLayer(&nn->dense[l], a->output[l-1], a->output[l], ncount, wcount, getActFctType(nn, l), nn->actPrecision);
+        PROFILE_STOP((l==getOutputLayer(nn)) ? PROFILE_OUTPUT_FORWARD : PROFILE_HIDDEN_FORWARD, startTime);
+    }
+    
+}
+
+
+
+
+/**
+ * @brief Defines the forward pass of a 3-layer topology compiled for one instruction set (target attribute)
+ */
+
+#define FIXED_FORWARD_3_ISA(name, target, I, H, O)                             \
+    target static void name(const Network *nn, Activations *a){                \
+        calcFixedNetworkLayer(nn, a, 1, H, I);                                 \
+        calcFixedNetworkLayer(nn, a, 2, O, H);                                 \
+    }
+
+/**
+ * @brief Defines the forward pass of a 4-layer topology compiled for one instruction set (target attribute)
+ */
+
+#define FIXED_FORWARD_4_ISA(name, target, I, H1, H2, O)                        \
+    target static void name(const Network *nn, Activations *a){                \
+        calcFixedNetworkLayer(nn, a, 1, H1, I);                                \
+        calcFixedNetworkLayer(nn, a, 2, H2, H1);                               \
+        calcFixedNetworkLayer(nn, a, 3, O, H2);                                \
+    }
+
+#ifdef FIXED_X86
+#define FIXED_TARGET_AVX2   __attribute__((target("avx2,fma")))
+#define FIXED_TARGET_AVX512 __attribute__((target("avx512f")))
+#define FIXED_FORWARD_3_X86(name, I, H, O)                                     \
+    FIXED_FORWARD_3_ISA(name##_avx2, FIXED_TARGET_AVX2, I, H, O)               \
+    FIXED_FORWARD_3_ISA(name##_avx512, FIXED_TARGET_AVX512, I, H, O)
+#define FIXED_FORWARD_4_X86(name, I, H1, H2, O)                                \
+    FIXED_FORWARD_4_ISA(name##_avx2, FIXED_TARGET_AVX2, I, H1, H2, O)          \
+    FIXED_FORWARD_4_ISA(name##_avx512, FIXED_TARGET_AVX512, I, H1, H2, O)
+#define FIXED_ENTRY(name, ...) {__VA_ARGS__, name, name##_avx2, name##_avx512}
+#else
+#define FIXED_FORWARD_3_X86(name, I, H, O)
+#define FIXED_FORWARD_4_X86(name, I, H1, H2, O)
+#define FIXED_ENTRY(name, ...) {__VA_ARGS__, name, name, name}
+#endif
+
+/**
+ * @brief Specializes the forward pass for the topology I-H-O on all instruction sets
+ */
+
+#define FIXED_FORWARD_3(I, H, O)                                               \
+    FIXED_FORWARD_3_ISA(forward_##I##_##H##_##O, , I, H, O)                    \
+    FIXED_FORWARD_3_X86(forward_##I##_##H##_##O, I, H, O)
+
+/**
+ * @brief Specializes the forward pass for the topology I-H1-H2-O on all instruction sets
+ */
+
+#define FIXED_FORWARD_4(I, H1, H2, O)                                          \
+    FIXED_FORWARD_4_ISA(forward_##I##_##H1##_##H2##_##O, , I, H1, H2, O)       \
+    FIXED_FORWARD_4_X86(forward_##I##_##H1##_##H2##_##O, I, H1, H2, O)
+
+FIXED_FORWARD_3(784, 20, 10)
+FIXED_FORWARD_3(784, 128, 10)
+FIXED_FORWARD_4(784, 128, 64, 10)
+
+
+static const FixedTopology fixedTopologies[] = {
+    FIXED_ENTRY(forward_784_20_10,      3, {784, 20, 10}),
+    FIXED_ENTRY(forward_784_128_10,     3, {784, 128, 10}),
+    FIXED_ENTRY(forward_784_128_64_10,  4, {784, 128, 64, 10}),
+};
+
+
+
+
+/**
+ * @details Compares the topology with every specialized one
+ */
+
+int findFixedTopology(int layerCount, const int *ncount){
+    
+    for (size_t t=0; t<sizeof(fixedTopologies)/sizeof(fixedTopologies[0]); t++){
+        
+        const FixedTopology *ft = &fixedTopologies[t];
+        
+        int match = (ft->layerCount==layerCount);
+        for (int l=0; match && l<layerCount; l++) if (ft->ncount[l]!=ncount[l]) match = 0;
+        if (match) return (int)t;
+    }
+    
+    return -1;
+}
+
+
+
+
+/**
+ * @details Runs the variant of the NN's topology for the instruction set the kernels currently use
+ */
+
+void feedForwardFixed(const Network *nn, Activations *a){
+    
+    const FixedTopology *ft = &fixedTopologies[nn->fixedTopology];
+    
+    switch (getKernelIsa()) {
+        case ISA_AVX512: ft->forwardAvx512(nn, a); break;
+        case ISA_AVX2:   ft->forwardAvx2(nn, a);   break;
+        default:         ft->forward(nn, a);       break;
+    }
+    
+}
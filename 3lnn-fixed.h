@@ -0,0 +1,38 @@
+/**
+ * @file 3lnn-fixed.h
+ * @brief Forward passes specialized at compile time for a few fixed NN topologies (e.g. 784-20-10, 784-128-64-10)
+ * @details The generic forward pass reads all layer sizes at run time and calls the kernel table for every
+ * group of rows. The specialized passes are generated by a macro per topology, so all node counts and row
+ * strides are compile-time constants: the inner loops run over whole NN_ALIGNMENT-byte vectors without tail
+ * handling and the small ones are fully unrolled. Every topology is compiled for AVX-512, AVX2 and the
+ * baseline instruction set; the variant matching the kernels' instruction set is picked on every pass, so it
+ * follows setKernelIsa(). Networks of any other topology use the generic pass.
+ */
+
+#ifndef MNIST_3LNN_FIXED_H
+#define MNIST_3LNN_FIXED_H
+
+#include "3lnn.h"
+
+
+/**
+ * @brief Returns the index of the specialized forward pass of a topology, or -1 if there is none
+ * @param layerCount Number of layers
+ * @param ncount Number of nodes per layer, from INPUT to OUTPUT
+ */
+
+int findFixedTopology(int layerCount, const int *ncount);
+
+
+
+
+/**
+ * @brief Feeds the input values held in a set of activations forward through a NN with a specialized topology
+ * @param nn A pointer to the NN (nn->fixedTopology is not -1)
+ * @param a A pointer to the activations holding the input values
+ */
+
+void feedForwardFixed(const Network *nn, Activations *a);
+
+
+#endif
@@ -0,0 +1,179 @@
+/**
+ * @file 3lnn-inference.c
+ * @brief Thread-safe inference API: classification against a shared, read-only NN
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util/mnist-utils.h"
+#include "3lnn.h"
+#include "3lnn-inference.h"
+
+
+
+
+/**
+ * @brief Data structure holding a stack of unused activation contexts
+ */
+
+struct ActivationsPool{
+    const Network *nn;          ///< NN the contexts are created for
+    pthread_mutex_t lock;
+    int count;                  ///< Number of unused contexts in the pool
+    int capacity;               ///< Size of the free array
+    Activations **free;         ///< Unused contexts
+};
+
+
+
+
+/**
+ * @details Classifies one input using a caller-owned activation context
+ */
+
+int classifyInput(const Network *nn, Activations *a, const NNReal *input, NNReal *scores){
+    
+    feedInputValuesActivations(a, input, nn->dense[INPUT].ncount);
+    
+    feedForwardActivations(nn, a);
+    
+    if (scores!=NULL) memcpy(scores, a->output[getOutputLayer(nn)], nn->dense[getOutputLayer(nn)].ncount * sizeof(NNReal));
+    
+    return getActivationsClassification(nn, a);
+}
+
+
+
+
+/**
+ * @details Classifies one binarized input using a caller-owned activation context
+ */
+
+int classifyInputBitset(const Network *nn, Activations *a, const uint64_t *bits, NNReal *scores){
+    
+    feedInputBitsetActivations(a, bits, nn->dense[INPUT].ncount);
+    
+    feedForwardActivations(nn, a);
+    
+    if (scores!=NULL) memcpy(scores, a->output[getOutputLayer(nn)], nn->dense[getOutputLayer(nn)].ncount * sizeof(NNReal));
+    
+    return getActivationsClassification(nn, a);
+}
+
+
+
+
+/**
+ * @details Classifies one input given as gray values using a caller-owned activation context
+ */
+
+int classifyInputPixels(const Network *nn, Activations *a, const uint8_t *pixel, NNReal *scores){
+    
+    feedInputPixelsActivations(a, pixel, nn->dense[INPUT].ncount);
+    
+    feedForwardActivations(nn, a);
+    
+    if (scores!=NULL) memcpy(scores, a->output[getOutputLayer(nn)], nn->dense[getOutputLayer(nn)].ncount * sizeof(NNReal));
+    
+    return getActivationsClassification(nn, a);
+}
+
+
+
+
+/**
+ * @details Creates a thread-safe pool of activation contexts for the given NN
+ */
+
+ActivationsPool *createActivationsPool(const Network *nn, int initialCount){
+    
+    ActivationsPool *pool = (ActivationsPool*)malloc(sizeof(ActivationsPool));
+    
+    pool->nn = nn;
+    pool->count = 0;
+    pool->capacity = (initialCount>4) ? initialCount : 4;
+    pool->free = (Activations**)malloc(pool->capacity * sizeof(Activations*));
+    pthread_mutex_init(&pool->lock, NULL);
+    
+    for (int i=0; i<initialCount; i++) pool->free[pool->count++] = createActivations(nn);
+    
+    return pool;
+}
+
+
+
+
+/**
+ * @details Frees a pool and all of its contexts
+ */
+
+void freeActivationsPool(ActivationsPool *pool){
+    
+    for (int i=0; i<pool->count; i++) freeActivations(pool->free[i]);
+    
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->free);
+    free(pool);
+    
+}
+
+
+
+
+/**
+ * @details Takes an activation context out of the pool (creates a new one if the pool is empty)
+ */
+
+Activations *acquireActivations(ActivationsPool *pool){
+    
+    Activations *a = NULL;
+    
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count>0) a = pool->free[--pool->count];
+    pthread_mutex_unlock(&pool->lock);
+    
+    if (a==NULL) a = createActivations(pool->nn);
+    
+    return a;
+}
+
+
+
+
+/**
+ * @details Returns an activation context to the pool
+ */
+
+void releaseActivations(ActivationsPool *pool, Activations *a){
+    
+    pthread_mutex_lock(&pool->lock);
+    
+    if (pool->count==pool->capacity){
+        pool->capacity *= 2;
+        pool->free = (Activations**)realloc(pool->free, pool->capacity * sizeof(Activations*));
+    }
+    pool->free[pool->count++] = a;
+    
+    pthread_mutex_unlock(&pool->lock);
+    
+}
+
+
+
+
+/**
+ * @details Classifies one input using an activation context borrowed from a pool
+ */
+
+int classifyInputPooled(const Network *nn, ActivationsPool *pool, const NNReal *input, NNReal *scores){
+    
+    Activations *a = acquireActivations(pool);
+    
+    int classification = classifyInput(nn, a, input, scores);
+    
+    releaseActivations(pool, a);
+    
+    return classification;
+}
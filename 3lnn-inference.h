@@ -0,0 +1,116 @@
+/**
+ * @file 3lnn-inference.h
+ * @brief Thread-safe inference API: classification against a shared, read-only NN
+ * @details The network is only read during inference. All per-request state lives in an Activations
+ * context that is either owned by the caller or borrowed from a thread-safe ActivationsPool, so any
+ * number of threads can classify inputs against one shared copy of the weights.
+ */
+
+#ifndef MNIST_3LNN_INFERENCE_H
+#define MNIST_3LNN_INFERENCE_H
+
+#include "3lnn.h"
+
+
+typedef struct ActivationsPool ActivationsPool;
+
+
+
+
+/**
+ * @brief Classifies one input using a caller-owned activation context
+ * @param nn A pointer to the (read-only) NN
+ * @param a A pointer to activations created for this NN via createActivations(), used by one thread at a time
+ * @param input Input values (one per INPUT node)
+ * @param scores Array receiving the output value of every OUTPUT node (may be NULL)
+ * @return ID of the output node with the highest output
+ */
+
+int classifyInput(const Network *nn, Activations *a, const NNReal *input, NNReal *scores);
+
+
+
+
+/**
+ * @brief Classifies one binarized input using a caller-owned activation context
+ * @param nn A pointer to the (read-only) NN
+ * @param a A pointer to activations created for this NN via createActivations(), used by one thread at a time
+ * @param bits Bitset holding one bit per INPUT node (bit set = 1, bit clear = 0)
+ * @param scores Array receiving the output value of every OUTPUT node (may be NULL)
+ * @return ID of the output node with the highest output
+ */
+
+int classifyInputBitset(const Network *nn, Activations *a, const uint64_t *bits, NNReal *scores);
+
+
+
+
+/**
+ * @brief Classifies one input given as gray values (0 to 255 -> 0 to 1) using a caller-owned activation context
+ * @param nn A pointer to the (read-only) NN
+ * @param a A pointer to activations created for this NN via createActivations(), used by one thread at a time
+ * @param pixel One gray value per INPUT node
+ * @param scores Array receiving the output value of every OUTPUT node (may be NULL)
+ * @return ID of the output node with the highest output
+ */
+
+int classifyInputPixels(const Network *nn, Activations *a, const uint8_t *pixel, NNReal *scores);
+
+
+
+
+/**
+ * @brief Creates a thread-safe pool of activation contexts for the given NN
+ * @param nn A pointer to the NN
+ * @param initialCount Number of contexts that are created up front (more are created on demand)
+ */
+
+ActivationsPool *createActivationsPool(const Network *nn, int initialCount);
+
+
+
+
+/**
+ * @brief Frees a pool and all of its contexts (none of them may still be in use)
+ * @param pool A pointer to the pool
+ */
+
+void freeActivationsPool(ActivationsPool *pool);
+
+
+
+
+/**
+ * @brief Takes an activation context out of the pool (creates a new one if the pool is empty)
+ * @param pool A pointer to the pool
+ */
+
+Activations *acquireActivations(ActivationsPool *pool);
+
+
+
+
+/**
+ * @brief Returns an activation context to the pool
+ * @param pool A pointer to the pool
+ * @param a A pointer to activations previously returned by acquireActivations()
+ */
+
+void releaseActivations(ActivationsPool *pool, Activations *a);
+
+
+
+
+/**
+ * @brief Classifies one input using an activation context borrowed from a pool
+ * @param nn A pointer to the (read-only) NN
+ * @param pool A pointer to a pool created for this NN
+ * @param input Input values (one per INPUT node)
+ * @param scores Array receiving the output value of every OUTPUT node (may be NULL)
+ * @return ID of the output node with the highest output
+ */
+
+int classifyInputPooled(const Network *nn, ActivationsPool *pool, const NNReal *input, NNReal *scores);
+
+
+#endif
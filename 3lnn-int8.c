@@ -0,0 +1,487 @@
+/**
+ * @file 3lnn-int8.c
+ * @brief Post-training quantized inference: a copy of a trained NN with int8 weights and integer dot products
+ * @details With x = (q - zero) / inputScale for a uint8 input q, and w = rowScale * w8 for an int8 weight w8,
+ * a node's sum is bias + rowScale/inputScale * (dot(w8, q) - zero * sum(w8)). The constant part is folded
+ * into the stored bias and scale, so the kernels only calculate dot(w8, q), which is exact in int32.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INT8_X86
+#endif
+
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-int8.h"
+
+
+/**
+ * @brief Kernels of one instruction set: int32 dot products of int8 weight rows with a uint8 input
+ * @details n is always a multiple of NN_ALIGNMENT (the padded row length), the padding weights are 0.
+ */
+
+typedef struct Int8Kernels{
+    void    (*dotRows4)(const int8_t *w, int stride, const uint8_t *x, int n, int32_t *sum);  ///< sum[k] = dot product of row k (of 4) with x
+    int32_t (*dotRow)(const int8_t *w, const uint8_t *x, int n);                             ///< returns the dot product of w and x
+} Int8Kernels;
+
+static Int8Kernels int8Kernels = {NULL, NULL};
+
+
+
+
+/**
+ * @details Rounds a number of floats up to the next multiple of NN_ALIGNMENT bytes
+ */
+
+static inline int padFloats(int count){
+    
+    int perLine = NN_ALIGNMENT / sizeof(float);
+    
+    return ((count + perLine - 1) / perLine) * perLine;
+}
+
+
+
+
+/**
+ * @details Returns the byte size of a layer's weights, scales and biases in the block of a quantized NN
+ */
+
+static inline size_t getInt8LayerSize(const Int8Network *qn, int layer){
+    
+    return (size_t)qn->ncount[layer] * qn->stride[layer] + 2 * (size_t)padFloats(qn->ncount[layer]) * sizeof(float);
+}
+
+
+
+
+/**
+ * @details Scalar dot product of one int8 weight row with a uint8 input
+ */
+
+int32_t dotRowInt8Scalar(const int8_t *w, const uint8_t *x, int n){
+    
+    int32_t sum = 0;
+    for (int i=0; i<n; i++) sum += w[i] * x[i];
+    
+    return sum;
+}
+
+
+
+
+/**
+ * @details Scalar dot products of 4 int8 weight rows, one row at a time
+ */
+
+void dotRows4Int8Scalar(const int8_t *w, int stride, const uint8_t *x, int n, int32_t *sum){
+    
+    for (int k=0; k<4; k++) sum[k] = dotRowInt8Scalar(w + (size_t)k * stride, x, n);
+    
+}
+
+
+
+
+#ifdef INT8_X86
+
+/**
+ * @details Adds up the 8 int32 values of an AVX register
+ */
+
+__attribute__((target("avx2")))
+int32_t hsumInt32Avx2(__m256i v){
+    
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1,0,3,2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2,3,0,1)));
+    
+    return _mm_cvtsi128_si32(s);
+}
+
+
+
+
+/**
+ * @details AVX2 sum += dot product of 32 int8 weights with 32 uint8 inputs (given as two halves widened to int16)
+ * Both operands are widened to int16 so that multiply-add of pairs cannot saturate.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i dot32Int8Avx2(__m256i sum, const int8_t *w, __m256i xlo, __m256i xhi){
+    
+    __m256i wv = _mm256_loadu_si256((const __m256i*)w);
+    __m256i wlo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(wv));
+    __m256i whi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(wv, 1));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(wlo, xlo));
+    
+    return _mm256_add_epi32(sum, _mm256_madd_epi16(whi, xhi));
+}
+
+
+
+
+/**
+ * @details AVX2 dot products of 4 int8 weight rows, every widened input value is reused 4 times
+ */
+
+__attribute__((target("avx2")))
+void dotRows4Int8Avx2(const int8_t *w, int stride, const uint8_t *x, int n, int32_t *sum){
+    
+    __m256i s0 = _mm256_setzero_si256();
+    __m256i s1 = _mm256_setzero_si256();
+    __m256i s2 = _mm256_setzero_si256();
+    __m256i s3 = _mm256_setzero_si256();
+    
+    for (int i=0; i<n; i+=32){
+        __m256i xv = _mm256_loadu_si256((const __m256i*)(x+i));
+        __m256i xlo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(xv));
+        __m256i xhi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(xv, 1));
+        s0 = dot32Int8Avx2(s0, w + i, xlo, xhi);
+        s1 = dot32Int8Avx2(s1, w + stride + i, xlo, xhi);
+        s2 = dot32Int8Avx2(s2, w + 2*(size_t)stride + i, xlo, xhi);
+        s3 = dot32Int8Avx2(s3, w + 3*(size_t)stride + i, xlo, xhi);
+    }
+    
+    sum[0] = hsumInt32Avx2(s0);
+    sum[1] = hsumInt32Avx2(s1);
+    sum[2] = hsumInt32Avx2(s2);
+    sum[3] = hsumInt32Avx2(s3);
+    
+}
+
+
+
+
+/**
+ * @details AVX2 dot product of one int8 weight row
+ */
+
+__attribute__((target("avx2")))
+int32_t dotRowInt8Avx2(const int8_t *w, const uint8_t *x, int n){
+    
+    __m256i s = _mm256_setzero_si256();
+    
+    for (int i=0; i<n; i+=32){
+        __m256i xv = _mm256_loadu_si256((const __m256i*)(x+i));
+        s = dot32Int8Avx2(s, w + i, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(xv)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(xv, 1)));
+    }
+    
+    return hsumInt32Avx2(s);
+}
+
+
+
+
+/**
+ * @details AVX-512 VNNI dot products of 4 int8 weight rows: one instruction multiplies 64 uint8 x int8 pairs
+ * and adds them up in groups of 4 into 16 int32 sums
+ */
+
+__attribute__((target("avx512f,avx512vnni")))
+void dotRows4Int8Vnni(const int8_t *w, int stride, const uint8_t *x, int n, int32_t *sum){
+    
+    const int8_t *w0 = w;
+    const int8_t *w1 = w0 + stride;
+    const int8_t *w2 = w1 + stride;
+    const int8_t *w3 = w2 + stride;
+    
+    __m512i s0 = _mm512_setzero_si512();
+    __m512i s1 = _mm512_setzero_si512();
+    __m512i s2 = _mm512_setzero_si512();
+    __m512i s3 = _mm512_setzero_si512();
+    
+    for (int i=0; i<n; i+=64){
+        __m512i xv = _mm512_loadu_si512(x+i);
+        s0 = _mm512_dpbusd_epi32(s0, xv, _mm512_loadu_si512(w0+i));
+        s1 = _mm512_dpbusd_epi32(s1, xv, _mm512_loadu_si512(w1+i));
+        s2 = _mm512_dpbusd_epi32(s2, xv, _mm512_loadu_si512(w2+i));
+        s3 = _mm512_dpbusd_epi32(s3, xv, _mm512_loadu_si512(w3+i));
+    }
+    
+    sum[0] = _mm512_reduce_add_epi32(s0);
+    sum[1] = _mm512_reduce_add_epi32(s1);
+    sum[2] = _mm512_reduce_add_epi32(s2);
+    sum[3] = _mm512_reduce_add_epi32(s3);
+    
+}
+
+
+
+
+/**
+ * @details AVX-512 VNNI dot product of one int8 weight row
+ */
+
+__attribute__((target("avx512f,avx512vnni")))
+int32_t dotRowInt8Vnni(const int8_t *w, const uint8_t *x, int n){
+    
+    __m512i s = _mm512_setzero_si512();
+    
+    for (int i=0; i<n; i+=64) s = _mm512_dpbusd_epi32(s, _mm512_loadu_si512(x+i), _mm512_loadu_si512(w+i));
+    
+    return _mm512_reduce_add_epi32(s);
+}
+
+#endif
+
+
+
+
+/**
+ * @details Picks the VNNI kernels if the CPU supports them and 3lnn-kernels uses AVX-512, else AVX2 or scalar
+ */
+
+void initInt8Kernels(void){
+    
+    KernelIsa isa = getKernelIsa();
+    
+    int8Kernels = (Int8Kernels){dotRows4Int8Scalar, dotRowInt8Scalar};
+    
+#ifdef INT8_X86
+    if (isa==ISA_AVX512 && __builtin_cpu_supports("avx512vnni")) int8Kernels = (Int8Kernels){dotRows4Int8Vnni, dotRowInt8Vnni};
+    else if (isa==ISA_AVX512 || isa==ISA_AVX2) int8Kernels = (Int8Kernels){dotRows4Int8Avx2, dotRowInt8Avx2};
+#else
+    (void)isa;
+#endif
+    
+}
+
+
+
+
+/**
+ * @details Quantizes every weight row of a dense layer with its own scale. A node's sum is calculated from
+ * the uint8 inputs q as bias + scale * dot(w8, q), see the file description for how they are derived.
+ * @param qn A pointer to the quantized NN
+ * @param dl A pointer to the dense layer
+ * @param layer Index of the layer (1 to layerCount-1)
+ * @param inputScale Factor mapping the layer's float inputs onto uint8 (q = x * inputScale + inputZero)
+ * @param inputZero Zero point of the layer's uint8 inputs
+ */
+
+void quantizeLayer(Int8Network *qn, const DenseLayer *dl, int layer, float inputScale, int inputZero){
+    
+    for (int n=0; n<dl->ncount; n++){
+        
+        const NNReal *w = dl->weights + (size_t)n * dl->stride;
+        int8_t *w8 = qn->weights[layer] + (size_t)n * qn->stride[layer];
+        
+        double maxAbs = 0;
+        for (int i=0; i<dl->wcount; i++) maxAbs = fmax(maxAbs, fabs(w[i]));
+        
+        double rowScale = (maxAbs>0) ? maxAbs / 127 : 1;
+        
+        int32_t rowSum = 0;
+        for (int i=0; i<dl->wcount; i++){
+            w8[i] = (int8_t)lround(fmin(fmax(w[i] / rowScale, -127), 127));
+            rowSum += w8[i];
+        }
+        
+        qn->scale[layer][n] = (float)(rowScale / inputScale);
+        qn->bias[layer][n]  = (float)(dl->bias[n] - rowScale / inputScale * inputZero * rowSum);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Allocates all arrays in one aligned block and quantizes the first HIDDEN layer for binarized inputs
+ * (inputScale 1, zero point 0) and every following layer for the quantized outputs of the layer below
+ */
+
+Int8Network *createInt8Network(const Network *nn){
+    
+    initInt8Kernels();
+    
+    Int8Network *qn = (Int8Network*)malloc(sizeof(Int8Network));
+    if (qn==NULL){
+        printf("Abort! Could not allocate memory for the quantized network\n");
+        exit(1);
+    }
+    
+    qn->layerCount = nn->layerCount;
+    
+    size_t blockSize = 0;
+    for (int l=0; l<qn->layerCount; l++){
+        qn->ncount[l]  = nn->dense[l].ncount;
+        qn->stride[l]  = (l==INPUT) ? 0 : ((nn->dense[l-1].ncount + NN_ALIGNMENT - 1) / NN_ALIGNMENT) * NN_ALIGNMENT;
+        qn->actType[l] = getActFctType(nn, l);
+        if (l!=INPUT) blockSize += getInt8LayerSize(qn, l);
+    }
+    
+    if (posix_memalign(&qn->block, NN_ALIGNMENT, blockSize) != 0){
+        printf("Abort! Could not allocate memory for the quantized network\n");
+        exit(1);
+    }
+    memset(qn->block, 0, blockSize);
+    
+    // Every array is padded to full NN_ALIGNMENT bytes, so every array in the block stays aligned
+    uint8_t *ptr = (uint8_t*)qn->block;
+    qn->weights[INPUT] = NULL;
+    qn->scale[INPUT]   = NULL;
+    qn->bias[INPUT]    = NULL;
+    for (int l=1; l<qn->layerCount; l++){
+        qn->weights[l] = (int8_t*)ptr;  ptr += (size_t)qn->ncount[l] * qn->stride[l];
+        qn->scale[l]   = (float*)ptr;   ptr += (size_t)padFloats(qn->ncount[l]) * sizeof(float);
+        qn->bias[l]    = (float*)ptr;   ptr += (size_t)padFloats(qn->ncount[l]) * sizeof(float);
+    }
+    
+    quantizeLayer(qn, &nn->dense[1], 1, 1, 0);
+    
+    // Sigmoid outputs [0,1] are mapped onto [0,255], tanh outputs [-1,1] onto [1,255]
+    for (int l=2; l<qn->layerCount; l++){
+        if (qn->actType[l-1]==TANH) quantizeLayer(qn, &nn->dense[l], l, 127, 128);
+                               else quantizeLayer(qn, &nn->dense[l], l, 255, 0);
+    }
+    
+    return qn;
+}
+
+
+
+
+/**
+ * @details Frees a quantized NN
+ */
+
+void freeInt8Network(Int8Network *qn){
+    
+    free(qn->block);
+    free(qn);
+}
+
+
+
+
+/**
+ * @details Returns the byte size of the arrays holding a quantized NN's weights, scales and biases (including padding),
+ * which is the size of the block allocated by createInt8Network()
+ */
+
+size_t getInt8NetworkSize(const Int8Network *qn){
+    
+    size_t size = 0;
+    for (int l=1; l<qn->layerCount; l++) size += getInt8LayerSize(qn, l);
+    
+    return size;
+}
+
+
+
+
+/**
+ * @details The workspace holds the uint8 inputs of every layer (the binarized INPUT values and the quantized
+ * HIDDEN outputs) followed by the float sums of one layer
+ */
+
+uint8_t *createInt8Workspace(const Int8Network *qn){
+    
+    int maxCount = 0;
+    size_t size = 0;
+    for (int l=1; l<qn->layerCount; l++){
+        if (qn->ncount[l] > maxCount) maxCount = qn->ncount[l];
+        size += qn->stride[l];
+    }
+    size += (size_t)padFloats(maxCount) * sizeof(float);
+    
+    void *work = NULL;
+    if (posix_memalign(&work, NN_ALIGNMENT, size) != 0){
+        printf("Abort! Could not allocate memory for the quantized workspace\n");
+        exit(1);
+    }
+    memset(work, 0, size);
+    
+    return (uint8_t*)work;
+}
+
+
+
+
+/**
+ * @brief Calculates the activated outputs of a quantized layer from its uint8 inputs
+ * @param qn A pointer to the quantized NN
+ * @param layer Index of the layer (1 to layerCount-1)
+ * @param input Quantized inputs, qn->stride[layer] values (padding values are multiplied with 0 weights)
+ * @param output Array receiving the qn->ncount[layer] activated outputs
+ */
+
+void calcLayerInt8(const Int8Network *qn, int layer, const uint8_t *input, float *output){
+    
+    const int8_t *w = qn->weights[layer];
+    int stride = qn->stride[layer];
+    int32_t sum[4];
+    int n = 0;
+    
+    for (; n+4<=qn->ncount[layer]; n+=4){
+        int8Kernels.dotRows4(w + (size_t)n * stride, stride, input, stride, sum);
+        for (int k=0; k<4; k++) output[n+k] = qn->bias[layer][n+k] + qn->scale[layer][n+k] * sum[k];
+    }
+    
+    // remaining nodes one at a time
+    for (; n<qn->ncount[layer]; n++){
+        output[n] = qn->bias[layer][n] + qn->scale[layer][n] * int8Kernels.dotRow(w + (size_t)n * stride, input, stride);
+    }
+    
+    for (n=0; n<qn->ncount[layer]; n++) output[n] = (float)activate(qn->actType[layer], output[n]);
+    
+}
+
+
+
+
+/**
+ * @details Binarizes the pixels, then calculates one layer after the other, quantizing the outputs of every
+ * HIDDEN layer to the uint8 inputs of the next layer
+ */
+
+int classifyImageInt8(const Int8Network *qn, uint8_t *work, const uint8_t *pixel, float *scores){
+    
+    int out = qn->layerCount-1;
+    
+    size_t inputSize = 0;
+    for (int l=1; l<qn->layerCount; l++) inputSize += qn->stride[l];
+    
+    uint8_t *input  = work;
+    float *output   = (float*)(work + inputSize);
+    
+    for (int i=0; i<qn->ncount[INPUT]; i++) input[i] = (pixel[i]!=0);
+    
+    for (int l=1; l<out; l++){
+        
+        calcLayerInt8(qn, l, input, output);
+        
+        // Same mapping as the one the next layer was quantized for
+        uint8_t *hidden = input + qn->stride[l];
+        for (int h=0; h<qn->ncount[l]; h++){
+            if (qn->actType[l]==TANH) hidden[h] = (uint8_t)lrintf(output[h] * 127 + 128);
+                                 else hidden[h] = (uint8_t)lrintf(output[h] * 255);
+        }
+        input = hidden;
+    }
+    
+    calcLayerInt8(qn, out, input, output);
+    
+    float maxOut = 0;
+    int maxInd = 0;
+    
+    for (int o=0; o<qn->ncount[out]; o++){
+        if (output[o] > maxOut){
+            maxOut = output[o];
+            maxInd = o;
+        }
+    }
+    
+    if (scores!=NULL) memcpy(scores, output, qn->ncount[out] * sizeof(float));
+    
+    return maxInd;
+}
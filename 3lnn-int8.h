@@ -0,0 +1,93 @@
+/**
+ * @file 3lnn-int8.h
+ * @brief Post-training quantized inference: a copy of a trained NN with int8 weights and integer dot products
+ * @details Every weight row (=node) of the HIDDEN and OUTPUT layers is quantized symmetrically to int8 with
+ * its own scale (scale = max. absolute weight / 127). The inputs of all layers are uint8: the binarized
+ * MNIST pixels (0 or 1) and the HIDDEN outputs mapped from [0,1] to [0,255] or from [-1,1] to [1,255]. The dot products are exact
+ * uint8 x int8 -> int32 sums (AVX-512 VNNI, AVX2 or scalar), only biases and activations are float.
+ */
+
+#ifndef MNIST_3LNN_INT8_H
+#define MNIST_3LNN_INT8_H
+
+#include <stdint.h>
+
+#include "3lnn.h"
+
+
+typedef struct Int8Network Int8Network;
+
+
+
+
+/**
+ * @brief Read-only, quantized copy of a NN's weights
+ */
+
+struct Int8Network{
+    int layerCount;                 ///< Number of layers, from INPUT to OUTPUT
+    int ncount[NN_MAX_LAYERS];      ///< Number of nodes per layer
+    int stride[NN_MAX_LAYERS];      ///< Number of bytes from one row to the next (ncount of the previous layer padded to NN_ALIGNMENT bytes)
+    int8_t *weights[NN_MAX_LAYERS]; ///< Row-major ncount x stride int8 weight matrix per layer (NULL for INPUT)
+    float *scale[NN_MAX_LAYERS];    ///< Per-row factor converting the int32 dot product of a row back to float (NULL for INPUT)
+    float *bias[NN_MAX_LAYERS];     ///< Per-row bias, including the correction of the input's zero point (NULL for INPUT)
+    ActFctType actType[NN_MAX_LAYERS];  ///< Activation function per layer
+    void *block;                ///< Single NN_ALIGNMENT-aligned memory block holding all arrays
+};
+
+
+
+
+/**
+ * @brief Creates a quantized copy of a (trained or loaded) NN
+ * @param nn A pointer to the NN
+ */
+
+Int8Network *createInt8Network(const Network *nn);
+
+
+
+
+/**
+ * @brief Frees a quantized NN
+ * @param qn A pointer to the quantized NN
+ */
+
+void freeInt8Network(Int8Network *qn);
+
+
+
+
+/**
+ * @brief Returns the byte size of a quantized NN's weights, scales and biases (the allocated size, including padding)
+ * @param qn A pointer to the quantized NN
+ */
+
+size_t getInt8NetworkSize(const Int8Network *qn);
+
+
+
+
+/**
+ * @brief Allocates the uint8 workspace a thread needs for classifyImageInt8() (released via free())
+ * @param qn A pointer to the quantized NN
+ */
+
+uint8_t *createInt8Workspace(const Int8Network *qn);
+
+
+
+
+/**
+ * @brief Classifies one image with a quantized NN, binarizing its pixels (pixel!=0 -> 1)
+ * @param qn A pointer to the (read-only) quantized NN
+ * @param work Workspace created via createInt8Workspace(), used by one thread at a time
+ * @param pixel One uint8 value per INPUT node, e.g. MNIST_Image.pixel
+ * @param scores Array receiving the output value of every OUTPUT node (may be NULL)
+ * @return ID of the output node with the highest output
+ */
+
+int classifyImageInt8(const Int8Network *qn, uint8_t *work, const uint8_t *pixel, float *scores);
+
+
+#endif
@@ -0,0 +1,1525 @@
+/**
+ * @file 3lnn-kernels.c
+ * @brief Vectorized (AVX2, AVX-512, NEON) compute kernels for the dense layers of the NN
+ * @details Each instruction set provides a small table of primitives (dot products of 1 or 4 weight
+ * rows, y += alpha * x, rank-B updates of 4 weight rows, fused optimizer steps). The layer kernels are
+ * built on top of these. The 4-row dot product computes 4 nodes (=rows of the weight matrix) at a time
+ * so that every input value that is loaded is reused 4 times. The weight updates are built on the same
+ * primitives and work on ranges of rows, so that the rows of a layer can be updated by several threads.
+ * Since the vector kernels sum up the products in a different order than the scalar kernel, their
+ * results may differ within floating point tolerance. All kernels operate on NNReal, so a float build
+ * (NN_FLOAT32) processes twice as many values per vector instruction as the double build.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KERNELS_NEON
+#endif
+
+#include "3lnn-kernels.h"
+
+
+/**
+ * @brief Table of the kernel primitives of one instruction set
+ */
+
+typedef struct KernelTable{
+    void   (*dotRows4)(const NNReal *w, int stride, const NNReal *x, int n, NNReal *sum);   ///< sum[k] += dot product of row k (of 4) with x
+    NNReal (*dotRow)(const NNReal *w, const NNReal *x, int n, NNReal sum);              ///< returns sum + dot product of w and x
+    void   (*axpy)(int n, NNReal alpha, const NNReal *x, NNReal *y);                      ///< y += alpha * x
+    void   (*outerRows4)(NNReal *w, int stride, int n, NNReal alpha, const NNReal *d, const NNReal *const *x, int count); ///< row k (of 4) of w += alpha * sum of d[4*s+k] * x[s] over all samples s
+    void   (*tanhRational)(int n, NNReal inScale, NNReal outScale, NNReal outOffset, NNReal *v); ///< v = outOffset + outScale * tanh(inScale * v) (approximated)
+    void   (*momentumStep)(int n, NNReal rate, NNReal mu, NNReal gradWeight, NNReal velWeight, NNReal scale, const NNReal *g, NNReal *v, NNReal *w); ///< v = mu * v + scale * g, w += rate * (gradWeight * scale * g + velWeight * v)
+    void   (*adamStep)(int n, NNReal rate, NNReal beta1, NNReal beta2, NNReal epsilon, NNReal scale, const NNReal *g, NNReal *m, NNReal *v, NNReal *w); ///< Adam moments of scale * g, w += rate * m / (sqrt(v) + epsilon)
+} KernelTable;
+
+static KernelIsa kernelIsa = ISA_SCALAR;
+static KernelTable kernels = {NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+
+#define TANH_APPROX_CLAMP 7.0                               ///< |x| beyond which the rational tanh approximation is clamped
+#define ACT_TABLE_RANGE 16.0                                ///< Activation tables cover [-ACT_TABLE_RANGE, ACT_TABLE_RANGE]
+#define ACT_TABLE_STEPS 4096                                ///< Number of intervals of the activation tables
+#define UPDATE_TILE_BYTES 16384                             ///< Byte size of the input columns of all samples that a rank-B update keeps in the L1 cache
+#define UPDATE_TILE_MIN (NN_ALIGNMENT / (int)sizeof(NNReal))  ///< Minimum number of columns per tile (=1 cache line)
+#define UPDATE_TILE_MAX (UPDATE_TILE_BYTES / (int)sizeof(NNReal)) ///< Maximum number of columns per tile (=1 sample)
+#define UPDATE_MAX_SAMPLES 256                              ///< Maximum number of samples a rank-B update sums up before adding them to the weights
+
+static double actTable[2][ACT_TABLE_STEPS+1];               ///< Activation function values at the interval bounds, indexed by ActFctType
+
+
+
+
+/**
+ * @details Applies an activation function to a single value
+ */
+
+double activate(ActFctType actFct, double x){
+    
+    if (actFct==TANH) return tanh(x);
+    
+    return 1 / (1 + (exp((double)-x)) );
+}
+
+
+
+
+/**
+ * @details Scalar dot product of one weight row, adding up the products in input order
+ */
+
+NNReal dotRowScalar(const NNReal *w, const NNReal *x, int n, NNReal sum){
+    
+    for (int i=0; i<n; i++){
+        sum += x[i] * w[i];
+    }
+    
+    return sum;
+}
+
+
+
+
+/**
+ * @details Scalar dot products of 4 weight rows, one row at a time
+ */
+
+void dotRows4Scalar(const NNReal *w, int stride, const NNReal *x, int n, NNReal *sum){
+    
+    for (int k=0; k<4; k++) sum[k] = dotRowScalar(w + (size_t)k * stride, x, n, sum[k]);
+    
+}
+
+
+
+
+/**
+ * @details Scalar y += alpha * x
+ */
+
+void axpyScalar(int n, NNReal alpha, const NNReal *x, NNReal *y){
+    
+    for (int i=0; i<n; i++) y[i] += alpha * x[i];
+    
+}
+
+
+
+
+/**
+ * @details Scalar momentum step, one weight at a time
+ */
+
+void momentumStepScalar(int n, NNReal rate, NNReal mu, NNReal gradWeight, NNReal velWeight, NNReal scale, const NNReal *g, NNReal *v, NNReal *w){
+    
+    for (int i=0; i<n; i++){
+        NNReal sg = scale * g[i];
+        v[i] = mu * v[i] + sg;
+        w[i] += rate * (gradWeight * sg + velWeight * v[i]);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Scalar Adam step, one weight at a time
+ */
+
+void adamStepScalar(int n, NNReal rate, NNReal beta1, NNReal beta2, NNReal epsilon, NNReal scale, const NNReal *g, NNReal *m, NNReal *v, NNReal *w){
+    
+    for (int i=0; i<n; i++){
+        NNReal sg = scale * g[i];
+        m[i] = beta1 * m[i] + (1 - beta1) * sg;
+        v[i] = beta2 * v[i] + (1 - beta2) * sg * sg;
+        w[i] += rate * m[i] / ((NNReal)sqrt(v[i]) + epsilon);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Scalar rank-B update of 4 weight rows: the products of all samples are summed up first, in sample
+ * order, and then added to the weight
+ */
+
+void outerRows4Scalar(NNReal *w, int stride, int n, NNReal alpha, const NNReal *d, const NNReal *const *x, int count){
+    
+    for (int k=0; k<4; k++){
+        
+        NNReal *wk = w + (size_t)k * stride;
+        
+        for (int i=0; i<n; i++){
+            NNReal sum = 0;
+            for (int s=0; s<count; s++) sum += d[4*s+k] * x[s][i];
+            wk[i] += alpha * sum;
+        }
+    }
+    
+}
+
+
+
+
+/**
+ * @details Rational approximation of tanh (Lambert's continued fraction, cut off at degree 9/8)
+ * The input is clamped to +-TANH_APPROX_CLAMP and the result to [-1,1], which keeps the absolute
+ * error below 7e-6 on the whole real line. Only uses multiply, add, divide, min and max, so it maps
+ * 1:1 onto vector instructions (see the AVX2, AVX-512 and NEON versions below).
+ */
+
+static inline double tanhRationalValue(double x){
+    
+    x = fmin(fmax(x, -TANH_APPROX_CLAMP), TANH_APPROX_CLAMP);
+    
+    double x2 = x*x;
+    double p = x * (34459425 + x2*(4729725 + x2*(135135 + x2*(990 + x2))));
+    double q = 34459425 + x2*(16216200 + x2*(945945 + x2*(13860 + x2*45)));
+    
+    return fmin(fmax(p/q, -1), 1);
+}
+
+
+
+
+/**
+ * @details Scalar v = outOffset + outScale * tanh(inScale * v), tanh approximated by tanhRationalValue()
+ */
+
+void tanhRationalScalar(int n, NNReal inScale, NNReal outScale, NNReal outOffset, NNReal *v){
+    
+    for (int i=0; i<n; i++) v[i] = outOffset + outScale * tanhRationalValue(inScale * v[i]);
+    
+}
+
+
+
+
+#ifdef KERNELS_X86
+
+// Intrinsics operating on NNReal: AVX2(op) expands to _mm256_<op>_pd (4 doubles) or _mm256_<op>_ps (8 floats),
+// AVX512(op) to _mm512_<op>_pd (8 doubles) or _mm512_<op>_ps (16 floats)
+#ifdef NN_FLOAT32
+#define AVX2(op) _mm256_##op##_ps
+#define AVX2_VEC __m256
+#define AVX512(op) _mm512_##op##_ps
+#define AVX512_VEC __m512
+#define AVX512_MASK __mmask16
+#else
+#define AVX2(op) _mm256_##op##_pd
+#define AVX2_VEC __m256d
+#define AVX512(op) _mm512_##op##_pd
+#define AVX512_VEC __m512d
+#define AVX512_MASK __mmask8
+#endif
+
+#define AVX2_LANES ((int)(32 / sizeof(NNReal)))                ///< Number of NNReal values per AVX register
+#define AVX512_LANES ((int)(64 / sizeof(NNReal)))              ///< Number of NNReal values per AVX-512 register
+
+
+
+
+/**
+ * @details Adds up all values of an AVX register
+ */
+
+__attribute__((target("avx2,fma")))
+NNReal hsumAvx2(AVX2_VEC v){
+    
+#ifdef NN_FLOAT32
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    
+    return _mm_cvtss_f32(_mm_add_ss(lo, _mm_movehdup_ps(lo)));
+#else
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+#endif
+}
+
+
+
+
+/**
+ * @details AVX2 dot products of 4 weight rows: 4 rows x 1 register of weights per fused multiply-add step
+ */
+
+__attribute__((target("avx2,fma")))
+void dotRows4Avx2(const NNReal *w, int stride, const NNReal *x, int n, NNReal *sum){
+    
+    const NNReal *w0 = w;
+    const NNReal *w1 = w0 + stride;
+    const NNReal *w2 = w1 + stride;
+    const NNReal *w3 = w2 + stride;
+    int nv = n & ~(AVX2_LANES-1);
+    
+    AVX2_VEC s0 = AVX2(setzero)();
+    AVX2_VEC s1 = AVX2(setzero)();
+    AVX2_VEC s2 = AVX2(setzero)();
+    AVX2_VEC s3 = AVX2(setzero)();
+    
+    for (int i=0; i<nv; i+=AVX2_LANES){
+        AVX2_VEC xv = AVX2(loadu)(x+i);
+        s0 = AVX2(fmadd)(AVX2(loadu)(w0+i), xv, s0);
+        s1 = AVX2(fmadd)(AVX2(loadu)(w1+i), xv, s1);
+        s2 = AVX2(fmadd)(AVX2(loadu)(w2+i), xv, s2);
+        s3 = AVX2(fmadd)(AVX2(loadu)(w3+i), xv, s3);
+    }
+    
+    sum[0] += hsumAvx2(s0);
+    sum[1] += hsumAvx2(s1);
+    sum[2] += hsumAvx2(s2);
+    sum[3] += hsumAvx2(s3);
+    
+    for (int i=nv; i<n; i++){
+        sum[0] += x[i] * w0[i];
+        sum[1] += x[i] * w1[i];
+        sum[2] += x[i] * w2[i];
+        sum[3] += x[i] * w3[i];
+    }
+    
+}
+
+
+
+
+/**
+ * @details AVX2 dot product of one weight row
+ */
+
+__attribute__((target("avx2,fma")))
+NNReal dotRowAvx2(const NNReal *w, const NNReal *x, int n, NNReal sum){
+    
+    int nv = n & ~(AVX2_LANES-1);
+    
+    AVX2_VEC s = AVX2(setzero)();
+    for (int i=0; i<nv; i+=AVX2_LANES) s = AVX2(fmadd)(AVX2(loadu)(w+i), AVX2(loadu)(x+i), s);
+    
+    sum += hsumAvx2(s);
+    for (int i=nv; i<n; i++) sum += x[i] * w[i];
+    
+    return sum;
+}
+
+
+
+
+/**
+ * @details AVX2 y += alpha * x
+ */
+
+__attribute__((target("avx2,fma")))
+void axpyAvx2(int n, NNReal alpha, const NNReal *x, NNReal *y){
+    
+    int nv = n & ~(AVX2_LANES-1);
+    AVX2_VEC a = AVX2(set1)(alpha);
+    
+    for (int i=0; i<nv; i+=AVX2_LANES) AVX2(storeu)(y+i, AVX2(fmadd)(a, AVX2(loadu)(x+i), AVX2(loadu)(y+i)));
+    for (int i=nv; i<n; i++) y[i] += alpha * x[i];
+    
+}
+
+
+
+
+/**
+ * @details AVX2 momentum step: velocity and weights are read and written in the same pass
+ */
+
+__attribute__((target("avx2,fma")))
+void momentumStepAvx2(int n, NNReal rate, NNReal mu, NNReal gradWeight, NNReal velWeight, NNReal scale, const NNReal *g, NNReal *v, NNReal *w){
+    
+    int nv = n & ~(AVX2_LANES-1);
+    AVX2_VEC r  = AVX2(set1)(rate);
+    AVX2_VEC mv = AVX2(set1)(mu);
+    AVX2_VEC gw = AVX2(set1)(gradWeight);
+    AVX2_VEC vw = AVX2(set1)(velWeight);
+    AVX2_VEC sc = AVX2(set1)(scale);
+    
+    for (int i=0; i<nv; i+=AVX2_LANES){
+        AVX2_VEC sg = AVX2(mul)(sc, AVX2(loadu)(g+i));
+        AVX2_VEC vel = AVX2(fmadd)(mv, AVX2(loadu)(v+i), sg);
+        AVX2(storeu)(v+i, vel);
+        AVX2(storeu)(w+i, AVX2(fmadd)(r, AVX2(fmadd)(gw, sg, AVX2(mul)(vw, vel)), AVX2(loadu)(w+i)));
+    }
+    momentumStepScalar(n-nv, rate, mu, gradWeight, velWeight, scale, g+nv, v+nv, w+nv);
+    
+}
+
+
+
+
+/**
+ * @details AVX2 Adam step: both moments and the weights are read and written in the same pass
+ */
+
+__attribute__((target("avx2,fma")))
+void adamStepAvx2(int n, NNReal rate, NNReal beta1, NNReal beta2, NNReal epsilon, NNReal scale, const NNReal *g, NNReal *m, NNReal *v, NNReal *w){
+    
+    int nv = n & ~(AVX2_LANES-1);
+    AVX2_VEC r   = AVX2(set1)(rate);
+    AVX2_VEC b1  = AVX2(set1)(beta1);
+    AVX2_VEC b1c = AVX2(set1)(1 - beta1);
+    AVX2_VEC b2  = AVX2(set1)(beta2);
+    AVX2_VEC b2c = AVX2(set1)(1 - beta2);
+    AVX2_VEC eps = AVX2(set1)(epsilon);
+    AVX2_VEC sc  = AVX2(set1)(scale);
+    
+    for (int i=0; i<nv; i+=AVX2_LANES){
+        AVX2_VEC sg = AVX2(mul)(sc, AVX2(loadu)(g+i));
+        AVX2_VEC mom = AVX2(fmadd)(b1, AVX2(loadu)(m+i), AVX2(mul)(b1c, sg));
+        AVX2_VEC var = AVX2(fmadd)(b2, AVX2(loadu)(v+i), AVX2(mul)(b2c, AVX2(mul)(sg, sg)));
+        AVX2(storeu)(m+i, mom);
+        AVX2(storeu)(v+i, var);
+        AVX2_VEC step = AVX2(div)(AVX2(mul)(r, mom), AVX2(add)(AVX2(sqrt)(var), eps));
+        AVX2(storeu)(w+i, AVX2(add)(AVX2(loadu)(w+i), step));
+    }
+    adamStepScalar(n-nv, rate, beta1, beta2, epsilon, scale, g+nv, m+nv, v+nv, w+nv);
+    
+}
+
+
+
+
+/**
+ * @details AVX2 rank-B update of 4 weight rows: for every register of columns, the products of all samples
+ * are summed up in 4 registers (one per row), which are then added to the weights
+ */
+
+__attribute__((target("avx2,fma")))
+void outerRows4Avx2(NNReal *w, int stride, int n, NNReal alpha, const NNReal *d, const NNReal *const *x, int count){
+    
+    NNReal *w0 = w;
+    NNReal *w1 = w0 + stride;
+    NNReal *w2 = w1 + stride;
+    NNReal *w3 = w2 + stride;
+    int nv = n & ~(AVX2_LANES-1);
+    AVX2_VEC a = AVX2(set1)(alpha);
+    
+    for (int i=0; i<nv; i+=AVX2_LANES){
+        
+        AVX2_VEC s0 = AVX2(setzero)();
+        AVX2_VEC s1 = AVX2(setzero)();
+        AVX2_VEC s2 = AVX2(setzero)();
+        AVX2_VEC s3 = AVX2(setzero)();
+        
+        for (int s=0; s<count; s++){
+            AVX2_VEC xv = AVX2(loadu)(x[s]+i);
+            s0 = AVX2(fmadd)(AVX2(set1)(d[4*s]),   xv, s0);
+            s1 = AVX2(fmadd)(AVX2(set1)(d[4*s+1]), xv, s1);
+            s2 = AVX2(fmadd)(AVX2(set1)(d[4*s+2]), xv, s2);
+            s3 = AVX2(fmadd)(AVX2(set1)(d[4*s+3]), xv, s3);
+        }
+        
+        AVX2(storeu)(w0+i, AVX2(fmadd)(a, s0, AVX2(loadu)(w0+i)));
+        AVX2(storeu)(w1+i, AVX2(fmadd)(a, s1, AVX2(loadu)(w1+i)));
+        AVX2(storeu)(w2+i, AVX2(fmadd)(a, s2, AVX2(loadu)(w2+i)));
+        AVX2(storeu)(w3+i, AVX2(fmadd)(a, s3, AVX2(loadu)(w3+i)));
+    }
+    
+    for (int k=0; k<4; k++){
+        
+        NNReal *wk = w + (size_t)k * stride;
+        
+        for (int i=nv; i<n; i++){
+            NNReal sum = 0;
+            for (int s=0; s<count; s++) sum += d[4*s+k] * x[s][i];
+            wk[i] += alpha * sum;
+        }
+    }
+    
+}
+
+
+
+
+/**
+ * @details AVX2 rational tanh approximation (same formula as tanhRationalValue()) of one register of values
+ */
+
+__attribute__((target("avx2,fma")))
+AVX2_VEC tanhRationalAvx2Vec(AVX2_VEC x){
+    
+    AVX2_VEC c = AVX2(set1)(TANH_APPROX_CLAMP);
+    AVX2_VEC one = AVX2(set1)(1);
+    
+    x = AVX2(min)(AVX2(max)(x, AVX2(sub)(AVX2(setzero)(), c)), c);
+    AVX2_VEC x2 = AVX2(mul)(x, x);
+    
+    AVX2_VEC p = AVX2(add)(x2, AVX2(set1)(990));
+    p = AVX2(fmadd)(p, x2, AVX2(set1)(135135));
+    p = AVX2(fmadd)(p, x2, AVX2(set1)(4729725));
+    p = AVX2(fmadd)(p, x2, AVX2(set1)(34459425));
+    p = AVX2(mul)(p, x);
+    
+    AVX2_VEC q = AVX2(fmadd)(AVX2(set1)(45), x2, AVX2(set1)(13860));
+    q = AVX2(fmadd)(q, x2, AVX2(set1)(945945));
+    q = AVX2(fmadd)(q, x2, AVX2(set1)(16216200));
+    q = AVX2(fmadd)(q, x2, AVX2(set1)(34459425));
+    
+    AVX2_VEC r = AVX2(div)(p, q);
+    
+    return AVX2(min)(AVX2(max)(r, AVX2(sub)(AVX2(setzero)(), one)), one);
+}
+
+
+
+
+/**
+ * @details AVX2 v = outOffset + outScale * tanh(inScale * v)
+ */
+
+__attribute__((target("avx2,fma")))
+void tanhRationalAvx2(int n, NNReal inScale, NNReal outScale, NNReal outOffset, NNReal *v){
+    
+    int nv = n & ~(AVX2_LANES-1);
+    AVX2_VEC is = AVX2(set1)(inScale);
+    AVX2_VEC os = AVX2(set1)(outScale);
+    AVX2_VEC oo = AVX2(set1)(outOffset);
+    
+    for (int i=0; i<nv; i+=AVX2_LANES){
+        AVX2_VEC r = tanhRationalAvx2Vec(AVX2(mul)(AVX2(loadu)(v+i), is));
+        AVX2(storeu)(v+i, AVX2(fmadd)(r, os, oo));
+    }
+    tanhRationalScalar(n-nv, inScale, outScale, outOffset, v+nv);
+    
+}
+
+
+
+
+/**
+ * @details AVX-512 dot products of 4 weight rows: 4 rows x 1 register of weights per fused multiply-add step,
+ * tail handled via masked loads
+ */
+
+__attribute__((target("avx512f")))
+void dotRows4Avx512(const NNReal *w, int stride, const NNReal *x, int n, NNReal *sum){
+    
+    const NNReal *w0 = w;
+    const NNReal *w1 = w0 + stride;
+    const NNReal *w2 = w1 + stride;
+    const NNReal *w3 = w2 + stride;
+    int nv = n & ~(AVX512_LANES-1);
+    AVX512_MASK tail = (AVX512_MASK)((1u << (n - nv)) - 1);
+    
+    AVX512_VEC s0 = AVX512(setzero)();
+    AVX512_VEC s1 = AVX512(setzero)();
+    AVX512_VEC s2 = AVX512(setzero)();
+    AVX512_VEC s3 = AVX512(setzero)();
+    
+    for (int i=0; i<nv; i+=AVX512_LANES){
+        AVX512_VEC xv = AVX512(loadu)(x+i);
+        s0 = AVX512(fmadd)(AVX512(loadu)(w0+i), xv, s0);
+        s1 = AVX512(fmadd)(AVX512(loadu)(w1+i), xv, s1);
+        s2 = AVX512(fmadd)(AVX512(loadu)(w2+i), xv, s2);
+        s3 = AVX512(fmadd)(AVX512(loadu)(w3+i), xv, s3);
+    }
+    
+    if (tail){
+        AVX512_VEC xv = AVX512(maskz_loadu)(tail, x+nv);
+        s0 = AVX512(fmadd)(AVX512(maskz_loadu)(tail, w0+nv), xv, s0);
+        s1 = AVX512(fmadd)(AVX512(maskz_loadu)(tail, w1+nv), xv, s1);
+        s2 = AVX512(fmadd)(AVX512(maskz_loadu)(tail, w2+nv), xv, s2);
+        s3 = AVX512(fmadd)(AVX512(maskz_loadu)(tail, w3+nv), xv, s3);
+    }
+    
+    sum[0] += AVX512(reduce_add)(s0);
+    sum[1] += AVX512(reduce_add)(s1);
+    sum[2] += AVX512(reduce_add)(s2);
+    sum[3] += AVX512(reduce_add)(s3);
+    
+}
+
+
+
+
+/**
+ * @details AVX-512 dot product of one weight row
+ */
+
+__attribute__((target("avx512f")))
+NNReal dotRowAvx512(const NNReal *w, const NNReal *x, int n, NNReal sum){
+    
+    int nv = n & ~(AVX512_LANES-1);
+    AVX512_MASK tail = (AVX512_MASK)((1u << (n - nv)) - 1);
+    
+    AVX512_VEC s = AVX512(setzero)();
+    for (int i=0; i<nv; i+=AVX512_LANES) s = AVX512(fmadd)(AVX512(loadu)(w+i), AVX512(loadu)(x+i), s);
+    if (tail) s = AVX512(fmadd)(AVX512(maskz_loadu)(tail, w+nv), AVX512(maskz_loadu)(tail, x+nv), s);
+    
+    return sum + AVX512(reduce_add)(s);
+}
+
+
+
+
+/**
+ * @details AVX-512 y += alpha * x
+ */
+
+__attribute__((target("avx512f")))
+void axpyAvx512(int n, NNReal alpha, const NNReal *x, NNReal *y){
+    
+    int nv = n & ~(AVX512_LANES-1);
+    AVX512_MASK tail = (AVX512_MASK)((1u << (n - nv)) - 1);
+    AVX512_VEC a = AVX512(set1)(alpha);
+    
+    for (int i=0; i<nv; i+=AVX512_LANES) AVX512(storeu)(y+i, AVX512(fmadd)(a, AVX512(loadu)(x+i), AVX512(loadu)(y+i)));
+    if (tail) AVX512(mask_storeu)(y+nv, tail, AVX512(fmadd)(a, AVX512(maskz_loadu)(tail, x+nv), AVX512(maskz_loadu)(tail, y+nv)));
+    
+}
+
+
+
+
+/**
+ * @details AVX-512 momentum step: velocity and weights are read and written in the same pass, tail handled via masks
+ */
+
+__attribute__((target("avx512f")))
+void momentumStepAvx512(int n, NNReal rate, NNReal mu, NNReal gradWeight, NNReal velWeight, NNReal scale, const NNReal *g, NNReal *v, NNReal *w){
+    
+    AVX512_VEC r  = AVX512(set1)(rate);
+    AVX512_VEC mv = AVX512(set1)(mu);
+    AVX512_VEC gw = AVX512(set1)(gradWeight);
+    AVX512_VEC vw = AVX512(set1)(velWeight);
+    AVX512_VEC sc = AVX512(set1)(scale);
+    
+    for (int i=0; i<n; i+=AVX512_LANES){
+        AVX512_MASK k = (n-i >= AVX512_LANES) ? (AVX512_MASK)~0u : (AVX512_MASK)((1u << (n-i)) - 1);
+        AVX512_VEC sg = AVX512(mul)(sc, AVX512(maskz_loadu)(k, g+i));
+        AVX512_VEC vel = AVX512(fmadd)(mv, AVX512(maskz_loadu)(k, v+i), sg);
+        AVX512(mask_storeu)(v+i, k, vel);
+        AVX512(mask_storeu)(w+i, k, AVX512(fmadd)(r, AVX512(fmadd)(gw, sg, AVX512(mul)(vw, vel)), AVX512(maskz_loadu)(k, w+i)));
+    }
+    
+}
+
+
+
+
+/**
+ * @details AVX-512 Adam step: both moments and the weights are read and written in the same pass, tail handled via masks
+ */
+
+__attribute__((target("avx512f")))
+void adamStepAvx512(int n, NNReal rate, NNReal beta1, NNReal beta2, NNReal epsilon, NNReal scale, const NNReal *g, NNReal *m, NNReal *v, NNReal *w){
+    
+    AVX512_VEC r   = AVX512(set1)(rate);
+    AVX512_VEC b1  = AVX512(set1)(beta1);
+    AVX512_VEC b1c = AVX512(set1)(1 - beta1);
+    AVX512_VEC b2  = AVX512(set1)(beta2);
+    AVX512_VEC b2c = AVX512(set1)(1 - beta2);
+    AVX512_VEC eps = AVX512(set1)(epsilon);
+    AVX512_VEC sc  = AVX512(set1)(scale);
+    
+    for (int i=0; i<n; i+=AVX512_LANES){
+        AVX512_MASK k = (n-i >= AVX512_LANES) ? (AVX512_MASK)~0u : (AVX512_MASK)((1u << (n-i)) - 1);
+        AVX512_VEC sg = AVX512(mul)(sc, AVX512(maskz_loadu)(k, g+i));
+        AVX512_VEC mom = AVX512(fmadd)(b1, AVX512(maskz_loadu)(k, m+i), AVX512(mul)(b1c, sg));
+        AVX512_VEC var = AVX512(fmadd)(b2, AVX512(maskz_loadu)(k, v+i), AVX512(mul)(b2c, AVX512(mul)(sg, sg)));
+        AVX512(mask_storeu)(m+i, k, mom);
+        AVX512(mask_storeu)(v+i, k, var);
+        AVX512_VEC step = AVX512(div)(AVX512(mul)(r, mom), AVX512(add)(AVX512(sqrt)(var), eps));
+        AVX512(mask_storeu)(w+i, k, AVX512(add)(AVX512(maskz_loadu)(k, w+i), step));
+    }
+    
+}
+
+
+
+
+/**
+ * @details AVX-512 rank-B update of 4 weight rows: for every register of columns, the products of all samples
+ * are summed up in 4 registers (one per row), which are then added to the weights; tail handled via masks
+ */
+
+__attribute__((target("avx512f")))
+void outerRows4Avx512(NNReal *w, int stride, int n, NNReal alpha, const NNReal *d, const NNReal *const *x, int count){
+    
+    NNReal *w0 = w;
+    NNReal *w1 = w0 + stride;
+    NNReal *w2 = w1 + stride;
+    NNReal *w3 = w2 + stride;
+    AVX512_VEC a = AVX512(set1)(alpha);
+    
+    for (int i=0; i<n; i+=AVX512_LANES){
+        
+        // Full register except for the tail
+        AVX512_MASK m = (n-i >= AVX512_LANES) ? (AVX512_MASK)~0u : (AVX512_MASK)((1u << (n-i)) - 1);
+        
+        AVX512_VEC s0 = AVX512(setzero)();
+        AVX512_VEC s1 = AVX512(setzero)();
+        AVX512_VEC s2 = AVX512(setzero)();
+        AVX512_VEC s3 = AVX512(setzero)();
+        
+        for (int s=0; s<count; s++){
+            AVX512_VEC xv = AVX512(maskz_loadu)(m, x[s]+i);
+            s0 = AVX512(fmadd)(AVX512(set1)(d[4*s]),   xv, s0);
+            s1 = AVX512(fmadd)(AVX512(set1)(d[4*s+1]), xv, s1);
+            s2 = AVX512(fmadd)(AVX512(set1)(d[4*s+2]), xv, s2);
+            s3 = AVX512(fmadd)(AVX512(set1)(d[4*s+3]), xv, s3);
+        }
+        
+        AVX512(mask_storeu)(w0+i, m, AVX512(fmadd)(a, s0, AVX512(maskz_loadu)(m, w0+i)));
+        AVX512(mask_storeu)(w1+i, m, AVX512(fmadd)(a, s1, AVX512(maskz_loadu)(m, w1+i)));
+        AVX512(mask_storeu)(w2+i, m, AVX512(fmadd)(a, s2, AVX512(maskz_loadu)(m, w2+i)));
+        AVX512(mask_storeu)(w3+i, m, AVX512(fmadd)(a, s3, AVX512(maskz_loadu)(m, w3+i)));
+    }
+    
+}
+
+
+
+
+/**
+ * @details AVX-512 rational tanh approximation (same formula as tanhRationalValue()) of one register of values
+ */
+
+__attribute__((target("avx512f")))
+AVX512_VEC tanhRationalAvx512Vec(AVX512_VEC x){
+    
+    AVX512_VEC c = AVX512(set1)(TANH_APPROX_CLAMP);
+    AVX512_VEC one = AVX512(set1)(1);
+    
+    x = AVX512(min)(AVX512(max)(x, AVX512(sub)(AVX512(setzero)(), c)), c);
+    AVX512_VEC x2 = AVX512(mul)(x, x);
+    
+    AVX512_VEC p = AVX512(add)(x2, AVX512(set1)(990));
+    p = AVX512(fmadd)(p, x2, AVX512(set1)(135135));
+    p = AVX512(fmadd)(p, x2, AVX512(set1)(4729725));
+    p = AVX512(fmadd)(p, x2, AVX512(set1)(34459425));
+    p = AVX512(mul)(p, x);
+    
+    AVX512_VEC q = AVX512(fmadd)(AVX512(set1)(45), x2, AVX512(set1)(13860));
+    q = AVX512(fmadd)(q, x2, AVX512(set1)(945945));
+    q = AVX512(fmadd)(q, x2, AVX512(set1)(16216200));
+    q = AVX512(fmadd)(q, x2, AVX512(set1)(34459425));
+    
+    AVX512_VEC r = AVX512(div)(p, q);
+    
+    return AVX512(min)(AVX512(max)(r, AVX512(sub)(AVX512(setzero)(), one)), one);
+}
+
+
+
+
+/**
+ * @details AVX-512 v = outOffset + outScale * tanh(inScale * v), tail handled via masked loads/stores
+ */
+
+__attribute__((target("avx512f")))
+void tanhRationalAvx512(int n, NNReal inScale, NNReal outScale, NNReal outOffset, NNReal *v){
+    
+    int nv = n & ~(AVX512_LANES-1);
+    AVX512_MASK tail = (AVX512_MASK)((1u << (n - nv)) - 1);
+    AVX512_VEC is = AVX512(set1)(inScale);
+    AVX512_VEC os = AVX512(set1)(outScale);
+    AVX512_VEC oo = AVX512(set1)(outOffset);
+    
+    for (int i=0; i<nv; i+=AVX512_LANES){
+        AVX512_VEC r = tanhRationalAvx512Vec(AVX512(mul)(AVX512(loadu)(v+i), is));
+        AVX512(storeu)(v+i, AVX512(fmadd)(r, os, oo));
+    }
+    if (tail){
+        AVX512_VEC r = tanhRationalAvx512Vec(AVX512(mul)(AVX512(maskz_loadu)(tail, v+nv), is));
+        AVX512(mask_storeu)(v+nv, tail, AVX512(fmadd)(r, os, oo));
+    }
+    
+}
+
+#endif
+
+
+
+
+#ifdef KERNELS_NEON
+
+// Intrinsics operating on NNReal: NEON(op) expands to v<op>q_f64 (2 doubles) or v<op>q_f32 (4 floats),
+// NEON_N(op) to the variant taking a scalar operand
+#ifdef NN_FLOAT32
+#define NEON(op) v##op##q_f32
+#define NEON_N(op) v##op##q_n_f32
+#define NEON_VEC float32x4_t
+#else
+#define NEON(op) v##op##q_f64
+#define NEON_N(op) v##op##q_n_f64
+#define NEON_VEC float64x2_t
+#endif
+
+#define NEON_LANES ((int)(16 / sizeof(NNReal)))                ///< Number of NNReal values per NEON register
+
+
+
+
+/**
+ * @details NEON dot products of 4 weight rows: 4 rows x 1 register of weights per fused multiply-add step
+ */
+
+void dotRows4Neon(const NNReal *w, int stride, const NNReal *x, int n, NNReal *sum){
+    
+    const NNReal *w0 = w;
+    const NNReal *w1 = w0 + stride;
+    const NNReal *w2 = w1 + stride;
+    const NNReal *w3 = w2 + stride;
+    int nv = n & ~(NEON_LANES-1);
+    
+    NEON_VEC s0 = NEON_N(dup)(0);
+    NEON_VEC s1 = NEON_N(dup)(0);
+    NEON_VEC s2 = NEON_N(dup)(0);
+    NEON_VEC s3 = NEON_N(dup)(0);
+    
+    for (int i=0; i<nv; i+=NEON_LANES){
+        NEON_VEC xv = NEON(ld1)(x+i);
+        s0 = NEON(fma)(s0, NEON(ld1)(w0+i), xv);
+        s1 = NEON(fma)(s1, NEON(ld1)(w1+i), xv);
+        s2 = NEON(fma)(s2, NEON(ld1)(w2+i), xv);
+        s3 = NEON(fma)(s3, NEON(ld1)(w3+i), xv);
+    }
+    
+    sum[0] += NEON(addv)(s0);
+    sum[1] += NEON(addv)(s1);
+    sum[2] += NEON(addv)(s2);
+    sum[3] += NEON(addv)(s3);
+    
+    for (int i=nv; i<n; i++){
+        sum[0] += x[i] * w0[i];
+        sum[1] += x[i] * w1[i];
+        sum[2] += x[i] * w2[i];
+        sum[3] += x[i] * w3[i];
+    }
+    
+}
+
+
+
+
+/**
+ * @details NEON dot product of one weight row
+ */
+
+NNReal dotRowNeon(const NNReal *w, const NNReal *x, int n, NNReal sum){
+    
+    int nv = n & ~(NEON_LANES-1);
+    
+    NEON_VEC s = NEON_N(dup)(0);
+    for (int i=0; i<nv; i+=NEON_LANES) s = NEON(fma)(s, NEON(ld1)(w+i), NEON(ld1)(x+i));
+    
+    sum += NEON(addv)(s);
+    for (int i=nv; i<n; i++) sum += x[i] * w[i];
+    
+    return sum;
+}
+
+
+
+
+/**
+ * @details NEON y += alpha * x
+ */
+
+void axpyNeon(int n, NNReal alpha, const NNReal *x, NNReal *y){
+    
+    int nv = n & ~(NEON_LANES-1);
+    NEON_VEC a = NEON_N(dup)(alpha);
+    
+    for (int i=0; i<nv; i+=NEON_LANES) NEON(st1)(y+i, NEON(fma)(NEON(ld1)(y+i), a, NEON(ld1)(x+i)));
+    for (int i=nv; i<n; i++) y[i] += alpha * x[i];
+    
+}
+
+
+
+
+/**
+ * @details NEON momentum step: velocity and weights are read and written in the same pass
+ */
+
+void momentumStepNeon(int n, NNReal rate, NNReal mu, NNReal gradWeight, NNReal velWeight, NNReal scale, const NNReal *g, NNReal *v, NNReal *w){
+    
+    int nv = n & ~(NEON_LANES-1);
+    NEON_VEC r  = NEON_N(dup)(rate);
+    NEON_VEC mv = NEON_N(dup)(mu);
+    NEON_VEC gw = NEON_N(dup)(gradWeight);
+    NEON_VEC vw = NEON_N(dup)(velWeight);
+    NEON_VEC sc = NEON_N(dup)(scale);
+    
+    for (int i=0; i<nv; i+=NEON_LANES){
+        NEON_VEC sg = NEON(mul)(sc, NEON(ld1)(g+i));
+        NEON_VEC vel = NEON(fma)(sg, mv, NEON(ld1)(v+i));
+        NEON(st1)(v+i, vel);
+        NEON(st1)(w+i, NEON(fma)(NEON(ld1)(w+i), r, NEON(fma)(NEON(mul)(vw, vel), gw, sg)));
+    }
+    momentumStepScalar(n-nv, rate, mu, gradWeight, velWeight, scale, g+nv, v+nv, w+nv);
+    
+}
+
+
+
+
+/**
+ * @details NEON Adam step: both moments and the weights are read and written in the same pass
+ */
+
+void adamStepNeon(int n, NNReal rate, NNReal beta1, NNReal beta2, NNReal epsilon, NNReal scale, const NNReal *g, NNReal *m, NNReal *v, NNReal *w){
+    
+    int nv = n & ~(NEON_LANES-1);
+    NEON_VEC r   = NEON_N(dup)(rate);
+    NEON_VEC b1  = NEON_N(dup)(beta1);
+    NEON_VEC b1c = NEON_N(dup)(1 - beta1);
+    NEON_VEC b2  = NEON_N(dup)(beta2);
+    NEON_VEC b2c = NEON_N(dup)(1 - beta2);
+    NEON_VEC eps = NEON_N(dup)(epsilon);
+    NEON_VEC sc  = NEON_N(dup)(scale);
+    
+    for (int i=0; i<nv; i+=NEON_LANES){
+        NEON_VEC sg = NEON(mul)(sc, NEON(ld1)(g+i));
+        NEON_VEC mom = NEON(fma)(NEON(mul)(b1c, sg), b1, NEON(ld1)(m+i));
+        NEON_VEC var = NEON(fma)(NEON(mul)(b2c, NEON(mul)(sg, sg)), b2, NEON(ld1)(v+i));
+        NEON(st1)(m+i, mom);
+        NEON(st1)(v+i, var);
+        NEON_VEC step = NEON(div)(NEON(mul)(r, mom), NEON(add)(NEON(sqrt)(var), eps));
+        NEON(st1)(w+i, NEON(add)(NEON(ld1)(w+i), step));
+    }
+    adamStepScalar(n-nv, rate, beta1, beta2, epsilon, scale, g+nv, m+nv, v+nv, w+nv);
+    
+}
+
+
+
+
+/**
+ * @details NEON rank-B update of 4 weight rows: for every register of columns, the products of all samples
+ * are summed up in 4 registers (one per row), which are then added to the weights
+ */
+
+void outerRows4Neon(NNReal *w, int stride, int n, NNReal alpha, const NNReal *d, const NNReal *const *x, int count){
+    
+    NNReal *w0 = w;
+    NNReal *w1 = w0 + stride;
+    NNReal *w2 = w1 + stride;
+    NNReal *w3 = w2 + stride;
+    int nv = n & ~(NEON_LANES-1);
+    NEON_VEC a = NEON_N(dup)(alpha);
+    
+    for (int i=0; i<nv; i+=NEON_LANES){
+        
+        NEON_VEC s0 = NEON_N(dup)(0);
+        NEON_VEC s1 = NEON_N(dup)(0);
+        NEON_VEC s2 = NEON_N(dup)(0);
+        NEON_VEC s3 = NEON_N(dup)(0);
+        
+        for (int s=0; s<count; s++){
+            NEON_VEC xv = NEON(ld1)(x[s]+i);
+            s0 = NEON(fma)(s0, xv, NEON_N(dup)(d[4*s]));
+            s1 = NEON(fma)(s1, xv, NEON_N(dup)(d[4*s+1]));
+            s2 = NEON(fma)(s2, xv, NEON_N(dup)(d[4*s+2]));
+            s3 = NEON(fma)(s3, xv, NEON_N(dup)(d[4*s+3]));
+        }
+        
+        NEON(st1)(w0+i, NEON(fma)(NEON(ld1)(w0+i), a, s0));
+        NEON(st1)(w1+i, NEON(fma)(NEON(ld1)(w1+i), a, s1));
+        NEON(st1)(w2+i, NEON(fma)(NEON(ld1)(w2+i), a, s2));
+        NEON(st1)(w3+i, NEON(fma)(NEON(ld1)(w3+i), a, s3));
+    }
+    
+    for (int k=0; k<4; k++){
+        
+        NNReal *wk = w + (size_t)k * stride;
+        
+        for (int i=nv; i<n; i++){
+            NNReal sum = 0;
+            for (int s=0; s<count; s++) sum += d[4*s+k] * x[s][i];
+            wk[i] += alpha * sum;
+        }
+    }
+    
+}
+
+
+
+
+/**
+ * @details NEON v = outOffset + outScale * tanh(inScale * v), same formula as tanhRationalValue()
+ */
+
+void tanhRationalNeon(int n, NNReal inScale, NNReal outScale, NNReal outOffset, NNReal *v){
+    
+    int nv = n & ~(NEON_LANES-1);
+    NEON_VEC c = NEON_N(dup)(TANH_APPROX_CLAMP);
+    NEON_VEC one = NEON_N(dup)(1);
+    
+    for (int i=0; i<nv; i+=NEON_LANES){
+        NEON_VEC x = NEON_N(mul)(NEON(ld1)(v+i), inScale);
+        x = NEON(min)(NEON(max)(x, NEON(neg)(c)), c);
+        NEON_VEC x2 = NEON(mul)(x, x);
+        
+        NEON_VEC p = NEON(add)(x2, NEON_N(dup)(990));
+        p = NEON(fma)(NEON_N(dup)(135135), p, x2);
+        p = NEON(fma)(NEON_N(dup)(4729725), p, x2);
+        p = NEON(fma)(NEON_N(dup)(34459425), p, x2);
+        p = NEON(mul)(p, x);
+        
+        NEON_VEC q = NEON(fma)(NEON_N(dup)(13860), NEON_N(dup)(45), x2);
+        q = NEON(fma)(NEON_N(dup)(945945), q, x2);
+        q = NEON(fma)(NEON_N(dup)(16216200), q, x2);
+        q = NEON(fma)(NEON_N(dup)(34459425), q, x2);
+        
+        NEON_VEC r = NEON(min)(NEON(max)(NEON(div)(p, q), NEON(neg)(one)), one);
+        NEON(st1)(v+i, NEON(fma)(NEON_N(dup)(outOffset), r, NEON_N(dup)(outScale)));
+    }
+    tanhRationalScalar(n-nv, inScale, outScale, outOffset, v+nv);
+    
+}
+
+#endif
+
+
+
+
+/**
+ * @details Returns 1 if the CPU (and OS) support the given instruction set
+ */
+
+int isKernelIsaSupported(KernelIsa isa){
+    
+    switch (isa) {
+        case ISA_SCALAR:
+            return 1;
+#ifdef KERNELS_X86
+        case ISA_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case ISA_AVX512:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx512f");
+#endif
+#ifdef KERNELS_NEON
+        case ISA_NEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+
+
+
+/**
+ * @details Fills the lookup tables of the activation functions
+ */
+
+void initActivationTables(void){
+    
+    for (int i=0; i<=ACT_TABLE_STEPS; i++){
+        double x = -ACT_TABLE_RANGE + i * (2*ACT_TABLE_RANGE / ACT_TABLE_STEPS);
+        actTable[SIGMOID][i] = activate(SIGMOID, x);
+        actTable[TANH][i]    = activate(TANH, x);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Fills the kernel table with the primitives of an instruction set
+ */
+
+int applyKernelIsa(KernelIsa isa){
+    
+    if (!isKernelIsaSupported(isa)) return 0;
+    
+    switch (isa) {
+#ifdef KERNELS_X86
+        case ISA_AVX2:
+            kernels = (KernelTable){dotRows4Avx2, dotRowAvx2, axpyAvx2, outerRows4Avx2, tanhRationalAvx2, momentumStepAvx2, adamStepAvx2};
+            break;
+        case ISA_AVX512:
+            kernels = (KernelTable){dotRows4Avx512, dotRowAvx512, axpyAvx512, outerRows4Avx512, tanhRationalAvx512, momentumStepAvx512, adamStepAvx512};
+            break;
+#endif
+#ifdef KERNELS_NEON
+        case ISA_NEON:
+            kernels = (KernelTable){dotRows4Neon, dotRowNeon, axpyNeon, outerRows4Neon, tanhRationalNeon, momentumStepNeon, adamStepNeon};
+            break;
+#endif
+        default:
+            kernels = (KernelTable){dotRows4Scalar, dotRowScalar, axpyScalar, outerRows4Scalar, tanhRationalScalar, momentumStepScalar, adamStepScalar};
+            break;
+    }
+    
+    kernelIsa = isa;
+    
+    return 1;
+}
+
+
+
+
+/**
+ * @details Fills the activation tables and selects the best kernel implementation supported by the CPU
+ */
+
+void selectKernels(void){
+    
+    initActivationTables();
+    
+    if (applyKernelIsa(ISA_AVX512)) return;
+    if (applyKernelIsa(ISA_AVX2)) return;
+    if (applyKernelIsa(ISA_NEON)) return;
+    
+    applyKernelIsa(ISA_SCALAR);
+}
+
+
+
+
+/**
+ * @details The first call selects the kernels, concurrent first calls wait until they are selected
+ */
+
+void initKernels(void){
+    
+    pthread_once(&kernelsOnce, selectKernels);
+    
+}
+
+
+
+
+/**
+ * @details Forces the kernels to use a given instruction set (after the default selection, which it overrides)
+ */
+
+int setKernelIsa(KernelIsa isa){
+    
+    initKernels();
+    
+    return applyKernelIsa(isa);
+}
+
+
+
+
+/**
+ * @details Returns the instruction set used by the kernels
+ */
+
+KernelIsa getKernelIsa(void){
+    
+    initKernels();
+    
+    return kernelIsa;
+}
+
+
+
+
+/**
+ * @details Returns a printable name of an instruction set
+ */
+
+const char *getKernelIsaName(KernelIsa isa){
+    
+    switch (isa) {
+        case ISA_AVX2:   return "AVX2";
+        case ISA_AVX512: return "AVX-512";
+        case ISA_NEON:   return "NEON";
+        default:         return "scalar";
+    }
+}
+
+
+
+
+/**
+ * @details Activates a vector in place using the given precision
+ * ACT_EXACT calls libm for every value. ACT_APPROX evaluates the rational tanh approximation with the
+ * selected vector kernel (sigmoid(x) = 0.5 + 0.5 * tanh(x/2)). ACT_TABLE interpolates linearly between
+ * the values of a table with ACT_TABLE_STEPS intervals (inputs outside of the table are clamped).
+ */
+
+void activateVector(ActFctType actFct, ActPrecision prec, int n, NNReal *v){
+    
+    switch (prec) {
+        
+        case ACT_APPROX:
+            if (actFct==TANH) kernels.tanhRational(n, 1, 1, 0, v);
+                         else kernels.tanhRational(n, 0.5, 0.5, 0.5, v);
+            break;
+        
+        case ACT_TABLE:{
+            const double *table = actTable[actFct];
+            const double scale = ACT_TABLE_STEPS / (2*ACT_TABLE_RANGE);
+            for (int i=0; i<n; i++){
+                double t = fmin(fmax((v[i] + ACT_TABLE_RANGE) * scale, 0), ACT_TABLE_STEPS);
+                int k = (int)t;
+                if (k==ACT_TABLE_STEPS) k--;
+                double f = t - k;
+                v[i] = table[k] + f * (table[k+1] - table[k]);
+            }
+            break;
+        }
+        
+        default:
+            for (int i=0; i<n; i++) v[i] = activate(actFct, v[i]);
+            break;
+    }
+    
+}
+
+
+
+
+/**
+ * @details Compares the activation of an evenly spaced grid of inputs in [-20, 20] (step 0.0001) with libm
+ */
+
+double getActivationMaxError(ActFctType actFct, ActPrecision prec){
+    
+    double x[1000];
+    NNReal y[1000];
+    double maxError = 0;
+    
+    initKernels();
+    
+    for (int first=-200000; first<=200000; first+=1000){
+        
+        int n = (first+1000 <= 200001) ? 1000 : 200001-first;
+        for (int i=0; i<n; i++) x[i] = y[i] = (first+i) * 0.0001;
+        
+        activateVector(actFct, prec, n, y);
+        
+        for (int i=0; i<n; i++) maxError = fmax(maxError, fabs(y[i] - activate(actFct, x[i])));
+    }
+    
+    return maxError;
+}
+
+
+
+
+/**
+ * @details Calculates all outputs of a dense layer via the selected kernel
+ */
+
+void calcDenseLayer(const DenseLayer *l, const NNReal *input, NNReal *output, ActFctType actFct, ActPrecision prec){
+    
+    calcDenseLayerBatch(l, input, 0, 1, output, 0, actFct, prec);
+}
+
+
+
+
+/**
+ * @details Loops over blocks of 4 weight rows and, inside, over all samples. A block of weight
+ * rows therefore stays in the L1 cache while it is multiplied with every sample of the batch.
+ * The sums are activated at the end, one whole output row per sample.
+ */
+
+void calcDenseLayerBatch(const DenseLayer *l, const NNReal *input, int inpStride, int count, NNReal *output, int outStride, ActFctType actFct, ActPrecision prec){
+    
+    int n = 0;
+    
+    for (; n+4<=l->ncount; n+=4){
+        
+        const NNReal *w = l->weights + (size_t)n * l->stride;
+        
+        for (int s=0; s<count; s++){
+            
+            NNReal *out = output + (size_t)s * outStride;
+            
+            // Start by adding the bias
+            NNReal sum[4] = {l->bias[n], l->bias[n+1], l->bias[n+2], l->bias[n+3]};
+            
+            kernels.dotRows4(w, l->stride, input + (size_t)s * inpStride, l->wcount, sum);
+            
+            for (int k=0; k<4; k++) out[n+k] = sum[k];
+        }
+    }
+    
+    // remaining nodes one at a time
+    for (; n<l->ncount; n++){
+        
+        const NNReal *w = l->weights + (size_t)n * l->stride;
+        
+        for (int s=0; s<count; s++){
+            output[(size_t)s * outStride + n] = kernels.dotRow(w, input + (size_t)s * inpStride, l->wcount, l->bias[n]);
+        }
+    }
+    
+    for (int s=0; s<count; s++) activateVector(actFct, prec, l->ncount, output + (size_t)s * outStride);
+    
+}
+
+
+
+
+/**
+ * @details Only the weights of the non-zero inputs are added up, in input order and starting with the
+ * bias like the scalar kernel. Since the skipped products are all 0 the result matches the scalar dense
+ * kernel. The weights are gathered from 4 rows at a time so that every index that is loaded is reused
+ * 4 times.
+ */
+
+void calcDenseLayerSparse(const DenseLayer *l, const NNReal *input, const int *active, int activeCount, NNReal *output, ActFctType actFct, ActPrecision prec){
+    
+    int n = 0;
+    
+    for (; n+4<=l->ncount; n+=4){
+        
+        const NNReal *w0 = l->weights + (size_t)n * l->stride;
+        const NNReal *w1 = w0 + l->stride;
+        const NNReal *w2 = w1 + l->stride;
+        const NNReal *w3 = w2 + l->stride;
+        
+        NNReal sum0 = l->bias[n], sum1 = l->bias[n+1], sum2 = l->bias[n+2], sum3 = l->bias[n+3];
+        
+        for (int a=0; a<activeCount; a++){
+            int i = active[a];
+            NNReal x = input[i];
+            sum0 += x * w0[i];
+            sum1 += x * w1[i];
+            sum2 += x * w2[i];
+            sum3 += x * w3[i];
+        }
+        
+        output[n]   = sum0;
+        output[n+1] = sum1;
+        output[n+2] = sum2;
+        output[n+3] = sum3;
+    }
+    
+    // remaining nodes one at a time
+    for (; n<l->ncount; n++){
+        
+        const NNReal *w = l->weights + (size_t)n * l->stride;
+        NNReal sum = l->bias[n];
+        
+        for (int a=0; a<activeCount; a++) sum += input[active[a]] * w[active[a]];
+        
+        output[n] = sum;
+    }
+    
+    activateVector(actFct, prec, l->ncount, output);
+    
+}
+
+
+
+
+/**
+ * @details A rank-1 update has no input values that could be reused, so it is not tiled: every weight row
+ * is updated with one axpy, and rows whose delta is 0 (e.g. saturated nodes) are skipped. With an index
+ * list, only the weights of the non-zero inputs are visited, 4 rows at a time so that every index that is
+ * loaded is reused 4 times (as in calcDenseLayerSparse()). The update of each sparse weight and bias is
+ * calculated in double precision, as the learning rate is a double.
+ */
+
+void updateDenseLayer(DenseLayer *l, double alpha, const NNReal *delta, const NNReal *input, const int *active, int activeCount, int firstRow, int lastRow){
+    
+    int n = firstRow;
+    
+    if (active!=NULL){
+        
+        for (; n+4<=lastRow; n+=4){
+            
+            NNReal *w0 = l->weights + (size_t)n * l->stride;
+            NNReal *w1 = w0 + l->stride;
+            NNReal *w2 = w1 + l->stride;
+            NNReal *w3 = w2 + l->stride;
+            
+            double a0 = alpha * delta[n], a1 = alpha * delta[n+1], a2 = alpha * delta[n+2], a3 = alpha * delta[n+3];
+            
+            for (int a=0; a<activeCount; a++){
+                int i = active[a];
+                NNReal x = input[i];
+                w0[i] += a0 * x;
+                w1[i] += a1 * x;
+                w2[i] += a2 * x;
+                w3[i] += a3 * x;
+            }
+        }
+        
+        // remaining nodes one at a time
+        for (; n<lastRow; n++){
+            
+            NNReal *w = l->weights + (size_t)n * l->stride;
+            double an = alpha * delta[n];
+            
+            for (int a=0; a<activeCount; a++) w[active[a]] += an * input[active[a]];
+        }
+    }
+    else {
+        
+        for (; n<lastRow; n++){
+            NNReal an = (NNReal)(alpha * delta[n]);
+            if (an!=0) kernels.axpy(l->wcount, an, input, l->weights + (size_t)n * l->stride);
+        }
+    }
+    
+    for (n=firstRow; n<lastRow; n++) l->bias[n] += alpha * delta[n];
+    
+}
+
+
+
+
+/**
+ * @details Returns 1 if any of the n values is not 0
+ */
+
+int hasNonZeroValue(const NNReal *v, int n){
+    
+    for (int i=0; i<n; i++) if (v[i]!=0) return 1;
+    
+    return 0;
+}
+
+
+
+
+/**
+ * @details The columns are processed in tiles that are narrow enough for the tile's input values of all
+ * samples to stay in the L1 cache while every row is visited. The rows are updated 4 at a time: the
+ * products of all samples are first summed up in registers (in sample order) and then added to the
+ * weights, so each weight is loaded and stored once per call. This is the same arithmetic as summing the samples
+ * into a cleared gradient buffer and applying it, so both give identical results for up to
+ * UPDATE_MAX_SAMPLES samples (larger batches are added in chunks). Samples whose input values are all 0
+ * in a tile (e.g. the border pixels of the MNIST images) and samples whose delta is 0 are skipped, which
+ * does not change the result either.
+ */
+
+void updateDenseLayerBatch(DenseLayer *l, NNReal alpha, const NNReal *delta, int deltaStride, const NNReal *input, int inpStride, int count, int firstRow, int lastRow){
+    
+    NNReal sum[UPDATE_TILE_MAX] __attribute__((aligned(NN_ALIGNMENT)));
+    int tileSamples[UPDATE_MAX_SAMPLES];
+    const NNReal *tileInput[UPDATE_MAX_SAMPLES];
+    NNReal tileDelta[4 * UPDATE_MAX_SAMPLES];
+    
+    for (int s0=0; s0<count; s0+=UPDATE_MAX_SAMPLES){
+        
+        int sn = (count-s0 < UPDATE_MAX_SAMPLES) ? count-s0 : UPDATE_MAX_SAMPLES;
+        
+        int tile = UPDATE_TILE_MAX / sn;
+        tile -= tile % UPDATE_TILE_MIN;
+        if (tile<UPDATE_TILE_MIN) tile = UPDATE_TILE_MIN;
+        
+        for (int c=0; c<l->wcount; c+=tile){
+            
+            int cn = (l->wcount-c < tile) ? l->wcount-c : tile;
+            
+            // Samples that contribute to this tile at all
+            int tileCount = 0;
+            for (int s=s0; s<s0+sn; s++){
+                if (!hasNonZeroValue(input + (size_t)s * inpStride + c, cn)) continue;
+                tileInput[tileCount] = input + (size_t)s * inpStride + c;
+                tileSamples[tileCount++] = s;
+            }
+            if (tileCount==0) continue;
+            
+            int n = firstRow;
+            
+            for (; n+4<=lastRow; n+=4){
+                
+                for (int k=0; k<tileCount; k++){
+                    const NNReal *d = delta + (size_t)tileSamples[k] * deltaStride + n;
+                    for (int j=0; j<4; j++) tileDelta[4*k+j] = d[j];
+                }
+                
+                kernels.outerRows4(l->weights + (size_t)n * l->stride + c, l->stride, cn, alpha, tileDelta, tileInput, tileCount);
+            }
+            
+            // remaining nodes one at a time
+            for (; n<lastRow; n++){
+                
+                int used = 0;
+                
+                for (int k=0; k<tileCount; k++){
+                    
+                    int s = tileSamples[k];
+                    NNReal d = delta[(size_t)s * deltaStride + n];
+                    if (d==0) continue;
+                    
+                    if (!used) memset(sum, 0, cn * sizeof(NNReal));
+                    kernels.axpy(cn, d, input + (size_t)s * inpStride + c, sum);
+                    used = 1;
+                }
+                
+                if (used) kernels.axpy(cn, alpha, sum, l->weights + (size_t)n * l->stride + c);
+            }
+        }
+        
+        // The bias acts like an input that is always 1
+        for (int n0=firstRow; n0<lastRow; n0+=UPDATE_TILE_MAX){
+            
+            int rows = (lastRow-n0 < UPDATE_TILE_MAX) ? lastRow-n0 : UPDATE_TILE_MAX;
+            
+            memset(sum, 0, rows * sizeof(NNReal));
+            for (int s=s0; s<s0+sn; s++){
+                for (int n=0; n<rows; n++) sum[n] += delta[(size_t)s * deltaStride + n0 + n];
+            }
+            
+            kernels.axpy(rows, alpha, sum, l->bias + n0);
+        }
+    }
+    
+}
+
+
+
+
+/**
+ * @details Adds a scaled vector to another vector via the selected kernel
+ */
+
+void addScaledVector(int n, NNReal alpha, const NNReal *x, NNReal *y){
+    
+    kernels.axpy(n, alpha, x, y);
+}
+
+
+
+
+/**
+ * @details Plain momentum adds the velocity, Nesterov momentum looks ahead by adding the gradient plus
+ * the velocity scaled by mu; both are one pass of the selected kernel
+ */
+
+void stepMomentum(int n, NNReal rate, NNReal mu, int nesterov, NNReal scale, const NNReal *g, NNReal *v, NNReal *w){
+    
+    if (nesterov) kernels.momentumStep(n, rate, mu, 1, mu, scale, g, v, w);
+    else kernels.momentumStep(n, rate, mu, 0, 1, scale, g, v, w);
+}
+
+
+
+
+/**
+ * @details Performs an Adam step via the selected kernel
+ */
+
+void stepAdam(int n, NNReal rate, NNReal beta1, NNReal beta2, NNReal epsilon, NNReal scale, const NNReal *g, NNReal *m, NNReal *v, NNReal *w){
+    
+    kernels.adamStep(n, rate, beta1, beta2, epsilon, scale, g, m, v, w);
+}
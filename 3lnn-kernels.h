@@ -0,0 +1,237 @@
+/**
+ * @file 3lnn-kernels.h
+ * @brief Vectorized (AVX2, AVX-512, NEON) compute kernels for the dense layers of the NN
+ * @details The kernel implementation is chosen once at runtime based on what the CPU supports
+ * (CPUID on x86) and falls back to a plain scalar loop.
+ */
+
+#ifndef MNIST_3LNN_KERNELS_H
+#define MNIST_3LNN_KERNELS_H
+
+#include "3lnn.h"
+
+
+typedef enum KernelIsa {ISA_SCALAR, ISA_AVX2, ISA_AVX512, ISA_NEON} KernelIsa;
+
+
+
+
+/**
+ * @brief Selects the best kernel implementation supported by the CPU
+ * @details Called by every constructor of a NN (and by getKernelIsa(), setKernelIsa() and getActivationMaxError()),
+ * so the kernels are selected before they are used. Thread-safe: the first call selects them, concurrent callers wait
+ * for it, later calls have no effect.
+ */
+
+void initKernels(void);
+
+
+
+
+/**
+ * @brief Returns the instruction set used by the kernels
+ */
+
+KernelIsa getKernelIsa(void);
+
+
+
+
+/**
+ * @brief Forces the kernels to use a given instruction set
+ * @details Must not be called while other threads run kernels.
+ * @param isa Instruction set to use
+ * @return 1 if the instruction set is supported by this CPU and was selected, 0 otherwise
+ */
+
+int setKernelIsa(KernelIsa isa);
+
+
+
+
+/**
+ * @brief Returns a printable name of an instruction set
+ * @param isa Instruction set
+ */
+
+const char *getKernelIsaName(KernelIsa isa);
+
+
+
+
+/**
+ * @brief Applies an activation function to a single value
+ * @param actFct Type of activation function (SIGMOID, TANH)
+ * @param x Value to be activated
+ */
+
+double activate(ActFctType actFct, double x);
+
+
+
+
+/**
+ * @brief Applies an activation function to all values of a vector (in place) using the given precision
+ * @details Maximum absolute error against libm (ACT_EXACT), as measured by getActivationMaxError():
+ * ACT_APPROX (vectorized rational function): SIGMOID 3.4e-6, TANH 6.8e-6;
+ * ACT_TABLE (4096 intervals on [-16,16], linear interpolation): SIGMOID 7.3e-7, TANH 5.9e-6.
+ * @param actFct Type of activation function (SIGMOID, TANH)
+ * @param prec Precision the activation function is evaluated with
+ * @param n Number of values
+ * @param v Values to be activated
+ */
+
+void activateVector(ActFctType actFct, ActPrecision prec, int n, NNReal *v);
+
+
+
+
+/**
+ * @brief Returns the maximum absolute error of an activation precision against libm, measured on [-20, 20]
+ * @param actFct Type of activation function (SIGMOID, TANH)
+ * @param prec Precision to be measured
+ */
+
+double getActivationMaxError(ActFctType actFct, ActPrecision prec);
+
+
+
+
+/**
+ * @brief Calculates all outputs of a dense layer: output = activation(bias + weights * input)
+ * @param l A pointer to the layer holding the weights and biases
+ * @param input Output values of the previous layer (l->wcount values)
+ * @param output Array receiving the l->ncount activated output values
+ * @param actFct Type of activation function (SIGMOID, TANH)
+ * @param prec Precision the activation function is evaluated with
+ */
+
+void calcDenseLayer(const DenseLayer *l, const NNReal *input, NNReal *output, ActFctType actFct, ActPrecision prec);
+
+
+
+
+/**
+ * @brief Calculates the outputs of a dense layer for a whole batch of samples (matrix-matrix product)
+ * @param l A pointer to the layer holding the weights and biases
+ * @param input Row-major matrix holding one sample (=previous layer's outputs) per row
+ * @param inpStride Number of values from one input row to the next
+ * @param count Number of samples (rows) in the batch
+ * @param output Row-major matrix receiving l->ncount activated output values per sample
+ * @param outStride Number of values from one output row to the next
+ * @param actFct Type of activation function (SIGMOID, TANH)
+ * @param prec Precision the activation function is evaluated with
+ */
+
+void calcDenseLayerBatch(const DenseLayer *l, const NNReal *input, int inpStride, int count, NNReal *output, int outStride, ActFctType actFct, ActPrecision prec);
+
+
+
+
+/**
+ * @brief Calculates all outputs of a dense layer from a sparse input, only visiting its non-zero values
+ * @param l A pointer to the layer holding the weights and biases
+ * @param input Output values of the previous layer (l->wcount values)
+ * @param active Ascending indices of all non-zero values in input
+ * @param activeCount Number of indices in active
+ * @param output Array receiving the l->ncount activated output values
+ * @param actFct Type of activation function (SIGMOID, TANH)
+ * @param prec Precision the activation function is evaluated with
+ */
+
+void calcDenseLayerSparse(const DenseLayer *l, const NNReal *input, const int *active, int activeCount, NNReal *output, ActFctType actFct, ActPrecision prec);
+
+
+
+
+/**
+ * @brief Adds the weight update of one sample to a range of rows of a dense layer (rank-1 update)
+ * @details weights[n] += alpha * delta[n] * input and bias[n] += alpha * delta[n] for every row n
+ * from firstRow to lastRow-1. Distinct row ranges can be updated by different threads at the same time.
+ * @param l A pointer to the layer holding the weights and biases
+ * @param alpha Factor applied to all updates (e.g. the learning rate)
+ * @param delta Error signals of the layer's nodes (l->ncount values)
+ * @param input Output values of the previous layer (l->wcount values)
+ * @param active Ascending indices of all non-zero values in input (NULL = visit all inputs)
+ * @param activeCount Number of indices in active
+ * @param firstRow First row (=node) to be updated
+ * @param lastRow Row after the last row to be updated
+ */
+
+void updateDenseLayer(DenseLayer *l, double alpha, const NNReal *delta, const NNReal *input, const int *active, int activeCount, int firstRow, int lastRow);
+
+
+
+
+/**
+ * @brief Adds the summed weight updates of a batch of samples to a range of rows of a dense layer (rank-B update)
+ * @details weights += alpha * delta^T * input and bias += alpha * delta^T * 1, restricted to the rows
+ * from firstRow to lastRow-1. Cache-blocked, see the implementation. Distinct row ranges can be updated
+ * by different threads at the same time.
+ * @param l A pointer to the layer holding the weights and biases (or a gradient buffer of the same layout)
+ * @param alpha Factor applied to the summed updates (e.g. the learning rate)
+ * @param delta Row-major matrix holding one sample's error signals (l->ncount values) per row
+ * @param deltaStride Number of values from one delta row to the next
+ * @param input Row-major matrix holding one sample's input (=previous layer's outputs) per row
+ * @param inpStride Number of values from one input row to the next
+ * @param count Number of samples (rows) in the batch
+ * @param firstRow First row (=node) to be updated
+ * @param lastRow Row after the last row to be updated
+ */
+
+void updateDenseLayerBatch(DenseLayer *l, NNReal alpha, const NNReal *delta, int deltaStride, const NNReal *input, int inpStride, int count, int firstRow, int lastRow);
+
+
+
+
+/**
+ * @brief Adds a scaled vector to another vector: y += alpha * x
+ * @param n Number of values in the vectors
+ * @param alpha Factor applied to x
+ * @param x Vector to be added
+ * @param y Vector that is updated
+ */
+
+void addScaledVector(int n, NNReal alpha, const NNReal *x, NNReal *y);
+
+
+
+
+/**
+ * @brief Applies one (Nesterov) momentum step to a vector of weights, updating their velocity in the same pass
+ * @details v = mu * v + scale * g; then w += rate * v (plain) or w += rate * (scale * g + mu * v) (Nesterov).
+ * @param n Number of weights
+ * @param rate Learning rate
+ * @param mu Momentum factor
+ * @param nesterov 1 = Nesterov momentum, 0 = plain momentum
+ * @param scale Factor applied to the gradients
+ * @param g Gradients (steepest descent direction, as accumulated in a gradient buffer)
+ * @param v Velocity of every weight
+ * @param w Weights that are updated
+ */
+
+void stepMomentum(int n, NNReal rate, NNReal mu, int nesterov, NNReal scale, const NNReal *g, NNReal *v, NNReal *w);
+
+
+
+
+/**
+ * @brief Applies one Adam step to a vector of weights, updating their moments in the same pass
+ * @details m = beta1 * m + (1-beta1) * scale * g; v = beta2 * v + (1-beta2) * (scale * g)^2;
+ * w += rate * m / (sqrt(v) + epsilon). The bias correction is left to the caller (via rate and epsilon).
+ * @param n Number of weights
+ * @param rate Learning rate (including the bias correction)
+ * @param beta1 Decay of the first moment
+ * @param beta2 Decay of the second moment
+ * @param epsilon Term keeping the denominator away from 0
+ * @param scale Factor applied to the gradients
+ * @param g Gradients (steepest descent direction, as accumulated in a gradient buffer)
+ * @param m First moment of every weight
+ * @param v Second moment of every weight
+ * @param w Weights that are updated
+ */
+
+void stepAdam(int n, NNReal rate, NNReal beta1, NNReal beta2, NNReal epsilon, NNReal scale, const NNReal *g, NNReal *m, NNReal *v, NNReal *w);
+
+
+#endif
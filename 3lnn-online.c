@@ -0,0 +1,265 @@
+/**
+ * @file 3lnn-online.c
+ * @brief Online learning: a NN that keeps being trained on labeled samples while other threads classify with it
+ * @details Every version counts its readers. A reader increments the count of the published version and
+ * then checks that this version is still the published one, otherwise it lets go and tries again. The
+ * trainer only overwrites the unpublished version once its count is 0: a reader that increments the count
+ * after that check finds that the version is not the published one and never reads it. All of these
+ * accesses are sequentially consistent, which is what makes the increment-then-check safe.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "3lnn.h"
+#include "3lnn-checkpoint.h"
+#include "3lnn-online.h"
+
+
+typedef struct OnlineVersion OnlineVersion;
+
+
+
+
+/**
+ * @brief One read-only copy of the NN and the number of readers holding it
+ */
+
+struct OnlineVersion{
+    Network *nn;
+    int readers;
+};
+
+
+
+
+/**
+ * @brief Data structure holding the trained NN, its two published versions and the statistics
+ */
+
+struct OnlineModel{
+    Network *train;                 ///< Private copy the samples are trained into (lock held)
+    OnlineVersion versions[2];
+    OnlineVersion *published;       ///< Version the readers acquire
+    pthread_mutex_t lock;           ///< Serializes training, publishing and snapshots
+    uint64_t *bits;                 ///< Binarized sample (lock held)
+    const char *snapshotFileName;
+    long snapshotInterval;
+    unsigned long sampleCount;      ///< Number of samples trained
+    unsigned long errCount;         ///< Number of samples the NN misclassified right before training them
+    unsigned long publishCount;     ///< Number of versions published
+    unsigned long snapshotCount;    ///< Number of snapshots saved
+    unsigned long publishedSample;  ///< sampleCount of the last published version
+    unsigned long snapshotSample;   ///< sampleCount of the last snapshot
+};
+
+
+
+
+/**
+ * @details Both versions start as copies of the NN, the first one is published
+ */
+
+OnlineModel *createOnlineModel(const Network *nn, const char *snapshotFileName, long snapshotInterval){
+    
+    OnlineModel *m = (OnlineModel*)malloc(sizeof(OnlineModel));
+    
+    m->train = copyNetwork(nn);
+    for (int v=0; v<2; v++){
+        m->versions[v].nn = copyNetwork(nn);
+        m->versions[v].readers = 0;
+    }
+    m->published = &m->versions[0];
+    
+    pthread_mutex_init(&m->lock, NULL);
+    m->bits = (uint64_t*)calloc((nn->dense[INPUT].ncount + 63) / 64, sizeof(uint64_t));
+    m->snapshotFileName = snapshotFileName;
+    m->snapshotInterval = (snapshotInterval>0) ? snapshotInterval : 1;
+    m->sampleCount = 0;
+    m->errCount = 0;
+    m->publishCount = 0;
+    m->snapshotCount = 0;
+    m->publishedSample = 0;
+    m->snapshotSample = 0;
+    
+    return m;
+}
+
+
+
+
+/**
+ * @details Frees an online model
+ */
+
+void freeOnlineModel(OnlineModel *m){
+    
+    pthread_mutex_destroy(&m->lock);
+    free(m->bits);
+    for (int v=0; v<2; v++) freeNetwork(m->versions[v].nn);
+    freeNetwork(m->train);
+    free(m);
+    
+}
+
+
+
+
+/**
+ * @details Holds the published version, retrying if it was replaced before the hold was registered
+ */
+
+const Network *acquireOnlineNetwork(OnlineModel *m){
+    
+    for (;;){
+        OnlineVersion *v = __atomic_load_n(&m->published, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&v->readers, 1, __ATOMIC_SEQ_CST);
+        if (v==__atomic_load_n(&m->published, __ATOMIC_SEQ_CST)) return v->nn;
+        __atomic_sub_fetch(&v->readers, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+
+
+
+/**
+ * @details Releases a version of the NN returned by acquireOnlineNetwork()
+ */
+
+void releaseOnlineNetwork(OnlineModel *m, const Network *nn){
+    
+    OnlineVersion *v = (nn==m->versions[0].nn) ? &m->versions[0] : &m->versions[1];
+    
+    __atomic_sub_fetch(&v->readers, 1, __ATOMIC_SEQ_CST);
+    
+}
+
+
+
+
+/**
+ * @details Copies the trained weights into the unpublished version and publishes it (lock held)
+ */
+
+void publishOnlineModelLocked(OnlineModel *m){
+    
+    if (m->publishedSample==m->sampleCount) return;
+    
+    OnlineVersion *v = (m->published==&m->versions[0]) ? &m->versions[1] : &m->versions[0];
+    
+    // Readers hold a version for one batch at most
+    while (__atomic_load_n(&v->readers, __ATOMIC_SEQ_CST)!=0) sched_yield();
+    
+    memcpy(v->nn->denseBlock, m->train->denseBlock, getDenseBlockSize(m->train));
+    __atomic_store_n(&m->published, v, __ATOMIC_SEQ_CST);
+    
+    m->publishedSample = m->sampleCount;
+    m->publishCount++;
+    
+}
+
+
+
+
+/**
+ * @details Saves the trained weights to a temporary file and renames it to the snapshot file (lock held)
+ */
+
+void snapshotOnlineModelLocked(OnlineModel *m){
+    
+    if (m->snapshotFileName==NULL || m->snapshotSample==m->sampleCount) return;
+    
+    char tmpFileName[1024];
+    snprintf(tmpFileName, sizeof(tmpFileName), "%s.tmp", m->snapshotFileName);
+    
+    saveNetwork(m->train, tmpFileName);
+    if (rename(tmpFileName, m->snapshotFileName)!=0){
+        printf("Abort! Could not replace checkpoint file: %s\n", m->snapshotFileName);
+        exit(1);
+    }
+    
+    m->snapshotSample = m->sampleCount;
+    m->snapshotCount++;
+    
+}
+
+
+
+
+/**
+ * @details Binarizes the sample, feeds it forward and back propagates it through the private copy
+ */
+
+void learnOnlineSample(OnlineModel *m, const uint8_t *pixel, int label){
+    
+    pthread_mutex_lock(&m->lock);
+    
+    int inpCount = m->train->dense[INPUT].ncount;
+    memset(m->bits, 0, (inpCount + 63) / 64 * sizeof(uint64_t));
+    for (int i=0; i<inpCount; i++){
+        if (pixel[i]) m->bits[i/64] |= (uint64_t)1 << (i%64);
+    }
+    
+    feedInputBitset(m->train, m->bits);
+    feedForwardNetwork(m->train);
+    if (getNetworkClassification(m->train)!=label) m->errCount++;
+    backPropagateNetwork(m->train, label);
+    m->sampleCount++;
+    
+    if (m->sampleCount - m->publishedSample >= ONLINE_PUBLISH_INTERVAL) publishOnlineModelLocked(m);
+    if (m->sampleCount - m->snapshotSample >= (unsigned long)m->snapshotInterval) snapshotOnlineModelLocked(m);
+    
+    pthread_mutex_unlock(&m->lock);
+}
+
+
+
+
+/**
+ * @details Publishes the weights trained so far (thread-safe)
+ */
+
+void publishOnlineModel(OnlineModel *m){
+    
+    pthread_mutex_lock(&m->lock);
+    publishOnlineModelLocked(m);
+    pthread_mutex_unlock(&m->lock);
+    
+}
+
+
+
+
+/**
+ * @details Saves the weights trained so far to the snapshot file (thread-safe)
+ */
+
+void snapshotOnlineModel(OnlineModel *m){
+    
+    pthread_mutex_lock(&m->lock);
+    snapshotOnlineModelLocked(m);
+    pthread_mutex_unlock(&m->lock);
+    
+}
+
+
+
+
+/**
+ * @details Outputs the statistics to stderr, since stdout may carry classifications
+ */
+
+void displayOnlineStats(OnlineModel *m){
+    
+    pthread_mutex_lock(&m->lock);
+    
+    fprintf(stderr, "LEARNED: %lu samples (%.4f%% classified correctly before the update), %lu versions published, %lu snapshots saved",
+            m->sampleCount, (m->sampleCount>0) ? 100 * (1 - (double)m->errCount/m->sampleCount) : 0, m->publishCount, m->snapshotCount);
+    if (m->snapshotFileName!=NULL) fprintf(stderr, " to %s", m->snapshotFileName);
+    fprintf(stderr, "\n");
+    
+    pthread_mutex_unlock(&m->lock);
+}
@@ -0,0 +1,114 @@
+/**
+ * @file 3lnn-online.h
+ * @brief Online learning: a NN that keeps being trained on labeled samples while other threads classify with it
+ * @details The samples are trained into a private copy of the NN, one sample at a time as with
+ * backPropagateNetwork(). Readers never use that copy: they classify with the published version, one of two
+ * read-only copies. Publishing copies the trained weights into the copy that no reader holds and then swaps
+ * the published pointer, so a reader either sees the model before or after an update, never a mix
+ * (read-copy-update with two versions). Every snapshotInterval samples, the trained weights are saved to
+ * a checkpoint file.
+ */
+
+#ifndef MNIST_3LNN_ONLINE_H
+#define MNIST_3LNN_ONLINE_H
+
+#include <stdint.h>
+
+#include "3lnn.h"
+
+
+#define ONLINE_PUBLISH_INTERVAL 64      ///< Maximum number of samples trained between two published versions
+
+
+typedef struct OnlineModel OnlineModel;
+
+
+
+
+/**
+ * @brief Creates an online model starting from the weights of a (trained or loaded) NN
+ * @param nn A pointer to the NN (only read while creating the model)
+ * @param snapshotFileName Checkpoint file the trained weights are saved to (NULL = no snapshots)
+ * @param snapshotInterval Number of samples between two snapshots
+ */
+
+OnlineModel *createOnlineModel(const Network *nn, const char *snapshotFileName, long snapshotInterval);
+
+
+
+
+/**
+ * @brief Frees an online model (no reader may still hold one of its versions)
+ * @param m A pointer to the online model
+ */
+
+void freeOnlineModel(OnlineModel *m);
+
+
+
+
+/**
+ * @brief Returns the published version of the NN and holds it until releaseOnlineNetwork() (thread-safe, lock-free)
+ * @param m A pointer to the online model
+ */
+
+const Network *acquireOnlineNetwork(OnlineModel *m);
+
+
+
+
+/**
+ * @brief Releases a version of the NN returned by acquireOnlineNetwork()
+ * @param m A pointer to the online model
+ * @param nn A pointer to the version
+ */
+
+void releaseOnlineNetwork(OnlineModel *m, const Network *nn);
+
+
+
+
+/**
+ * @brief Trains the model on one labeled sample (thread-safe), publishing and saving snapshots as due
+ * @param m A pointer to the online model
+ * @param pixel One uint8 value per INPUT node (pixel!=0 -> 1)
+ * @param label Target classification
+ */
+
+void learnOnlineSample(OnlineModel *m, const uint8_t *pixel, int label);
+
+
+
+
+/**
+ * @brief Publishes the weights trained so far, if any sample was trained since the last version (thread-safe)
+ * @details Waits until no reader holds the version that is to be overwritten.
+ * @param m A pointer to the online model
+ */
+
+void publishOnlineModel(OnlineModel *m);
+
+
+
+
+/**
+ * @brief Saves the weights trained so far to the snapshot file, if any sample was trained since the last one (thread-safe)
+ * @details The checkpoint is written to a temporary file that then replaces the snapshot file, so the
+ * snapshot file always holds a complete checkpoint (and a mapping of the old file stays valid).
+ * @param m A pointer to the online model
+ */
+
+void snapshotOnlineModel(OnlineModel *m);
+
+
+
+
+/**
+ * @brief Outputs the number of samples trained, versions published and snapshots saved (to stderr)
+ * @param m A pointer to the online model
+ */
+
+void displayOnlineStats(OnlineModel *m);
+
+
+#endif
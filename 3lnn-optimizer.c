@@ -0,0 +1,253 @@
+/**
+ * @file 3lnn-optimizer.c
+ * @brief Optimizers (SGD, momentum, Nesterov momentum, Adam) and learning rate schedules for training
+ * @details The steps run on the fused kernels of 3lnn-kernels.c, one call per weight matrix and bias
+ * vector. Adam's bias correction is folded into the learning rate and epsilon of every step, so the kernel
+ * only has to keep the raw moments.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "util/profile-stats.h"
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-batch.h"
+#include "3lnn-optimizer.h"
+
+
+
+
+/**
+ * @details Returns the number of state vectors per weight of an optimizer type
+ */
+
+int getOptimizerStateCount(OptimizerType type){
+    
+    if (type==OPT_ADAM) return 2;
+    if (type==OPT_MOMENTUM || type==OPT_NESTEROV) return 1;
+    
+    return 0;
+}
+
+
+
+
+/**
+ * @details The optimizer and all of its state share one arena (= one heap allocation)
+ */
+
+Optimizer *createOptimizer(Network *nn, const OptimizerConfig *c){
+    
+    int ncount[NN_MAX_LAYERS];
+    for (int l=0; l<nn->layerCount; l++) ncount[l] = nn->dense[l].ncount;
+    
+    int stateCount = getOptimizerStateCount(c->type);
+    
+    size_t arenaSize = reserveArenaSize(0, sizeof(Optimizer), NN_ALIGNMENT);
+    for (int k=0; k<stateCount; k++) arenaSize = reserveDenseLayers(arenaSize, nn->layerCount, ncount);
+    Arena *arena = createArena(arenaSize);
+    
+    Optimizer *o = (Optimizer*)allocArena(arena, sizeof(Optimizer), NN_ALIGNMENT);
+    
+    o->config = *c;
+    if (o->config.epochs<1) o->config.epochs = 1;
+    o->arena = arena;
+    o->stepCount = 0;
+    o->layerCount = nn->layerCount;
+    for (int k=0; k<stateCount; k++) createDenseLayers(arena, o->state[k], o->layerCount, ncount);
+    
+    if (c->learningRate>0) o->baseRate = c->learningRate;
+    else if (c->type==OPT_ADAM) o->baseRate = OPT_ADAM_RATE;
+    else if (c->type==OPT_MOMENTUM || c->type==OPT_NESTEROV) o->baseRate = OPT_MOMENTUM_RATE;
+    else o->baseRate = nn->learningRate;
+    
+    o->learningRate = o->baseRate;
+    if (c->type==OPT_SGD) nn->learningRate = o->learningRate;
+    
+    return o;
+}
+
+
+
+
+/**
+ * @details Frees an optimizer and its state
+ */
+
+void freeOptimizer(Optimizer *o){
+    
+    freeArena(o->arena);
+    
+}
+
+
+
+
+/**
+ * @details Returns a printable name of an optimizer type
+ */
+
+const char *getOptimizerName(OptimizerType type){
+    
+    switch (type) {
+        case OPT_MOMENTUM: return "momentum";
+        case OPT_NESTEROV: return "nesterov";
+        case OPT_ADAM:     return "adam";
+        default:           return "sgd";
+    }
+}
+
+
+
+
+/**
+ * @details Only plain SGD is stateless
+ */
+
+int usesOptimizerState(const Optimizer *o){
+    
+    return o->config.type!=OPT_SGD;
+}
+
+
+
+
+/**
+ * @details The schedule is a function of the fraction of all epochs trained so far, so the learning rate
+ * changes smoothly from batch to batch (SCHEDULE_COSINE) or once per epoch (SCHEDULE_STEP)
+ */
+
+void updateOptimizerSchedule(Optimizer *o, Network *nn, int epoch, int done, int count){
+    
+    double progress = ((epoch-1) + (double)done / count) / o->config.epochs;
+    if (progress>1) progress = 1;
+    
+    switch (o->config.schedule) {
+        case SCHEDULE_STEP:
+            o->learningRate = o->baseRate * pow(o->config.decay, epoch-1);
+            break;
+        case SCHEDULE_COSINE:
+            o->learningRate = o->baseRate * 0.5 * (1 + cos(M_PI * progress));
+            break;
+        default:
+            o->learningRate = o->baseRate;
+            break;
+    }
+    
+    if (o->config.type==OPT_SGD) nn->learningRate = o->learningRate;
+    
+}
+
+
+
+
+/**
+ * @details Applies the step of the optimizer's type to one weight matrix or bias vector
+ */
+
+void stepOptimizerValues(Optimizer *o, int n, NNReal rate, NNReal epsilon, NNReal scale, const NNReal *g, NNReal *m, NNReal *v, NNReal *w){
+    
+    switch (o->config.type) {
+        case OPT_MOMENTUM:
+        case OPT_NESTEROV:
+            stepMomentum(n, rate, OPT_MOMENTUM_FACTOR, o->config.type==OPT_NESTEROV, scale, g, m, w);
+            break;
+        case OPT_ADAM:
+            stepAdam(n, rate, OPT_ADAM_BETA1, OPT_ADAM_BETA2, epsilon, scale, g, m, v, w);
+            break;
+        default:
+            addScaledVector(n, rate * scale, g, w);
+            break;
+    }
+    
+}
+
+
+
+
+/**
+ * @details The padding of the weight rows is 0 in the weights, the gradients and the state, and stays 0,
+ * so every slice of rows is updated in one go
+ */
+
+void stepOptimizerSlice(Optimizer *o, Network *nn, Gradients *g, double scale, int threadId, int threadCount){
+    
+    double rate = o->learningRate;
+    double epsilon = OPT_ADAM_EPSILON;
+    
+    // Adam's bias correction of both moments, for the step that is taken
+    if (o->config.type==OPT_ADAM){
+        long t = o->stepCount + 1;
+        double c2 = sqrt(1 - pow(OPT_ADAM_BETA2, t));
+        rate *= c2 / (1 - pow(OPT_ADAM_BETA1, t));
+        epsilon *= c2;
+    }
+    
+    for (int l=1; l<nn->layerCount; l++){
+        
+        PROFILE_START(startTime);
+        
+        DenseLayer *dl = &nn->dense[l];
+        DenseLayer *gl = &g->layer[l];
+        DenseLayer *ml = &o->state[0][l];
+        DenseLayer *vl = &o->state[1][l];
+        int hasState = usesOptimizerState(o);
+        int hasMoment = (o->config.type==OPT_ADAM);
+        
+        int first = (int)(((long)dl->ncount * threadId) / threadCount);
+        int last  = (int)(((long)dl->ncount * (threadId+1)) / threadCount);
+        size_t offset = (size_t)first * dl->stride;
+        
+        stepOptimizerValues(o, (last-first) * dl->stride, rate, epsilon, scale, gl->weights + offset,
+                            hasState ? ml->weights + offset : NULL, hasMoment ? vl->weights + offset : NULL, dl->weights + offset);
+        stepOptimizerValues(o, last-first, rate, epsilon, scale, gl->bias + first,
+                            hasState ? ml->bias + first : NULL, hasMoment ? vl->bias + first : NULL, dl->bias + first);
+        
+        PROFILE_STOP((l==getOutputLayer(nn)) ? PROFILE_OUTPUT_BACKPROP : PROFILE_HIDDEN_BACKPROP, startTime);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Counts the step
+ */
+
+void finishOptimizerStep(Optimizer *o){
+    
+    o->stepCount++;
+    
+}
+
+
+
+
+/**
+ * @details Applies one optimizer step to all weights of the NN
+ */
+
+void stepOptimizer(Optimizer *o, Network *nn, Gradients *g, double scale){
+    
+    stepOptimizerSlice(o, nn, g, scale, 0, 1);
+    finishOptimizerStep(o);
+    
+}
+
+
+
+
+/**
+ * @details Sums up the gradients of the batch in the scratch buffer and takes one step
+ */
+
+void backPropagateBatchWithOptimizer(Network *nn, Batch *b, Gradients *g, Optimizer *o){
+    
+    clearGradients(g);
+    accumulateGradients(nn, b, g);
+    
+    stepOptimizer(o, nn, g, getBatchGradientScale(b->count));
+    
+}
@@ -0,0 +1,177 @@
+/**
+ * @file 3lnn-optimizer.h
+ * @brief Optimizers (SGD, momentum, Nesterov momentum, Adam) and learning rate schedules for training
+ * @details An optimizer turns the summed gradients of a mini-batch into a weight update. Its state (the
+ * velocity or the two moments of every weight) is kept in dense layers with the same layout as the NN's
+ * weights, so that each step is a single fused pass over the weights, their gradients and their state.
+ * Plain SGD has no state: its scheduled learning rate is written into the NN, so the existing training
+ * paths (including per-sample training) follow the schedule unchanged.
+ */
+
+#ifndef MNIST_3LNN_OPTIMIZER_H
+#define MNIST_3LNN_OPTIMIZER_H
+
+#include "3lnn.h"
+#include "3lnn-batch.h"
+
+
+#define OPT_MOMENTUM_FACTOR 0.9         ///< Momentum factor (mu) of OPT_MOMENTUM and OPT_NESTEROV
+#define OPT_MOMENTUM_RATE 0.03          ///< Default learning rate of OPT_MOMENTUM and OPT_NESTEROV
+#define OPT_ADAM_BETA1 0.9              ///< Decay of Adam's first moment
+#define OPT_ADAM_BETA2 0.999            ///< Decay of Adam's second moment
+#define OPT_ADAM_EPSILON 1e-8           ///< Term keeping Adam's denominator away from 0
+#define OPT_ADAM_RATE 0.003             ///< Default learning rate of OPT_ADAM
+
+
+typedef enum OptimizerType {OPT_SGD, OPT_MOMENTUM, OPT_NESTEROV, OPT_ADAM} OptimizerType;
+
+typedef enum ScheduleType {SCHEDULE_CONSTANT, SCHEDULE_STEP, SCHEDULE_COSINE} ScheduleType;
+
+typedef struct OptimizerConfig OptimizerConfig;
+typedef struct Optimizer Optimizer;
+
+
+
+
+/**
+ * @brief Settings of an optimizer and its learning rate schedule
+ */
+
+struct OptimizerConfig{
+    OptimizerType type;
+    double learningRate;            ///< Initial learning rate (0 = the NN's rate for OPT_SGD, the optimizer's default otherwise)
+    ScheduleType schedule;          ///< How the learning rate changes over the course of training
+    double decay;                   ///< Factor the learning rate is multiplied with after every epoch (SCHEDULE_STEP)
+    int epochs;                     ///< Number of epochs the schedule spans
+};
+
+
+
+
+/**
+ * @brief Data structure holding an optimizer's settings and state
+ */
+
+struct Optimizer{
+    OptimizerConfig config;
+    Arena *arena;                   ///< Arena holding the optimizer and its state
+    double baseRate;                ///< Learning rate at the start of the schedule
+    double learningRate;            ///< Learning rate at the current point of the schedule
+    long stepCount;                 ///< Number of steps taken so far (for Adam's bias correction)
+    int layerCount;
+    DenseLayer state[2][NN_MAX_LAYERS]; ///< Velocity (momentum) or first and second moment (Adam) of every weight
+};
+
+
+
+
+/**
+ * @brief Creates an optimizer for the given NN, all state starting at 0
+ * @param nn A pointer to the NN
+ * @param c A pointer to the settings
+ */
+
+Optimizer *createOptimizer(Network *nn, const OptimizerConfig *c);
+
+
+
+
+/**
+ * @brief Frees an optimizer
+ * @param o A pointer to the optimizer
+ */
+
+void freeOptimizer(Optimizer *o);
+
+
+
+
+/**
+ * @brief Returns a printable name of an optimizer type
+ * @param type Type of optimizer
+ */
+
+const char *getOptimizerName(OptimizerType type);
+
+
+
+
+/**
+ * @brief Returns 1 if the optimizer keeps state per weight and therefore needs the summed gradients of
+ * every batch (stepOptimizer()), 0 for plain SGD, which can update the weights directly
+ * @param o A pointer to the optimizer
+ */
+
+int usesOptimizerState(const Optimizer *o);
+
+
+
+
+/**
+ * @brief Moves the learning rate to the given point of training
+ * @details For OPT_SGD the learning rate is written into the NN (nn->learningRate).
+ * @param o A pointer to the optimizer
+ * @param nn A pointer to the NN
+ * @param epoch Current epoch (1 to config.epochs)
+ * @param done Number of images of the current epoch trained so far
+ * @param count Number of images per epoch
+ */
+
+void updateOptimizerSchedule(Optimizer *o, Network *nn, int epoch, int done, int count);
+
+
+
+
+/**
+ * @brief Applies one optimizer step to one slice of the rows of every layer
+ * @details The rows of every layer are split into threadCount slices, so the threads of a pool can update
+ * disjoint slices at the same time. Once all slices are updated, finishOptimizerStep() completes the step.
+ * @param o A pointer to the optimizer
+ * @param nn A pointer to the NN whose weights are updated
+ * @param g A pointer to the summed gradients of the batch
+ * @param scale Factor applied to the gradients (e.g. 1/sqrt(batch size))
+ * @param threadId Index of the slice (0 to threadCount-1)
+ * @param threadCount Number of slices
+ */
+
+void stepOptimizerSlice(Optimizer *o, Network *nn, Gradients *g, double scale, int threadId, int threadCount);
+
+
+
+
+/**
+ * @brief Completes a step applied via stepOptimizerSlice()
+ * @param o A pointer to the optimizer
+ */
+
+void finishOptimizerStep(Optimizer *o);
+
+
+
+
+/**
+ * @brief Applies one optimizer step to all weights of the NN
+ * @param o A pointer to the optimizer
+ * @param nn A pointer to the NN whose weights are updated
+ * @param g A pointer to the summed gradients of the batch
+ * @param scale Factor applied to the gradients (e.g. 1/sqrt(batch size))
+ */
+
+void stepOptimizer(Optimizer *o, Network *nn, Gradients *g, double scale);
+
+
+
+
+/**
+ * @brief Back propagates the error of all samples of a batch and applies their summed gradients with an optimizer
+ * @details The gradients are scaled by 1/sqrt(batch size), as in backPropagateBatch().
+ * @param nn A pointer to the NN
+ * @param b A pointer to the batch (after feedForwardBatch())
+ * @param g A pointer to a gradient buffer used as scratch space
+ * @param o A pointer to the optimizer
+ */
+
+void backPropagateBatchWithOptimizer(Network *nn, Batch *b, Gradients *g, Optimizer *o);
+
+
+#endif
@@ -0,0 +1,342 @@
+/**
+ * @file 3lnn-parallel.c
+ * @brief Multi-threaded, data-parallel mini-batch training with per-thread gradient buffers
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "util/mnist-utils.h"
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-batch.h"
+#include "3lnn-parallel.h"
+
+
+
+
+/**
+ * @details Creates a parallel trainer with threadCount threads for the given NN
+ */
+
+ParallelTrainer *createParallelTrainer(Network *nn, int threadCount, ReductionType reduction){
+    
+    ParallelTrainer *pt = (ParallelTrainer*)malloc(sizeof(ParallelTrainer));
+    
+    pt->nn = nn;
+    pt->pool = createThreadPool(threadCount);
+    pt->reduction = reduction;
+    pt->optimizer = NULL;
+    pt->batch = NULL;
+    
+    threadCount = getThreadPoolSize(pt->pool);
+    
+    pt->gradients = NULL;
+    if (reduction!=REDUCE_ROWS){
+        pt->gradients = (Gradients**)malloc(threadCount * sizeof(Gradients*));
+        for (int t=0; t<threadCount; t++) pt->gradients[t] = createGradients(nn);
+    }
+    
+    pt->shared = (reduction==REDUCE_ATOMIC) ? createGradients(nn) : NULL;
+    
+    pt->activations = (Activations**)malloc(threadCount * sizeof(Activations*));
+    for (int t=0; t<threadCount; t++) pt->activations[t] = createActivations(nn);
+    
+    return pt;
+}
+
+
+
+
+/**
+ * @details Stops the worker threads and frees a parallel trainer
+ */
+
+void freeParallelTrainer(ParallelTrainer *pt){
+    
+    int threadCount = getThreadPoolSize(pt->pool);
+    
+    freeThreadPool(pt->pool);
+    
+    if (pt->gradients!=NULL){
+        for (int t=0; t<threadCount; t++) freeGradients(pt->gradients[t]);
+        free(pt->gradients);
+    }
+    
+    for (int t=0; t<threadCount; t++) freeActivations(pt->activations[t]);
+    free(pt->activations);
+    
+    if (pt->shared!=NULL) freeGradients(pt->shared);
+    
+    free(pt);
+    
+}
+
+
+
+
+/**
+ * @details Returns the first index of part partId when splitting count items into partCount parts
+ */
+
+int getPartitionStart(int count, int partId, int partCount){
+    
+    return (int)(((long)count * partId) / partCount);
+}
+
+
+
+
+/**
+ * @details Lock-free y += x for NNReal values via compare-and-swap
+ */
+
+void atomicAddReal(NNReal *y, NNReal x){
+    
+    NNReal expected, desired;
+    
+    __atomic_load(y, &expected, __ATOMIC_RELAXED);
+    
+    do {
+        desired = expected + x;
+    } while (!__atomic_compare_exchange(y, &expected, &desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    
+}
+
+
+
+
+/**
+ * @details Adds one thread's gradients to the shared gradient buffer using atomic adds
+ */
+
+void atomicAddGradients(Gradients *dst, Gradients *src){
+    
+    for (int l=1; l<dst->layerCount; l++){
+        
+        DenseLayer *dl = &dst->layer[l];
+        DenseLayer *sl = &src->layer[l];
+        
+        for (int n=0; n<dl->ncount; n++){
+            
+            NNReal *d = dl->weights + (size_t)n * dl->stride;
+            NNReal *s = sl->weights + (size_t)n * sl->stride;
+            
+            for (int i=0; i<dl->wcount; i++) if (s[i]!=0) atomicAddReal(&d[i], s[i]);
+            
+            atomicAddReal(&dl->bias[n], sl->bias[n]);
+        }
+    }
+    
+}
+
+
+
+
+/**
+ * @details Clears the slice of the rows of a gradient buffer that belongs to one thread
+ */
+
+void clearGradientSlice(Gradients *g, int threadId, int threadCount){
+    
+    for (int l=1; l<g->layerCount; l++){
+        
+        DenseLayer *gl = &g->layer[l];
+        
+        int first = getPartitionStart(gl->ncount, threadId, threadCount);
+        int last  = getPartitionStart(gl->ncount, threadId+1, threadCount);
+        
+        memset(gl->weights + (size_t)first * gl->stride, 0, (size_t)(last-first) * gl->stride * sizeof(NNReal));
+        memset(gl->bias + first, 0, (last-first) * sizeof(NNReal));
+    }
+    
+}
+
+
+
+
+/**
+ * @details Applies the slice of the rows of the summed gradients that belongs to one thread to the network's weights
+ */
+
+void applyGradientSlice(Network *nn, Gradients *g, double scale, int threadId, int threadCount){
+    
+    for (int l=1; l<nn->layerCount; l++){
+        
+        DenseLayer *dl = &nn->dense[l];
+        DenseLayer *gl = &g->layer[l];
+        
+        int first = getPartitionStart(dl->ncount, threadId, threadCount);
+        int last  = getPartitionStart(dl->ncount, threadId+1, threadCount);
+        
+        addScaledVector((last-first) * dl->stride, nn->learningRate * scale, gl->weights + (size_t)first * gl->stride, dl->weights + (size_t)first * dl->stride);
+        addScaledVector(last-first, nn->learningRate * scale, gl->bias + first, dl->bias + first);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Stateful optimizers need the summed gradients; with REDUCE_ROWS, every thread sums up its slice
+ * of the rows in a shared buffer
+ */
+
+void setParallelOptimizer(ParallelTrainer *pt, Optimizer *o){
+    
+    pt->optimizer = (o!=NULL && usesOptimizerState(o)) ? o : NULL;
+    
+    if (pt->optimizer!=NULL && pt->reduction==REDUCE_ROWS && pt->shared==NULL) pt->shared = createGradients(pt->nn);
+    
+}
+
+
+
+
+/**
+ * @details Training step executed by every thread: forward and backward pass of the thread's shard of the batch,
+ * reduction of all threads' gradients and update of the thread's slice of the weights
+ */
+
+void runParallelTrainingStep(void *arg, int threadId, int threadCount){
+    
+    ParallelTrainer *pt = (ParallelTrainer*)arg;
+    Network *nn = pt->nn;
+    Batch *b = pt->batch;
+    
+    int first = getPartitionStart(b->count, threadId, threadCount);
+    int last  = getPartitionStart(b->count, threadId+1, threadCount);
+    
+    if (pt->reduction==REDUCE_ROWS){
+        
+        // The error signals of this thread's shard are written into the shared batch
+        if (last>first){
+            Batch shard;
+            getSubBatch(b, first, last-first, &shard);
+            feedForwardBatch(nn, &shard);
+            calcBatchDeltas(nn, &shard);
+        }
+        
+        // No thread may update the weights before all threads are done reading them
+        waitThreadPoolBarrier(pt->pool);
+        
+        // Same learning rate scaling as backPropagateBatch()
+        if (pt->optimizer==NULL){
+            updateBatchLayers(b, nn->dense, nn->learningRate * getBatchGradientScale(b->count), threadId, threadCount);
+            return;
+        }
+        
+        clearGradientSlice(pt->shared, threadId, threadCount);
+        updateBatchLayers(b, pt->shared->layer, 1, threadId, threadCount);
+        stepOptimizerSlice(pt->optimizer, nn, pt->shared, getBatchGradientScale(b->count), threadId, threadCount);
+        
+        return;
+    }
+    
+    // Feed forward and back propagate this thread's shard into its private gradient buffer
+    Gradients *g = pt->gradients[threadId];
+    
+    clearGradients(g);
+    
+    if (last>first){
+        Batch shard;
+        getSubBatch(b, first, last-first, &shard);
+        feedForwardBatch(nn, &shard);
+        accumulateGradients(nn, &shard, g);
+    }
+    
+    Gradients *sum;
+    
+    if (pt->reduction==REDUCE_ATOMIC){
+        
+        clearGradientSlice(pt->shared, threadId, threadCount);
+        waitThreadPoolBarrier(pt->pool);
+        
+        atomicAddGradients(pt->shared, g);
+        sum = pt->shared;
+    }
+    else {
+        
+        // Pairwise tree reduction in a fixed order: after the last round thread 0's buffer holds the sum
+        for (int step=1; step<threadCount; step*=2){
+            waitThreadPoolBarrier(pt->pool);
+            if (threadId % (2*step)==0 && threadId+step<threadCount) addGradients(g, pt->gradients[threadId+step]);
+        }
+        sum = pt->gradients[0];
+    }
+    
+    waitThreadPoolBarrier(pt->pool);
+    
+    // Same learning rate scaling as backPropagateBatch()
+    if (pt->optimizer!=NULL) stepOptimizerSlice(pt->optimizer, nn, sum, getBatchGradientScale(b->count), threadId, threadCount);
+    else applyGradientSlice(nn, sum, getBatchGradientScale(b->count), threadId, threadCount);
+    
+}
+
+
+
+
+/**
+ * @details Feeds a batch forward, back propagates it and applies its gradients using all threads
+ */
+
+void trainBatchParallel(ParallelTrainer *pt, Batch *b){
+    
+    pt->batch = b;
+    
+    runOnThreadPool(pt->pool, runParallelTrainingStep, pt);
+    if (pt->optimizer!=NULL) finishOptimizerStep(pt->optimizer);
+    
+    pt->batch = NULL;
+}
+
+
+
+
+/**
+ * @details Hogwild step executed by every thread: per-sample feed forward and back propagation of the
+ * thread's shard of the batch directly on the shared weights (benign races, no locks)
+ */
+
+void runHogwildTrainingStep(void *arg, int threadId, int threadCount){
+    
+    ParallelTrainer *pt = (ParallelTrainer*)arg;
+    Network *nn = pt->nn;
+    Batch *b = pt->batch;
+    Activations *a = pt->activations[threadId];
+    int out = getOutputLayer(nn);
+    
+    int first = getPartitionStart(b->count, threadId, threadCount);
+    int last  = getPartitionStart(b->count, threadId+1, threadCount);
+    
+    for (int s=first; s<last; s++){
+        
+        feedInputValuesActivations(a, b->output[INPUT] + (size_t)s * b->stride[INPUT], b->ncount[INPUT]);
+        
+        feedForwardActivations(nn, a);
+        
+        // Keep the outputs in the batch so that the caller can classify the sample
+        memcpy(b->output[out] + (size_t)s * b->stride[out], a->output[out], b->ncount[out] * sizeof(NNReal));
+        
+        backPropagateActivations(nn, a, b->labels[s]);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Trains the NN on the samples of a batch with lock-free asynchronous (Hogwild) SGD using all threads
+ */
+
+void trainBatchHogwild(ParallelTrainer *pt, Batch *b){
+    
+    pt->batch = b;
+    
+    runOnThreadPool(pt->pool, runHogwildTrainingStep, pt);
+    
+    pt->batch = NULL;
+}
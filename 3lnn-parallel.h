@@ -0,0 +1,117 @@
+/**
+ * @file 3lnn-parallel.h
+ * @brief Multi-threaded, data-parallel mini-batch training with per-thread gradient buffers
+ * @details Every mini-batch is split into one shard per thread. Each thread feeds its shard forward
+ * and back propagates it into a private gradient buffer. The buffers are then reduced and the sum is
+ * applied to the shared weights, with every thread updating its own slice of the weight matrices.
+ *
+ * Alternatively, trainBatchHogwild() runs lock-free asynchronous SGD: every thread performs the regular
+ * per-sample back propagation directly on the shared weights, using its own Activations.
+ */
+
+#ifndef MNIST_3LNN_PARALLEL_H
+#define MNIST_3LNN_PARALLEL_H
+
+#include "3lnn.h"
+#include "3lnn-batch.h"
+#include "3lnn-optimizer.h"
+#include "util/thread-pool.h"
+
+
+typedef struct ParallelTrainer ParallelTrainer;
+
+/**
+ * @brief Method used to sum up the per-thread gradient buffers
+ * @details REDUCE_TREE adds the buffers pairwise in a fixed order, so results are reproducible for a given
+ * number of threads. REDUCE_ATOMIC lets every thread add its buffer into a shared one via lock-free atomic
+ * adds, whose summation order (and rounding) depends on thread timing. REDUCE_ROWS avoids the per-thread
+ * buffers altogether: once all threads have calculated the error signals of their shard, every thread adds
+ * the gradients of the whole batch to its own slice of the rows of the weights, which gives the same
+ * result as single-threaded training for any number of threads. It pays off for large HIDDEN layers,
+ * whose gradient buffers are expensive to clear and add up.
+ */
+
+typedef enum ReductionType {REDUCE_TREE, REDUCE_ATOMIC, REDUCE_ROWS} ReductionType;
+
+
+
+
+/**
+ * @brief Data structure holding the worker threads and per-thread buffers of the parallel trainer
+ */
+
+struct ParallelTrainer{
+    Network *nn;                ///< Network whose weights are trained
+    ThreadPool *pool;           ///< Worker threads (the calling thread is thread 0)
+    ReductionType reduction;    ///< Method used to sum up the per-thread gradients
+    Gradients **gradients;      ///< One private gradient buffer per thread (not with REDUCE_ROWS)
+    Gradients *shared;          ///< Buffer all threads add into (REDUCE_ATOMIC), or sum up their rows in (REDUCE_ROWS with an optimizer)
+    Activations **activations;  ///< One private set of activations per thread (Hogwild)
+    Optimizer *optimizer;       ///< Optimizer applying the summed gradients (NULL = plain SGD)
+    Batch *batch;               ///< Batch of the current training step
+};
+
+
+
+
+/**
+ * @brief Creates a parallel trainer with threadCount threads for the given NN
+ * @param nn A pointer to the NN
+ * @param threadCount Number of threads (including the calling thread)
+ * @param reduction Method used to sum up the per-thread gradients
+ */
+
+ParallelTrainer *createParallelTrainer(Network *nn, int threadCount, ReductionType reduction);
+
+
+
+
+/**
+ * @brief Stops the worker threads and frees a parallel trainer
+ * @param pt A pointer to the parallel trainer
+ */
+
+void freeParallelTrainer(ParallelTrainer *pt);
+
+
+
+
+/**
+ * @brief Lets a parallel trainer apply the summed gradients of every batch with an optimizer
+ * @details Every thread applies the optimizer step to its own slice of the weight rows. Not supported by
+ * trainBatchHogwild(), which always uses plain SGD.
+ * @param pt A pointer to the parallel trainer
+ * @param o A pointer to the optimizer (NULL = plain SGD)
+ */
+
+void setParallelOptimizer(ParallelTrainer *pt, Optimizer *o);
+
+
+
+
+/**
+ * @brief Feeds a batch forward, back propagates it and applies its gradients using all threads
+ * @details The outputs of all samples are available in the batch afterwards (as after feedForwardBatch()).
+ * @param pt A pointer to the parallel trainer
+ * @param b A pointer to the batch
+ */
+
+void trainBatchParallel(ParallelTrainer *pt, Batch *b);
+
+
+
+
+/**
+ * @brief Trains the NN on the samples of a batch with lock-free asynchronous (Hogwild) SGD using all threads
+ * @details Each thread feeds its shard of the batch forward one sample at a time and updates the shared
+ * weights right away, without any locking. Concurrent updates of the same weight may occasionally get
+ * lost, which is rare because most input values (and hence weight updates) of an MNIST image are 0.
+ * The outputs of all samples are available in the batch afterwards.
+ * @param pt A pointer to the parallel trainer
+ * @param b A pointer to the batch
+ */
+
+void trainBatchHogwild(ParallelTrainer *pt, Batch *b);
+
+
+#endif
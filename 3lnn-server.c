@@ -0,0 +1,707 @@
+/**
+ * @file 3lnn-server.c
+ * @brief Long-running inference server that coalesces concurrent requests into micro-batches
+ * @details The queue is a bounded ring of request pointers protected by one mutex. Batching threads only
+ * hold the mutex while they take requests from the queue and while they mark them as done; the batched
+ * forward pass runs without it. The latencies (from submission until the request is done) are counted
+ * in a histogram of 1 usec buckets.
+ *
+ * The binarized images are sparse (about 1 in 5 pixels is set), so the first HIDDEN layer is calculated
+ * per image from the indices of its non-zero pixels, which is less work than the dense matrix-matrix
+ * product. All later layers have dense inputs and are calculated for the whole batch at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-batch.h"
+#include "3lnn-online.h"
+#include "3lnn-server.h"
+
+
+#define SERVER_LATENCY_BUCKETS 10000    ///< Latencies of up to 10 msec are counted per usec, longer ones in the last bucket
+
+
+/**
+ * @brief Data structure holding the request queue, the batching threads and the statistics of the server
+ */
+
+struct InferenceServer{
+    const Network *nn;
+    OnlineModel *model;             ///< Online model whose published version is used instead of nn (NULL = nn)
+    int maxBatch;                   ///< Maximum number of requests per batch
+    int maxWait;                    ///< Maximum number of usec to wait for more requests
+    int threadCount;
+    pthread_t *threads;
+    InferenceRequest **queue;       ///< Ring of queued requests
+    int queueCapacity;
+    int queueHead;                  ///< Index of the oldest queued request
+    int queueCount;                 ///< Number of queued requests
+    pthread_mutex_t lock;
+    pthread_cond_t pending;         ///< Signals the batching threads that requests were queued (or shutdown)
+    pthread_cond_t space;           ///< Signals the clients that the queue has space again
+    pthread_cond_t done;            ///< Signals the clients that requests are done
+    int shutdown;                   ///< Set to stop the batching threads once the queue is empty
+    unsigned long requestCount;     ///< Number of requests done
+    unsigned long batchCount;       ///< Number of batches run
+    unsigned long *latency;         ///< Histogram of the request latencies (SERVER_LATENCY_BUCKETS buckets of 1 usec)
+    uint64_t startTime;             ///< Creation time of the server
+};
+
+
+
+
+/**
+ * @details Returns the current value of the monotonic clock in nanoseconds
+ */
+
+uint64_t getServerTime(void){
+    
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    
+    return (uint64_t)t.tv_sec*1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+
+
+
+/**
+ * @details Converts a point in time of the monotonic clock into the timespec expected by pthread_cond_timedwait()
+ */
+
+struct timespec getServerDeadline(uint64_t time){
+    
+    struct timespec t;
+    t.tv_sec  = (time_t)(time / 1000000000ull);
+    t.tv_nsec = (long)(time % 1000000000ull);
+    
+    return t;
+}
+
+
+
+
+/**
+ * @details Binarizes the pixels of a request into the next INPUT row of the batch (pixel!=0 -> 1) and
+ * records the indices of the pixels that are set
+ */
+
+void addRequestToBatch(Batch *b, const InferenceRequest *r, int *active, int *activeCount){
+    
+    NNReal *row = b->output[INPUT] + (size_t)b->count * b->stride[INPUT];
+    
+    int count = 0;
+    for (int i=0; i<b->ncount[INPUT]; i++){
+        row[i] = (r->pixel[i]!=0);
+        if (r->pixel[i]) active[count++] = i;
+    }
+    *activeCount = count;
+    
+    b->labels[b->count] = 0;
+    b->count++;
+}
+
+
+
+
+/**
+ * @details Feeds all requests of a batch forward, the first HIDDEN layer per image if its input is sparse
+ * (same rule as isInputSparse()), all other layers as one matrix-matrix product
+ */
+
+void feedForwardRequests(const Network *nn, Batch *b, const int *active, const int *activeCount){
+    
+    int inpCount = b->ncount[INPUT];
+    int first = 1;
+    
+    if (nn->layerCount>2){
+        for (int s=0; s<b->count; s++){
+            const NNReal *input = b->output[INPUT] + (size_t)s * b->stride[INPUT];
+            NNReal *output = b->output[1] + (size_t)s * b->stride[1];
+            if (activeCount[s]*2 <= inpCount) calcDenseLayerSparse(&nn->dense[1], input, active + (size_t)s * inpCount, activeCount[s], output, getActFctType(nn, 1), nn->actPrecision);
+            else calcDenseLayer(&nn->dense[1], input, output, getActFctType(nn, 1), nn->actPrecision);
+        }
+        first = 2;
+    }
+    
+    for (int l=first; l<nn->layerCount; l++){
+        calcDenseLayerBatch(&nn->dense[l], b->output[l-1], b->stride[l-1], b->count, b->output[l], b->stride[l], getActFctType(nn, l), nn->actPrecision);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Main loop of a batching thread: waits for requests, coalesces up to maxBatch of them and classifies them in one pass
+ */
+
+void *runInferenceBatcher(void *arg){
+    
+    InferenceServer *s = (InferenceServer*)arg;
+    
+    Batch *batch = createBatch(s->nn, s->maxBatch);
+    InferenceRequest **requests = (InferenceRequest**)malloc(s->maxBatch * sizeof(InferenceRequest*));
+    int *active = (int*)malloc((size_t)s->maxBatch * s->nn->dense[INPUT].ncount * sizeof(int));
+    int *activeCount = (int*)malloc(s->maxBatch * sizeof(int));
+    
+    pthread_mutex_lock(&s->lock);
+    
+    for (;;){
+        
+        while (s->queueCount==0 && !s->shutdown) pthread_cond_wait(&s->pending, &s->lock);
+        if (s->queueCount==0) break;
+        
+        // Wait for more requests until the batch is full or the oldest request has waited for maxWait usec
+        struct timespec deadline = getServerDeadline(s->queue[s->queueHead]->submitTime + (uint64_t)s->maxWait * 1000);
+        while (s->queueCount<s->maxBatch && !s->shutdown){
+            if (pthread_cond_timedwait(&s->pending, &s->lock, &deadline)==ETIMEDOUT) break;
+        }
+        
+        int count = (s->queueCount<s->maxBatch) ? s->queueCount : s->maxBatch;
+        for (int i=0; i<count; i++) requests[i] = s->queue[(s->queueHead + i) % s->queueCapacity];
+        s->queueHead = (s->queueHead + count) % s->queueCapacity;
+        s->queueCount -= count;
+        pthread_cond_broadcast(&s->space);
+        
+        // Leave the remaining requests to the next idle batching thread
+        if (s->queueCount>0) pthread_cond_signal(&s->pending);
+        
+        pthread_mutex_unlock(&s->lock);
+        
+        clearBatch(batch);
+        for (int i=0; i<count; i++) addRequestToBatch(batch, requests[i], active + (size_t)i * s->nn->dense[INPUT].ncount, &activeCount[i]);
+        
+        // With online learning, the whole batch is classified by the same version of the model
+        const Network *nn = (s->model!=NULL) ? acquireOnlineNetwork(s->model) : s->nn;
+        feedForwardRequests(nn, batch, active, activeCount);
+        if (s->model!=NULL) releaseOnlineNetwork(s->model, nn);
+        
+        pthread_mutex_lock(&s->lock);
+        
+        uint64_t now = getServerTime();
+        for (int i=0; i<count; i++){
+            requests[i]->classification = getBatchClassification(batch, i);
+            uint64_t usec = (now - requests[i]->submitTime) / 1000;
+            s->latency[(usec<SERVER_LATENCY_BUCKETS) ? usec : SERVER_LATENCY_BUCKETS-1]++;
+            __atomic_store_n(&requests[i]->done, 1, __ATOMIC_RELEASE);
+        }
+        s->requestCount += count;
+        s->batchCount++;
+        pthread_cond_broadcast(&s->done);
+    }
+    
+    pthread_mutex_unlock(&s->lock);
+    
+    free(activeCount);
+    free(active);
+    free(requests);
+    freeBatch(batch);
+    
+    return NULL;
+}
+
+
+
+
+/**
+ * @details Allocates the queue (room for 4 batches per thread) and starts the batching threads
+ */
+
+InferenceServer *createInferenceServer(const Network *nn, int maxBatch, int maxWait, int threadCount){
+    
+    InferenceServer *s = (InferenceServer*)malloc(sizeof(InferenceServer));
+    
+    s->nn = nn;
+    s->model = NULL;
+    s->maxBatch = (maxBatch>0) ? maxBatch : 1;
+    s->maxWait = (maxWait>=0) ? maxWait : 0;
+    s->threadCount = (threadCount>0) ? threadCount : 1;
+    s->queueCapacity = 4 * s->maxBatch * s->threadCount;
+    s->queueHead = 0;
+    s->queueCount = 0;
+    s->shutdown = 0;
+    s->requestCount = 0;
+    s->batchCount = 0;
+    s->startTime = getServerTime();
+    
+    s->queue = (InferenceRequest**)malloc(s->queueCapacity * sizeof(InferenceRequest*));
+    s->latency = (unsigned long*)calloc(SERVER_LATENCY_BUCKETS, sizeof(unsigned long));
+    s->threads = (pthread_t*)malloc(s->threadCount * sizeof(pthread_t));
+    if (s->queue==NULL || s->latency==NULL || s->threads==NULL) {
+        printf("Abort! Could not allocate memory for the inference server\n");
+        exit(1);
+    }
+    
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->space, NULL);
+    pthread_cond_init(&s->done, NULL);
+    
+    // The batching threads wait on the monotonic clock, like the submission times
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->pending, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    for (int t=0; t<s->threadCount; t++){
+        if (pthread_create(&s->threads[t], NULL, runInferenceBatcher, s)!=0){
+            printf("Abort! Could not create inference batching thread\n");
+            exit(1);
+        }
+    }
+    
+    return s;
+}
+
+
+
+
+/**
+ * @details Lets the batching threads use the published version of an online model
+ */
+
+void setInferenceServerModel(InferenceServer *s, OnlineModel *m){
+    
+    pthread_mutex_lock(&s->lock);
+    s->model = m;
+    pthread_mutex_unlock(&s->lock);
+    
+}
+
+
+
+
+/**
+ * @details Lets the batching threads finish the queued requests, then frees the server
+ */
+
+void freeInferenceServer(InferenceServer *s){
+    
+    pthread_mutex_lock(&s->lock);
+    s->shutdown = 1;
+    pthread_cond_broadcast(&s->pending);
+    pthread_mutex_unlock(&s->lock);
+    
+    for (int t=0; t<s->threadCount; t++) pthread_join(s->threads[t], NULL);
+    
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->space);
+    pthread_cond_destroy(&s->pending);
+    pthread_mutex_destroy(&s->lock);
+    
+    free(s->threads);
+    free(s->latency);
+    free(s->queue);
+    free(s);
+    
+}
+
+
+
+
+/**
+ * @details Wakes up one batching thread, which either starts a batch or keeps waiting for more requests
+ */
+
+void submitInferenceRequest(InferenceServer *s, InferenceRequest *r){
+    
+    r->done = 0;
+    r->submitTime = getServerTime();
+    
+    pthread_mutex_lock(&s->lock);
+    
+    while (s->queueCount==s->queueCapacity) pthread_cond_wait(&s->space, &s->lock);
+    
+    s->queue[(s->queueHead + s->queueCount) % s->queueCapacity] = r;
+    s->queueCount++;
+    pthread_cond_signal(&s->pending);
+    
+    pthread_mutex_unlock(&s->lock);
+    
+}
+
+
+
+
+/**
+ * @details Returns right away if the request is already done
+ */
+
+int waitInferenceRequest(InferenceServer *s, InferenceRequest *r){
+    
+    if (!__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)){
+        pthread_mutex_lock(&s->lock);
+        while (!r->done) pthread_cond_wait(&s->done, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+    }
+    
+    return r->classification;
+}
+
+
+
+
+/**
+ * @details Reads exactly size bytes, returns 0 at the end of the stream (an incomplete image is dropped)
+ */
+
+int readFully(int fd, uint8_t *buf, size_t size){
+    
+    size_t got = 0;
+    
+    while (got<size){
+        ssize_t n = read(fd, buf + got, size - got);
+        if (n<0 && errno==EINTR) continue;
+        if (n<=0) return 0;
+        got += (size_t)n;
+    }
+    
+    return 1;
+}
+
+
+
+
+/**
+ * @details Writes all bytes, returns 0 if the other side has gone
+ */
+
+int writeFully(int fd, const uint8_t *buf, size_t size){
+    
+    size_t put = 0;
+    
+    while (put<size){
+        ssize_t n = write(fd, buf + put, size - put);
+        if (n<0 && errno==EINTR) continue;
+        if (n<=0) return 0;
+        put += (size_t)n;
+    }
+    
+    return 1;
+}
+
+
+
+
+/**
+ * @details Keeps a window of up to maxBatch requests in flight. Before blocking on the next read, the
+ * results that are due are written, so a client that waits for its answer before sending more gets it.
+ */
+
+long serveInferenceStream(InferenceServer *s, int inFd, int outFd){
+    
+    int window = s->maxBatch;
+    int imgSize = s->nn->dense[INPUT].ncount;
+    
+    InferenceRequest *requests = (InferenceRequest*)malloc(window * sizeof(InferenceRequest));
+    uint8_t *pixels = (uint8_t*)malloc((size_t)window * imgSize);
+    uint8_t *results = (uint8_t*)malloc(window);
+    
+    int head = 0;                   // oldest request in flight
+    int inFlight = 0;
+    int eof = 0;
+    long served = 0;
+    
+    for (;;){
+        
+        // Without more input at hand, flush the oldest request and all following ones that are done
+        struct pollfd pfd = {inFd, POLLIN, 0};
+        if (inFlight>0 && (eof || inFlight==window || poll(&pfd, 1, 0)==0)){
+            
+            int count = 0;
+            results[count++] = (uint8_t)waitInferenceRequest(s, &requests[head]);
+            head = (head + 1) % window;
+            inFlight--;
+            while (inFlight>0 && __atomic_load_n(&requests[head].done, __ATOMIC_ACQUIRE)){
+                results[count++] = (uint8_t)requests[head].classification;
+                head = (head + 1) % window;
+                inFlight--;
+            }
+            
+            served += count;
+            if (!writeFully(outFd, results, count)) eof = 1;
+            continue;
+        }
+        
+        if (eof) break;
+        
+        int slot = (head + inFlight) % window;
+        uint8_t *pixel = pixels + (size_t)slot * imgSize;
+        if (!readFully(inFd, pixel, imgSize)){
+            eof = 1;
+            continue;
+        }
+        
+        requests[slot].pixel = pixel;
+        submitInferenceRequest(s, &requests[slot]);
+        inFlight++;
+    }
+    
+    free(results);
+    free(pixels);
+    free(requests);
+    
+    return served;
+}
+
+
+
+
+/**
+ * @details Trains every labeled sample of the stream into the online model. Whenever no further sample is
+ * at hand, the weights trained so far are published, so a correction is used as soon as the stream pauses.
+ */
+
+long serveLearningStream(InferenceServer *s, int inFd){
+    
+    if (s->model==NULL){
+        printf("Abort! Learning needs an online model attached to the server\n");
+        exit(1);
+    }
+    
+    int imgSize = s->nn->dense[INPUT].ncount;
+    uint8_t *sample = (uint8_t*)malloc(1 + imgSize);
+    long learned = 0;
+    
+    // Every sample is the label byte followed by the pixels
+    while (readFully(inFd, sample, 1 + imgSize)){
+        
+        learnOnlineSample(s->model, sample + 1, sample[0]);
+        learned++;
+        
+        struct pollfd pfd = {inFd, POLLIN, 0};
+        if (poll(&pfd, 1, 0)==0) publishOnlineModel(s->model);
+    }
+    
+    publishOnlineModel(s->model);
+    
+    free(sample);
+    
+    return learned;
+}
+
+
+
+
+typedef struct ServerConnection{
+    InferenceServer *server;
+    int fd;                         ///< Connected socket (or listening socket for runServerSocket())
+    int learning;                   ///< 1 = the connection sends labeled samples to learn, 0 = images to classify
+} ServerConnection;
+
+
+
+
+/**
+ * @details Serves one TCP connection until the client closes it
+ */
+
+void *runServerConnection(void *arg){
+    
+    ServerConnection *c = (ServerConnection*)arg;
+    
+    if (c->learning) serveLearningStream(c->server, c->fd);
+    else serveInferenceStream(c->server, c->fd, c->fd);
+    close(c->fd);
+    free(c);
+    
+    return NULL;
+}
+
+
+
+
+/**
+ * @details Listens on 127.0.0.1 only (aborts if the port cannot be opened)
+ */
+
+int openServerSocket(int port){
+    
+    // A client that disconnects early must not kill the server with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    
+    if (listenFd<0 || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr))!=0 || listen(listenFd, 64)!=0){
+        printf("Abort! Could not listen on port %d: %s\n", port, strerror(errno));
+        exit(1);
+    }
+    
+    return listenFd;
+}
+
+
+
+
+/**
+ * @details Accepts connections forever and starts one detached thread per accepted connection
+ */
+
+void *runServerSocket(void *arg){
+    
+    ServerConnection *listener = (ServerConnection*)arg;
+    
+    for (;;){
+        
+        int fd = accept(listener->fd, NULL, NULL);
+        if (fd<0){
+            if (errno==EINTR || errno==ECONNABORTED) continue;
+            printf("Abort! Could not accept connections: %s\n", strerror(errno));
+            exit(1);
+        }
+        
+        ServerConnection *c = (ServerConnection*)malloc(sizeof(ServerConnection));
+        c->server = listener->server;
+        c->fd = fd;
+        c->learning = listener->learning;
+        
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, runServerConnection, c)!=0){
+            close(fd);
+            free(c);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    
+    return NULL;
+}
+
+
+
+
+/**
+ * @details Opens the port right away, then accepts its connections on the calling thread or on a thread of its own
+ */
+
+void startServerSocket(InferenceServer *s, int port, int learning, int background){
+    
+    ServerConnection *listener = (ServerConnection*)malloc(sizeof(ServerConnection));
+    listener->server = s;
+    listener->fd = openServerSocket(port);
+    listener->learning = learning;
+    
+    if (!background){
+        runServerSocket(listener);
+        return;
+    }
+    
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, runServerSocket, listener)!=0){
+        printf("Abort! Could not create thread accepting connections on port %d\n", port);
+        exit(1);
+    }
+    pthread_detach(thread);
+    
+}
+
+
+
+
+/**
+ * @details Every connection is served by a thread of its own
+ */
+
+void serveInferenceSocket(InferenceServer *s, int port){
+    
+    startServerSocket(s, port, 0, 0);
+    
+}
+
+
+
+
+/**
+ * @details Returns once the port is open, its connections are accepted by a background thread
+ */
+
+void startInferenceSocket(InferenceServer *s, int port){
+    
+    startServerSocket(s, port, 0, 1);
+    
+}
+
+
+
+
+/**
+ * @details Returns once the port is open, its connections are accepted by a background thread
+ */
+
+void startLearningSocket(InferenceServer *s, int port){
+    
+    if (s->model==NULL){
+        printf("Abort! Learning needs an online model attached to the server\n");
+        exit(1);
+    }
+    
+    startServerSocket(s, port, 1, 1);
+    
+}
+
+
+
+
+/**
+ * @details Returns the smallest latency (in usec) that at least p percent of the requests did not exceed
+ */
+
+int getLatencyPercentile(const InferenceServer *s, double p){
+    
+    unsigned long rank = (unsigned long)(p/100 * s->requestCount + 0.5);
+    if (rank<1) rank = 1;
+    
+    unsigned long sum = 0;
+    for (int i=0; i<SERVER_LATENCY_BUCKETS; i++){
+        sum += s->latency[i];
+        if (sum>=rank) return i;
+    }
+    
+    return SERVER_LATENCY_BUCKETS-1;
+}
+
+
+
+
+/**
+ * @details Outputs the statistics to stderr, since stdout may carry the classifications
+ */
+
+void displayServerStats(InferenceServer *s){
+    
+    pthread_mutex_lock(&s->lock);
+    
+    double seconds = (getServerTime() - s->startTime) / 1e9;
+    
+    fprintf(stderr, "SERVED: %lu images in %lu batches (%.1f images per batch) in %.3f sec, %.0f images/sec\n", s->requestCount, s->batchCount,
+            (s->batchCount>0) ? (double)s->requestCount/s->batchCount : 0, seconds, (seconds>0) ? s->requestCount/seconds : 0);
+    if (s->requestCount>0){
+        fprintf(stderr, "LATENCY: p50=%d usec  p99=%d usec  (max. batch %d, max. wait %d usec)\n",
+                getLatencyPercentile(s, 50), getLatencyPercentile(s, 99), s->maxBatch, s->maxWait);
+    }
+    
+    pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,177 @@
+/**
+ * @file 3lnn-server.h
+ * @brief Long-running inference server that coalesces concurrent requests into micro-batches
+ * @details Requests (one raw 28x28 image of 784 bytes each) are put into a queue. Batching threads take up
+ * to maxBatch requests at a time from the queue and classify them with one batched forward pass (matrix-
+ * matrix products instead of one matrix-vector product per image). A batching thread that finds fewer
+ * than maxBatch requests waits until the oldest of them has been queued for maxWait microseconds, so
+ * a single request is never delayed by more than maxWait plus the time of one batch.
+ *
+ * The front ends read a stream of images from a file descriptor (e.g. stdin) or from TCP connections and
+ * write back one byte per image, the classification (0-9), in the order the images were received.
+ *
+ * With an online model attached, the server also learns: the learning front ends read a stream of labeled
+ * samples (a label byte followed by the image) and train them into the model, whose published version is
+ * used by the batching threads.
+ */
+
+#ifndef MNIST_3LNN_SERVER_H
+#define MNIST_3LNN_SERVER_H
+
+#include <stdint.h>
+
+#include "3lnn.h"
+#include "3lnn-online.h"
+
+
+typedef struct InferenceServer InferenceServer;
+typedef struct InferenceRequest InferenceRequest;
+
+
+
+
+/**
+ * @brief A single classification request, owned by the client that submits it
+ */
+
+struct InferenceRequest{
+    const uint8_t *pixel;           ///< One uint8 value per INPUT node (pixel!=0 -> 1), unchanged until the request is done
+    int classification;             ///< ID of the output node with the highest output
+    int done;                       ///< Set once classification is valid
+    uint64_t submitTime;            ///< Time of submission in nanoseconds (monotonic clock)
+};
+
+
+
+
+/**
+ * @brief Creates an inference server and starts its batching threads
+ * @param nn A pointer to the (read-only) NN
+ * @param maxBatch Maximum number of requests per batch
+ * @param maxWait Maximum number of microseconds a batching thread waits for more requests
+ * @param threadCount Number of batching threads, each with its own batch
+ */
+
+InferenceServer *createInferenceServer(const Network *nn, int maxBatch, int maxWait, int threadCount);
+
+
+
+
+/**
+ * @brief Lets the server classify with the published version of an online model instead of its NN
+ * @details To be called before the first request is submitted.
+ * @param s A pointer to the server
+ * @param m A pointer to the online model (created from a NN with the same topology)
+ */
+
+void setInferenceServerModel(InferenceServer *s, OnlineModel *m);
+
+
+
+
+/**
+ * @brief Stops the batching threads (after the queued requests are done) and frees the server
+ * @param s A pointer to the server
+ */
+
+void freeInferenceServer(InferenceServer *s);
+
+
+
+
+/**
+ * @brief Queues a request, waiting while the queue is full (thread-safe)
+ * @param s A pointer to the server
+ * @param r A pointer to the request
+ */
+
+void submitInferenceRequest(InferenceServer *s, InferenceRequest *r);
+
+
+
+
+/**
+ * @brief Waits until a submitted request is done and returns its classification (thread-safe)
+ * @param s A pointer to the server
+ * @param r A pointer to the request
+ */
+
+int waitInferenceRequest(InferenceServer *s, InferenceRequest *r);
+
+
+
+
+/**
+ * @brief Classifies the stream of images read from a file descriptor and writes one byte per image to another
+ * @details Up to maxBatch images of the stream are in flight at once, so a single stream is batched as well.
+ * Returns at the end of the input stream.
+ * @param s A pointer to the server
+ * @param inFd File descriptor the images are read from
+ * @param outFd File descriptor the classifications are written to
+ * @return Number of images classified
+ */
+
+long serveInferenceStream(InferenceServer *s, int inFd, int outFd);
+
+
+
+
+/**
+ * @brief Accepts TCP connections on a port of the loopback interface and serves every connection as a stream
+ * @details Every connection is served by a thread of its own, the requests of all connections are
+ * batched together. Runs until the process is stopped (aborts if the port cannot be opened).
+ * @param s A pointer to the server
+ * @param port TCP port
+ */
+
+void serveInferenceSocket(InferenceServer *s, int port);
+
+
+
+
+/**
+ * @brief Like serveInferenceSocket(), but accepts the connections in the background and returns right away
+ * @param s A pointer to the server
+ * @param port TCP port
+ */
+
+void startInferenceSocket(InferenceServer *s, int port);
+
+
+
+
+/**
+ * @brief Trains the stream of labeled samples read from a file descriptor into the server's online model
+ * @details Every sample is one label byte followed by one byte per INPUT node (e.g. an MNIST label and
+ * image). Returns at the end of the input stream, after publishing all samples.
+ * @param s A pointer to the server (with an online model attached)
+ * @param inFd File descriptor the samples are read from
+ * @return Number of samples trained
+ */
+
+long serveLearningStream(InferenceServer *s, int inFd);
+
+
+
+
+/**
+ * @brief Accepts TCP connections on a port of the loopback interface in the background and trains the
+ * labeled samples of every connection into the server's online model
+ * @param s A pointer to the server (with an online model attached)
+ * @param port TCP port
+ */
+
+void startLearningSocket(InferenceServer *s, int port);
+
+
+
+
+/**
+ * @brief Outputs the number of requests and batches and the latency distribution (to stderr)
+ * @param s A pointer to the server
+ */
+
+void displayServerStats(InferenceServer *s);
+
+
+#endif
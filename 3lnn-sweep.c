@@ -0,0 +1,430 @@
+/**
+ * @file 3lnn-sweep.c
+ * @brief Hyperparameter sweep: trains many independent network configurations concurrently on one shared data set
+ * @details The networks are created one at a time under a lock, each right after srand(1), since the weights are
+ * initialized from rand(). Everything after that is private to the configuration's thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "util/mnist-utils.h"
+#include "util/mnist-dataset.h"
+#include "util/thread-pool.h"
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-batch.h"
+#include "3lnn-inference.h"
+#include "3lnn-sweep.h"
+
+
+typedef struct Sweep Sweep;
+
+
+
+
+/**
+ * @brief Data structure holding the state shared by the threads of a running sweep
+ */
+
+struct Sweep{
+    const SweepConfig *configs;     ///< Configurations to train
+    SweepResult *results;           ///< One result per configuration
+    int count;                      ///< Number of configurations
+    int nextConfig;                 ///< Next configuration to be trained (taken atomically)
+    const MNIST_Dataset *trainingSet;
+    const MNIST_Dataset *testingSet;
+    const SweepOptions *opt;
+    struct timespec startTime;      ///< Start of the sweep
+    pthread_mutex_t lock;           ///< Serializes the creation of networks (rand()) and the output
+};
+
+
+
+
+/**
+ * @details Returns the wall time since the start of the sweep in seconds
+ */
+
+double getSweepTime(const Sweep *s){
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    return (now.tv_sec - s->startTime.tv_sec) + (now.tv_nsec - s->startTime.tv_nsec)/1e9;
+}
+
+
+
+
+/**
+ * @details Parses the comma-separated values of one hyperparameter into the configurations' field,
+ * returns the number of values
+ */
+
+int parseSweepValues(const char *name, char *values, SweepConfig *configs){
+    
+    int count = 0;
+    char *save = NULL;
+    
+    for (char *value = strtok_r(values, ",", &save); value!=NULL; value = strtok_r(NULL, ",", &save)){
+        
+        if (count==SWEEP_MAX_VALUES){
+            printf("Abort! A sweep takes at most %d values per hyperparameter\n", SWEEP_MAX_VALUES);
+            exit(1);
+        }
+        SweepConfig *c = &configs[count];
+        int valid = 1;
+        
+        if (strcmp(name, "lr")==0){
+            c->learningRate = atof(value);
+            valid = (c->learningRate>0);
+        }
+        else if (strcmp(name, "hidden")==0){
+            // HIDDEN layer sizes are separated by 'x', the INPUT and OUTPUT sizes stay the same
+            int outCount = c->ncount[c->layerCount-1];
+            int layerCount = 1;
+            char *saveLayer = NULL;
+            for (char *size = strtok_r(value, "x", &saveLayer); size!=NULL; size = strtok_r(NULL, "x", &saveLayer)){
+                if (layerCount==NN_MAX_LAYERS-1 || atoi(size)<1){
+                    layerCount = 0;
+                    break;
+                }
+                c->ncount[layerCount++] = atoi(size);
+            }
+            valid = (layerCount>=2);
+            c->ncount[layerCount++] = outCount;
+            c->layerCount = layerCount;
+        }
+        else if (strcmp(name, "act")==0){
+            if (strcmp(value, "sigmoid")==0) c->actType = SIGMOID;
+            else if (strcmp(value, "tanh")==0) c->actType = TANH;
+            else valid = 0;
+        }
+        else if (strcmp(name, "batch")==0){
+            c->batchSize = atoi(value);
+            valid = (c->batchSize>=1);
+        }
+        else {
+            printf("Abort! Unknown sweep hyperparameter '%s' (lr, hidden, act or batch)\n", name);
+            exit(1);
+        }
+        
+        if (!valid){
+            printf("Abort! Invalid sweep value '%s' of '%s'\n", value, name);
+            exit(1);
+        }
+        
+        count++;
+    }
+    
+    return count;
+}
+
+
+
+
+/**
+ * @details Builds the cross product one hyperparameter at a time: every configuration so far is
+ * repeated once per value of the next hyperparameter
+ */
+
+int parseSweepConfigs(const char *spec, const SweepConfig *base, SweepConfig *configs){
+    
+    char *copy = strdup(spec);
+    char *save = NULL;
+    
+    configs[0] = *base;
+    int count = 1;
+    
+    for (char *param = strtok_r(copy, ":", &save); param!=NULL; param = strtok_r(NULL, ":", &save)){
+        
+        char *values = strchr(param, '=');
+        if (values==NULL){
+            printf("Abort! Sweep hyperparameters are given as name=value,value,... (not '%s')\n", param);
+            exit(1);
+        }
+        *values++ = '\0';
+        
+        // The values are parsed on top of the base configuration, which keeps the INPUT/OUTPUT sizes
+        SweepConfig valueConfigs[SWEEP_MAX_VALUES];
+        for (int v=0; v<SWEEP_MAX_VALUES; v++) valueConfigs[v] = *base;
+        int valueCount = parseSweepValues(param, values, valueConfigs);
+        
+        if (valueCount==0 || (long)count*valueCount > SWEEP_MAX_CONFIGS){
+            printf("Abort! A sweep needs at least 1 value per hyperparameter and at most %d configurations\n", SWEEP_MAX_CONFIGS);
+            exit(1);
+        }
+        
+        for (int v=valueCount-1; v>=0; v--){
+            for (int i=0; i<count; i++){
+                SweepConfig *c = &configs[v*count + i];
+                if (v>0) *c = configs[i];
+                if (strcmp(param, "lr")==0) c->learningRate = valueConfigs[v].learningRate;
+                else if (strcmp(param, "hidden")==0){
+                    c->layerCount = valueConfigs[v].layerCount;
+                    memcpy(c->ncount, valueConfigs[v].ncount, sizeof(c->ncount));
+                }
+                else if (strcmp(param, "act")==0) c->actType = valueConfigs[v].actType;
+                else c->batchSize = valueConfigs[v].batchSize;
+            }
+        }
+        count *= valueCount;
+    }
+    
+    free(copy);
+    
+    return count;
+}
+
+
+
+
+/**
+ * @details Writes the HIDDEN layer sizes of a configuration into a string, e.g. "128x64"
+ */
+
+void formatSweepHidden(const SweepConfig *c, char *str, size_t size){
+    
+    int len = 0;
+    str[0] = '\0';
+    for (int l=1; l<c->layerCount-1 && len<(int)size; l++) len += snprintf(str+len, size-len, (l>1) ? "x%d" : "%d", c->ncount[l]);
+    
+}
+
+
+
+
+/**
+ * @details Writes the hyperparameters of a configuration into a string, e.g. "lr=0.2 hidden=128x64 act=sigmoid batch=1"
+ */
+
+void formatSweepConfig(const SweepConfig *c, double learningRate, char *str, size_t size){
+    
+    char hidden[64];
+    formatSweepHidden(c, hidden, sizeof(hidden));
+    
+    snprintf(str, size, "lr=%g hidden=%s act=%s batch=%d", learningRate, hidden, (c->actType==TANH) ? "tanh" : "sigmoid", c->batchSize);
+    
+}
+
+
+
+
+/**
+ * @details Trains a network for one epoch on the images of the training set in the given order
+ */
+
+void trainSweepEpoch(Network *nn, const MNIST_Dataset *ds, const int *order, Batch *batch){
+    
+    for (int i=0; i<ds->count; i++){
+        
+        const uint64_t *bits = getDatasetBitset(ds, order[i]);
+        MNIST_Label lbl = getDatasetLabel(ds, order[i]);
+        
+        if (batch==NULL){
+            feedInputBitset(nn, bits);
+            feedForwardNetwork(nn);
+            backPropagateNetwork(nn, lbl);
+            continue;
+        }
+        
+        addBitsetToBatch(batch, bits, lbl);
+        
+        // Update the weights once the batch is full (or the last images are in it)
+        if (batch->count==batch->capacity || i==ds->count-1){
+            feedForwardBatch(nn, batch);
+            backPropagateBatch(nn, batch);
+            clearBatch(batch);
+        }
+    }
+    
+}
+
+
+
+
+/**
+ * @details Outputs the testing accuracy of a configuration after an epoch (lock held)
+ */
+
+void displaySweepEpoch(const Sweep *s, int id, int epoch, double accuracy, double trainTime, double wallTime){
+    
+    const SweepConfig *c = &s->configs[id];
+    char str[128], hidden[64];
+    formatSweepConfig(c, s->results[id].learningRate, str, sizeof(str));
+    formatSweepHidden(c, hidden, sizeof(hidden));
+    
+    if (s->opt->json){
+        printf("{\"config\":%d,\"learningRate\":%g,\"hidden\":\"%s\",\"act\":\"%s\",\"batch\":%d,\"epoch\":%d,\"accuracy\":%.4f,\"trainSeconds\":%.3f,\"wallSeconds\":%.3f}\n",
+               id+1, s->results[id].learningRate, hidden, (c->actType==TANH) ? "tanh" : "sigmoid", c->batchSize,
+               epoch, accuracy, trainTime, wallTime);
+    }
+    else printf("    SWEEP: config %3d of %d [%s] epoch %d: Accuracy=%7.4f%%  after %.2f sec training, %.2f sec wall time\n",
+                id+1, s->count, str, epoch, accuracy, trainTime, wallTime);
+    
+    fflush(stdout);
+}
+
+
+
+
+/**
+ * @details Creates, trains and tests the network of one configuration
+ */
+
+void runSweepConfig(Sweep *s, int id){
+    
+    const SweepConfig *c = &s->configs[id];
+    SweepResult *r = &s->results[id];
+    const MNIST_Dataset *train = s->trainingSet;
+    const MNIST_Dataset *test = s->testingSet;
+    
+    // Start from the weights of a separate run (rand() is only used while creating networks)
+    pthread_mutex_lock(&s->lock);
+    srand(1);
+    Network *nn = createDeepNetwork(c->layerCount, c->ncount);
+    
+    // The scale of the initial weights depends on the activation function type
+    nn->hidLayerActType = c->actType;
+    nn->outLayerActType = c->actType;
+    srand(1);
+    initNetworkWeights(nn);
+    pthread_mutex_unlock(&s->lock);
+    
+    nn->learningRate = (c->learningRate>0) ? c->learningRate : getDefaultLearningRate(c->actType);
+    
+    Batch *batch = (c->batchSize>1) ? createBatch(nn, c->batchSize) : NULL;
+    Activations *act = createActivations(nn);
+    int *order = createSampleOrder(train->count);
+    uint64_t seed = 1;
+    
+    memset(r, 0, sizeof(SweepResult));
+    r->learningRate = nn->learningRate;
+    r->startTime = getSweepTime(s);
+    
+    for (int epoch=1; epoch<=s->opt->epochs; epoch++){
+        
+        if (s->opt->shuffle) shuffleSampleOrder(order, train->count, &seed);
+        
+        double trainStart = getSweepTime(s);
+        trainSweepEpoch(nn, train, order, batch);
+        r->trainTime += getSweepTime(s) - trainStart;
+        
+        int errCount = 0;
+        for (int i=0; i<test->count; i++){
+            if (classifyInputBitset(nn, act, getDatasetBitset(test, i), NULL)!=getDatasetLabel(test, i)) errCount++;
+        }
+        
+        r->epochs = epoch;
+        r->accuracy = 100 * (1 - (double)errCount/test->count);
+        if (r->accuracy>r->bestAccuracy){
+            r->bestAccuracy = r->accuracy;
+            r->bestEpoch = epoch;
+        }
+        r->endTime = getSweepTime(s);
+        
+        pthread_mutex_lock(&s->lock);
+        displaySweepEpoch(s, id, epoch, r->accuracy, r->trainTime, r->endTime);
+        pthread_mutex_unlock(&s->lock);
+    }
+    
+    free(order);
+    freeActivations(act);
+    if (batch!=NULL) freeBatch(batch);
+    freeNetwork(nn);
+    
+}
+
+
+
+
+/**
+ * @details Sweep step executed by every thread: trains the next configuration until none are left
+ */
+
+void runSweepStep(void *arg, int threadId, int threadCount){
+    
+    (void)threadId;
+    (void)threadCount;
+    
+    Sweep *s = (Sweep*)arg;
+    
+    int id;
+    while ((id = __atomic_fetch_add(&s->nextConfig, 1, __ATOMIC_RELAXED)) < s->count) runSweepConfig(s, id);
+    
+}
+
+
+
+
+/**
+ * @details Trains and tests all configurations on a pool of threads
+ */
+
+void runSweep(const SweepConfig *configs, int count, const MNIST_Dataset *trainingSet, const MNIST_Dataset *testingSet,
+              const SweepOptions *opt, SweepResult *results){
+    
+    Sweep s = {.configs = configs, .results = results, .count = count, .nextConfig = 0,
+               .trainingSet = trainingSet, .testingSet = testingSet, .opt = opt};
+    pthread_mutex_init(&s.lock, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &s.startTime);
+    
+    int threadCount = (opt->threadCount<count) ? opt->threadCount : count;
+    ThreadPool *pool = createThreadPool(threadCount);
+    runOnThreadPool(pool, runSweepStep, &s);
+    freeThreadPool(pool);
+    
+    pthread_mutex_destroy(&s.lock);
+    
+}
+
+
+
+
+/**
+ * @details Outputs one line per configuration, the one with the highest accuracy first
+ */
+
+void displaySweepResults(const SweepConfig *configs, const SweepResult *results, int count, const SweepOptions *opt){
+    
+    int *rank = (int*)malloc(count * sizeof(int));
+    for (int i=0; i<count; i++) rank[i] = i;
+    
+    // Insertion sort by best accuracy, ties in configuration order
+    for (int i=1; i<count; i++){
+        int id = rank[i], j = i;
+        while (j>0 && results[rank[j-1]].bestAccuracy < results[id].bestAccuracy){
+            rank[j] = rank[j-1];
+            j--;
+        }
+        rank[j] = id;
+    }
+    
+    int failCount = 0;
+    
+    if (!opt->json) printf("\n    RANKING:  %4s  %-44s %9s %6s %10s %10s\n", "#", "configuration", "accuracy", "epoch", "train sec", "done after");
+    
+    for (int i=0; i<count; i++){
+        const SweepConfig *c = &configs[rank[i]];
+        const SweepResult *r = &results[rank[i]];
+        char str[128];
+        formatSweepConfig(c, r->learningRate, str, sizeof(str));
+        int learned = (r->bestAccuracy>=SWEEP_MIN_ACCURACY);
+        if (!learned) failCount++;
+        if (opt->json) printf("{\"rank\":%d,\"config\":%d,\"configuration\":\"%s\",\"bestAccuracy\":%.4f,\"bestEpoch\":%d,\"trainSeconds\":%.3f,\"wallSeconds\":%.3f,\"learned\":%s}\n",
+                              i+1, rank[i]+1, str, r->bestAccuracy, r->bestEpoch, r->trainTime, r->endTime, learned ? "true" : "false");
+        else printf("              %4d  %-44s %8.4f%% %6d %10.2f %10.2f%s\n", rank[i]+1, str, r->bestAccuracy, r->bestEpoch, r->trainTime, r->endTime,
+                    learned ? "" : "  did not learn");
+    }
+    
+    if (failCount>0 && !opt->json){
+        printf("\n    NOTE: %d configuration(s) stayed near chance level (below %d%%), their learning rate is probably too high\n",
+               failCount, SWEEP_MIN_ACCURACY);
+    }
+    
+    free(rank);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file 3lnn-sweep.h
+ * @brief Hyperparameter sweep: trains many independent network configurations concurrently on one shared data set
+ * @details The training and testing sets are mapped and binarized once and only read by the threads. Every
+ * thread takes the next configuration, creates its network and trains it single-threaded, testing it after
+ * every epoch. Every network starts from the weights a separate run with the same topology would start from,
+ * so the result of a configuration does not depend on the other configurations or the number of threads.
+ */
+
+#ifndef MNIST_3LNN_SWEEP_H
+#define MNIST_3LNN_SWEEP_H
+
+#include "3lnn.h"
+#include "util/mnist-dataset.h"
+
+
+#define SWEEP_MAX_CONFIGS 1024          ///< Maximum number of configurations of a sweep
+#define SWEEP_MAX_VALUES 32             ///< Maximum number of values per hyperparameter
+#define SWEEP_MIN_ACCURACY 20           ///< Best accuracy (in %) below which a configuration is flagged as not learning (chance = 10%)
+
+
+typedef struct SweepConfig SweepConfig;
+typedef struct SweepResult SweepResult;
+typedef struct SweepOptions SweepOptions;
+
+
+
+
+/**
+ * @brief Hyperparameters of one configuration
+ */
+
+struct SweepConfig{
+    double learningRate;            ///< Learning rate (0 = the default of getDefaultLearningRate() for actType)
+    int layerCount;                 ///< Number of layers (INPUT, HIDDEN layers, OUTPUT)
+    int ncount[NN_MAX_LAYERS];      ///< Number of nodes per layer, from INPUT to OUTPUT
+    ActFctType actType;             ///< Activation function of all HIDDEN and OUTPUT layers
+    int batchSize;                  ///< Number of images per mini-batch (1 = update the weights after every image)
+};
+
+
+
+
+/**
+ * @brief Outcome of one configuration
+ */
+
+struct SweepResult{
+    double learningRate;            ///< Learning rate the network was trained with
+    int epochs;                     ///< Number of epochs trained
+    double accuracy;                ///< Testing accuracy after the last epoch (%)
+    double bestAccuracy;            ///< Highest testing accuracy after any epoch (%)
+    int bestEpoch;                  ///< Epoch of bestAccuracy
+    double trainTime;               ///< Time spent training, without testing (sec)
+    double startTime;               ///< Wall time from the start of the sweep until the configuration was started (sec)
+    double endTime;                 ///< Wall time from the start of the sweep until the configuration was done (sec)
+};
+
+
+
+
+/**
+ * @brief Options shared by all configurations of a sweep
+ */
+
+struct SweepOptions{
+    int threadCount;                ///< Number of configurations trained at the same time
+    int epochs;                     ///< Number of epochs per configuration
+    int shuffle;                    ///< 1 = shuffle the training set before every epoch
+    int json;                       ///< 1 = report as one JSON object per line instead of text
+};
+
+
+
+
+/**
+ * @brief Parses a sweep specification into the cross product of its values
+ * @details The specification lists hyperparameters separated by ':', each with comma-separated values, e.g.
+ * "lr=0.1,0.2:hidden=20,128x64:act=sigmoid,tanh:batch=1,10". Multiple HIDDEN layers are separated by 'x'.
+ * Hyperparameters that are not listed keep the value of base. Aborts if the specification is invalid.
+ * @param spec Sweep specification
+ * @param base Configuration providing the values of the hyperparameters that are not listed
+ * @param configs Array of at least SWEEP_MAX_CONFIGS configurations receiving the cross product
+ * @return Number of configurations
+ */
+
+int parseSweepConfigs(const char *spec, const SweepConfig *base, SweepConfig *configs);
+
+
+
+
+/**
+ * @brief Trains and tests all configurations, reporting every configuration's accuracy after every epoch
+ * @param configs Array of count configurations
+ * @param count Number of configurations
+ * @param trainingSet A pointer to the binarized MNIST training set
+ * @param testingSet A pointer to the binarized MNIST testing set
+ * @param opt A pointer to the sweep options
+ * @param results Array of count results
+ */
+
+void runSweep(const SweepConfig *configs, int count, const MNIST_Dataset *trainingSet, const MNIST_Dataset *testingSet,
+              const SweepOptions *opt, SweepResult *results);
+
+
+
+
+/**
+ * @brief Outputs all configurations ranked by their best testing accuracy
+ * @param configs Array of count configurations
+ * @param results Array of count results
+ * @param count Number of configurations
+ * @param opt A pointer to the sweep options
+ */
+
+void displaySweepResults(const SweepConfig *configs, const SweepResult *results, int count, const SweepOptions *opt);
+
+
+#endif
@@ -1,6 +1,6 @@
 /**
  * @file 3lnn.c
- * @brief Neural network functionality for a 3-layer (INPUT, HIDDEN, OUTPUT) feed-forward, back-prop NN
+ * @brief Neural network functionality for a multi-layer (INPUT, HIDDEN..., OUTPUT) feed-forward, back-prop NN
  * @author Matt Lind
  * @date August 2015
  */
@@ -8,9 +8,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <sys/mman.h>
 
 #include "util/mnist-utils.h"
+#include "util/profile-stats.h"
 #include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-fixed.h"
 
 
 
@@ -21,7 +25,7 @@
 
 Node *getNode(Layer *l, int nodeId) {
     
-    int nodeSize = sizeof(Node) + (l->nodes[0].wcount * sizeof(double));
+    int nodeSize = sizeof(Node) + (l->nodes[0].wcount * sizeof(NNReal));
     uint8_t *sbptr = (uint8_t*) l->nodes;
     
     sbptr += nodeId * nodeSize;
@@ -35,34 +39,32 @@ Node *getNode(Layer *l, int nodeId) {
 /**
  * @brief Returns one of the layers of the network
  * @param nn A pointer to the NN
- * @param ltype Type of layer to be returned (INPUT, HIDDEN, OUTPUT)
+ * @param layer Index of the layer to be returned (0 = INPUT to layerCount-1 = OUTPUT)
  */
 
-Layer *getLayer(Network *nn, LayerType ltype){
+Layer *getLayer(Network *nn, int layer){
     
-    Layer *l;
+    // The layers are stored one after the other
+    uint8_t *sbptr = (uint8_t*) nn->layers;
+    for (int l=0; l<layer; l++) sbptr += nn->layerSize[l];
     
-    switch (ltype) {
-        case INPUT:{
-            l = nn->layers;
-            break;
-        }
-        case HIDDEN:{
-            uint8_t *sbptr = (uint8_t*) nn->layers;
-            sbptr += nn->inpLayerSize;
-            l = (Layer*)sbptr;
-            break;
-        }
-            
-        default:{ // OUTPUT
-            uint8_t *sbptr = (uint8_t*) nn->layers;
-            sbptr += nn->inpLayerSize + nn->hidLayerSize;
-            l = (Layer*)sbptr;
-            break;
-        }
-    }
+    return (Layer*)sbptr;
+}
+
+
+
+
+/**
+ * @brief Returns the activation function type used by a given layer
+ * @param nn A pointer to the NN
+ * @param layer Index of the layer (1 to layerCount-1)
+ */
+
+ActFctType getActFctType(const Network *nn, int layer){
+    
+    if (layer<getOutputLayer(nn)) return nn->hidLayerActType;
     
-    return l;
+    return nn->outLayerActType;
 }
 
 
@@ -71,19 +73,17 @@ Layer *getLayer(Network *nn, LayerType ltype){
 /**
  * @brief Returns the result of applying the given outputValue to the derivate of the activation function
  * @param nn A pointer to the NN
- * @param ltype Type of layer (INPUT, HIDDEN, OUTPUT)
+ * @param layer Index of the layer (1 to layerCount-1)
  * @param outVal Output value that is to be back propagated
  */
 
-double getActFctDerivative(Network *nn, LayerType ltype, double outVal){
+NNReal getActFctDerivative(const Network *nn, int layer, NNReal outVal){
     
-    double dVal = 0;
-    ActFctType actFct;
+    NNReal dVal = 0;
+    ActFctType actFct = getActFctType(nn, layer);
     
-    if (ltype==HIDDEN) actFct = nn->hidLayerActType;
-                  else actFct = nn->outLayerActType;
-    
-    if (actFct==TANH) dVal = 1-pow(tanh(outVal),2);
+    // Both derivatives are expressed in terms of the already activated output value
+    if (actFct==TANH) dVal = 1 - outVal*outVal;
                  else dVal = outVal * (1-outVal);
     
     return dVal;
@@ -93,146 +93,150 @@ double getActFctDerivative(Network *nn, LayerType ltype, double outVal){
 
 
 /**
- * @brief Updates a node's weights based on given error
+ * @brief Returns 1 if the INPUT values of a set of activations are sparse enough to use their index list
  * @param nn A pointer to the NN
- * @param ltype Type of layer (INPUT, HIDDEN, OUTPUT)
- * @param id Sequential id of the node that is to be calculated
- * @param error The error (difference between desired output and actual output
+ * @param a A pointer to the activations
  */
 
-void updateNodeWeights(Network *nn, LayerType ltype, int id, double error){
-    
-    Layer *updateLayer = getLayer(nn, ltype);
-    Node *updateNode = getNode(updateLayer, id);
-    
-    Layer *prevLayer;
-    int prevLayerNodeSize = 0;
-    if (ltype==HIDDEN) {
-        prevLayer = getLayer(nn, INPUT);
-        prevLayerNodeSize = nn->inpNodeSize;
-    } else {
-        prevLayer = getLayer(nn, HIDDEN);
-        prevLayerNodeSize = nn->hidNodeSize;
-    }
-    
-    uint8_t *sbptr = (uint8_t*) prevLayer->nodes;
-    
-    for (int i=0; i<updateNode->wcount; i++){
-        Node *prevLayerNode = (Node*)sbptr;
-        updateNode->weights[i] += (nn->learningRate * prevLayerNode->output * error);
-        sbptr += prevLayerNodeSize;
-    }
-    
-    // update bias weight
-    updateNode->bias += (nn->learningRate * 1 * error);
+int isInputSparse(const Network *nn, const Activations *a){
     
+    // Gathering the weights of scattered inputs is slower than a vectorized dense loop over all of them,
+    // so the index list only pays off if most inputs are 0
+    return a->activeCount>=0 && a->activeCount*2 <= nn->dense[INPUT].ncount;
 }
 
 
 
 
 /**
- * @brief Back propagates network error to hidden layer
+ * @brief Calculates the error signals (deltas) of the OUTPUT layer: delta = (target - output) * derivative
  * @param nn A pointer to the NN
+ * @param a A pointer to the activations of the sample that is back propagated
  * @param targetClassification Correct classification (=label) of the input stream
  */
 
-void backPropagateHiddenLayer(Network *nn, int targetClassification){
+void calcOutputDeltas(const Network *nn, Activations *a, int targetClassification){
     
-    Layer *ol = getLayer(nn, OUTPUT);
-    Layer *hl = getLayer(nn, HIDDEN);
+    PROFILE_START(startTime);
     
-    for (int h=0;h<hl->ncount;h++){
-        Node *hn = getNode(hl,h);
+    int out = getOutputLayer(nn);
+    const DenseLayer *ol = &nn->dense[out];
+    
+    for (int o=0;o<ol->ncount;o++){
         
-        double outputcellerrorsum = 0;
+        NNReal outVal = a->output[out][o];
         
-        for (int o=0;o<ol->ncount;o++){
-            
-            Node *on = getNode(ol,o);
-            
-            int targetOutput = (o==targetClassification)?1:0;
-            
-            double errorDelta = targetOutput - on->output;
-            double errorSignal = errorDelta * getActFctDerivative(nn, OUTPUT, on->output);
-            
-            outputcellerrorsum += errorSignal * on->weights[h];
-        }
-        
-        double hiddenErrorSignal = outputcellerrorsum * getActFctDerivative(nn, HIDDEN, hn->output);
+        int targetOutput = (o==targetClassification)?1:0;
         
-        updateNodeWeights(nn, HIDDEN, h, hiddenErrorSignal);
+        NNReal errorDelta = targetOutput - outVal;
+        a->delta[out][o] = errorDelta * getActFctDerivative(nn, out, outVal);
     }
     
+    PROFILE_STOP(PROFILE_OUTPUT_BACKPROP, startTime);
 }
 
 
 
 
 /**
- * @brief Back propagates network error in output layer
+ * @brief Calculates the error signals (deltas) of a HIDDEN layer from the deltas of the layer above it
+ * @details The deltas of the layer above are propagated back with one transposed matrix-vector product
+ * (hidden delta = W_above^T * delta above), accumulated one weight row at a time, and then multiplied
+ * with the derivative of the hidden outputs.
  * @param nn A pointer to the NN
- * @param targetClassification Correct classification (=label) of the input stream
+ * @param a A pointer to the activations of the sample that is back propagated (deltas of layer+1 calculated)
+ * @param layer Index of the HIDDEN layer (1 to layerCount-2)
  */
 
-void backPropagateOutputLayer(Network *nn, int targetClassification){
+void calcHiddenDeltas(const Network *nn, Activations *a, int layer){
     
-    Layer *ol = getLayer(nn, OUTPUT);
+    PROFILE_START(startTime);
+    
+    const DenseLayer *ol = &nn->dense[layer+1];
+    const DenseLayer *hl = &nn->dense[layer];
+    
+    NNReal *hidDelta = a->delta[layer];
+    
+    memset(hidDelta, 0, hl->ncount * sizeof(NNReal));
     
     for (int o=0;o<ol->ncount;o++){
-        
-        Node *on = getNode(ol,o);
-        
-        int targetOutput = (o==targetClassification)?1:0;
-        
-        double errorDelta = targetOutput - on->output;
-        double errorSignal = errorDelta * getActFctDerivative(nn, OUTPUT, on->output);
-        
-        updateNodeWeights(nn, OUTPUT, o, errorSignal);
-        
+        addScaledVector(ol->wcount, a->delta[layer+1][o], ol->weights + (size_t)o * ol->stride, hidDelta);
+    }
+    
+    for (int h=0;h<hl->ncount;h++){
+        hidDelta[h] *= getActFctDerivative(nn, layer, a->output[layer][h]);
     }
     
+    PROFILE_STOP(PROFILE_HIDDEN_BACKPROP, startTime);
 }
 
 
 
 
 /**
- * @brief Back propagates network error from output layer to hidden layer
+ * @brief Updates the weights of all nodes of a layer based on the layer's error signals (one rank-1 update)
  * @param nn A pointer to the NN
- * @param targetClassification Correct classification (=label) of the input stream
+ * @param a A pointer to the activations of the sample that is back propagated
+ * @param layer Index of the layer (1 to layerCount-1)
  */
 
-void backPropagateNetwork(Network *nn, int targetClassification){
+void updateLayerWeights(Network *nn, Activations *a, int layer){
     
-    backPropagateOutputLayer(nn, targetClassification);
+    PROFILE_START(startTime);
     
-    backPropagateHiddenLayer(nn, targetClassification);
+    // Weights of inputs that are 0 would not change, so only visit the non-zero inputs if they are known
+    int sparse = (layer==1 && isInputSparse(nn, a));
     
+    updateDenseLayer(&nn->dense[layer], nn->learningRate, a->delta[layer], a->output[layer-1],
+                     sparse ? a->active : NULL, sparse ? a->activeCount : 0, 0, nn->dense[layer].ncount);
+    
+    PROFILE_STOP((layer==getOutputLayer(nn)) ? PROFILE_OUTPUT_BACKPROP : PROFILE_HIDDEN_BACKPROP, startTime);
 }
 
 
 
 
 /**
- * @brief Performs an activiation function (as defined in the NN's defaults) to a specified node
+ * @brief Back propagates network error from output layer through all hidden layers
  * @param nn A pointer to the NN
- * @param ltype Type of layer (INPUT, HIDDEN, OUTPUT)
- * @param id Sequential id of the node that is to be calculated
+ * @param targetClassification Correct classification (=label) of the input stream
  */
 
-void activateNode(Network *nn, LayerType ltype, int id){
+void backPropagateNetwork(Network *nn, int targetClassification){
     
-    Layer *l = getLayer(nn, ltype);
-    Node *n = getNode(l, id);
+    backPropagateActivations(nn, &nn->act, targetClassification);
     
-    ActFctType actFct;
+}
+
+
+
+
+/**
+ * @brief Back propagates the error of a sample whose activations are held outside of the NN
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations of the sample (after feedForwardActivations())
+ * @param targetClassification Correct classification (=label) of the input stream
+ */
+
+void backPropagateActivations(Network *nn, Activations *a, int targetClassification){
     
-    if (ltype==HIDDEN) actFct = nn->hidLayerActType;
-    else actFct = nn->outLayerActType;
+    // The deltas of every layer are calculated once and shared by its weight update and the layer below
+    calcOutputDeltas(nn, a, targetClassification);
     
-    if (actFct==TANH)   n->output = tanh(n->output);
-    else n->output = 1 / (1 + (exp((double)-n->output)) );
+    for (int l=getOutputLayer(nn); l>1; l--){
+        if (nn->usePreUpdateWeights){
+            // Exact gradient: propagate the error through the weights the sample was fed forward with
+            calcHiddenDeltas(nn, a, l-1);
+            updateLayerWeights(nn, a, l);
+        }
+        else {
+            // Original behavior: the error is propagated through the already updated weights
+            updateLayerWeights(nn, a, l);
+            calcHiddenDeltas(nn, a, l-1);
+        }
+    }
+    
+    updateLayerWeights(nn, a, 1);
     
 }
 
@@ -240,96 +244,291 @@ void activateNode(Network *nn, LayerType ltype, int id){
 
 
 /**
- * @brief Calculates the output value of a specified node by multiplying all its weights with the previous layer's outputs
+ * @brief Calculates the output values of a given NN layer
  * @param nn A pointer to the NN
- * @param ltype Type of layer (INPUT, HIDDEN, OUTPUT)
- * @param id Sequential id of the node that is to be calculated
+ * @param a A pointer to the activations the layer's output values are written to
+ * @param layer Index of the layer (1 to layerCount-1)
  */
 
-void calcNodeOutput(Network *nn, LayerType ltype, int id){
+void calcLayer(const Network *nn, Activations *a, int layer){
+    const DenseLayer *l;
+    l = &nn->dense[layer];
     
-    Layer *calcLayer = getLayer(nn, ltype);
-    Node *calcNode = getNode(calcLayer, id);
+    PROFILE_START(startTime);
     
-    Layer *prevLayer;
-    int prevLayerNodeSize = 0;
+    if (layer==1 && isInputSparse(nn, a)) calcDenseLayerSparse(l, a->output[INPUT], a->active, a->activeCount, a->output[1], getActFctType(nn, 1), nn->actPrecision);
+    else calcDenseLayer(l, a->output[layer-1], a->output[layer], getActFctType(nn, layer), nn->actPrecision);
     
-    if (ltype==HIDDEN) {
-        prevLayer = getLayer(nn, INPUT);
-        prevLayerNodeSize = nn->inpNodeSize;
-    }
-    else {
-        prevLayer = getLayer(nn, HIDDEN);
-        prevLayerNodeSize = nn->hidNodeSize;
+    PROFILE_STOP((layer==getOutputLayer(nn)) ? PROFILE_OUTPUT_FORWARD : PROFILE_HIDDEN_FORWARD, startTime);
+}
+
+
+
+
+/**
+ * @brief Feeds input layer values forward through all hidden layers to the output layer (calculation and activation fct)
+ * @param nn A pointer to the NN
+ */
+
+void feedForwardNetwork(Network *nn){
+    feedForwardActivations(nn, &nn->act);
+}
+
+
+
+
+/**
+ * @brief Feeds the input values held in a set of activations forward through all layers
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations holding the input values
+ */
+
+void feedForwardActivations(const Network *nn, Activations *a){
+    
+    if (nn->fixedTopology>=0){
+        feedForwardFixed(nn, a);
+        return;
     }
     
-    uint8_t *sbptr = (uint8_t*) prevLayer->nodes;
+    for (int l=1; l<nn->layerCount; l++) calcLayer(nn, a, l);
+}
+
+
+
+
+/**
+ * @brief Feeds some Vector data into the INPUT layer of the NN
+ * @param nn A pointer to the NN
+ * @param v A pointer to a vector
+ */
+
+void feedInput(Network *nn, Vector *v) {
+    
+    feedInputActivations(&nn->act, v);
     
-    // Start by adding the bias
-    calcNode->output = calcNode->bias;
+}
+
 
+
+
+/**
+ * @brief Copies some Vector data into the INPUT layer values of a set of activations
+ * @param a A pointer to the activations
+ * @param v A pointer to a vector
+ */
+
+void feedInputActivations(Activations *a, Vector *v) {
     
-    for (int i=0; i<prevLayer->ncount;i++){
-        Node *prevLayerNode = (Node*)sbptr;
-        calcNode->output += prevLayerNode->output * calcNode->weights[i];
-        sbptr += prevLayerNodeSize;
+    feedInputValuesActivations(a, v->vals, v->size);
+    
+}
+
+
+
+
+/**
+ * @brief Copies an array of input values into the INPUT layer values of a set of activations
+ * @details Also records the indices of all non-zero input values.
+ * @param a A pointer to the activations
+ * @param input Input values
+ * @param count Number of input values
+ */
+
+void feedInputValuesActivations(Activations *a, const NNReal *input, int count) {
+    
+    // Copy the input values into the output vector of the input layer
+    memcpy(a->output[INPUT], input, count * sizeof(NNReal));
+    
+    int activeCount = 0;
+    for (int i=0; i<count; i++){
+        if (input[i]!=0) a->active[activeCount++] = i;
     }
+    a->activeCount = activeCount;
+    
+}
+
+
+
 
+/**
+ * @brief Sets the INPUT layer values of a set of activations from a bitset (bit set = 1, bit clear = 0)
+ * @details The indices of the non-zero input values are taken directly from the set bits.
+ * @param a A pointer to the activations
+ * @param bits Bitset holding one bit per input value, starting at the lowest bit of bits[0]
+ * @param count Number of input values
+ */
+
+void feedInputBitsetActivations(Activations *a, const uint64_t *bits, int count) {
+    
+    PROFILE_START(startTime);
+    
+    NNReal *input = a->output[INPUT];
+    memset(input, 0, count * sizeof(NNReal));
+    
+    int activeCount = 0;
+    for (int w=0; w*64<count; w++){
+        for (uint64_t word = bits[w]; word!=0; word &= word-1){
+            int i = w*64 + __builtin_ctzll(word);
+            input[i] = 1;
+            a->active[activeCount++] = i;
+        }
+    }
+    a->activeCount = activeCount;
+    
+    PROFILE_STOP(PROFILE_FEED_INPUT, startTime);
 }
 
 
 
 
 /**
- * @brief Calculates the output values of a given NN layer
+ * @brief Sets the INPUT layer values of the NN from a bitset (bit set = 1, bit clear = 0)
  * @param nn A pointer to the NN
- * @param ltype Type of layer (INPUT, HIDDEN, OUTPUT)
+ * @param bits Bitset holding one bit per INPUT node, starting at the lowest bit of bits[0]
+ */
+
+void feedInputBitset(Network *nn, const uint64_t *bits) {
+    
+    feedInputBitsetActivations(&nn->act, bits, nn->dense[INPUT].ncount);
+    
+}
+
+
+
+
+/**
+ * @brief Sets the INPUT layer values of a set of activations from gray values (0 to 255 -> 0 to 1)
+ * @details Also records the indices of all non-zero input values (the background of MNIST images is 0).
+ * @param a A pointer to the activations
+ * @param pixel One gray value per input value
+ * @param count Number of input values
  */
 
-void calcLayer(Network *nn, LayerType ltype){
-    Layer *l;
-    l = getLayer(nn, ltype);
+void feedInputPixelsActivations(Activations *a, const uint8_t *pixel, int count) {
     
-    for (int i=0;i<l->ncount;i++){
-        calcNodeOutput(nn, ltype, i);
-        activateNode(nn,ltype,i);
+    PROFILE_START(startTime);
+    
+    NNReal *input = a->output[INPUT];
+    
+    int activeCount = 0;
+    for (int i=0; i<count; i++){
+        input[i] = pixel[i] * (NNReal)(1.0 / 255);
+        if (pixel[i]!=0) a->active[activeCount++] = i;
     }
+    a->activeCount = activeCount;
+    
+    PROFILE_STOP(PROFILE_FEED_INPUT, startTime);
 }
 
 
 
 
 /**
- * @brief Feeds input layer values forward to hidden to output layer (calculation and activation fct)
+ * @brief Sets the INPUT layer values of the NN from gray values (0 to 255 -> 0 to 1)
  * @param nn A pointer to the NN
+ * @param pixel One gray value per INPUT node
  */
 
-void feedForwardNetwork(Network *nn){
-    calcLayer(nn, HIDDEN);
-    calcLayer(nn, OUTPUT);
+void feedInputPixels(Network *nn, const uint8_t *pixel) {
+    
+    feedInputPixelsActivations(&nn->act, pixel, nn->dense[INPUT].ncount);
+    
 }
 
 
 
 
 /**
- * @brief Feeds some Vector data into the INPUT layer of the NN
+ * @brief Initializes the NN's Layer/Node view in place (INPUT, HIDDEN and OUTPUT layers one after the other)
+ * @details The view is part of the NN's zero-initialized arena, so only the node and weight counts are set.
  * @param nn A pointer to the NN
- * @param v A pointer to a vector
+ * @param ncount Number of nodes per layer, from INPUT to OUTPUT
  */
 
-void feedInput(Network *nn, Vector *v) {
+void initNetwork(Network *nn, const int *ncount){
     
-    Layer *il;
-    il = nn->layers;
+    for (int l=0; l<nn->layerCount; l++){
+        
+        Layer *layer = getLayer(nn, l);
+        layer->ncount = ncount[l];
+        
+        // The INPUT layer has 0 weights, every other node has one weight per node of the previous layer
+        uint8_t *sbptr = (uint8_t*) layer->nodes;     // single byte pointer
+        for (int i=0; i<ncount[l]; i++){
+            ((Node*)sbptr)->wcount = (l==INPUT) ? 0 : ncount[l-1];
+            sbptr += nn->nodeSize[l];
+        }
+    }
     
-    Node *iln;
-    iln = il->nodes;
+}
+
+
+
+
+/**
+ * @details Rounds a number of values up to the next multiple of NN_ALIGNMENT bytes
+ * @param count Number of values
+ */
+
+int padToAlignment(int count){
+    
+    int perLine = NN_ALIGNMENT / sizeof(NNReal);
+    
+    return ((count + perLine - 1) / perLine) * perLine;
+}
+
+
+
+
+/**
+ * @brief Sets the node counts and row strides of a stack of dense layers
+ * @return Number of values of the memory block holding all of their weight and bias arrays
+ * @param dense Array of layerCount dense layers, from INPUT to OUTPUT
+ * @param layerCount Number of layers
+ * @param ncount Number of nodes per layer
+ */
+
+size_t initDenseLayers(DenseLayer *dense, int layerCount, const int *ncount){
+    
+    // Every array is padded to full cache lines, so every array in the block stays aligned
+    size_t blockSize = 0;
+    for (int l=0; l<layerCount; l++){
+        DenseLayer *dl = &dense[l];
+        dl->ncount = ncount[l];
+        dl->wcount = (l==INPUT) ? 0 : ncount[l-1];
+        dl->stride = padToAlignment(dl->wcount);
+        blockSize += (size_t)dl->ncount * dl->stride;
+        if (l!=INPUT) blockSize += padToAlignment(dl->ncount);
+    }
+    
+    return blockSize;
+}
+
+
+
+
+/**
+ * @brief Points the weight and bias arrays of a stack of dense layers into a memory block
+ * @param dense Array of layerCount dense layers, set up via initDenseLayers()
+ * @param layerCount Number of layers
+ * @param block NN_ALIGNMENT-aligned memory block of the size returned by initDenseLayers()
+ */
+
+void setDenseLayersBlock(DenseLayer *dense, int layerCount, NNReal *block){
     
-    // Copy the vector content to the "output" field of the input layer nodes
-    for (int i=0; i<v->size;i++){
-        iln->output = v->vals[i];
-        iln++;               // @warning This only works because inputNodeSize = sizeof(Node)
+    NNReal *ptr = block;
+    for (int l=0; l<layerCount; l++){
+        DenseLayer *dl = &dense[l];
+        if (l==INPUT){
+            dl->weights = NULL;
+            dl->bias    = NULL;
+        }
+        else {
+            dl->weights = ptr;
+            ptr += (size_t)dl->ncount * dl->stride;
+            dl->bias    = ptr;
+            ptr += padToAlignment(dl->ncount);
+        }
     }
     
 }
@@ -338,103 +537,171 @@ void feedInput(Network *nn, Vector *v) {
 
 
 /**
- * @details Creates an input layer and sets all weights to random values [0-1]
- * @param inpCount Number of nodes in the input layer
+ * @brief Returns the arena fill level after reserving the memory block of a stack of dense layers
+ * @param used Number of bytes used before the block
+ * @param layerCount Number of layers
+ * @param ncount Number of nodes per layer
  */
 
-Layer *createInputLayer(int inpCount){
+size_t reserveDenseLayers(size_t used, int layerCount, const int *ncount){
     
-    int inpNodeSize     = sizeof(Node);         // Input layer has 0 weights
-    int inpLayerSize    = sizeof(Layer) + (inpCount * inpNodeSize);
+    DenseLayer dense[NN_MAX_LAYERS];
+    size_t blockSize = initDenseLayers(dense, layerCount, ncount);
     
-    Layer *il = malloc(inpLayerSize);
-    il->ncount = inpCount;
+    return reserveArenaSize(used, blockSize * sizeof(NNReal), NN_ALIGNMENT);
+}
+
+
+
+
+/**
+ * @brief Allocates an aligned memory block holding a stack of dense layers from an arena
+ * @details The returned block is zero-initialized and released together with the arena.
+ * @param arena A pointer to the arena (with the space reserved via reserveDenseLayers())
+ * @param dense Array of layerCount dense layers that are set up to point into the block
+ * @param layerCount Number of layers
+ * @param ncount Number of nodes per layer
+ */
+
+NNReal *createDenseLayers(Arena *arena, DenseLayer *dense, int layerCount, const int *ncount){
     
-    // Create a detault input layer node
-    Node iln;
-    iln.bias = 0;
-    iln.output = 0;
-    iln.wcount = 0;
+    size_t blockSize = initDenseLayers(dense, layerCount, ncount);
     
-    // Use a single byte pointer to fill in the network's content
-    uint8_t *sbptr = (uint8_t*) il->nodes;
+    NNReal *block = (NNReal*)allocArena(arena, blockSize * sizeof(NNReal), NN_ALIGNMENT);
     
-    // Copy the default input layer node x times
-    for (int i=0;i<il->ncount;i++){
-        memcpy(sbptr,&iln,inpNodeSize);
-        sbptr += inpNodeSize;
+    setDenseLayersBlock(dense, layerCount, block);
+    
+    return block;
+}
+
+
+
+
+/**
+ * @brief Returns the byte size of the memory block holding all weight and bias arrays of a NN
+ * @param nn A pointer to the NN
+ */
+
+size_t getDenseBlockSize(const Network *nn){
+    
+    size_t blockSize = 0;
+    for (int l=1; l<nn->layerCount; l++){
+        blockSize += (size_t)nn->dense[l].ncount * nn->dense[l].stride + padToAlignment(nn->dense[l].ncount);
     }
     
-    return il;
+    return blockSize * sizeof(NNReal);
 }
 
 
 
+
 /**
- * @details Creates a layer and sets all weights to random values [0-1]
- * @param nodeCount Number of nodes
- * @param weightCount Number of weights per node
+ * @brief Returns the arena fill level after reserving the vectors of a set of activations
+ * @param used Number of bytes used before the vectors
+ * @param layerCount Number of layers
+ * @param ncount Number of nodes per layer
  */
 
-Layer *createLayer(int nodeCount, int weightCount){
+size_t reserveActivations(size_t used, int layerCount, const int *ncount){
+    
+    // One output vector per layer plus one delta vector per HIDDEN/OUTPUT layer
+    size_t blockSize = 0;
+    for (int l=0; l<layerCount; l++) blockSize += padToAlignment(ncount[l]);
+    for (int l=1; l<layerCount; l++) blockSize += padToAlignment(ncount[l]);
     
-    int nodeSize = sizeof(Node) + (weightCount * sizeof(double));
-    Layer *l = (Layer*)malloc(sizeof(Layer) + (nodeCount*nodeSize));
+    used = reserveArenaSize(used, blockSize * sizeof(NNReal), NN_ALIGNMENT);
     
-    l->ncount = nodeCount;
+    return reserveArenaSize(used, ncount[INPUT] * sizeof(int), sizeof(int));
+}
+
+
+
+
+/**
+ * @brief Allocates the aligned output vectors of a set of activations for the given NN from an arena
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations to be set up
+ * @param arena A pointer to the arena (with the space reserved via reserveActivations())
+ */
+
+void initActivations(const Network *nn, Activations *a, Arena *arena){
     
-    // create a detault node
-    Node *dn = (Node*)malloc(sizeof(Node) + ((weightCount)*sizeof(double)));
-    dn->bias = 0;
-    dn->output = 0;
-    dn->wcount = weightCount;
-    for (int o=0;o<weightCount;o++) dn->weights[o] = 0; // will be initialized later
+    // One output vector per layer plus one delta vector per HIDDEN/OUTPUT layer
+    size_t blockSize = 0;
+    for (int l=0; l<nn->layerCount; l++) blockSize += padToAlignment(nn->dense[l].ncount);
+    for (int l=1; l<nn->layerCount; l++) blockSize += padToAlignment(nn->dense[l].ncount);
     
-    uint8_t *sbptr = (uint8_t*) l->nodes;     // single byte pointer
+    a->arena = arena;
+    a->block = (NNReal*)allocArena(arena, blockSize * sizeof(NNReal), NN_ALIGNMENT);
     
-    // copy the default cell to all cell positions in the layer
-    for (int i=0;i<nodeCount;i++) memcpy(sbptr+(i*nodeSize),dn,nodeSize);
+    NNReal *ptr = a->block;
+    for (int l=0; l<nn->layerCount; l++){
+        a->output[l] = ptr;
+        ptr += padToAlignment(nn->dense[l].ncount);
+    }
+    a->delta[INPUT] = NULL;
+    for (int l=1; l<nn->layerCount; l++){
+        a->delta[l] = ptr;
+        ptr += padToAlignment(nn->dense[l].ncount);
+    }
     
-    free(dn);
+    a->active = (int*)allocArena(arena, nn->dense[INPUT].ncount * sizeof(int), sizeof(int));
+    a->activeCount = -1;
     
-    return l;
 }
 
 
 
 
 /**
- * @brief Initializes the NN by creating and copying INTPUT, HIDDEN, OUTPUT data structures into the NN's memory space
+ * @brief Creates a set of activations (one output vector per layer) for the given NN
  * @param nn A pointer to the NN
- * @param inpCount Number of nodes in the INPUT layer
- * @param hidCount Number of nodes in the HIDDEN layer
- * @param outCount Number of nodes in the OUTPUT layer
  */
 
-void initNetwork(Network *nn, int inpCount, int hidCount, int outCount){
+Activations *createActivations(const Network *nn){
+    
+    int ncount[NN_MAX_LAYERS];
+    for (int l=0; l<nn->layerCount; l++) ncount[l] = nn->dense[l].ncount;
+    
+    // The activations and their vectors share one arena (= one heap allocation)
+    size_t arenaSize = reserveArenaSize(0, sizeof(Activations), NN_ALIGNMENT);
+    arenaSize = reserveActivations(arenaSize, nn->layerCount, ncount);
+    Arena *arena = createArena(arenaSize);
+    
+    Activations *a = (Activations*)allocArena(arena, sizeof(Activations), NN_ALIGNMENT);
     
-    // Copy the input layer into the network's memory block and delete it
-    Layer *il = createInputLayer(inpCount);
-    memcpy(nn->layers,il,nn->inpLayerSize);
-    free(il);
+    initActivations(nn, a, arena);
     
-    // Move pointer to end of input layer = beginning of hidden layer
-    uint8_t *sbptr = (uint8_t*) nn->layers;     // single byte pointer
-    sbptr += nn->inpLayerSize;
+    return a;
+}
+
+
+
+
+/**
+ * @brief Frees a set of activations created via createActivations()
+ * @param a A pointer to the activations
+ */
+
+void freeActivations(Activations *a){
     
-    // Copy the hidden layer into the network's memory block and delete it
-    Layer *hl = createLayer(hidCount, inpCount);
-    memcpy(sbptr,hl,nn->hidLayerSize);
-    free(hl);
+    freeArena(a->arena);
     
-    // Move pointer to end of hidden layer = beginning of output layer
-    sbptr += nn->hidLayerSize;
+}
+
+
+
+
+/**
+ * @brief Returns the default learning rate of a NN whose layers use a given activation function type
+ * @param actFct Type of the activation function (SIGMOID or TANH)
+ */
+
+double getDefaultLearningRate(ActFctType actFct){
     
-    // Copy the output layer into the network's memory block and delete it
-    Layer *ol = createLayer(outCount, hidCount);
-    memcpy(sbptr,ol,nn->outLayerSize);
-    free(ol);
+    if (actFct==TANH) return 0.004;     // TANH 89.0%
     
+    return 0.2;                         // SIGMOID 91.5%
 }
 
 
@@ -451,8 +718,11 @@ void setNetworkDefaults(Network *nn){
     nn->hidLayerActType = SIGMOID;
     nn->outLayerActType = SIGMOID;
     
-    nn->learningRate    = 0.004;    // TANH 78.0%
-    nn->learningRate    = 0.2;      // SIGMOID 91.5%
+    nn->learningRate    = getDefaultLearningRate(nn->hidLayerActType);
+    
+    nn->actPrecision    = ACT_EXACT;
+    
+    nn->usePreUpdateWeights = 0;
     
 }
 
@@ -461,40 +731,125 @@ void setNetworkDefaults(Network *nn){
 
 /**
  * @brief Initializes a layer's weights with random values
+ * @details TANH saturates at much smaller net inputs than SIGMOID, so the weights of a TANH layer are scaled
+ * by its fan-in (variance 1/wcount). Otherwise the derivative 1-out^2 is close to 0 from the start.
  * @param nn A pointer to the NN
- * @param ltype Defining what layer to initialize
+ * @param layer Index of the layer to initialize
  */
 
-void initWeights(Network *nn, LayerType ltype){
+void initWeights(Network *nn, int layer){
     
-    int nodeSize = 0;
-    if (ltype==HIDDEN) nodeSize=nn->hidNodeSize;
-                  else nodeSize=nn->outNodeSize;
+    DenseLayer *l = &nn->dense[layer];
     
-    Layer *l = getLayer(nn, ltype);
-    
-    uint8_t *sbptr = (uint8_t*) l->nodes;
+    double weightScale = 0.7;
+    double biasScale   = 1;
+    if (getActFctType(nn, layer)==TANH){
+        weightScale = sqrt(3.0 / l->wcount);
+        biasScale   = weightScale;
+    }
     
     for (int o=0; o<l->ncount;o++){
     
-        Node *n = (Node *)sbptr;
+        NNReal *weights = l->weights + (size_t)o * l->stride;
         
-        for (int i=0; i<n->wcount; i++){
-            n->weights[i] = 0.7*(rand()/(double)(RAND_MAX));
-            if (i%2) n->weights[i] = -n->weights[i];  // make half of the weights negative
+        for (int i=0; i<l->wcount; i++){
+            weights[i] = weightScale*(rand()/(double)(RAND_MAX));
+            if (i%2) weights[i] = -weights[i];  // make half of the weights negative
         }
         
         // init bias weight
-        n->bias =  rand()/(double)(RAND_MAX);
-        if (o%2) n->bias = -n->bias;  // make half of the bias weights negative
+        l->bias[o] =  biasScale*(rand()/(double)(RAND_MAX));
+        if (o%2) l->bias[o] = -l->bias[o];  // make half of the bias weights negative
         
-        sbptr += nodeSize;
     }
     
 }
 
 
 
+
+/**
+ * @brief Initializes the weights of all layers with random values, according to their activation function types
+ * @param nn A pointer to the NN
+ */
+
+void initNetworkWeights(Network *nn){
+    
+    for (int l=1; l<nn->layerCount; l++) initWeights(nn, l);
+    
+}
+
+
+
+/**
+ * @brief Creates a NN with its Layer/Node view and activations in a single arena
+ * @details The NN, its view and its activations are constructed in place. If withDenseBlock is set, the
+ * arena has room for the dense arrays as well, to be allocated via createDenseLayers(nn->arena, ...).
+ * @param layerCount Number of layers (INPUT, HIDDEN layers, OUTPUT), 2 to NN_MAX_LAYERS
+ * @param ncount Number of nodes per layer, from INPUT to OUTPUT
+ * @param withDenseBlock 1 = reserve space for the dense arrays in the arena
+ */
+
+Network *createNetworkInArena(int layerCount, const int *ncount, int withDenseBlock){
+    
+    if (layerCount<2 || layerCount>NN_MAX_LAYERS){
+        printf("Abort! A network needs 2 to %d layers (not %d)\n", NN_MAX_LAYERS, layerCount);
+        exit(1);
+    }
+    
+    // Calculate the size of every layer (the INPUT layer has 0 weights)
+    int nodeSize[NN_MAX_LAYERS];
+    int layerSize[NN_MAX_LAYERS];
+    size_t viewSize = 0;
+    for (int l=0; l<layerCount; l++){
+        int weightsCount = (l==0) ? 0 : ncount[l-1];
+        nodeSize[l]  = sizeof(Node) + (weightsCount * sizeof(NNReal));
+        layerSize[l] = sizeof(Layer) + (ncount[l] * nodeSize[l]);
+        viewSize    += layerSize[l];
+    }
+    
+    // Plan the arena: the network and its view, the activations, then the dense arrays
+    size_t arenaSize = reserveArenaSize(0, sizeof(Network) + viewSize, NN_ALIGNMENT);
+    arenaSize = reserveActivations(arenaSize, layerCount, ncount);
+    if (withDenseBlock) arenaSize = reserveDenseLayers(arenaSize, layerCount, ncount);
+    
+    // Allocate the memory block for the network (zero-initialized)
+    Arena *arena = createArena(arenaSize);
+    Network *nn = (Network*)allocArena(arena, sizeof(Network) + viewSize, NN_ALIGNMENT);
+    nn->arena = arena;
+    
+    // Set/remember byte sizes of each component of the network
+    nn->layerCount = layerCount;
+    for (int l=0; l<layerCount; l++){
+        nn->nodeSize[l]  = nodeSize[l];
+        nn->layerSize[l] = layerSize[l];
+    }
+    
+    // Initialize the INPUT, HIDDEN and OUTPUT layers inside of it
+    initNetwork(nn, ncount);
+    
+    // The dense arrays are set up by the caller, but their sizes are needed for the activations
+    initDenseLayers(nn->dense, layerCount, ncount);
+    nn->denseBlock = NULL;
+    nn->denseMap = NULL;
+    nn->denseMapSize = 0;
+    initActivations(nn, &nn->act, arena);
+    
+    // Setting defaults
+    setNetworkDefaults(nn);
+    
+    // Select the kernels before the NN (or any thread using it) runs them
+    initKernels();
+    
+    // Use the compile-time specialized forward pass if there is one for this topology
+    nn->fixedTopology = findFixedTopology(layerCount, ncount);
+    
+    return nn;
+}
+
+
+
+
 /**
  * @brief Creates a dynamically-sized, 3-layer (INTPUT, HIDDEN, OUTPUT) neural network
  * @param inpCount Number of nodes in the INPUT layer
@@ -504,42 +859,121 @@ void initWeights(Network *nn, LayerType ltype){
 
 Network *createNetwork(int inpCount, int hidCount, int outCount){
     
-    // Calculate size of INPUT Layer
-    int inpNodeSize     = sizeof(Node);         // Input layer has 0 weights
-    int inpLayerSize    = sizeof(Layer) + (inpCount * inpNodeSize);
+    int ncount[3] = {inpCount, hidCount, outCount};
     
-    // Calculate size of HIDDEN Layer
-    int hidWeightsCount = inpCount;
-    int hidNodeSize     = sizeof(Node) + (hidWeightsCount * sizeof(double));
-    int hidLayerSize    = sizeof(Layer) + (hidCount * hidNodeSize);
+    return createDeepNetwork(3, ncount);
+}
+
+
+
+
+/**
+ * @brief Creates a dynamically-sized neural network with any number of HIDDEN layers
+ * @param layerCount Number of layers (INPUT, HIDDEN layers, OUTPUT), 2 to NN_MAX_LAYERS
+ * @param ncount Number of nodes per layer, from INPUT to OUTPUT
+ */
+
+Network *createDeepNetwork(int layerCount, const int *ncount){
     
-    // Calculate size of OUTPUT Layer
-    int outWeightsCount = hidCount;
-    int outNodeSize     = sizeof(Node) + (outWeightsCount * sizeof(double));
-    int outLayerSize    = sizeof(Layer) + (outCount * outNodeSize);
+    Network *nn = createNetworkInArena(layerCount, ncount, 1);
     
-    // Allocate memory block for the network
-    Network *nn = (Network*)malloc(sizeof(Network) + inpLayerSize + hidLayerSize + outLayerSize);
+    // Allocate the contiguous weight, bias and output arrays the network computes on (reserved in the NN's arena)
+    nn->denseBlock = createDenseLayers(nn->arena, nn->dense, layerCount, ncount);
     
-    // Set/remember byte sizes of each component of the network
-    nn->inpNodeSize     = inpNodeSize;
-    nn->inpLayerSize    = inpLayerSize;
-    nn->hidNodeSize     = hidNodeSize;
-    nn->hidLayerSize    = hidLayerSize;
-    nn->outNodeSize     = outNodeSize;
-    nn->outLayerSize    = outLayerSize;
+    // Init connection weights with random values, layer by layer from the first HIDDEN layer to OUTPUT
+    initNetworkWeights(nn);
     
-    // Initialize the network by creating the INPUT, HIDDEN and OUTPUT layer inside of it
-    initNetwork(nn, inpCount, hidCount, outCount);
+    syncNetworkView(nn);
     
-    // Setting defaults
-    setNetworkDefaults(nn);
+    return nn;
+}
+
+
+
+
+/**
+ * @brief Creates a NN with its Layer/Node view and activations, but without dense weight arrays
+ * @details The caller has to set up nn->dense and nn->denseBlock (and nn->denseMap if the block is an mmap).
+ * @param layerCount Number of layers (INPUT, HIDDEN layers, OUTPUT), 2 to NN_MAX_LAYERS
+ * @param ncount Number of nodes per layer, from INPUT to OUTPUT
+ */
+
+Network *createEmptyNetwork(int layerCount, const int *ncount){
+    
+    return createNetworkInArena(layerCount, ncount, 0);
+}
+
+
+
+
+/**
+ * @brief Creates a copy of a NN (weights and settings) that can be trained independently of the original
+ * @param nn A pointer to the NN
+ */
+
+Network *copyNetwork(const Network *nn){
     
-    // Init connection weights with random values
-    initWeights(nn, HIDDEN);
-    initWeights(nn, OUTPUT);
+    int ncount[NN_MAX_LAYERS];
+    for (int l=0; l<nn->layerCount; l++) ncount[l] = nn->dense[l].ncount;
+    
+    Network *copy = createNetworkInArena(nn->layerCount, ncount, 1);
+    copy->denseBlock = createDenseLayers(copy->arena, copy->dense, copy->layerCount, ncount);
+    memcpy(copy->denseBlock, nn->denseBlock, getDenseBlockSize(nn));
+    
+    copy->learningRate        = nn->learningRate;
+    copy->hidLayerActType     = nn->hidLayerActType;
+    copy->outLayerActType     = nn->outLayerActType;
+    copy->actPrecision        = nn->actPrecision;
+    copy->usePreUpdateWeights = nn->usePreUpdateWeights;
+    
+    syncNetworkView(copy);
+    
+    return copy;
+}
+
+
+
+
+/**
+ * @brief Frees all memory held by a NN created via createNetwork()
+ * @param nn A pointer to the NN
+ */
+
+void freeNetwork(Network *nn){
+    
+    // The dense arrays of a NN loaded from a checkpoint live in the file mapping, everything else in the arena
+    if (nn->denseMap!=NULL) munmap(nn->denseMap, nn->denseMapSize);
+    freeArena(nn->arena);
+    
+}
+
+
+
+
+/**
+ * @brief Copies the weights, biases and outputs of the dense layers into the network's Layer/Node view
+ * @param nn A pointer to the NN
+ */
+
+void syncNetworkView(Network *nn){
+    
+    for (int l=0; l<nn->layerCount; l++){
+        
+        DenseLayer *dl = &nn->dense[l];
+        Layer *layer = getLayer(nn, l);
+        
+        for (int i=0; i<dl->ncount; i++){
+            
+            Node *node = getNode(layer, i);
+            
+            node->output = nn->act.output[l][i];
+            if (l==INPUT) continue;
+            
+            node->bias = dl->bias[i];
+            memcpy(node->weights, dl->weights + (size_t)i * dl->stride, dl->wcount * sizeof(NNReal));
+        }
+    }
     
-    return nn;
 }
 
 
@@ -552,21 +986,38 @@ Network *createNetwork(int inpCount, int hidCount, int outCount){
 
 int getNetworkClassification(Network *nn){
     
-    Layer *l = getLayer(nn, OUTPUT);
+    return getActivationsClassification(nn, &nn->act);
+}
+
+
+
+
+/**
+ * @brief Returns the classification of a sample using the ID of the output node with the highest output
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations of the sample (after feedForwardActivations())
+ */
+
+int getActivationsClassification(const Network *nn, const Activations *a){
+    
+    PROFILE_START(startTime);
+    
+    int out = getOutputLayer(nn);
+    const NNReal *output = a->output[out];
     
-    double maxOut = 0;
+    NNReal maxOut = 0;
     int maxInd = 0;
     
-    for (int i=0; i<l->ncount; i++){
+    for (int i=0; i<nn->dense[out].ncount; i++){
         
-        Node *on = getNode(l,i);
-
-        if (on->output > maxOut){
-            maxOut = on->output;
+        if (output[i] > maxOut){
+            maxOut = output[i];
             maxInd = i;
         }
     }
     
+    PROFILE_STOP(PROFILE_CLASSIFY, startTime);
+    
     return maxInd;
 }
 
@@ -585,9 +1036,12 @@ void displayNetworkWeightsForDebugging(Network *nn){
     // only print the first x and last x nodes/connections (to improve legible rendering in the console screen)
     int topLast = 6;
     
+    // the Layer/Node view is not updated by training, so refresh it from the dense layers
+    syncNetworkView(nn);
+    
     for (int l=1; l<2;l++){
         
-        Layer *layer = getLayer(nn, OUTPUT);
+        Layer *layer = getLayer(nn, getOutputLayer(nn));
         
         printf("Layer %d   Weights\n\n",l);
         
@@ -617,7 +1071,7 @@ void displayNetworkWeightsForDebugging(Network *nn){
                 for (int c=0; c<connCount; c++){
                     
                     // Dereference the weightPointer to validate its pointing to a valid weight
-                    double w = node->weights[c];
+                    NNReal w = node->weights[c];
                     
                     if (c<topLast || c>=connCount-topLast) printf("%5d:%9f",c,w);
                 }
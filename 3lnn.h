@@ -1,21 +1,48 @@
 /**
  * @file 3lnn.h
- * @brief Neural network functionality for a 3-layer (INPUT, HIDDEN, OUTPUT) feed-forward, back-prop NN
+ * @brief Neural network functionality for a multi-layer (INPUT, HIDDEN..., OUTPUT) feed-forward, back-prop NN
+ * @details Layers are indexed from 0 (INPUT) to layerCount-1 (OUTPUT), all layers in between are HIDDEN layers.
+ * The names of the LayerType enum are the indices of the original 3-layer network.
  * @author Matt Lind
  * @date August 2015
  */
 
+#ifndef MNIST_3LNN_H
+#define MNIST_3LNN_H
 
+#include <stddef.h>
+#include <stdint.h>
 
+#include "util/arena.h"
 
 
 typedef struct Network Network;
 typedef struct Layer Layer;
 typedef struct Node Node;
 typedef struct Vector Vector;
+typedef struct DenseLayer DenseLayer;
+typedef struct Activations Activations;
 
 typedef enum LayerType {INPUT, HIDDEN, OUTPUT} LayerType;
 typedef enum ActFctType {SIGMOID, TANH} ActFctType;
+typedef enum ActPrecision {ACT_EXACT, ACT_APPROX, ACT_TABLE} ActPrecision;
+
+
+#define NN_ALIGNMENT 64                                     ///< Byte alignment of all dense weight, bias and output arrays (=1 cache line)
+#define NN_MAX_LAYERS 8                                     ///< Maximum number of layers (INPUT + up to 6 HIDDEN + OUTPUT)
+
+
+/**
+ * @brief Numeric type of all weights, biases, inputs and outputs of the NN
+ * @details Selected at compile time: double by default (the reference), float if built with NN_FLOAT32
+ * (make PRECISION=float), which doubles the number of values per SIMD register and halves the memory traffic.
+ */
+
+#ifdef NN_FLOAT32
+typedef float NNReal;
+#else
+typedef double NNReal;
+#endif
 
 
 
@@ -26,7 +53,7 @@ typedef enum ActFctType {SIGMOID, TANH} ActFctType;
 
 struct Vector{
     int size;
-    double vals[];
+    NNReal vals[];
 };
 
 
@@ -37,10 +64,10 @@ struct Vector{
  */
 
 struct Node{
-    double bias;
-    double output;
+    NNReal bias;
+    NNReal output;
     int wcount;
-    double weights[];
+    NNReal weights[];
 };
 
 
@@ -56,20 +83,67 @@ struct Layer{
 };
 
 
+/**
+ * @brief Contiguous (structure-of-arrays) data structure holding a layer's weights and biases
+ * @details Row i of the weight matrix holds the weights of node i. Rows are padded to a multiple
+ * of NN_ALIGNMENT bytes so that every row starts on a cache line.
+ */
+
+struct DenseLayer{
+    int ncount;                 ///< Number of nodes in the layer
+    int wcount;                 ///< Number of weights per node (=number of nodes in the previous layer)
+    int stride;                 ///< Number of values from one row of the weight matrix to the next
+    NNReal *weights;            ///< Row-major ncount x stride weight matrix (NULL for the INPUT layer)
+    NNReal *bias;               ///< ncount bias weights (NULL for the INPUT layer)
+};
+
+
+
+
+/**
+ * @brief Data structure holding the output values (activations) of all layers for one sample
+ * @details Activations are kept apart from the weights, so several threads can feed samples through the
+ * same network at the same time, each one using its own Activations.
+ * The input values are to be set via one of the feedInput...Activations() functions, which also record the
+ * indices of the non-zero inputs. If only few inputs are non-zero (as in a binarized MNIST image), the
+ * first HIDDEN layer is calculated and updated from these indices only.
+ */
+
+struct Activations{
+    NNReal *output[NN_MAX_LAYERS];  ///< Output values per layer (layer 0 = INPUT holds the input values)
+    NNReal *delta[NN_MAX_LAYERS];   ///< Error signals per layer during back propagation (NULL for INPUT)
+    NNReal *block;              ///< Single NN_ALIGNMENT-aligned memory block holding all output and delta vectors
+    int *active;                ///< Ascending indices of the non-zero INPUT values
+    int activeCount;            ///< Number of indices in active (-1 = unknown, the input is treated as dense)
+    Arena *arena;               ///< Arena holding block and active (owned by the activations if created via createActivations())
+};
+
+
+
+
 /**
  * @brief Dynamic data structure holding the whole network
+ * @details All computation runs on the DenseLayer arrays. The Layer/Node view in layers[]
+ * is kept for inspection and is only refreshed by syncNetworkView(). The activations in act
+ * are used by the single-sample API (feedInput, feedForwardNetwork, backPropagateNetwork).
  */
 
 struct Network{
-    int inpNodeSize;
-    int inpLayerSize;
-    int hidNodeSize;
-    int hidLayerSize;
-    int outNodeSize;
-    int outLayerSize;
+    int layerCount;                  ///< Number of layers (INPUT, HIDDEN layers, OUTPUT), at least 2
+    int nodeSize[NN_MAX_LAYERS];     ///< Byte size of one Node per layer in the Layer/Node view
+    int layerSize[NN_MAX_LAYERS];    ///< Byte size of one Layer in the Layer/Node view
     double learningRate;         ///< Factor by which connection weight changes are applied
-    ActFctType hidLayerActType;
+    ActFctType hidLayerActType;  ///< Activation function of all HIDDEN layers
     ActFctType outLayerActType;
+    ActPrecision actPrecision;   ///< How the activation functions are evaluated (libm, rational approximation, lookup table)
+    int usePreUpdateWeights;     ///< 1 = propagate the hidden error through the output weights from before the sample's update (exact gradient)
+    DenseLayer dense[NN_MAX_LAYERS];  ///< Dense layers, from INPUT (0) to OUTPUT (layerCount-1)
+    int fixedTopology;           ///< Index of the forward pass specialized for this topology (-1 = generic, see 3lnn-fixed.h)
+    NNReal *denseBlock;          ///< Single NN_ALIGNMENT-aligned memory block holding all dense arrays
+    void *denseMap;              ///< File mapping holding denseBlock (NULL if denseBlock was allocated)
+    size_t denseMapSize;         ///< Byte size of denseMap
+    Activations act;             ///< Output values of the last sample fed through the single-sample API
+    Arena *arena;                ///< Arena holding the NN itself, its Layer/Node view, act and (unless mapped) denseBlock
     Layer layers[];
 };
 
@@ -88,6 +162,190 @@ Network *createNetwork(int inpCount, int hidCount, int outCount);
 
 
 
+/**
+ * @brief Creates a dynamically-sized neural network with any number of HIDDEN layers
+ * @param layerCount Number of layers (INPUT, HIDDEN layers, OUTPUT), 2 to NN_MAX_LAYERS
+ * @param ncount Number of nodes per layer, from INPUT to OUTPUT
+ */
+
+Network *createDeepNetwork(int layerCount, const int *ncount);
+
+
+
+
+/**
+ * @brief Initializes the weights of all layers with random values (again)
+ * @details The scale of the weights depends on the activation function type of each layer, so a NN whose
+ * types are changed after it was created is initialized again before it is trained.
+ * @param nn A pointer to the NN
+ */
+
+void initNetworkWeights(Network *nn);
+
+
+
+
+/**
+ * @brief Returns the default learning rate of a NN whose layers use a given activation function type
+ * @details The derivative of TANH reaches 1 instead of 1/4, so TANH layers get up to 4 times larger gradients
+ * and diverge at the SIGMOID rate.
+ * @param actFct Type of the activation function (SIGMOID or TANH)
+ */
+
+double getDefaultLearningRate(ActFctType actFct);
+
+
+
+
+/**
+ * @brief Creates a NN with its Layer/Node view and activations, but without dense weight arrays
+ * @details Sets the node counts and strides of nn->dense. The caller has to point the weight and bias
+ * arrays to a memory block (see setDenseLayersBlock()) and set nn->denseBlock (and nn->denseMap).
+ * @param layerCount Number of layers (INPUT, HIDDEN layers, OUTPUT), 2 to NN_MAX_LAYERS
+ * @param ncount Number of nodes per layer, from INPUT to OUTPUT
+ */
+
+Network *createEmptyNetwork(int layerCount, const int *ncount);
+
+
+
+
+/**
+ * @brief Creates a copy of a NN (weights and settings) that can be trained independently of the original
+ * @param nn A pointer to the NN
+ */
+
+Network *copyNetwork(const Network *nn);
+
+
+
+
+/**
+ * @brief Sets the node counts and row strides of a stack of dense layers
+ * @return Number of values of the memory block holding all of their weight and bias arrays
+ * @param dense Array of layerCount dense layers, from INPUT to OUTPUT
+ * @param layerCount Number of layers
+ * @param ncount Number of nodes per layer
+ */
+
+size_t initDenseLayers(DenseLayer *dense, int layerCount, const int *ncount);
+
+
+
+
+/**
+ * @brief Points the weight and bias arrays of a stack of dense layers into a memory block
+ * @param dense Array of layerCount dense layers, set up via initDenseLayers()
+ * @param layerCount Number of layers
+ * @param block NN_ALIGNMENT-aligned memory block of the size returned by initDenseLayers()
+ */
+
+void setDenseLayersBlock(DenseLayer *dense, int layerCount, NNReal *block);
+
+
+
+
+/**
+ * @brief Returns the arena fill level after reserving the memory block of a stack of dense layers
+ * @param used Number of bytes used before the block
+ * @param layerCount Number of layers
+ * @param ncount Number of nodes per layer
+ */
+
+size_t reserveDenseLayers(size_t used, int layerCount, const int *ncount);
+
+
+
+
+/**
+ * @brief Allocates an aligned memory block holding a stack of dense layers from an arena
+ * @details The returned block is zero-initialized and released together with the arena.
+ * @param arena A pointer to the arena (with the space reserved via reserveDenseLayers())
+ * @param dense Array of layerCount dense layers that are set up to point into the block
+ * @param layerCount Number of layers
+ * @param ncount Number of nodes per layer
+ */
+
+NNReal *createDenseLayers(Arena *arena, DenseLayer *dense, int layerCount, const int *ncount);
+
+
+
+
+/**
+ * @brief Returns the byte size of the memory block holding all weight and bias arrays of a NN
+ * @param nn A pointer to the NN
+ */
+
+size_t getDenseBlockSize(const Network *nn);
+
+
+
+
+/**
+ * @brief Returns the index of the OUTPUT layer (= layerCount-1)
+ * @param nn A pointer to the NN
+ */
+
+static inline int getOutputLayer(const Network *nn){
+    return nn->layerCount - 1;
+}
+
+
+
+
+/**
+ * @brief Returns the number of values needed to store count values padded to full NN_ALIGNMENT bytes
+ * @param count Number of values
+ */
+
+int padToAlignment(int count);
+
+
+
+
+/**
+ * @brief Returns the activation function type used by a given layer
+ * @param nn A pointer to the NN
+ * @param layer Index of the layer (1 to layerCount-1)
+ */
+
+ActFctType getActFctType(const Network *nn, int layer);
+
+
+
+
+/**
+ * @brief Returns the result of applying the given outputValue to the derivate of the activation function
+ * @param nn A pointer to the NN
+ * @param layer Index of the layer (1 to layerCount-1)
+ * @param outVal Output value that is to be back propagated
+ */
+
+NNReal getActFctDerivative(const Network *nn, int layer, NNReal outVal);
+
+
+
+
+/**
+ * @brief Frees all memory held by a NN created via createNetwork()
+ * @param nn A pointer to the NN
+ */
+
+void freeNetwork(Network *nn);
+
+
+
+
+/**
+ * @brief Copies the weights, biases and outputs of the dense layers into the network's Layer/Node view
+ * @param nn A pointer to the NN
+ */
+
+void syncNetworkView(Network *nn);
+
+
+
+
 /**
  * @brief Feeds some Vector data into the INPUT layer of the NN
  * @param nn A pointer to the NN
@@ -100,7 +358,7 @@ void feedInput(Network *nn, Vector *v);
 
 
 /**
- * @brief Feeds input layer values forward to hidden to output layer (calculation and activation fct)
+ * @brief Feeds input layer values forward through all hidden layers to the output layer (calculation and activation fct)
  * @param nn A pointer to the NN
  */
 
@@ -110,7 +368,7 @@ void feedForwardNetwork(Network *nn);
 
 
 /**
- * @brief Back propagates network error from output layer to hidden layer
+ * @brief Back propagates network error from output layer through all hidden layers
  * @param nn A pointer to the NN
  * @param targetClassification Correct classification (=label) of the input stream
  */
@@ -130,5 +388,157 @@ int getNetworkClassification(Network *nn);
 
 
 
+/**
+ * @brief Creates a set of activations (one output vector per layer) for the given NN
+ * @param nn A pointer to the NN
+ */
+
+Activations *createActivations(const Network *nn);
+
+
+
+
+/**
+ * @brief Frees a set of activations created via createActivations()
+ * @param a A pointer to the activations
+ */
+
+void freeActivations(Activations *a);
+
+
+
+
+/**
+ * @brief Copies some Vector data into the INPUT layer values of a set of activations
+ * @param a A pointer to the activations
+ * @param v A pointer to a vector
+ */
+
+void feedInputActivations(Activations *a, Vector *v);
+
+
+
+
+/**
+ * @brief Copies an array of input values into the INPUT layer values of a set of activations
+ * @param a A pointer to the activations
+ * @param input Input values
+ * @param count Number of input values
+ */
+
+void feedInputValuesActivations(Activations *a, const NNReal *input, int count);
+
+
+
+
+/**
+ * @brief Sets the INPUT layer values of a set of activations from a bitset (bit set = 1, bit clear = 0)
+ * @param a A pointer to the activations
+ * @param bits Bitset holding one bit per input value, starting at the lowest bit of bits[0]
+ * @param count Number of input values
+ */
+
+void feedInputBitsetActivations(Activations *a, const uint64_t *bits, int count);
+
+
+
+
+/**
+ * @brief Sets the INPUT layer values of the NN from a bitset (bit set = 1, bit clear = 0)
+ * @param nn A pointer to the NN
+ * @param bits Bitset holding one bit per INPUT node, starting at the lowest bit of bits[0]
+ */
+
+void feedInputBitset(Network *nn, const uint64_t *bits);
+
+
+
+
+/**
+ * @brief Sets the INPUT layer values of a set of activations from gray values (0 to 255 -> 0 to 1)
+ * @param a A pointer to the activations
+ * @param pixel One gray value per input value
+ * @param count Number of input values
+ */
+
+void feedInputPixelsActivations(Activations *a, const uint8_t *pixel, int count);
+
+
+
+
+/**
+ * @brief Sets the INPUT layer values of the NN from gray values (0 to 255 -> 0 to 1)
+ * @param nn A pointer to the NN
+ * @param pixel One gray value per INPUT node
+ */
+
+void feedInputPixels(Network *nn, const uint8_t *pixel);
+
+
+
+
+/**
+ * @brief Feeds the input values held in a set of activations forward through all layers
+ * @details Uses the specialized forward pass of the NN's topology if it has one (see 3lnn-fixed.h).
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations holding the input values
+ */
+
+void feedForwardActivations(const Network *nn, Activations *a);
+
+
+
+
+/**
+ * @brief Calculates the output values of one layer of the NN from the outputs of the layer below
+ * @details The first HIDDEN layer only visits the non-zero inputs if isInputSparse() is true.
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations the layer's output values are written to
+ * @param layer Index of the layer (1 to layerCount-1)
+ */
+
+void calcLayer(const Network *nn, Activations *a, int layer);
+
+
+
+
+/**
+ * @brief Returns 1 if the INPUT values of a set of activations are sparse enough to use their index list
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations
+ */
+
+int isInputSparse(const Network *nn, const Activations *a);
+
+
+
+
+/**
+ * @brief Back propagates the error of a sample whose activations are held outside of the NN
+ * @details Weights are updated in place, so several threads may call this concurrently on the same NN
+ * (with their own activations) for lock-free asynchronous (Hogwild) training.
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations of the sample (after feedForwardActivations())
+ * @param targetClassification Correct classification (=label) of the input stream
+ */
+
+void backPropagateActivations(Network *nn, Activations *a, int targetClassification);
+
+
+
+
+/**
+ * @brief Returns the classification of a sample using the ID of the output node with the highest output
+ * @param nn A pointer to the NN
+ * @param a A pointer to the activations of the sample (after feedForwardActivations())
+ */
+
+int getActivationsClassification(const Network *nn, const Activations *a);
+
+
+
+
 void displayNetworkWeightsForDebugging(Network *nn);
 
+
+#endif
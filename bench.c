@@ -0,0 +1,473 @@
+/**
+ * @file bench.c
+ * @brief Micro- and macro-benchmarks of the NN, built and run via "make bench"
+ * @details Micro-benchmarks time single kernels (layer kernels, forward pass, back propagation, activation
+ * functions, data set loading) in a tight loop. Macro-benchmarks time whole passes over the MNIST files:
+ * training and inference throughput, the latency distribution of single-sample inference and the training
+ * time until the test accuracy reaches fixed targets. Every micro-benchmark is repeated and reports the
+ * median and minimum of its repetitions. The weights are initialized from the default state of rand(),
+ * so the networks (and the accuracies) are the same as in a default run of mnist-3lnn.
+ * All results are written as a single JSON object.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util/mnist-utils.h"
+#include "util/mnist-dataset.h"
+#include "3lnn.h"
+#include "3lnn-kernels.h"
+#include "3lnn-inference.h"
+
+
+#define BENCH_HIDDEN_NODES 20           ///< HIDDEN layer of the benchmarked network (same as mnist-3lnn's default)
+#define BENCH_UPDATE_NODES 512         ///< HIDDEN layer of the weight update benchmarks (a large layer, where the update dominates training)
+#define BENCH_UPDATE_BATCH 32           ///< Number of samples of the rank-B weight update benchmark
+#define BENCH_ACT_VALUES 1024           ///< Number of values per call of the activation benchmarks
+#define BENCH_TTA_CHUNK 2000            ///< Number of training images between two accuracy checks (time-to-accuracy)
+
+
+typedef void (*BenchFct)(void *arg);
+
+
+/**
+ * @brief State shared by the micro-benchmarks
+ */
+
+typedef struct BenchContext{
+    Network *nn;
+    Activations *act;               ///< Holds the (sparse) first training image
+    ActFctType actFct;
+    ActPrecision prec;
+    NNReal *actInput;               ///< BENCH_ACT_VALUES inputs of the activation benchmarks
+    NNReal *actOutput;
+    int label;                      ///< Label of the first training image
+    Network *wide;                  ///< Network with BENCH_UPDATE_NODES HIDDEN nodes
+    NNReal *updateInput;            ///< First BENCH_UPDATE_BATCH training images, one padded row per image
+    NNReal *updateDelta;            ///< BENCH_UPDATE_BATCH rows of error signals of the wide HIDDEN layer
+} BenchContext;
+
+
+/**
+ * @brief Writer of the JSON report, separating the benchmarks by commas
+ */
+
+typedef struct BenchReport{
+    FILE *out;
+    int count;                      ///< Number of benchmarks written so far
+} BenchReport;
+
+
+
+
+/**
+ * @details Returns the current value of the monotonic clock in nanoseconds
+ */
+
+double getTimeNs(void){
+    
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    
+    return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+
+
+
+/**
+ * @details Comparison function for qsort()
+ */
+
+int compareDouble(const void *a, const void *b){
+    
+    double x = *(const double*)a, y = *(const double*)b;
+    
+    return (x>y) - (x<y);
+}
+
+
+
+
+/**
+ * @details Returns the p-th percentile (0..100) of count sorted values (nearest rank)
+ */
+
+double getPercentile(const double *sorted, int count, double p){
+    
+    int i = (int)(p/100 * count + 0.5) - 1;
+    if (i<0) i = 0;
+    if (i>=count) i = count-1;
+    
+    return sorted[i];
+}
+
+
+
+
+/**
+ * @details Starts the next entry of the benchmarks array
+ */
+
+void beginBenchmark(BenchReport *r, const char *name, const char *type){
+    
+    fprintf(r->out, "%s\n    {\"name\": \"%s\", \"type\": \"%s\"", (r->count>0) ? "," : "", name, type);
+    r->count++;
+    
+}
+
+
+
+
+/**
+ * @details Runs a function iterations times per repetition and reports the median and minimum time per call
+ */
+
+void runMicroBenchmark(BenchReport *r, const char *name, BenchFct fct, void *arg, long iterations, int repetitions, double opsPerCall, const char *unit){
+    
+    double *times = (double*)malloc(repetitions * sizeof(double));
+    
+    // One untimed repetition warms up the caches and the branch predictors
+    for (long i=0; i<iterations; i++) fct(arg);
+    
+    for (int rep=0; rep<repetitions; rep++){
+        double start = getTimeNs();
+        for (long i=0; i<iterations; i++) fct(arg);
+        times[rep] = (getTimeNs() - start) / (iterations * opsPerCall);
+    }
+    
+    qsort(times, repetitions, sizeof(double), compareDouble);
+    
+    beginBenchmark(r, name, "micro");
+    fprintf(r->out, ", \"unit\": \"%s\", \"median\": %.3f, \"min\": %.3f, \"max\": %.3f, \"iterations\": %ld, \"repetitions\": %d}",
+            unit, getPercentile(times, repetitions, 50), times[0], times[repetitions-1], iterations, repetitions);
+    
+    free(times);
+}
+
+
+
+
+void benchHiddenDense(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    calcDenseLayer(&c->nn->dense[1], c->act->output[0], c->act->output[1], c->nn->hidLayerActType, c->nn->actPrecision);
+}
+
+
+
+void benchHiddenSparse(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    calcDenseLayerSparse(&c->nn->dense[1], c->act->output[0], c->act->active, c->act->activeCount, c->act->output[1], c->nn->hidLayerActType, c->nn->actPrecision);
+}
+
+
+
+void benchOutputLayer(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    calcDenseLayer(&c->nn->dense[2], c->act->output[1], c->act->output[2], c->nn->outLayerActType, c->nn->actPrecision);
+}
+
+
+
+void benchForward(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    feedForwardActivations(c->nn, c->act);
+}
+
+
+
+void benchBackPropagate(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    backPropagateActivations(c->nn, c->act, c->label);
+}
+
+
+
+void benchTrainStep(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    feedForwardActivations(c->nn, c->act);
+    backPropagateActivations(c->nn, c->act, c->label);
+}
+
+
+
+void benchUpdateSparse(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    DenseLayer *l = &c->wide->dense[1];
+    updateDenseLayer(l, 1e-9, c->updateDelta, c->act->output[0], c->act->active, c->act->activeCount, 0, l->ncount);
+}
+
+
+
+void benchUpdateDense(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    DenseLayer *l = &c->wide->dense[1];
+    updateDenseLayer(l, 1e-9, c->updateDelta, c->act->output[0], NULL, 0, 0, l->ncount);
+}
+
+
+
+void benchUpdateBatch(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    DenseLayer *l = &c->wide->dense[1];
+    updateDenseLayerBatch(l, 1e-9, c->updateDelta, l->ncount, c->updateInput, l->stride, BENCH_UPDATE_BATCH, 0, l->ncount);
+}
+
+
+
+void benchActivation(void *arg){
+    BenchContext *c = (BenchContext*)arg;
+    memcpy(c->actOutput, c->actInput, BENCH_ACT_VALUES * sizeof(NNReal));
+    activateVector(c->actFct, c->prec, BENCH_ACT_VALUES, c->actOutput);
+}
+
+
+
+void benchDatasetLoad(void *arg){
+    (void)arg;
+    MNIST_Dataset *ds = openMNISTDataset(MNIST_TRAINING_SET_IMAGE_FILE_NAME, MNIST_TRAINING_SET_LABEL_FILE_NAME);
+    binarizeMNISTDataset(ds);
+    closeMNISTDataset(ds);
+}
+
+
+
+
+/**
+ * @details Runs all micro-benchmarks on a network fed with the first training image
+ */
+
+void runMicroBenchmarks(BenchReport *r, const MNIST_Dataset *trainingSet, int repetitions){
+    
+    BenchContext c;
+    
+    srand(1);
+    c.nn = createNetwork(MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH, BENCH_HIDDEN_NODES, 10);
+    c.act = createActivations(c.nn);
+    c.label = getDatasetLabel(trainingSet, 0);
+    feedInputBitsetActivations(c.act, getDatasetBitset(trainingSet, 0), MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH);
+    
+    runMicroBenchmark(r, "layer.hidden.dense",  benchHiddenDense,  &c, 20000, repetitions, 1, "ns/call");
+    runMicroBenchmark(r, "layer.hidden.sparse", benchHiddenSparse, &c, 20000, repetitions, 1, "ns/call");
+    runMicroBenchmark(r, "layer.output",        benchOutputLayer,  &c, 200000, repetitions, 1, "ns/call");
+    runMicroBenchmark(r, "forward",             benchForward,      &c, 20000, repetitions, 1, "ns/call");
+    runMicroBenchmark(r, "backprop",            benchBackPropagate, &c, 20000, repetitions, 1, "ns/call");
+    runMicroBenchmark(r, "train.step",          benchTrainStep,    &c, 20000, repetitions, 1, "ns/call");
+    
+    // Weight updates of a large HIDDEN layer: 1 sample (sparse and dense input) and a batch of samples
+    int ncount[3] = {MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH, BENCH_UPDATE_NODES, 10};
+    c.wide = createDeepNetwork(3, ncount);
+    DenseLayer *wl = &c.wide->dense[1];
+    c.updateInput = (NNReal*)calloc((size_t)BENCH_UPDATE_BATCH * wl->stride, sizeof(NNReal));
+    c.updateDelta = (NNReal*)malloc((size_t)BENCH_UPDATE_BATCH * wl->ncount * sizeof(NNReal));
+    for (int s=0; s<BENCH_UPDATE_BATCH; s++){
+        const uint64_t *bits = getDatasetBitset(trainingSet, s);
+        for (int i=0; i<wl->wcount; i++) c.updateInput[(size_t)s * wl->stride + i] = (bits[i/64] >> (i%64)) & 1;
+    }
+    for (int i=0; i<BENCH_UPDATE_BATCH * wl->ncount; i++) c.updateDelta[i] = (NNReal)rand() / RAND_MAX - 0.5;
+    
+    runMicroBenchmark(r, "update.hidden.sparse", benchUpdateSparse, &c, 2000, repetitions, 1, "ns/call");
+    runMicroBenchmark(r, "update.hidden.dense",  benchUpdateDense,  &c, 2000, repetitions, 1, "ns/call");
+    runMicroBenchmark(r, "update.hidden.batch",  benchUpdateBatch,  &c, 200, repetitions, BENCH_UPDATE_BATCH, "ns/sample");
+    
+    free(c.updateDelta);
+    free(c.updateInput);
+    freeNetwork(c.wide);
+    
+    // Inputs spread over the range in which the activation functions are not yet saturated
+    c.actInput  = (NNReal*)malloc(BENCH_ACT_VALUES * sizeof(NNReal));
+    c.actOutput = (NNReal*)malloc(BENCH_ACT_VALUES * sizeof(NNReal));
+    for (int i=0; i<BENCH_ACT_VALUES; i++) c.actInput[i] = -8 + 16.0*i/BENCH_ACT_VALUES;
+    
+    const char *actNames[] = {"sigmoid", "tanh"};
+    const char *precNames[] = {"exact", "approx", "table"};
+    for (int f=SIGMOID; f<=TANH; f++){
+        for (int p=ACT_EXACT; p<=ACT_TABLE; p++){
+            char name[64];
+            snprintf(name, sizeof(name), "activation.%s.%s", actNames[f], precNames[p]);
+            c.actFct = (ActFctType)f;
+            c.prec = (ActPrecision)p;
+            runMicroBenchmark(r, name, benchActivation, &c, 2000, repetitions, BENCH_ACT_VALUES, "ns/value");
+        }
+    }
+    
+    runMicroBenchmark(r, "dataset.load", benchDatasetLoad, NULL, 1, repetitions, 1e6, "ms/call");
+    
+    free(c.actOutput);
+    free(c.actInput);
+    freeActivations(c.act);
+    freeNetwork(c.nn);
+}
+
+
+
+
+/**
+ * @details Counts the misclassified images of a data set
+ */
+
+int countErrors(const Network *nn, Activations *act, const MNIST_Dataset *ds){
+    
+    int errCount = 0;
+    
+    for (int i=0; i<ds->count; i++){
+        if (classifyInputBitset(nn, act, getDatasetBitset(ds, i), NULL)!=getDatasetLabel(ds, i)) errCount++;
+    }
+    
+    return errCount;
+}
+
+
+
+
+/**
+ * @details Trains images first..first+count-1 of a data set one by one
+ */
+
+void trainImages(Network *nn, Activations *act, const MNIST_Dataset *ds, int first, int count){
+    
+    for (int i=first; i<first+count; i++){
+        feedInputBitsetActivations(act, getDatasetBitset(ds, i), MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH);
+        feedForwardActivations(nn, act);
+        backPropagateActivations(nn, act, getDatasetLabel(ds, i));
+    }
+    
+}
+
+
+
+
+/**
+ * @details Runs the macro-benchmarks: time-to-accuracy and training throughput over one epoch,
+ * then inference throughput and single-sample latency with the trained network
+ */
+
+void runMacroBenchmarks(BenchReport *r, const MNIST_Dataset *trainingSet, const MNIST_Dataset *testingSet, int repetitions){
+    
+    srand(1);
+    Network *nn = createNetwork(MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH, BENCH_HIDDEN_NODES, 10);
+    Activations *act = createActivations(nn);
+    
+    // Train one epoch in chunks, checking the test accuracy (untimed) after every chunk
+    const double targets[] = {80, 85, 90};
+    const int targetCount = sizeof(targets)/sizeof(targets[0]);
+    double targetTime[3] = {-1, -1, -1};
+    int targetImages[3] = {0, 0, 0};
+    double trainTime = 0;
+    double accuracy = 0;
+    
+    for (int first=0; first<trainingSet->count; first+=BENCH_TTA_CHUNK){
+        
+        int count = (trainingSet->count-first < BENCH_TTA_CHUNK) ? trainingSet->count-first : BENCH_TTA_CHUNK;
+        
+        double start = getTimeNs();
+        trainImages(nn, act, trainingSet, first, count);
+        trainTime += getTimeNs() - start;
+        
+        accuracy = 100 * (1 - (double)countErrors(nn, act, testingSet)/testingSet->count);
+        for (int t=0; t<targetCount; t++){
+            if (targetTime[t]<0 && accuracy>=targets[t]){
+                targetTime[t] = trainTime/1e9;
+                targetImages[t] = first+count;
+            }
+        }
+    }
+    
+    beginBenchmark(r, "train.throughput", "macro");
+    fprintf(r->out, ", \"unit\": \"samples/sec\", \"value\": %.0f, \"samples\": %d, \"seconds\": %.4f}",
+            trainingSet->count / (trainTime/1e9), trainingSet->count, trainTime/1e9);
+    
+    beginBenchmark(r, "time_to_accuracy", "macro");
+    fprintf(r->out, ", \"unit\": \"sec\", \"checkEvery\": %d, \"finalAccuracy\": %.4f, \"targets\": [", BENCH_TTA_CHUNK, accuracy);
+    for (int t=0; t<targetCount; t++){
+        if (targetTime[t]<0) fprintf(r->out, "%s{\"accuracy\": %.1f, \"seconds\": null, \"samples\": null}", t ? ", " : "", targets[t]);
+        else fprintf(r->out, "%s{\"accuracy\": %.1f, \"seconds\": %.4f, \"samples\": %d}", t ? ", " : "", targets[t], targetTime[t], targetImages[t]);
+    }
+    fprintf(r->out, "]}");
+    
+    // Inference throughput: best of all repetitions over the whole testing set
+    double bestTime = 0;
+    for (int rep=0; rep<repetitions; rep++){
+        double start = getTimeNs();
+        countErrors(nn, act, testingSet);
+        double time = getTimeNs() - start;
+        if (rep==0 || time<bestTime) bestTime = time;
+    }
+    beginBenchmark(r, "inference.throughput", "macro");
+    fprintf(r->out, ", \"unit\": \"samples/sec\", \"value\": %.0f, \"samples\": %d, \"repetitions\": %d}",
+            testingSet->count / (bestTime/1e9), testingSet->count, repetitions);
+    
+    // Latency of every single classification (including the overhead of reading the clock, about 20 ns)
+    double *latency = (double*)malloc(testingSet->count * sizeof(double));
+    for (int i=0; i<testingSet->count; i++){
+        double start = getTimeNs();
+        classifyInputBitset(nn, act, getDatasetBitset(testingSet, i), NULL);
+        latency[i] = getTimeNs() - start;
+    }
+    qsort(latency, testingSet->count, sizeof(double), compareDouble);
+    beginBenchmark(r, "inference.latency", "macro");
+    fprintf(r->out, ", \"unit\": \"ns\", \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"max\": %.0f, \"samples\": %d}",
+            getPercentile(latency, testingSet->count, 50), getPercentile(latency, testingSet->count, 90),
+            getPercentile(latency, testingSet->count, 99), latency[testingSet->count-1], testingSet->count);
+    free(latency);
+    
+    freeActivations(act);
+    freeNetwork(nn);
+}
+
+
+
+
+int main(int argc, char * const argv[]) {
+    
+    int repetitions = 5;
+    const char *outFileName = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:o:")) != -1){
+        switch (opt) {
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 'o':
+                outFileName = optarg;
+                break;
+            default:
+                printf("Usage: %s [-r repetitions] [-o jsonFile]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (repetitions<1) repetitions = 1;
+    
+    BenchReport r = {stdout, 0};
+    if (outFileName!=NULL && (r.out = fopen(outFileName, "w"))==NULL){
+        printf("Abort! Could not create benchmark file: %s\n", outFileName);
+        exit(1);
+    }
+    
+    MNIST_Dataset *trainingSet = openMNISTDataset(MNIST_TRAINING_SET_IMAGE_FILE_NAME, MNIST_TRAINING_SET_LABEL_FILE_NAME);
+    MNIST_Dataset *testingSet  = openMNISTDataset(MNIST_TESTING_SET_IMAGE_FILE_NAME, MNIST_TESTING_SET_LABEL_FILE_NAME);
+    binarizeMNISTDataset(trainingSet);
+    binarizeMNISTDataset(testingSet);
+    
+    fprintf(r.out, "{\n  \"isa\": \"%s\",\n  \"precision\": \"%s\",\n  \"topology\": \"%d-%d-%d\",\n  \"compiler\": \"%s\",\n  \"benchmarks\": [",
+            getKernelIsaName(getKernelIsa()), (sizeof(NNReal)==sizeof(float)) ? "float" : "double",
+            MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH, BENCH_HIDDEN_NODES, 10, __VERSION__);
+    
+    runMicroBenchmarks(&r, trainingSet, repetitions);
+    runMacroBenchmarks(&r, trainingSet, testingSet, repetitions);
+    
+    fprintf(r.out, "\n  ]\n}\n");
+    
+    if (r.out!=stdout){
+        fclose(r.out);
+        printf("Benchmark results written to %s\n", outFileName);
+    }
+    
+    closeMNISTDataset(trainingSet);
+    closeMNISTDataset(testingSet);
+    
+    return 0;
+}
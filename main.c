@@ -19,80 +19,397 @@
  
  
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "util/screen.h"
 #include "util/mnist-utils.h"
 #include "util/mnist-stats.h"
+#include "util/mnist-dataset.h"
+#include "util/mnist-prefetch.h"
+#include "util/mnist-augment.h"
+#include "util/alloc-stats.h"
+#include "util/progress-report.h"
+#include "util/profile-stats.h"
 #include "3lnn.h"
+#include "3lnn-batch.h"
+#include "3lnn-parallel.h"
+#include "3lnn-inference.h"
+#include "3lnn-checkpoint.h"
+#include "3lnn-kernels.h"
+#include "3lnn-bf16.h"
+#include "3lnn-int8.h"
+#include "3lnn-server.h"
+#include "3lnn-evaluate.h"
+#include "3lnn-sweep.h"
+#include "3lnn-online.h"
+#include "3lnn-optimizer.h"
+#include "3lnn-export.h"
+#include "3lnn-distributed.h"
 
 
 
 /**
- * @brief Returns a Vector holding the image pixels of a given MNIST image
- * @param img A pointer to a MNIST image
+ * @brief Training the network by processing the MNIST training set and updating the weights
+ * @param nn A pointer to the NN
+ * @param pf A pointer to the prefetcher, started on the images to train with
+ * @param count Number of images of the prefetcher's pass
+ * @param o A pointer to the (stateless SGD) optimizer whose learning rate schedule is followed
+ * @param epoch Current epoch
+ * @return Number of heap allocations made while looping through the images
  */
 
-Vector *getVectorFromImage(MNIST_Image *img){
+unsigned long trainNetwork(Network *nn, MNIST_Prefetcher *pf, int count, Optimizer *o, int epoch){
+    
+    int errCount = 0;
+
+    unsigned long allocCount = getAllocationCount();
     
-    Vector *v = (Vector*)malloc(sizeof(Vector) + (MNIST_IMG_WIDTH*MNIST_IMG_HEIGHT * sizeof(double)));
+    startProgress(PHASE_TRAINING, count, 3,5);
     
-    v->size = MNIST_IMG_WIDTH*MNIST_IMG_HEIGHT;
+    // Loop through all images of the epoch, batch by batch as they come in from the loader threads
+    const MNIST_PrefetchBatch *b;
+    while ((b = acquireMNISTBatch(pf))!=NULL){
+        
+        for (int i=0; i<b->count; i++){
+            
+            int imgCount = b->first + i;
+            
+            // Label of the next image
+            MNIST_Label lbl = b->labels[i];
+            
+            // Feed the binarized image (or its gray values) into the network
+            if (b->pixels!=NULL) feedInputPixels(nn, getPrefetchPixels(b, i));
+            else feedInputBitset(nn, getPrefetchBitset(b, i));
+            
+            // Feed forward all layers (from input to hidden to output) calculating all nodes' output
+            feedForwardNetwork(nn);
+            
+            // Back propagate the error and adjust weights in all layers accordingly
+            updateOptimizerSchedule(o, nn, epoch, imgCount, count);
+            backPropagateNetwork(nn, lbl);
+            
+            // Classify image by choosing output cell with highest output
+            int classification = getNetworkClassification(nn);
+            if (classification!=lbl) errCount++;
+            
+            // Publish progress during training (rendered by the progress thread)
+            updateProgress(imgCount+1, errCount);
+            
+        }
+        
+        releaseMNISTBatch(pf, b);
+    }
     
-    for (int i=0;i<v->size;i++)
-        v->vals[i] = img->pixel[i] ? 1 : 0;
+    allocCount = getAllocationCount() - allocCount;
     
-    return v;
+    finishProgress();
+    
+    return allocCount;
 }
 
 
 
 
 /**
- * @brief Training the network by processing the MNIST training set and updating the weights
+ * @brief Training the network in mini-batches by processing the MNIST training set and updating the weights once per batch
  * @param nn A pointer to the NN
+ * @param pf A pointer to the prefetcher, started on the images to train with
+ * @param count Number of images of the prefetcher's pass
+ * @param batchSize Number of images per mini-batch
+ * @param pt A pointer to a parallel trainer that processes each batch on multiple threads (NULL = single-threaded)
+ * @param hogwild 1 = let the parallel trainer's threads update the weights per sample without locking (Hogwild)
+ * @param o A pointer to the optimizer applying the gradients of every batch
+ * @param epoch Current epoch
+ * @param scratch Arena the batch and the gradients are created in (reset by the caller after the epoch)
+ * @return Number of heap allocations made while looping through the images
  */
 
-void trainNetwork(Network *nn){
+unsigned long trainNetworkBatch(Network *nn, MNIST_Prefetcher *pf, int count, int batchSize, ParallelTrainer *pt, int hogwild, Optimizer *o, int epoch, Arena *scratch){
     
-    // open MNIST files
-    FILE *imageFile, *labelFile;
-    imageFile = openMNISTImageFile(MNIST_TRAINING_SET_IMAGE_FILE_NAME);
-    labelFile = openMNISTLabelFile(MNIST_TRAINING_SET_LABEL_FILE_NAME);
+    Batch *batch = createBatchInArena(scratch, nn, batchSize);
+    
+    // Plain SGD updates the weights right away, stateful optimizers need the summed gradients of the batch
+    Gradients *gradients = (pt==NULL && usesOptimizerState(o)) ? createGradientsInArena(scratch, nn) : NULL;
     
     int errCount = 0;
-
-    // Loop through all images in the file
-    for (int imgCount=0; imgCount<MNIST_MAX_TRAINING_IMAGES; imgCount++){
+    
+    unsigned long allocCount = getAllocationCount();
+    
+    startProgress(PHASE_TRAINING, count, 3,5);
+    
+    // Loop through all batches of the epoch, the prefetcher hands them out in the size of the mini-batch
+    const MNIST_PrefetchBatch *b;
+    while ((b = acquireMNISTBatch(pf))!=NULL){
+        
+        // Unpack the binarized images (or their gray values) straight into the batch
+        for (int i=0; i<b->count; i++){
+            if (b->pixels!=NULL) addPixelsToBatch(batch, getPrefetchPixels(b, i), b->labels[i]);
+            else addBitsetToBatch(batch, getPrefetchBitset(b, i), b->labels[i]);
+        }
+        int imgCount = b->first + b->count;
+        updateOptimizerSchedule(o, nn, epoch, b->first, count);
+        releaseMNISTBatch(pf, b);
+        
+        // Feed forward all samples of the batch and back propagate their accumulated error
+        if (pt!=NULL && hogwild) trainBatchHogwild(pt, batch);
+        else if (pt!=NULL) trainBatchParallel(pt, batch);
+        else if (gradients!=NULL){
+            feedForwardBatch(nn, batch);
+            backPropagateBatchWithOptimizer(nn, batch, gradients, o);
+        }
+        else {
+            feedForwardBatch(nn, batch);
+            backPropagateBatch(nn, batch);
+        }
+        
+        // Classify images by choosing output cell with highest output
+        for (int s=0; s<batch->count; s++){
+            if (getBatchClassification(batch, s)!=batch->labels[s]) errCount++;
+        }
+        clearBatch(batch);
         
-        // Reading next image and its corresponding label
-        MNIST_Image img = getImage(imageFile);
-        MNIST_Label lbl = getLabel(labelFile);
+        // Publish progress during training (rendered by the progress thread)
+        updateProgress(imgCount, errCount);
+        
+    }
+    
+    allocCount = getAllocationCount() - allocCount;
+    
+    finishProgress();
+    
+    return allocCount;
+}
+
+
+
+
+/**
+ * @brief Training the network on this node's shard of the training images, in steps all nodes take together
+ * @details Every step, the nodes sum up the gradients of their batches and take the same optimizer step. Nodes
+ * whose shard has run out take the remaining steps with an empty batch, so that no node waits for the others forever.
+ * @param nn A pointer to the NN
+ * @param pf A pointer to the prefetcher, started on the images of this node's shard
+ * @param trainCount Number of training images of all nodes together
+ * @param batchSize Number of images per node and step
+ * @param group A pointer to the group of nodes
+ * @param o A pointer to the optimizer applying the summed gradients of every step
+ * @param epoch Current epoch
+ * @param scratch Arena the batch and the gradients are created in (reset by the caller after the epoch)
+ * @return Number of heap allocations made while looping through the images
+ */
+
+unsigned long trainNetworkDistributed(Network *nn, MNIST_Prefetcher *pf, int trainCount, int batchSize, DistributedGroup *group, Optimizer *o, int epoch, Arena *scratch){
+    
+    Batch *batch = createBatchInArena(scratch, nn, batchSize);
+    Gradients *gradients = createGradientsInArena(scratch, nn);
+    
+    // Node 0 has the largest shard and so takes the most steps
+    int count = getDistributedShardCount(group, getDistributedRank(group), trainCount);
+    int stepCount = (getDistributedShardCount(group, 0, trainCount) + batchSize - 1) / batchSize;
+    
+    int errCount = 0;
+    int imgCount = 0;
+    
+    unsigned long allocCount = getAllocationCount();
+    
+    startProgress(PHASE_TRAINING, count, 3,5);
+    
+    for (int step=0; step<stepCount; step++){
         
-        // Convert the MNIST image to a standardized vector format and feed into the network
-        Vector *inpVector = getVectorFromImage(&img);
-        feedInput(nn, inpVector);
+        // Unpack the binarized images (or their gray values) straight into the batch, none once the shard has run out
+        const MNIST_PrefetchBatch *b = acquireMNISTBatch(pf);
+        if (b!=NULL){
+            for (int i=0; i<b->count; i++){
+                if (b->pixels!=NULL) addPixelsToBatch(batch, getPrefetchPixels(b, i), b->labels[i]);
+                else addBitsetToBatch(batch, getPrefetchBitset(b, i), b->labels[i]);
+            }
+            imgCount = b->first + b->count;
+            releaseMNISTBatch(pf, b);
+        }
+        updateOptimizerSchedule(o, nn, epoch, step, stepCount);
         
-        // Feed forward all layers (from input to hidden to output) calculating all nodes' output
-        feedForwardNetwork(nn);
+        // Sum up the gradients of the batch, then those of all nodes, and take the step of all images
+        clearGradients(gradients);
+        if (batch->count>0){
+            feedForwardBatch(nn, batch);
+            accumulateGradients(nn, batch, gradients);
+        }
+        allReduceGradients(group, gradients);
+        stepOptimizer(o, nn, gradients, getBatchGradientScale(getDistributedBatchCount(group, trainCount, batchSize, step)));
         
-        // Back propagate the error and adjust weights in all layers accordingly
-        backPropagateNetwork(nn, lbl);
+        // Classify images by choosing output cell with highest output
+        for (int s=0; s<batch->count; s++){
+            if (getBatchClassification(batch, s)!=batch->labels[s]) errCount++;
+        }
+        clearBatch(batch);
         
-        // Classify image by choosing output cell with highest output
-        int classification = getNetworkClassification(nn);
-        if (classification!=lbl) errCount++;
+        // Publish progress during training (rendered by the progress thread)
+        updateProgress(imgCount, errCount);
         
-        // Display progress during training
-        displayTrainingProgress(imgCount, errCount, 3,5);
-//        displayImage(&img, lbl, classification, 7,6);
+    }
+    
+    allocCount = getAllocationCount() - allocCount;
+    
+    finishProgress();
+    
+    return allocCount;
+}
+
+
+
+
+/**
+ * @brief Options of the training driver
+ */
 
+typedef struct TrainingOptions{
+    int batchSize;              ///< Number of images per mini-batch (1 = update the weights after every image)
+    int threadCount;            ///< Number of threads every mini-batch is split across
+    ReductionType reduction;    ///< How the threads' gradients are summed up
+    int hogwild;                ///< 1 = lock-free asynchronous training on multiple threads
+    int epochs;                 ///< Maximum number of passes over the training images
+    int shuffle;                ///< 1 = visit the training images in a new random order in every epoch
+    int validationCount;        ///< Number of images at the end of the training set held out for validation (0 = none)
+    int patience;               ///< Stop after this many epochs without a lower validation error
+    int loaderCount;            ///< Number of threads loading the next batches in the background (0 = load them in the trainer's thread)
+    OptimizerConfig optimizer;  ///< Optimizer and learning rate schedule
+    MNIST_Augmentation augmentation;    ///< Transforms applied to the training images, gray values or binarized input
+    DistributedGroup *group;    ///< Nodes every mini-batch is split across (NULL = train in this process only)
+} TrainingOptions;
+
+
+
+
+/**
+ * @brief Training the network for several epochs, optionally shuffled and stopped early on a validation split
+ * @details The last validationCount images of the training set are held out. After every epoch they are
+ * classified, and training stops once the validation error has not improved for patience epochs. The
+ * weights of the epoch with the lowest validation error are kept.
+ * @param nn A pointer to the NN
+ * @param ds A pointer to the MNIST training set (binarized up front or by the prefetcher)
+ * @param opt A pointer to the training options
+ * @return Number of heap allocations made while looping through the images
+ */
+
+unsigned long trainNetworkEpochs(Network *nn, const MNIST_Dataset *ds, const TrainingOptions *opt){
+    
+    int validationCount = (opt->validationCount < ds->count) ? opt->validationCount : ds->count-1;
+    int trainCount = ds->count - validationCount;
+    
+    int *order = createSampleOrder(ds->count);
+    uint64_t seed = 1;
+    
+    OptimizerConfig oc = opt->optimizer;
+    oc.epochs = opt->epochs;
+    Optimizer *o = createOptimizer(nn, &oc);
+    
+    // Stateful optimizers take a step per batch, so their training always goes through the batch path
+    int batched = (opt->batchSize>1 || usesOptimizerState(o));
+    
+    // Distributed training: every node trains every size-th image of the (identically shuffled) order,
+    // the mini-batch is split evenly across the nodes
+    int *shard = NULL;
+    int shardCount = trainCount;
+    int nodeBatchSize = opt->batchSize;
+    MNIST_Augmentation aug = opt->augmentation;
+    if (opt->group!=NULL){
+        int rank = getDistributedRank(opt->group), size = getDistributedSize(opt->group);
+        shardCount = getDistributedShardCount(opt->group, rank, trainCount);
+        shard = (int*)malloc((shardCount>0 ? shardCount : 1) * sizeof(int));
+        nodeBatchSize = (opt->batchSize + size - 1) / size;
+        batched = 1;
+        // The transforms are seeded by the position in the shard, which repeats on every node
+        aug.seed += rank;
     }
     
-    // Close files
-    fclose(imageFile);
-    fclose(labelFile);
+    ParallelTrainer *pt = (opt->threadCount>1) ? createParallelTrainer(nn, opt->threadCount, opt->reduction) : NULL;
+    if (pt!=NULL) setParallelOptimizer(pt, o);
+    
+    // Mini-batches are prefetched as a whole, single images in chunks of 64; 2 slots beyond the loaders keep them busy
+    int prefetchSize = batched ? nodeBatchSize : 64;
+    MNIST_Prefetcher *pf = createMNISTPrefetcher(ds, prefetchSize, opt->loaderCount+2, opt->loaderCount);
+    setMNISTPrefetchAugmentation(pf, &aug);
+    
+    // One scratch arena for the whole run: the copy of the best weights stays, the batch and gradients
+    // of an epoch are released at the mark after it, so the later epochs reuse their space
+    size_t denseSize = getDenseBlockSize(nn);
+    size_t scratchSize = (validationCount>0) ? reserveArenaSize(0, denseSize, NN_ALIGNMENT) : 0;
+    scratchSize = reserveBatch(scratchSize, nn, batched ? prefetchSize : 1);
+    scratchSize = reserveGradients(scratchSize, nn);
+    Arena *scratch = createArena(scratchSize);
     
+    // Validation needs its own evaluation threads and a copy of the best weights
+    Evaluator *ev = NULL;
+    NNReal *bestBlock = NULL;
+    if (validationCount>0){
+        ev = createEvaluator(nn, opt->threadCount);
+        setEvaluatorGrayscale(ev, opt->augmentation.grayscale);
+        bestBlock = (NNReal*)allocArena(scratch, denseSize, NN_ALIGNMENT);
+    }
+    size_t epochMark = getArenaMark(scratch);
+    
+    int bestErrCount = validationCount+1;
+    int bestEpoch = 0;
+    unsigned long allocCount = 0;
+    
+    for (int epoch=1; epoch<=opt->epochs; epoch++){
+        
+        // Only the training part is shuffled, the validation images stay the same in every epoch
+        if (opt->shuffle) shuffleSampleOrder(order, trainCount, &seed);
+        
+        if (shard!=NULL){
+            int rank = getDistributedRank(opt->group), size = getDistributedSize(opt->group);
+            for (int i=0; i<shardCount; i++) shard[i] = order[rank + i*size];
+            startMNISTPrefetch(pf, shard, shardCount);
+            allocCount += trainNetworkDistributed(nn, pf, trainCount, nodeBatchSize, opt->group, o, epoch, scratch);
+        }
+        else {
+            startMNISTPrefetch(pf, order, trainCount);
+            if (pt!=NULL) allocCount += trainNetworkBatch(nn, pf, trainCount, opt->batchSize, pt, opt->hogwild, o, epoch, scratch);
+            else if (batched) allocCount += trainNetworkBatch(nn, pf, trainCount, opt->batchSize, NULL, 0, o, epoch, scratch);
+            else allocCount += trainNetwork(nn, pf, trainCount, o, epoch);
+        }
+        resetArenaToMark(scratch, epochMark);
+        
+        if (validationCount==0){
+            if (opt->epochs>1){
+                locateCursor(4, 5);
+                printf("   EPOCH %d of %d\n", epoch, opt->epochs);
+            }
+            continue;
+        }
+        
+        EvaluationReport r;
+        evaluateNetwork(ev, nn, ds, order + trainCount, validationCount, &r);
+        int errCount = r.errCount;
+        if (errCount<bestErrCount){
+            bestErrCount = errCount;
+            bestEpoch = epoch;
+            memcpy(bestBlock, nn->denseBlock, denseSize);
+        }
+        
+        locateCursor(4, 5);
+        printf("   EPOCH %d of %d: Validation accuracy=%5.4f%%  (best=%5.4f%% after epoch %d)\n", epoch, opt->epochs,
+               100 * (1 - (double)errCount/validationCount), 100 * (1 - (double)bestErrCount/validationCount), bestEpoch);
+        
+        // Early stopping: further epochs are unlikely to pay off once the validation error stopped improving
+        if (epoch-bestEpoch >= opt->patience) break;
+    }
+    
+    if (bestBlock!=NULL){
+        memcpy(nn->denseBlock, bestBlock, denseSize);
+        freeEvaluator(ev);
+    }
+    freeArena(scratch);
+    freeMNISTPrefetcher(pf);
+    if (pt!=NULL) freeParallelTrainer(pt);
+    freeOptimizer(o);
+    free(shard);
+    free(order);
+    
+    return allocCount;
 }
 
 
@@ -100,51 +417,294 @@ void trainNetwork(Network *nn){
 
 /**
  * @brief Testing the trained network by processing the MNIST testing set WITHOUT updating weights
+ * @details The images are classified by all threads of the evaluator, each with a private activation context.
  * @param nn A pointer to the NN
+ * @param ev A pointer to the evaluator
+ * @param ds A pointer to the binarized MNIST testing set
+ * @param r A pointer to the report receiving the confusion matrix and throughput
+ * @return Number of heap allocations made while looping through the images
  */
 
-void testNetwork(Network *nn){
+unsigned long testNetwork(const Network *nn, Evaluator *ev, const MNIST_Dataset *ds, EvaluationReport *r){
+    
+    unsigned long allocCount = getAllocationCount();
     
-    // open MNIST files
-    FILE *imageFile, *labelFile;
-    imageFile = openMNISTImageFile(MNIST_TESTING_SET_IMAGE_FILE_NAME);
-    labelFile = openMNISTLabelFile(MNIST_TESTING_SET_LABEL_FILE_NAME);
+    startProgress(PHASE_TESTING, ds->count, 5,5);
+    
+    // The network is read-only while testing, the progress is published once per chunk of images
+    evaluateNetwork(ev, nn, ds, NULL, ds->count, r);
+    
+    finishProgress();
+    
+    allocCount = getAllocationCount() - allocCount;
+    
+    return allocCount;
+}
+
+
+
+
+/**
+ * @brief Testing a bfloat16 copy of the trained network by processing the MNIST testing set
+ * @param bn A pointer to the bfloat16 NN
+ * @param ds A pointer to the binarized MNIST testing set
+ * @return Number of incorrectly classified images
+ */
+
+int testNetworkBf16(const Bf16Network *bn, const MNIST_Dataset *ds){
+    
+    float *work = createBf16Workspace(bn);
     
     int errCount = 0;
     
     // Loop through all images in the file
-    for (int imgCount=0; imgCount<MNIST_MAX_TESTING_IMAGES; imgCount++){
+    for (int imgCount=0; imgCount<ds->count; imgCount++){
         
-        // Reading next image and its corresponding label
-        MNIST_Image img = getImage(imageFile);
-        MNIST_Label lbl = getLabel(labelFile);
+        int classification = classifyInputBitsetBf16(bn, work, getDatasetBitset(ds, imgCount), NULL);
+        if (classification!=getDatasetLabel(ds, imgCount)) errCount++;
+    }
+    
+    free(work);
+    
+    return errCount;
+}
+
+
+
+
+
+/**
+ * @brief Results of comparing a quantized copy of the network with the network itself
+ */
+
+typedef struct QuantizationReport{
+    int refErrCount;            ///< Number of images misclassified by the network
+    int errCount;               ///< Number of images misclassified by the quantized copy
+    int diffCount;              ///< Number of images both classify differently
+    double refTime;             ///< Average time per image of the network (usec)
+    double time;                ///< Average time per image of the quantized copy (usec)
+} QuantizationReport;
+
+
+
+
+/**
+ * @brief Testing an int8 copy of the trained network against the network itself by processing the MNIST testing set
+ * @param nn A pointer to the NN
+ * @param qn A pointer to the quantized copy of the NN
+ * @param ds A pointer to the binarized MNIST testing set
+ * @param classifications Array receiving the classification of every image by the NN
+ */
+
+QuantizationReport testNetworkInt8(const Network *nn, const Int8Network *qn, const MNIST_Dataset *ds, int *classifications){
+    
+    QuantizationReport r = {0, 0, 0, 0, 0};
+    struct timespec start, end;
+    
+    Activations *act = createActivations(nn);
+    uint8_t *work = createInt8Workspace(qn);
+    
+    // Reference: the network itself, fed with the binarized images
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int imgCount=0; imgCount<ds->count; imgCount++){
+        classifications[imgCount] = classifyInputBitset(nn, act, getDatasetBitset(ds, imgCount), NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    r.refTime = ((end.tv_sec - start.tv_sec)*1e6 + (end.tv_nsec - start.tv_nsec)/1e3) / ds->count;
+    
+    // The quantized copy reads the uint8 pixels straight from the mapped image file
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int imgCount=0; imgCount<ds->count; imgCount++){
+        int classification = classifyImageInt8(qn, work, getDatasetImage(ds, imgCount)->pixel, NULL);
+        MNIST_Label lbl = getDatasetLabel(ds, imgCount);
+        if (classification!=lbl) r.errCount++;
+        if (classifications[imgCount]!=lbl) r.refErrCount++;
+        if (classification!=classifications[imgCount]) r.diffCount++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    r.time = ((end.tv_sec - start.tv_sec)*1e6 + (end.tv_nsec - start.tv_nsec)/1e3) / ds->count;
+    
+    free(work);
+    freeActivations(act);
+    
+    return r;
+}
+
+
+
+
+/**
+ * @brief Parses a comma-separated list of HIDDEN layer sizes (e.g. "128,64") into the node counts of a NN
+ * @param list Comma-separated list of node counts
+ * @param ncount Array of NN_MAX_LAYERS values receiving the node counts from INPUT to OUTPUT
+ * @return Number of layers
+ */
+
+int parseHiddenLayers(const char *list, int *ncount){
+    
+    int layerCount = 1;
+    ncount[INPUT] = MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH;
+    
+    for (const char *p = list; *p!='\0'; ){
         
-        // Convert the MNIST image to a standardized vector format and feed into the network
-        Vector *inpVector = getVectorFromImage(&img);
-        feedInput(nn, inpVector);
+        char *end;
+        long count = strtol(p, &end, 10);
+        if (end==p || count<1 || layerCount+1>=NN_MAX_LAYERS){
+            printf("Abort! Invalid list of up to %d hidden layer sizes: %s\n", NN_MAX_LAYERS-2, list);
+            exit(1);
+        }
+        ncount[layerCount++] = (int)count;
         
-        // Feed forward all layers (from input to hidden to output) calculating all nodes' output
-        feedForwardNetwork(nn);
+        p = (*end==',') ? end+1 : end;
+    }
+    
+    ncount[layerCount++] = 10;
+    
+    return layerCount;
+}
+
+
+
+
+/**
+ * @brief Writes the node counts of all layers of a NN as "784-20-10" into a string
+ * @param nn A pointer to the NN
+ * @param str String receiving the topology
+ * @param size Byte size of the string
+ */
+
+void formatTopology(const Network *nn, char *str, size_t size){
+    
+    int len = 0;
+    for (int l=0; l<nn->layerCount && (size_t)len<size; l++){
+        len += snprintf(str + len, size - len, (l==0) ? "%d" : "-%d", nn->dense[l].ncount);
+    }
+    
+}
+
+
+
+
+/**
+ * @brief Serves classification requests with a loaded network until the input stream ends (stdin) or forever (TCP)
+ * @details Every request is one raw image of 784 bytes (e.g. an MNIST_Image), every response one byte
+ * holding the classification. With a learning address, the network also keeps learning from a stream of
+ * labeled samples (the label byte followed by the 784 bytes of the image) while serving, the requests are
+ * classified by the latest published version. All messages go to stderr, since stdout may carry the responses.
+ * @param loadFileName Checkpoint file of the trained network
+ * @param address "-" = read images from stdin and write the classifications to stdout, otherwise a TCP port number (NULL = learn only)
+ * @param learnAddress "-" = read labeled samples from stdin, otherwise a TCP port number (NULL = no learning)
+ * @param snapshotFileName Checkpoint file the learned weights are saved to (NULL = no snapshots)
+ * @param snapshotInterval Number of learned samples between two snapshots
+ * @param maxBatch Maximum number of requests per batch
+ * @param maxWait Maximum number of microseconds to wait for more requests
+ * @param threadCount Number of batching threads
+ * @return Exit code of the program
+ */
+
+int serveNetwork(const char *loadFileName, const char *address, const char *learnAddress, const char *snapshotFileName,
+                 long snapshotInterval, int maxBatch, int maxWait, int threadCount){
+    
+    int serveStdin = (address!=NULL && strcmp(address, "-")==0);
+    int learnStdin = (learnAddress!=NULL && strcmp(learnAddress, "-")==0);
+    
+    if (serveStdin && learnStdin){
+        printf("Abort! Serving (-S) and learning (-U) cannot both read from stdin\n");
+        exit(1);
+    }
+    if (address==NULL && !learnStdin){
+        printf("Abort! Learning on a TCP port (-U) needs serving (-S) as well\n");
+        exit(1);
+    }
+    
+    Network *nn = loadNetwork(loadFileName);
+    char topology[128];
+    formatTopology(nn, topology, sizeof(topology));
+    
+    InferenceServer *s = createInferenceServer(nn, maxBatch, maxWait, threadCount);
+    
+    OnlineModel *m = NULL;
+    if (learnAddress!=NULL){
+        m = createOnlineModel(nn, snapshotFileName, snapshotInterval);
+        setInferenceServerModel(s, m);
         
-        // Classify image by choosing output cell with highest output
-        int classification = getNetworkClassification(nn);
-        if (classification!=lbl) errCount++;
+        if (learnStdin) fprintf(stderr, "LEARNING: Labeled samples on stdin");
+        else fprintf(stderr, "LEARNING: Labeled samples on 127.0.0.1:%d", atoi(learnAddress));
+        if (snapshotFileName!=NULL) fprintf(stderr, ", snapshot every %ld samples to %s\n", snapshotInterval, snapshotFileName);
+        else fprintf(stderr, ", no snapshots\n");
         
-        // Display progress during testing
-        displayTestingProgress(imgCount, errCount, 5,5);
-//        displayImage(&img, lbl, classification, 7,6);
+        if (!learnStdin) startLearningSocket(s, atoi(learnAddress));
+    }
+    
+    if (serveStdin){
+        fprintf(stderr, "SERVING: Checkpoint %s (%s nodes) on stdin, max. batch %d, max. wait %d usec\n", loadFileName, topology, maxBatch, maxWait);
+        serveInferenceStream(s, STDIN_FILENO, STDOUT_FILENO);
+    }
+    else if (address!=NULL){
+        fprintf(stderr, "SERVING: Checkpoint %s (%s nodes) on 127.0.0.1:%d, max. batch %d, max. wait %d usec\n", loadFileName, topology, atoi(address), maxBatch, maxWait);
         
+        // Learning from stdin ends the program once the stream of samples ends, otherwise the socket is served forever
+        if (learnStdin) startInferenceSocket(s, atoi(address));
+        else serveInferenceSocket(s, atoi(address));
+    }
+    
+    if (learnStdin) serveLearningStream(s, STDIN_FILENO);
+    
+    if (address!=NULL) displayServerStats(s);
+    
+    freeInferenceServer(s);
+    
+    if (m!=NULL){
+        snapshotOnlineModel(m);
+        displayOnlineStats(m);
+        freeOnlineModel(m);
     }
     
-    // Close files
-    fclose(imageFile);
-    fclose(labelFile);
+    freeNetwork(nn);
     
+    return 0;
 }
 
 
 
 
+/**
+ * @brief Sweep mode: trains every configuration of a sweep specification concurrently on the shared MNIST files
+ * @param spec Sweep specification (see parseSweepConfigs())
+ * @param base Configuration providing the values of the hyperparameters that are not swept
+ * @param opt A pointer to the sweep options
+ * @return Exit code of the program
+ */
+
+int sweepNetworks(const char *spec, const SweepConfig *base, const SweepOptions *opt){
+    
+    SweepConfig *configs = (SweepConfig*)malloc(SWEEP_MAX_CONFIGS * sizeof(SweepConfig));
+    int count = parseSweepConfigs(spec, base, configs);
+    SweepResult *results = (SweepResult*)malloc(count * sizeof(SweepResult));
+    
+    // Map and binarize the MNIST files once, all configurations read the same copy
+    MNIST_Dataset *trainingSet = openMNISTDataset(MNIST_TRAINING_SET_IMAGE_FILE_NAME, MNIST_TRAINING_SET_LABEL_FILE_NAME);
+    MNIST_Dataset *testingSet  = openMNISTDataset(MNIST_TESTING_SET_IMAGE_FILE_NAME, MNIST_TESTING_SET_LABEL_FILE_NAME);
+    binarizeMNISTDataset(trainingSet);
+    binarizeMNISTDataset(testingSet);
+    
+    if (!opt->json) printf("    SWEEP: %d configurations, %d epoch%s each, %d at a time\n", count, opt->epochs, (opt->epochs==1) ? "" : "s",
+                           (opt->threadCount<count) ? opt->threadCount : count);
+    
+    runSweep(configs, count, trainingSet, testingSet, opt, results);
+    
+    displaySweepResults(configs, results, count, opt);
+    
+    closeMNISTDataset(trainingSet);
+    closeMNISTDataset(testingSet);
+    free(results);
+    free(configs);
+    
+    return 0;
+}
+
+
+
 
 /**
  * @details Main function to run MNIST-1LNN
@@ -153,33 +713,371 @@ void testNetwork(Network *nn){
 int main(int argc, const char * argv[]) {
     
     // remember the time in order to calculate processing time at the end
-    time_t startTime = time(NULL);
+    struct timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    
+    // Hardware counters (MNIST_PROFILE builds only) cover all threads that are created from here on
+    startHardwareCounters();
+    
+    // parse command line options
+    int batchSize = 1;
+    int threadCount = 1;
+    ReductionType reduction = REDUCE_TREE;
+    int hogwild = 0;
+    const char *loadFileName = NULL;
+    const char *saveFileName = NULL;
+    const char *exportBaseName = NULL;
+    int preUpdateWeights = 0;
+    ActPrecision actPrecision = ACT_EXACT;
+    int testBf16 = 0;
+    int testInt8 = 0;
+    int epochs = 1;
+    int shuffle = 0;
+    int validationCount = 0;
+    int patience = 3;
+    int loaderCount = 0;
+    ProgressMode progressMode = PROGRESS_ANSI;
+    int progressInterval = 100;
+    const char *serveAddress = NULL;
+    int serveBatch = 32;
+    int serveWait = 1000;
+    const char *sweepSpec = NULL;
+    const char *learnAddress = NULL;
+    long snapshotInterval = 10000;
+    OptimizerConfig optimizer = {OPT_SGD, 0, SCHEDULE_CONSTANT, 0.5, 1};
+    MNIST_Augmentation augmentation;
+    initMNISTAugmentation(&augmentation);
+    const char *nodeList = NULL;
+    int nodeRank = 0;
+    int compressGradients = 0;
+    int ncount[NN_MAX_LAYERS] = {MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH, 20, 10};
+    int layerCount = 3;
+    int opt;
+    while ((opt = getopt(argc, (char * const *)argv, "b:t:auwl:s:X:ep:mqH:E:rv:P:f:gA:o:i:S:B:W:Y:U:K:O:L:D:N:R:C")) != -1){
+        switch (opt) {
+            case 'b':
+                batchSize = atoi(optarg);
+                break;
+            case 't':
+                threadCount = atoi(optarg);
+                if (threadCount==0) threadCount = getCPUCoreCount();
+                break;
+            case 'a':
+                reduction = REDUCE_ATOMIC;
+                break;
+            case 'u':
+                reduction = REDUCE_ROWS;
+                break;
+            case 'w':
+                hogwild = 1;
+                break;
+            case 'l':
+                loadFileName = optarg;
+                break;
+            case 's':
+                saveFileName = optarg;
+                break;
+            case 'X':
+                exportBaseName = optarg;
+                break;
+            case 'g':
+                augmentation.grayscale = 1;
+                break;
+            case 'A':
+                parseMNISTAugmentation(optarg, &augmentation);
+                break;
+            case 'e':
+                preUpdateWeights = 1;
+                break;
+            case 'p':
+                if (strcmp(optarg, "approx")==0) actPrecision = ACT_APPROX;
+                else if (strcmp(optarg, "table")==0) actPrecision = ACT_TABLE;
+                else actPrecision = ACT_EXACT;
+                break;
+            case 'm':
+                testBf16 = 1;
+                break;
+            case 'q':
+                testInt8 = 1;
+                break;
+            case 'H':
+                layerCount = parseHiddenLayers(optarg, ncount);
+                break;
+            case 'E':
+                epochs = atoi(optarg);
+                break;
+            case 'r':
+                shuffle = 1;
+                break;
+            case 'v':
+                validationCount = atoi(optarg);
+                break;
+            case 'P':
+                patience = atoi(optarg);
+                break;
+            case 'f':
+                loaderCount = atoi(optarg);
+                break;
+            case 'o':
+                if (strcmp(optarg, "plain")==0) progressMode = PROGRESS_PLAIN;
+                else if (strcmp(optarg, "json")==0) progressMode = PROGRESS_JSON;
+                else if (strcmp(optarg, "silent")==0) progressMode = PROGRESS_SILENT;
+                else progressMode = PROGRESS_ANSI;
+                break;
+            case 'i':
+                progressInterval = atoi(optarg);
+                break;
+            case 'S':
+                serveAddress = optarg;
+                break;
+            case 'B':
+                serveBatch = atoi(optarg);
+                break;
+            case 'W':
+                serveWait = atoi(optarg);
+                break;
+            case 'Y':
+                sweepSpec = optarg;
+                break;
+            case 'U':
+                learnAddress = optarg;
+                break;
+            case 'K':
+                snapshotInterval = atol(optarg);
+                break;
+            case 'O':
+                if (strcmp(optarg, "momentum")==0) optimizer.type = OPT_MOMENTUM;
+                else if (strcmp(optarg, "nesterov")==0) optimizer.type = OPT_NESTEROV;
+                else if (strcmp(optarg, "adam")==0) optimizer.type = OPT_ADAM;
+                else optimizer.type = OPT_SGD;
+                break;
+            case 'L':
+                optimizer.learningRate = atof(optarg);
+                break;
+            case 'D':
+                if (strncmp(optarg, "step", 4)==0){
+                    optimizer.schedule = SCHEDULE_STEP;
+                    if (optarg[4]==':') optimizer.decay = atof(optarg+5);
+                }
+                else if (strcmp(optarg, "cosine")==0) optimizer.schedule = SCHEDULE_COSINE;
+                else optimizer.schedule = SCHEDULE_CONSTANT;
+                break;
+            case 'N':
+                nodeList = optarg;
+                break;
+            case 'R':
+                nodeRank = atoi(optarg);
+                break;
+            case 'C':
+                compressGradients = 1;
+                break;
+            default:
+                printf("Usage: %s [-b batchSize] [-t threads] [-a] [-u] [-w] [-O sgd|momentum|nesterov|adam] [-L rate] [-D const|step[:factor]|cosine] [-e] [-p exact|approx|table] [-m] [-q] [-H hidden,sizes] [-E epochs] [-r] [-v validationImages] [-P patience] [-f loaderThreads] [-g] [-A shift=px:rotate=deg:elastic=alpha[,sigma]] [-o ansi|plain|json|silent] [-i intervalMs] [-S port|- [-B maxBatch] [-W maxWaitUsec]] [-U port|- [-K snapshotSamples]] [-Y sweep] [-N host:port,... -R rank [-C]] [-l checkpoint] [-s checkpoint] [-X exportName]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (batchSize<1) batchSize = 1;
+    if (threadCount<1) threadCount = 1;
+    if (epochs<1) epochs = 1;
+    if (validationCount<0) validationCount = 0;
+    if (patience<1) patience = 1;
+    if (loaderCount<0) loaderCount = 0;
+    if (snapshotInterval<1) snapshotInterval = 1;
+    
+    // Gray values are fed by the training, validation and testing paths only, the other paths always binarize
+    if (augmentation.grayscale && (testBf16 || testInt8 || exportBaseName!=NULL || serveAddress!=NULL || learnAddress!=NULL || sweepSpec!=NULL)){
+        printf("Abort! Gray value input (-g) cannot be combined with -m, -q, -X, -S, -U or -Y\n");
+        exit(1);
+    }
+    if (nodeList!=NULL && (threadCount>1 || hogwild || loadFileName!=NULL || serveAddress!=NULL || learnAddress!=NULL || sweepSpec!=NULL)){
+        printf("Abort! Distributed training (-N) cannot be combined with -t, -w, -l, -S, -U or -Y\n");
+        exit(1);
+    }
+    if (isTransformingMNIST(&augmentation) && sweepSpec!=NULL){
+        printf("Abort! Sweeps (-Y) train on the images as they are, without augmentation (-A)\n");
+        exit(1);
+    }
+    
+    // Sweep mode: train many configurations at the same time (one per thread) instead of a single network,
+    // every configuration is trained single-threaded with the batch size as given
+    if (sweepSpec!=NULL){
+        SweepConfig base = {0, layerCount, {0}, SIGMOID, batchSize};
+        memcpy(base.ncount, ncount, sizeof(base.ncount));
+        SweepOptions opt = {threadCount, epochs, shuffle, progressMode==PROGRESS_JSON};
+        return sweepNetworks(sweepSpec, &base, &opt);
+    }
+    
+    // Data-parallel training splits each batch across the threads, so every thread needs at least 1 image
+    // (the batch size that is actually used is shown with the training)
+    int requestedBatchSize = batchSize;
+    const char *batchSizeReason = NULL;
+    if (threadCount>1 && batchSize<threadCount){
+        batchSize = threadCount;
+        batchSizeReason = "at least 1 image per thread of -t";
+    }
+    
+    if (hogwild && optimizer.type!=OPT_SGD){
+        printf("Abort! Hogwild training (-w) only supports plain SGD (-O sgd)\n");
+        exit(1);
+    }
+    if (hogwild && threadCount<2){
+        printf("Abort! Hogwild training (-w) needs at least 2 threads (-t)\n");
+        exit(1);
+    }
+    
+    // Hogwild updates the weights per image, the batch only defines how many images are handed out at once
+    if (hogwild && batchSize<64*threadCount){
+        batchSize = 64*threadCount;
+        batchSizeReason = "Hogwild hands out 64 images per thread at a time, the weights are still updated per image";
+    }
+    
+    // Serving mode: classify raw images from stdin or TCP connections with a loaded network, without any screen output,
+    // optionally learning from a stream of labeled samples at the same time
+    if (serveAddress!=NULL || learnAddress!=NULL){
+        if (loadFileName==NULL){
+            printf("Abort! Serving (-S) and learning (-U) need a trained network to load (-l checkpoint)\n");
+            exit(1);
+        }
+        return serveNetwork(loadFileName, serveAddress, learnAddress, saveFileName, snapshotInterval, serveBatch, serveWait, threadCount);
+    }
+    
+    // Progress is rendered by a thread of its own, at most once per interval
+    initProgressReporting(progressMode, progressInterval);
     
     // clear screen of terminal window
     clearScreen();
     printf("    MNIST-3LNN: a simple 3-layer neural network processing the MNIST handwritten digit images\n\n");
     
-    // Create neural network using a manually allocated memory space
-    Network *nn = createNetwork(MNIST_IMG_HEIGHT*MNIST_IMG_WIDTH, 20, 10);
+    // Tell the user if the training runs with another batch size than the one given (-b)
+    if (batchSizeReason!=NULL && loadFileName==NULL){
+        locateCursor(2, 5);
+        printf("   NOTE: Training in batches of %d images instead of %d (%s)\n", batchSize, requestedBatchSize, batchSizeReason);
+    }
+    
+    // Map the MNIST training and testing files into memory
+    MNIST_Dataset *trainingSet = openMNISTDataset(MNIST_TRAINING_SET_IMAGE_FILE_NAME, MNIST_TRAINING_SET_LABEL_FILE_NAME);
+    MNIST_Dataset *testingSet  = openMNISTDataset(MNIST_TESTING_SET_IMAGE_FILE_NAME, MNIST_TESTING_SET_LABEL_FILE_NAME);
+    
+    // Binarize all images once, so that the single-sample loops can feed them as sparse bitsets
+    // (with loader threads the training images are binarized batch by batch while the network trains)
+    if (loaderCount==0) binarizeMNISTDataset(trainingSet);
+    binarizeMNISTDataset(testingSet);
+    
+    // Create neural network using a manually allocated memory space, or map an already trained one
+    Network *nn;
+    unsigned long trainAllocCount = 0;
+    
+    if (loadFileName!=NULL){
+        struct timespec loadStart, loadEnd;
+        clock_gettime(CLOCK_MONOTONIC, &loadStart);
+        nn = loadNetwork(loadFileName);
+        clock_gettime(CLOCK_MONOTONIC, &loadEnd);
+        double loadTime = (loadEnd.tv_sec - loadStart.tv_sec)*1e6 + (loadEnd.tv_nsec - loadStart.tv_nsec)/1e3;
+        char topology[128];
+        formatTopology(nn, topology, sizeof(topology));
+        locateCursor(3, 5);
+        printf("1: LOADED:   Checkpoint %s (%s nodes) in %.1f usec\n", loadFileName, topology, loadTime);
+    }
+    else nn = createDeepNetwork(layerCount, ncount);
+    
+    // Join the other nodes and start from the same weights as node 0
+    DistributedGroup *group = NULL;
+    if (nodeList!=NULL){
+        group = createDistributedGroup(nodeList, nodeRank, compressGradients, nn);
+        broadcastNetwork(group, nn);
+    }
+    
+    nn->usePreUpdateWeights = preUpdateWeights;
+    nn->actPrecision = actPrecision;
+    
+    // Show how far the selected activation precision may deviate from libm
+    if (actPrecision!=ACT_EXACT){
+        locateCursor(9, 5);
+        printf("4: ACTIVATION: %s, max. error vs. libm: SIGMOID=%.2g  TANH=%.2g\n", (actPrecision==ACT_APPROX) ? "rational approximation" : "lookup table",
+               getActivationMaxError(SIGMOID, actPrecision), getActivationMaxError(TANH, actPrecision));
+    }
     
 //    displayNetworkWeightsForDebugging(nn);
 //    exit(1);
     
     // Training the network by adjusting the weights based on error using the  TRAINING dataset
-    trainNetwork(nn);
+    if (loadFileName==NULL){
+        TrainingOptions opt = {batchSize, threadCount, reduction, hogwild, epochs, shuffle, validationCount, patience, loaderCount, optimizer, augmentation, group};
+        trainAllocCount = trainNetworkEpochs(nn, trainingSet, &opt);
+    }
+    
+    // All nodes end up with the same weights, which only node 0 writes
+    int writesNetwork = (group==NULL || getDistributedRank(group)==0);
+    
+    // Save the trained network so that later runs can skip the training
+    if (saveFileName!=NULL && writesNetwork) saveNetwork(nn, saveFileName);
+    
+    // Generate C source that classifies images without the library (for embedded targets)
+    if (exportBaseName!=NULL && writesNetwork) exportNetworkSource(nn, exportBaseName);
+    
+    // Display the traffic and time of summing up the gradients of the nodes
+    if (group!=NULL){
+        displayDistributedStats(group, 6,5);
+        freeDistributedGroup(group);
+    }
     
     // Testing the during training derived network using the TESTING dataset
-    testNetwork(nn);
+    Evaluator *ev = createEvaluator(nn, threadCount);
+    setEvaluatorGrayscale(ev, augmentation.grayscale);
+    EvaluationReport report;
+    unsigned long testAllocCount = testNetwork(nn, ev, testingSet, &report);
+    freeEvaluator(ev);
+    
+    // Display the number of heap allocations made inside the training and testing loops (should be 0)
+    displayAllocationStats(trainAllocCount, testAllocCount, 7,5);
     
-    // Free the manually allocated memory for this network
-    free(nn);
+    // Display the throughput of the testing and the per-class confusion matrix, precision and recall
+    displayEvaluationReport(&report, 16,5);
+    
+    // Testing again with the weights stored as bfloat16 (mixed precision: fp32 sums and activations)
+    if (testBf16){
+        size_t denseSize = getDenseBlockSize(nn);
+        Bf16Network *bn = createBf16Network(nn);
+        int errCount = testNetworkBf16(bn, testingSet);
+        locateCursor(11, 5);
+        printf("5: BF16: Accuracy=%.4f%% with bfloat16 weights (%zu KB instead of %zu KB)\n", 100 * (1 - (double)errCount/testingSet->count),
+               getBf16NetworkSize(bn)/1024, denseSize/1024);
+        freeBf16Network(bn);
+    }
+    
+    // Post-training quantization to int8 weights, compared image by image with the network itself
+    if (testInt8){
+        size_t denseSize = getDenseBlockSize(nn);
+        Int8Network *qn = createInt8Network(nn);
+        int *classifications = (int*)malloc(testingSet->count * sizeof(int));
+        QuantizationReport r = testNetworkInt8(nn, qn, testingSet, classifications);
+        double refAccuracy = 100 * (1 - (double)r.refErrCount/testingSet->count);
+        double accuracy    = 100 * (1 - (double)r.errCount/testingSet->count);
+        locateCursor(13, 5);
+        printf("6: INT8: Accuracy=%.4f%% (%+.4f%% vs. %.4f%%), %d of %d classifications differ, %zu KB instead of %zu KB\n",
+               accuracy, accuracy - refAccuracy, refAccuracy, r.diffCount, testingSet->count, getInt8NetworkSize(qn)/1024, denseSize/1024);
+        printf("    %.2f usec per image instead of %.2f usec (%.1fx)\n", r.time, r.refTime, r.refTime / r.time);
+        free(classifications);
+        freeInt8Network(qn);
+    }
+    
+    stopProgressReporting();
+    
+    // Free the manually allocated memory for this network and unmap the MNIST files
+    freeNetwork(nn);
+    closeMNISTDataset(trainingSet);
+    closeMNISTDataset(testingSet);
     
     locateCursor(36, 5);
     
     // Calculate and print the program's total execution time
-    time_t endTime = time(NULL);
-    double executionTime = difftime(endTime, startTime);
-    printf("\n    DONE! Total execution time: %.1f sec\n\n",executionTime);
+    struct timespec endTime;
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    double executionTime = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec)/1e9;
+    printf("\n    DONE! Total execution time: %.3f sec\n\n",executionTime);
+    
+    // Breakdown of the execution time per phase (MNIST_PROFILE builds only)
+    displayProfileStats(executionTime);
 
     return 0;
 }
@@ -0,0 +1,109 @@
+/**
+ * @file alloc-stats.c
+ * @brief Utilities for counting the heap allocations made by the program
+ */
+
+#include <stdlib.h>
+
+#include "alloc-stats.h"
+
+
+#ifdef MNIST_COUNT_ALLOCS
+
+static unsigned long allocationCount = 0;
+
+// The linker's --wrap option redirects all calls to X() to __wrap_X(), and __real_X() to the original X()
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int   __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+
+
+
+/**
+ * @details Counts the allocation and forwards it to the original malloc()
+ */
+
+void *__wrap_malloc(size_t size){
+    
+    __atomic_add_fetch(&allocationCount, 1, __ATOMIC_RELAXED);
+    
+    return __real_malloc(size);
+}
+
+
+
+
+/**
+ * @details Counts the allocation and forwards it to the original calloc()
+ */
+
+void *__wrap_calloc(size_t count, size_t size){
+    
+    __atomic_add_fetch(&allocationCount, 1, __ATOMIC_RELAXED);
+    
+    return __real_calloc(count, size);
+}
+
+
+
+
+/**
+ * @details Counts the allocation and forwards it to the original realloc()
+ */
+
+void *__wrap_realloc(void *ptr, size_t size){
+    
+    __atomic_add_fetch(&allocationCount, 1, __ATOMIC_RELAXED);
+    
+    return __real_realloc(ptr, size);
+}
+
+
+
+
+/**
+ * @details Counts the allocation and forwards it to the original posix_memalign()
+ */
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size){
+    
+    __atomic_add_fetch(&allocationCount, 1, __ATOMIC_RELAXED);
+    
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+#endif
+
+
+
+
+/**
+ * @details Returns 1 if heap allocations are counted in this build, 0 otherwise
+ */
+
+int isAllocationCountAvailable(void){
+    
+#ifdef MNIST_COUNT_ALLOCS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+
+
+/**
+ * @details Returns the number of heap allocations made so far (by any thread)
+ */
+
+unsigned long getAllocationCount(void){
+    
+#ifdef MNIST_COUNT_ALLOCS
+    return __atomic_load_n(&allocationCount, __ATOMIC_RELAXED);
+#else
+    return 0;
+#endif
+}
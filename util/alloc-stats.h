@@ -0,0 +1,31 @@
+/**
+ * @file alloc-stats.h
+ * @brief Utilities for counting the heap allocations made by the program
+ * @details When built with MNIST_COUNT_ALLOCS (and linked with -Wl,--wrap for malloc, calloc, realloc and
+ * posix_memalign, see makefile), every heap allocation made by the program's own code is counted.
+ * Otherwise the counter is not available and always reads 0.
+ */
+
+#ifndef MNIST_ALLOC_STATS_H
+#define MNIST_ALLOC_STATS_H
+
+
+
+
+/**
+ * @brief Returns 1 if heap allocations are counted in this build, 0 otherwise
+ */
+
+int isAllocationCountAvailable(void);
+
+
+
+
+/**
+ * @brief Returns the number of heap allocations made so far (by any thread)
+ */
+
+unsigned long getAllocationCount(void);
+
+
+#endif
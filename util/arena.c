@@ -0,0 +1,121 @@
+/**
+ * @file arena.c
+ * @brief Utilities for carving many aligned arrays out of a single heap allocation (bump allocator)
+ * @details Memory handed out is always zero: the block is cleared once when it is created and the released
+ * part again when it is reset, so owners only need to set what is not 0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+
+#define ARENA_HEADER_SIZE ((sizeof(Arena) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT)  ///< Bytes in front of base
+
+
+
+
+/**
+ * @details Rounds the fill level up to the alignment, then adds the size
+ */
+
+size_t reserveArenaSize(size_t used, size_t size, size_t alignment){
+    
+    return ((used + alignment - 1) & ~(alignment - 1)) + size;
+}
+
+
+
+
+/**
+ * @details The arena's state lives in front of its space inside the same block
+ */
+
+Arena *createArena(size_t size){
+    
+    // Make sure there is something to allocate
+    if (size==0) size = 1;
+    
+    void *block = NULL;
+    if (posix_memalign(&block, ARENA_ALIGNMENT, ARENA_HEADER_SIZE + size) != 0){
+        printf("Abort! Could not allocate an arena of %zu bytes\n", size);
+        exit(1);
+    }
+    memset(block, 0, ARENA_HEADER_SIZE + size);
+    
+    Arena *a = (Arena*)block;
+    a->base = (uint8_t*)block + ARENA_HEADER_SIZE;
+    a->size = size;
+    a->used = 0;
+    
+    return a;
+}
+
+
+
+
+/**
+ * @details Frees an arena and everything allocated from it
+ */
+
+void freeArena(Arena *a){
+    
+    free(a);
+    
+}
+
+
+
+
+/**
+ * @details Allocates zero-initialized memory from an arena (aborts if the arena is too small)
+ */
+
+void *allocArena(Arena *a, size_t size, size_t alignment){
+    
+    if (alignment==0 || alignment>ARENA_ALIGNMENT || (alignment & (alignment-1))!=0){
+        printf("Abort! Invalid arena alignment of %zu bytes\n", alignment);
+        exit(1);
+    }
+    
+    size_t used = reserveArenaSize(a->used, size, alignment);
+    if (used>a->size){
+        printf("Abort! Arena of %zu bytes is too small for another %zu bytes (%zu bytes used)\n", a->size, size, a->used);
+        exit(1);
+    }
+    
+    void *ptr = a->base + (used - size);
+    a->used = used;
+    
+    return ptr;
+}
+
+
+
+
+/**
+ * @details Returns the current fill level of an arena
+ */
+
+size_t getArenaMark(const Arena *a){
+    
+    return a->used;
+}
+
+
+
+
+/**
+ * @details Releases (and zeroes) everything allocated from an arena since a mark
+ */
+
+void resetArenaToMark(Arena *a, size_t mark){
+    
+    if (mark>=a->used) return;
+    
+    memset(a->base + mark, 0, a->used - mark);
+    a->used = mark;
+    
+}
@@ -0,0 +1,101 @@
+/**
+ * @file arena.h
+ * @brief Utilities for carving many aligned arrays out of a single heap allocation (bump allocator)
+ * @details An arena is one zero-initialized block, allocated once with all the space its owner needs. Every
+ * allocation only advances an offset (aligned as requested), nothing is freed individually: the whole arena is
+ * released at once, or reset and reused for the next set of scratch buffers. The exact size of an arena can be
+ * planned up front with reserveArenaSize(), by reserving the same allocations in the same order.
+ */
+
+#ifndef MNIST_ARENA_H
+#define MNIST_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define ARENA_ALIGNMENT 64              ///< Alignment of the start of every arena (=1 cache line), the maximum alignment of an allocation
+
+
+typedef struct Arena Arena;
+
+
+
+
+/**
+ * @brief Data structure holding the state of an arena (kept in the first bytes of its own block)
+ */
+
+struct Arena{
+    uint8_t *base;                  ///< First byte of the allocatable space (ARENA_ALIGNMENT-aligned)
+    size_t size;                    ///< Number of allocatable bytes
+    size_t used;                    ///< Number of bytes allocated so far (including the alignment padding)
+};
+
+
+
+
+/**
+ * @brief Returns the number of bytes used after one more allocation, for planning the size of an arena
+ * @param used Number of bytes used before the allocation (0 for the first one)
+ * @param size Byte size of the allocation
+ * @param alignment Byte alignment of the allocation (a power of 2, at most ARENA_ALIGNMENT)
+ */
+
+size_t reserveArenaSize(size_t used, size_t size, size_t alignment);
+
+
+
+
+/**
+ * @brief Creates a zero-initialized arena with size allocatable bytes (one heap allocation)
+ * @param size Number of allocatable bytes
+ */
+
+Arena *createArena(size_t size);
+
+
+
+
+/**
+ * @brief Frees an arena and everything allocated from it
+ * @param a A pointer to the arena
+ */
+
+void freeArena(Arena *a);
+
+
+
+
+/**
+ * @brief Allocates zero-initialized memory from an arena (aborts if the arena is too small)
+ * @param a A pointer to the arena
+ * @param size Byte size of the allocation
+ * @param alignment Byte alignment of the allocation (a power of 2, at most ARENA_ALIGNMENT)
+ */
+
+void *allocArena(Arena *a, size_t size, size_t alignment);
+
+
+
+
+/**
+ * @brief Returns the current fill level of an arena, to release everything allocated after it via resetArenaToMark()
+ * @param a A pointer to the arena
+ */
+
+size_t getArenaMark(const Arena *a);
+
+
+
+
+/**
+ * @brief Releases (and zeroes) everything allocated from an arena since a mark
+ * @param a A pointer to the arena
+ * @param mark Fill level returned by getArenaMark()
+ */
+
+void resetArenaToMark(Arena *a, size_t mark);
+
+
+#endif
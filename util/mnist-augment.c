@@ -0,0 +1,266 @@
+/**
+ * @file mnist-augment.c
+ * @brief Utilities for augmenting MNIST images on the fly (random shifts, rotations and elastic distortions)
+ * @details An image is processed as float planes of MNIST_IMG_WIDTH x MNIST_IMG_HEIGHT values. Apart from the
+ * bilinear lookup, every step (the source coordinates, the Gaussian filter of the displacement fields) is written
+ * as loops over whole rows or whole images without dependencies between the pixels, which the compiler turns into
+ * SIMD code. A row of MNIST_IMG_WIDTH = 28 pixels is not a multiple of the 8 (AVX2) or 16 (AVX-512) float lanes,
+ * so every row loop ends with a scalar remainder of 4 or 12 pixels; the loops over all 784 pixels have none.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mnist-augment.h"
+
+
+#define AUGMENT_PIXELS (MNIST_IMG_WIDTH*MNIST_IMG_HEIGHT)   ///< Number of pixels per image
+#define AUGMENT_PAD_WIDTH (MNIST_IMG_WIDTH+3)               ///< Row length of the zero-padded source image
+#define AUGMENT_PAD_HEIGHT (MNIST_IMG_HEIGHT+3)             ///< Number of rows of the zero-padded source image
+
+
+
+
+/**
+ * @details Binarizing without transforms
+ */
+
+void initMNISTAugmentation(MNIST_Augmentation *aug){
+    
+    aug->grayscale = 0;
+    aug->maxShift = 0;
+    aug->maxRotation = 0;
+    aug->elasticAlpha = 0;
+    aug->elasticSigma = MNIST_AUGMENT_ELASTIC_SIGMA;
+    aug->seed = 1;
+    
+}
+
+
+
+
+/**
+ * @details Parses "name=value[,value]" pairs separated by ':'
+ */
+
+void parseMNISTAugmentation(const char *spec, MNIST_Augmentation *aug){
+    
+    char *copy = strdup(spec);
+    char *save = NULL;
+    
+    for (char *param = strtok_r(copy, ":", &save); param!=NULL; param = strtok_r(NULL, ":", &save)){
+        
+        char *value = strchr(param, '=');
+        if (value==NULL){
+            printf("Abort! Augmentations are given as name=value (not '%s')\n", param);
+            exit(1);
+        }
+        *value++ = '\0';
+        
+        char *end;
+        float v = strtof(value, &end);
+        if (end==value || v<0){
+            printf("Abort! Invalid augmentation value '%s' of '%s'\n", value, param);
+            exit(1);
+        }
+        
+        if (strcmp(param, "shift")==0) aug->maxShift = v;
+        else if (strcmp(param, "rotate")==0) aug->maxRotation = v;
+        else if (strcmp(param, "elastic")==0){
+            aug->elasticAlpha = v;
+            if (*end==','){
+                char *sigma = end+1;
+                aug->elasticSigma = strtof(sigma, &end);
+                if (end==sigma || aug->elasticSigma<=0 || aug->elasticSigma*3>MNIST_AUGMENT_MAX_RADIUS){
+                    printf("Abort! The elastic sigma must be above 0 and at most %d (not '%s')\n", MNIST_AUGMENT_MAX_RADIUS/3, sigma);
+                    exit(1);
+                }
+            }
+        }
+        else {
+            printf("Abort! Unknown augmentation '%s' (shift, rotate or elastic)\n", param);
+            exit(1);
+        }
+        
+        if (*end!='\0'){
+            printf("Abort! Invalid augmentation value '%s' of '%s'\n", value, param);
+            exit(1);
+        }
+    }
+    
+    free(copy);
+    
+}
+
+
+
+
+/**
+ * @details Any of the three transforms
+ */
+
+int isTransformingMNIST(const MNIST_Augmentation *aug){
+    
+    return aug->maxShift>0 || aug->maxRotation>0 || aug->elasticAlpha>0;
+}
+
+
+
+
+/**
+ * @details Returns a uniformly distributed random number in [-1,1) (splitmix64)
+ */
+
+static inline float nextAugmentRandom(uint64_t *state){
+    
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    
+    return (float)(z >> 40) * (2.0f / (1 << 24)) - 1;
+}
+
+
+
+
+/**
+ * @details Separable filter with zero padding beyond the borders: first along the rows, then along the columns
+ */
+
+void blurAugmentField(float *field, const float *kernel, int radius){
+    
+    float tmp[AUGMENT_PIXELS];
+    
+    // Rows: every row is copied into a zero-padded buffer, so the taps need no bounds checks
+    for (int y=0; y<MNIST_IMG_HEIGHT; y++){
+        
+        float pad[MNIST_IMG_WIDTH + 2*MNIST_AUGMENT_MAX_RADIUS] = {0};
+        memcpy(pad + radius, field + y*MNIST_IMG_WIDTH, MNIST_IMG_WIDTH * sizeof(float));
+        
+        float *row = tmp + y*MNIST_IMG_WIDTH;
+        for (int x=0; x<MNIST_IMG_WIDTH; x++) row[x] = 0;
+        
+        for (int k=0; k<=2*radius; k++){
+            float c = kernel[k];
+            for (int x=0; x<MNIST_IMG_WIDTH; x++) row[x] += c * pad[x+k];
+        }
+    }
+    
+    // Columns: whole rows are weighted and added up, the rows beyond the borders are 0
+    for (int y=0; y<MNIST_IMG_HEIGHT; y++){
+        
+        float *row = field + y*MNIST_IMG_WIDTH;
+        for (int x=0; x<MNIST_IMG_WIDTH; x++) row[x] = 0;
+        
+        for (int k=0; k<=2*radius; k++){
+            int src = y + k - radius;
+            if (src<0 || src>=MNIST_IMG_HEIGHT) continue;
+            float c = kernel[k];
+            const float *in = tmp + src*MNIST_IMG_WIDTH;
+            for (int x=0; x<MNIST_IMG_WIDTH; x++) row[x] += c * in[x];
+        }
+    }
+    
+}
+
+
+
+
+/**
+ * @details Fills dx and dy with random displacements in [-1,1), smoothed by a normalized Gaussian filter
+ * (alpha is applied along with the other transforms)
+ */
+
+void createElasticField(const MNIST_Augmentation *aug, float *dx, float *dy, uint64_t *state){
+    
+    int radius = (int)ceilf(3 * aug->elasticSigma);
+    if (radius>MNIST_AUGMENT_MAX_RADIUS) radius = MNIST_AUGMENT_MAX_RADIUS;
+    
+    float kernel[2*MNIST_AUGMENT_MAX_RADIUS+1];
+    float sum = 0;
+    for (int k=0; k<=2*radius; k++){
+        float d = (float)(k - radius);
+        kernel[k] = expf(-d*d / (2 * aug->elasticSigma * aug->elasticSigma));
+        sum += kernel[k];
+    }
+    for (int k=0; k<=2*radius; k++) kernel[k] /= sum;
+    
+    for (int i=0; i<AUGMENT_PIXELS; i++) dx[i] = nextAugmentRandom(state);
+    for (int i=0; i<AUGMENT_PIXELS; i++) dy[i] = nextAugmentRandom(state);
+    
+    blurAugmentField(dx, kernel, radius);
+    blurAugmentField(dy, kernel, radius);
+    
+}
+
+
+
+
+/**
+ * @details Computes the source position of every pixel (inverse rotation and shift, plus the elastic displacement)
+ * and samples the zero-padded source image there bilinearly
+ */
+
+void augmentMNISTImage(const MNIST_Augmentation *aug, const MNIST_Image *src, MNIST_Image *dst, uint64_t seed){
+    
+    uint64_t state = aug->seed ^ (seed * 0xD6E8FEB86659FD93ull);
+    
+    float angle = aug->maxRotation * nextAugmentRandom(&state) * (float)(M_PI / 180);
+    float shiftX = aug->maxShift * nextAugmentRandom(&state);
+    float shiftY = aug->maxShift * nextAugmentRandom(&state);
+    float cosA = cosf(angle), sinA = sinf(angle);
+    
+    float centerX = (MNIST_IMG_WIDTH-1) * 0.5f, centerY = (MNIST_IMG_HEIGHT-1) * 0.5f;
+    float alpha = aug->elasticAlpha;
+    
+    float srcX[AUGMENT_PIXELS], srcY[AUGMENT_PIXELS];
+    
+    if (aug->elasticAlpha>0) createElasticField(aug, srcX, srcY, &state);
+    else {
+        memset(srcX, 0, sizeof(srcX));
+        memset(srcY, 0, sizeof(srcY));
+    }
+    
+    // Source positions in the padded image (+1), clamped to its border so that every lookup stays inside
+    // and the positions are never negative (truncation = floor)
+    for (int y=0; y<MNIST_IMG_HEIGHT; y++){
+        
+        float ry = y - centerY - shiftY;
+        float *sx = srcX + y*MNIST_IMG_WIDTH;
+        float *sy = srcY + y*MNIST_IMG_WIDTH;
+        
+        for (int x=0; x<MNIST_IMG_WIDTH; x++){
+            float rx = x - centerX - shiftX;
+            float px = cosA * rx + sinA * ry + centerX + 1 + alpha * sx[x];
+            float py = cosA * ry - sinA * rx + centerY + 1 + alpha * sy[x];
+            px = (px < 0) ? 0 : px;
+            py = (py < 0) ? 0 : py;
+            sx[x] = (px > MNIST_IMG_WIDTH+1) ? MNIST_IMG_WIDTH+1 : px;
+            sy[x] = (py > MNIST_IMG_HEIGHT+1) ? MNIST_IMG_HEIGHT+1 : py;
+        }
+    }
+    
+    // Source image with a border of 0s: 1 pixel before and 2 pixels after every row and column
+    float pad[AUGMENT_PAD_HEIGHT][AUGMENT_PAD_WIDTH] = {{0}};
+    for (int y=0; y<MNIST_IMG_HEIGHT; y++){
+        for (int x=0; x<MNIST_IMG_WIDTH; x++) pad[y+1][x+1] = src->pixel[y*MNIST_IMG_WIDTH + x];
+    }
+    
+    float threshold = aug->grayscale ? 0 : MNIST_AUGMENT_BINARY_THRESHOLD;
+    
+    for (int i=0; i<AUGMENT_PIXELS; i++){
+        
+        int x0 = (int)srcX[i], y0 = (int)srcY[i];
+        float ax = srcX[i] - x0, ay = srcY[i] - y0;
+        
+        float top    = pad[y0][x0]   + ax * (pad[y0][x0+1]   - pad[y0][x0]);
+        float bottom = pad[y0+1][x0] + ax * (pad[y0+1][x0+1] - pad[y0+1][x0]);
+        
+        float value = top + ay * (bottom - top);
+        dst->pixel[i] = (value < threshold) ? 0 : (uint8_t)(value + 0.5f);
+    }
+    
+}
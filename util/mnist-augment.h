@@ -0,0 +1,90 @@
+/**
+ * @file mnist-augment.h
+ * @brief Utilities for augmenting MNIST images on the fly (random shifts, rotations and elastic distortions)
+ * @details Every transform maps the pixels of the output image back to a position in the source image, which
+ * is then sampled bilinearly: a random rotation about the image center, a random shift and, optionally, an
+ * elastic distortion (a random displacement per pixel, smoothed by a Gaussian filter and scaled by alpha, as
+ * proposed by Simard et al. 2003). All random numbers of an image are derived from one seed, so the same
+ * seed always gives the same image, whichever thread computes it. Images that are binarized afterwards drop the
+ * faint gray values the interpolation spreads around the strokes, which would otherwise thicken every stroke.
+ */
+
+#ifndef MNIST_AUGMENT_H
+#define MNIST_AUGMENT_H
+
+#include <stdint.h>
+
+#include "mnist-utils.h"
+
+
+#define MNIST_AUGMENT_MAX_RADIUS 12                         ///< Maximum radius (pixels) of the elastic distortion's Gaussian filter
+#define MNIST_AUGMENT_ELASTIC_SIGMA 4                       ///< Default standard deviation (pixels) of the elastic distortion's Gaussian filter
+#define MNIST_AUGMENT_BINARY_THRESHOLD 64                   ///< Interpolated gray values below are set to 0 unless the images are handed out as gray values
+
+
+typedef struct MNIST_Augmentation MNIST_Augmentation;
+
+
+
+
+/**
+ * @brief Settings of the preprocessing applied to every training image
+ */
+
+struct MNIST_Augmentation{
+    int grayscale;                  ///< 1 = hand out the gray values of the images (0 to 255) instead of binarizing them
+    float maxShift;                 ///< Maximum random shift in x and y (pixels, 0 = none)
+    float maxRotation;              ///< Maximum random rotation (degrees, 0 = none)
+    float elasticAlpha;             ///< Scale of the elastic distortion (pixels, 0 = none)
+    float elasticSigma;             ///< Standard deviation of the elastic distortion's Gaussian filter (pixels)
+    uint64_t seed;                  ///< Seed all images' random numbers are derived from
+};
+
+
+
+
+/**
+ * @brief Sets the augmentation to binarizing the images without any transform
+ * @param aug A pointer to the settings
+ */
+
+void initMNISTAugmentation(MNIST_Augmentation *aug);
+
+
+
+
+/**
+ * @brief Parses a specification of the transforms into the settings, aborting if it is invalid
+ * @details The specification lists transforms separated by ':', e.g. "shift=2:rotate=15:elastic=34,4"
+ * (shift in pixels, rotation in degrees, elastic alpha and optionally sigma in pixels).
+ * @param spec Specification of the transforms
+ * @param aug A pointer to the settings receiving the transforms
+ */
+
+void parseMNISTAugmentation(const char *spec, MNIST_Augmentation *aug);
+
+
+
+
+/**
+ * @brief Returns 1 if any transform is enabled, 0 if the images are only binarized or passed as gray values
+ * @param aug A pointer to the settings
+ */
+
+int isTransformingMNIST(const MNIST_Augmentation *aug);
+
+
+
+
+/**
+ * @brief Writes a randomly transformed copy of an image
+ * @param aug A pointer to the settings
+ * @param src A pointer to the source image
+ * @param dst A pointer to the image receiving the transformed copy (not src)
+ * @param seed Seed of the image's random numbers (mixed with aug->seed)
+ */
+
+void augmentMNISTImage(const MNIST_Augmentation *aug, const MNIST_Image *src, MNIST_Image *dst, uint64_t seed);
+
+
+#endif
@@ -0,0 +1,226 @@
+/**
+ * @file mnist-dataset.c
+ * @brief Utilities for random access to a memory-mapped MNIST image+label file pair
+ * @see http://yann.lecun.com/exdb/mnist/
+ */
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mnist-utils.h"
+#include "mnist-dataset.h"
+#include "profile-stats.h"
+
+
+
+
+/**
+ * @details Returns the 32bit number stored in MSB-first byte order at the given address
+ */
+
+uint32_t readBigEndian32(const uint8_t *b){
+    
+    return ((uint32_t)b[0] << 24u) | ((uint32_t)b[1] << 16u) | ((uint32_t)b[2] << 8u) | (uint32_t)b[3];
+}
+
+
+
+
+/**
+ * @details Maps the whole file read-only into memory and returns its address (and size in mapSize)
+ */
+
+void *mapMNISTFile(char *fileName, size_t *mapSize){
+    
+    int fd = open(fileName, O_RDONLY);
+    if (fd<0) {
+        printf("Abort! Could not find MNIST file: %s\n",fileName);
+        exit(1);
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st)!=0 || st.st_size==0) {
+        printf("Abort! Could not read MNIST file: %s\n",fileName);
+        exit(1);
+    }
+    
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map==MAP_FAILED) {
+        printf("Abort! Could not map MNIST file: %s\n",fileName);
+        exit(1);
+    }
+    
+    // The whole file is read anyway, so let the kernel read it ahead in large chunks
+    madvise(map, (size_t)st.st_size, MADV_WILLNEED);
+    
+    *mapSize = (size_t)st.st_size;
+    
+    return map;
+}
+
+
+
+
+/**
+ * @details Maps a MNIST image file and its label file into memory and validates their headers
+ * The headers must be of the right type, describe 28x28 images, match each other in the number of
+ * images and fit the actual file sizes.
+ */
+
+MNIST_Dataset *openMNISTDataset(char *imageFileName, char *labelFileName){
+    
+    MNIST_Dataset *ds = (MNIST_Dataset*)malloc(sizeof(MNIST_Dataset));
+    
+    ds->imageMap = mapMNISTFile(imageFileName, &ds->imageMapSize);
+    ds->labelMap = mapMNISTFile(labelFileName, &ds->labelMapSize);
+    
+    const uint8_t *ifh = (const uint8_t*)ds->imageMap;
+    const uint8_t *lfh = (const uint8_t*)ds->labelMap;
+    
+    if (ds->imageMapSize<sizeof(MNIST_ImageFileHeader) || readBigEndian32(ifh)!=MNIST_IMAGE_FILE_MAGIC_NUMBER) {
+        printf("Abort! Not a MNIST IMAGE file: %s\n",imageFileName);
+        exit(1);
+    }
+    if (ds->labelMapSize<sizeof(MNIST_LabelFileHeader) || readBigEndian32(lfh)!=MNIST_LABEL_FILE_MAGIC_NUMBER) {
+        printf("Abort! Not a MNIST LABEL file: %s\n",labelFileName);
+        exit(1);
+    }
+    
+    uint32_t maxImages = readBigEndian32(ifh+4);
+    uint32_t maxLabels = readBigEndian32(lfh+4);
+    uint32_t imgHeight = readBigEndian32(ifh+8);
+    uint32_t imgWidth  = readBigEndian32(ifh+12);
+    
+    if (imgWidth!=MNIST_IMG_WIDTH || imgHeight!=MNIST_IMG_HEIGHT) {
+        printf("Abort! Unsupported image size %ux%u in MNIST IMAGE file: %s\n",imgWidth,imgHeight,imageFileName);
+        exit(1);
+    }
+    if (maxImages!=maxLabels) {
+        printf("Abort! MNIST IMAGE file holds %u images but LABEL file holds %u labels\n",maxImages,maxLabels);
+        exit(1);
+    }
+    if (ds->imageMapSize < sizeof(MNIST_ImageFileHeader) + (size_t)maxImages*sizeof(MNIST_Image)) {
+        printf("Abort! MNIST IMAGE file is truncated: %s\n",imageFileName);
+        exit(1);
+    }
+    if (ds->labelMapSize < sizeof(MNIST_LabelFileHeader) + (size_t)maxLabels*sizeof(MNIST_Label)) {
+        printf("Abort! MNIST LABEL file is truncated: %s\n",labelFileName);
+        exit(1);
+    }
+    
+    ds->count  = (int)maxImages;
+    ds->images = (const MNIST_Image*)(ifh + sizeof(MNIST_ImageFileHeader));
+    ds->labels = (const MNIST_Label*)(lfh + sizeof(MNIST_LabelFileHeader));
+    ds->bits   = NULL;
+    
+    return ds;
+}
+
+
+
+
+/**
+ * @details Converts all images of the data set into bitsets (one bit per pixel, set if the pixel is not 0)
+ * This shrinks an image from 784 bytes to 104, so that the whole training set fits into the L2/L3 cache.
+ */
+
+void binarizeMNISTDataset(MNIST_Dataset *ds){
+    
+    if (ds->bits!=NULL) return;
+    
+    ds->bits = (uint64_t*)calloc((size_t)ds->count * MNIST_BITSET_WORDS, sizeof(uint64_t));
+    if (ds->bits==NULL) {
+        printf("Abort! Could not allocate memory for the binarized MNIST images\n");
+        exit(1);
+    }
+    
+    PROFILE_START(startTime);
+    for (int i=0; i<ds->count; i++) binarizeMNISTImage(&ds->images[i], ds->bits + (size_t)i * MNIST_BITSET_WORDS);
+    PROFILE_STOP(PROFILE_VECTORIZE, startTime);
+    
+}
+
+
+
+
+/**
+ * @details Sets one bit per non-zero pixel, bit p in word p/64
+ */
+
+void binarizeMNISTImage(const MNIST_Image *img, uint64_t *bits){
+    
+    for (int w=0; w<MNIST_BITSET_WORDS; w++) bits[w] = 0;
+    
+    for (int p=0; p<MNIST_IMG_WIDTH*MNIST_IMG_HEIGHT; p++){
+        if (img->pixel[p]) bits[p/64] |= (uint64_t)1 << (p%64);
+    }
+    
+}
+
+
+
+
+/**
+ * @details Creates an array of sample indices 0 to count-1 in file order
+ */
+
+int *createSampleOrder(int count){
+    
+    int *order = (int*)malloc((count>0 ? count : 1) * sizeof(int));
+    if (order==NULL) {
+        printf("Abort! Could not allocate memory for the order of %d samples\n",count);
+        exit(1);
+    }
+    
+    for (int i=0; i<count; i++) order[i] = i;
+    
+    return order;
+}
+
+
+
+
+/**
+ * @details Fisher-Yates shuffle driven by splitmix64, so that the order does not depend on (or change)
+ * the state of rand() that initializes the weights
+ */
+
+void shuffleSampleOrder(int *order, int count, uint64_t *seed){
+    
+    for (int i=count-1; i>0; i--){
+        
+        uint64_t z = (*seed += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        z ^= z >> 31;
+        
+        // Map the upper 32 bits onto 0..i without a modulo
+        int j = (int)(((z >> 32) * (uint64_t)(i+1)) >> 32);
+        
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    
+}
+
+
+
+
+/**
+ * @details Unmaps the files of a MNIST data set and frees it
+ */
+
+void closeMNISTDataset(MNIST_Dataset *ds){
+    
+    munmap(ds->imageMap, ds->imageMapSize);
+    munmap(ds->labelMap, ds->labelMapSize);
+    
+    free(ds->bits);
+    free(ds);
+    
+}
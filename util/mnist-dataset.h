@@ -0,0 +1,150 @@
+/**
+ * @file mnist-dataset.h
+ * @brief Utilities for random access to a memory-mapped MNIST image+label file pair
+ * @details Both IDX files are mapped into memory once and their headers are validated. Images and labels
+ * are then accessed by index directly in the mapping, without any copying or per-sample system calls.
+ * Optionally, all images can be binarized once into a compact cache of one bit per pixel.
+ * @see http://yann.lecun.com/exdb/mnist/
+ */
+
+#ifndef MNIST_DATASET_H
+#define MNIST_DATASET_H
+
+#include <stddef.h>
+
+#include "mnist-utils.h"
+
+
+#define MNIST_IMAGE_FILE_MAGIC_NUMBER 2051                  ///< magic number of a MNIST image (idx3-ubyte) file
+#define MNIST_LABEL_FILE_MAGIC_NUMBER 2049                  ///< magic number of a MNIST label (idx1-ubyte) file
+#define MNIST_BITSET_WORDS ((MNIST_IMG_WIDTH*MNIST_IMG_HEIGHT+63)/64)   ///< number of 64bit words of a binarized image
+
+
+typedef struct MNIST_Dataset MNIST_Dataset;
+
+
+
+
+/**
+ * @brief Data block defining a memory-mapped MNIST data set
+ */
+
+struct MNIST_Dataset{
+    int count;                      ///< Number of images (= number of labels)
+    const MNIST_Image *images;      ///< First image inside the image file mapping
+    const MNIST_Label *labels;      ///< First label inside the label file mapping
+    uint64_t *bits;                 ///< Binarized images, MNIST_BITSET_WORDS per image (NULL until binarizeMNISTDataset())
+    void *imageMap;                 ///< Mapping of the whole image file
+    size_t imageMapSize;
+    void *labelMap;                 ///< Mapping of the whole label file
+    size_t labelMapSize;
+};
+
+
+
+
+/**
+ * @brief Maps a MNIST image file and its label file into memory and validates their headers
+ * @param imageFileName Name of the MNIST image file
+ * @param labelFileName Name of the MNIST label file
+ */
+
+MNIST_Dataset *openMNISTDataset(char *imageFileName, char *labelFileName);
+
+
+
+
+/**
+ * @brief Unmaps the files of a MNIST data set and frees it
+ * @param ds A pointer to the data set
+ */
+
+void closeMNISTDataset(MNIST_Dataset *ds);
+
+
+
+
+/**
+ * @brief Converts all images of the data set into bitsets (one bit per pixel, set if the pixel is not 0)
+ * @details Bit p of an image's bitset is bit (p%64) of word (p/64). Calling it again has no effect.
+ * @param ds A pointer to the data set
+ */
+
+void binarizeMNISTDataset(MNIST_Dataset *ds);
+
+
+
+
+/**
+ * @brief Converts one image into a bitset (one bit per pixel, set if the pixel is not 0)
+ * @param img A pointer to the image
+ * @param bits Array of MNIST_BITSET_WORDS words receiving the bitset
+ */
+
+void binarizeMNISTImage(const MNIST_Image *img, uint64_t *bits);
+
+
+
+
+/**
+ * @brief Returns a pointer to image i of the data set (pointing into the file mapping)
+ * @param ds A pointer to the data set
+ * @param i Index of the image
+ */
+
+static inline const MNIST_Image *getDatasetImage(const MNIST_Dataset *ds, int i){
+    return &ds->images[i];
+}
+
+
+
+
+/**
+ * @brief Returns label i of the data set
+ * @param ds A pointer to the data set
+ * @param i Index of the label
+ */
+
+static inline MNIST_Label getDatasetLabel(const MNIST_Dataset *ds, int i){
+    return ds->labels[i];
+}
+
+
+
+
+/**
+ * @brief Returns the bitset of image i of a binarized data set
+ * @param ds A pointer to the data set (after binarizeMNISTDataset())
+ * @param i Index of the image
+ */
+
+static inline const uint64_t *getDatasetBitset(const MNIST_Dataset *ds, int i){
+    return ds->bits + (size_t)i * MNIST_BITSET_WORDS;
+}
+
+
+
+
+/**
+ * @brief Creates an array of sample indices 0 to count-1 in file order (released via free())
+ * @details Training loops visit the samples through such an index array, so that the data set can be
+ * shuffled or split without moving any images.
+ * @param count Number of indices
+ */
+
+int *createSampleOrder(int count);
+
+
+
+
+/**
+ * @brief Shuffles an array of sample indices in place (Fisher-Yates) using a private random number generator
+ * @param order Array of sample indices
+ * @param count Number of indices
+ * @param seed State of the random number generator (updated, so consecutive calls give different orders)
+ */
+
+void shuffleSampleOrder(int *order, int count, uint64_t *seed);
+
+
+#endif
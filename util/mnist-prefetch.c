@@ -0,0 +1,345 @@
+/**
+ * @file mnist-prefetch.c
+ * @brief Utilities for loading upcoming batches of a MNIST data set on background threads (producer/consumer)
+ * @details Batch k of a pass always goes into slot k % depth. A loader claims the next batch number once
+ * its slot is free, loads it without holding the lock and marks the slot as ready. The consumer waits
+ * for the slot of the batch it needs next, so the batches are consumed in order even if several
+ * loaders finish out of order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mnist-prefetch.h"
+#include "profile-stats.h"
+
+
+typedef enum PrefetchSlotState {SLOT_FREE, SLOT_LOADING, SLOT_READY, SLOT_IN_USE} PrefetchSlotState;
+
+
+typedef struct PrefetchSlot{
+    MNIST_PrefetchBatch batch;
+    PrefetchSlotState state;
+    int index;                      ///< Number of the batch (in the current pass) held by the slot
+} PrefetchSlot;
+
+
+
+
+/**
+ * @brief Data structure holding the ring of batch slots, the loader threads and their synchronization state
+ */
+
+struct MNIST_Prefetcher{
+    const MNIST_Dataset *ds;
+    int batchSize;
+    int depth;                      ///< Number of slots
+    PrefetchSlot *slots;
+    MNIST_Label *labelBlock;        ///< Labels of all slots
+    uint64_t *bitBlock;             ///< Bitsets of all slots
+    uint8_t *pixelBlock;            ///< Gray values of all slots (NULL unless grayscale)
+    MNIST_Augmentation aug;         ///< Preprocessing of every image
+    int augment;                    ///< 1 = aug transforms the images
+    int threadCount;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;          ///< Signals the consumer that a slot became ready
+    pthread_cond_t freed;           ///< Signals the loaders that a slot became free or a new pass started
+    const int *order;               ///< Image indices of the current pass
+    int count;                      ///< Number of images of the current pass
+    int batchCount;                 ///< Number of batches of the current pass
+    int nextLoad;                   ///< Number of the next batch to be claimed by a loader
+    int nextAcquire;                ///< Number of the next batch to be handed to the consumer
+    int passCount;                  ///< Number of passes started (seeds the transforms)
+    int shutdown;                   ///< Set to stop all loaders
+};
+
+
+
+
+/**
+ * @details Reads, transforms and binarizes (or copies) one image into slot position i
+ */
+
+void loadAugmentedImage(MNIST_Prefetcher *p, MNIST_PrefetchBatch *b, int i, int img){
+    
+    const MNIST_Image *src = getDatasetImage(p->ds, img);
+    MNIST_Image transformed;
+    
+    if (p->augment){
+        uint64_t seed = ((uint64_t)p->passCount << 32) | (uint64_t)(b->first + i);
+        augmentMNISTImage(&p->aug, src, &transformed, seed);
+        src = &transformed;
+    }
+    
+    if (b->pixels!=NULL) memcpy(b->pixels + (size_t)i * sizeof(MNIST_Image), src->pixel, sizeof(MNIST_Image));
+    else binarizeMNISTImage(src, b->bits + (size_t)i * MNIST_BITSET_WORDS);
+}
+
+
+
+
+/**
+ * @details Reads and binarizes the images of batch k of the current pass into a slot
+ */
+
+void loadPrefetchSlot(MNIST_Prefetcher *p, PrefetchSlot *slot, int k){
+    
+    MNIST_PrefetchBatch *b = &slot->batch;
+    
+    b->first = k * p->batchSize;
+    b->count = (p->count - b->first < p->batchSize) ? p->count - b->first : p->batchSize;
+    
+    // Preprocessed images always start from the pixels, even if the data set is binarized
+    int preprocess = (p->augment || b->pixels!=NULL);
+    
+    PROFILE_START(startTime);
+    
+    for (int i=0; i<b->count; i++){
+        
+        int img = p->order[b->first + i];
+        uint64_t *bits = b->bits + (size_t)i * MNIST_BITSET_WORDS;
+        
+        b->labels[i] = getDatasetLabel(p->ds, img);
+        
+        if (preprocess) loadAugmentedImage(p, b, i, img);
+        else if (p->ds->bits!=NULL) memcpy(bits, getDatasetBitset(p->ds, img), MNIST_BITSET_WORDS * sizeof(uint64_t));
+        else binarizeMNISTImage(getDatasetImage(p->ds, img), bits);
+    }
+    
+    // Copying pre-binarized images is reading, everything else is decoding
+    PROFILE_STOP(preprocess ? PROFILE_AUGMENT : (p->ds->bits!=NULL) ? PROFILE_READ : PROFILE_VECTORIZE, startTime);
+    
+    slot->index = k;
+}
+
+
+
+
+/**
+ * @details Main loop of a loader thread: claims the next batch as soon as its slot is free and loads it
+ */
+
+void *runPrefetchLoader(void *arg){
+    
+    MNIST_Prefetcher *p = (MNIST_Prefetcher*)arg;
+    
+    pthread_mutex_lock(&p->lock);
+    
+    for (;;){
+        
+        while (!p->shutdown && (p->nextLoad>=p->batchCount || p->slots[p->nextLoad % p->depth].state!=SLOT_FREE)){
+            pthread_cond_wait(&p->freed, &p->lock);
+        }
+        if (p->shutdown) break;
+        
+        int k = p->nextLoad++;
+        PrefetchSlot *slot = &p->slots[k % p->depth];
+        slot->state = SLOT_LOADING;
+        
+        pthread_mutex_unlock(&p->lock);
+        loadPrefetchSlot(p, slot, k);
+        pthread_mutex_lock(&p->lock);
+        
+        slot->state = SLOT_READY;
+        pthread_cond_broadcast(&p->loaded);
+    }
+    
+    pthread_mutex_unlock(&p->lock);
+    
+    return NULL;
+}
+
+
+
+
+/**
+ * @details Allocates all slots in one go, so that no memory is allocated while batches are passed around
+ */
+
+MNIST_Prefetcher *createMNISTPrefetcher(const MNIST_Dataset *ds, int batchSize, int depth, int threadCount){
+    
+    MNIST_Prefetcher *p = (MNIST_Prefetcher*)malloc(sizeof(MNIST_Prefetcher));
+    
+    p->ds = ds;
+    p->batchSize = (batchSize>0) ? batchSize : 1;
+    p->depth = (depth>1) ? depth : 2;
+    p->threadCount = (threadCount>0) ? threadCount : 0;
+    
+    p->slots      = (PrefetchSlot*)malloc(p->depth * sizeof(PrefetchSlot));
+    p->labelBlock = (MNIST_Label*)malloc((size_t)p->depth * p->batchSize * sizeof(MNIST_Label));
+    p->bitBlock   = (uint64_t*)malloc((size_t)p->depth * p->batchSize * MNIST_BITSET_WORDS * sizeof(uint64_t));
+    if (p->slots==NULL || p->labelBlock==NULL || p->bitBlock==NULL) {
+        printf("Abort! Could not allocate memory for %d prefetch batches of %d images\n",p->depth,p->batchSize);
+        exit(1);
+    }
+    
+    for (int s=0; s<p->depth; s++){
+        p->slots[s].batch.labels = p->labelBlock + (size_t)s * p->batchSize;
+        p->slots[s].batch.bits   = p->bitBlock + (size_t)s * p->batchSize * MNIST_BITSET_WORDS;
+        p->slots[s].batch.pixels = NULL;
+        p->slots[s].state = SLOT_FREE;
+        p->slots[s].index = -1;
+    }
+    
+    p->order = NULL;
+    p->count = 0;
+    p->batchCount = 0;
+    p->nextLoad = 0;
+    p->nextAcquire = 0;
+    p->passCount = 0;
+    p->shutdown = 0;
+    p->pixelBlock = NULL;
+    p->augment = 0;
+    initMNISTAugmentation(&p->aug);
+    
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->loaded, NULL);
+    pthread_cond_init(&p->freed, NULL);
+    
+    p->threads = (pthread_t*)malloc((p->threadCount>0 ? p->threadCount : 1) * sizeof(pthread_t));
+    for (int t=0; t<p->threadCount; t++){
+        if (pthread_create(&p->threads[t], NULL, runPrefetchLoader, p)!=0){
+            printf("Abort! Could not create prefetch loader thread\n");
+            exit(1);
+        }
+    }
+    
+    return p;
+}
+
+
+
+
+/**
+ * @details Stops all loaders (after they finished the batch they are loading) and frees the prefetcher
+ */
+
+void freeMNISTPrefetcher(MNIST_Prefetcher *p){
+    
+    pthread_mutex_lock(&p->lock);
+    p->shutdown = 1;
+    pthread_cond_broadcast(&p->freed);
+    pthread_mutex_unlock(&p->lock);
+    
+    for (int t=0; t<p->threadCount; t++) pthread_join(p->threads[t], NULL);
+    
+    pthread_cond_destroy(&p->freed);
+    pthread_cond_destroy(&p->loaded);
+    pthread_mutex_destroy(&p->lock);
+    
+    free(p->threads);
+    free(p->pixelBlock);
+    free(p->bitBlock);
+    free(p->labelBlock);
+    free(p->slots);
+    free(p);
+    
+}
+
+
+
+
+/**
+ * @details The gray values get their own block of slots, the bitsets are not filled then
+ */
+
+void setMNISTPrefetchAugmentation(MNIST_Prefetcher *p, const MNIST_Augmentation *aug){
+    
+    pthread_mutex_lock(&p->lock);
+    
+    p->aug = *aug;
+    p->augment = isTransformingMNIST(aug);
+    
+    if (aug->grayscale && p->pixelBlock==NULL){
+        p->pixelBlock = (uint8_t*)malloc((size_t)p->depth * p->batchSize * sizeof(MNIST_Image));
+        if (p->pixelBlock==NULL) {
+            printf("Abort! Could not allocate memory for %d prefetch batches of %d images\n",p->depth,p->batchSize);
+            exit(1);
+        }
+        for (int s=0; s<p->depth; s++) p->slots[s].batch.pixels = p->pixelBlock + (size_t)s * p->batchSize * sizeof(MNIST_Image);
+    }
+    
+    pthread_mutex_unlock(&p->lock);
+    
+}
+
+
+
+
+/**
+ * @details Resets the batch counters to the new pass and wakes up the loaders
+ */
+
+void startMNISTPrefetch(MNIST_Prefetcher *p, const int *order, int count){
+    
+    pthread_mutex_lock(&p->lock);
+    
+    p->order = order;
+    p->count = count;
+    p->batchCount = (count + p->batchSize - 1) / p->batchSize;
+    p->nextLoad = 0;
+    p->nextAcquire = 0;
+    p->passCount++;
+    
+    pthread_cond_broadcast(&p->freed);
+    pthread_mutex_unlock(&p->lock);
+    
+}
+
+
+
+
+/**
+ * @details Without loader threads the batch is loaded right here, otherwise waits until a loader has made it ready
+ */
+
+const MNIST_PrefetchBatch *acquireMNISTBatch(MNIST_Prefetcher *p){
+    
+    if (p->nextAcquire>=p->batchCount) return NULL;
+    
+    int k = p->nextAcquire++;
+    PrefetchSlot *slot = &p->slots[k % p->depth];
+    
+    if (p->threadCount==0){
+        loadPrefetchSlot(p, slot, k);
+        slot->state = SLOT_IN_USE;
+        return &slot->batch;
+    }
+    
+    // The time the consumer waits for a loader is counted as reading
+    PROFILE_START(startTime);
+    pthread_mutex_lock(&p->lock);
+    while (slot->state!=SLOT_READY || slot->index!=k) pthread_cond_wait(&p->loaded, &p->lock);
+    slot->state = SLOT_IN_USE;
+    pthread_mutex_unlock(&p->lock);
+    PROFILE_STOP(PROFILE_READ, startTime);
+    
+    return &slot->batch;
+}
+
+
+
+
+/**
+ * @details Marks the batch's slot as free and wakes up the loaders waiting for it
+ */
+
+void releaseMNISTBatch(MNIST_Prefetcher *p, const MNIST_PrefetchBatch *b){
+    
+    PrefetchSlot *slot = (PrefetchSlot*)((char*)b - offsetof(PrefetchSlot, batch));
+    
+    if (p->threadCount==0){
+        slot->state = SLOT_FREE;
+        return;
+    }
+    
+    pthread_mutex_lock(&p->lock);
+    slot->state = SLOT_FREE;
+    pthread_cond_broadcast(&p->freed);
+    pthread_mutex_unlock(&p->lock);
+    
+}
@@ -0,0 +1,138 @@
+/**
+ * @file mnist-prefetch.h
+ * @brief Utilities for loading upcoming batches of a MNIST data set on background threads (producer/consumer)
+ * @details Loader threads read the images of the next batches from the mapped files, binarize them and put
+ * them into a bounded ring of batch slots, while the trainer consumes the current batch. Reading the file
+ * (page faults on a large or remote file) and decoding therefore overlap with the computation. Batches are
+ * handed out strictly in the order they were requested, so the results do not depend on the number of
+ * loader threads. Without loader threads every batch is loaded by the consuming thread itself.
+ * Optionally, the loaders augment every image before binarizing it, or hand out its gray values instead
+ * (see mnist-augment.h), so the transforms run in the background as well.
+ */
+
+#ifndef MNIST_PREFETCH_H
+#define MNIST_PREFETCH_H
+
+#include "mnist-utils.h"
+#include "mnist-dataset.h"
+#include "mnist-augment.h"
+
+
+typedef struct MNIST_Prefetcher MNIST_Prefetcher;
+typedef struct MNIST_PrefetchBatch MNIST_PrefetchBatch;
+
+
+
+
+/**
+ * @brief Data block holding the decoded images of one batch
+ */
+
+struct MNIST_PrefetchBatch{
+    int first;                      ///< Position of the batch's first image in the order of the current pass
+    int count;                      ///< Number of images in the batch
+    MNIST_Label *labels;            ///< Label of every image
+    uint64_t *bits;                 ///< Binarized images, MNIST_BITSET_WORDS per image (unused with grayscale augmentation)
+    uint8_t *pixels;                ///< Gray values of the images, MNIST_IMG_WIDTH*MNIST_IMG_HEIGHT per image (NULL unless grayscale)
+};
+
+
+
+
+/**
+ * @brief Creates a prefetcher with a ring of depth batch slots and starts its loader threads
+ * @param ds A pointer to the data set (its images are binarized by the loaders, ds->bits is used if present)
+ * @param batchSize Maximum number of images per batch
+ * @param depth Number of batch slots (2 = double buffering, 3 = triple buffering, ...)
+ * @param threadCount Number of loader threads (0 = load every batch in acquireMNISTBatch())
+ */
+
+MNIST_Prefetcher *createMNISTPrefetcher(const MNIST_Dataset *ds, int batchSize, int depth, int threadCount);
+
+
+
+
+/**
+ * @brief Stops the loader threads and frees the prefetcher
+ * @param p A pointer to the prefetcher
+ */
+
+void freeMNISTPrefetcher(MNIST_Prefetcher *p);
+
+
+
+
+/**
+ * @brief Lets the loaders preprocess every image: transform it randomly and/or hand out its gray values
+ * @details Must be called before the first pass. The random transforms of an image depend on the number of
+ * the pass and the image's position in it only, so they are the same for any number of loader threads.
+ * @param p A pointer to the prefetcher
+ * @param aug A pointer to the settings (copied)
+ */
+
+void setMNISTPrefetchAugmentation(MNIST_Prefetcher *p, const MNIST_Augmentation *aug);
+
+
+
+
+/**
+ * @brief Starts a pass over a sequence of images, e.g. one training epoch
+ * @details All batches of the previous pass must have been acquired and released. The order array
+ * must stay unchanged until the pass is finished.
+ * @param p A pointer to the prefetcher
+ * @param order Indices of the images, in the order they are to be handed out
+ * @param count Number of indices in order
+ */
+
+void startMNISTPrefetch(MNIST_Prefetcher *p, const int *order, int count);
+
+
+
+
+/**
+ * @brief Returns the next batch of the current pass, waiting until it is loaded
+ * @param p A pointer to the prefetcher
+ * @return A pointer to the batch, or NULL if all batches of the pass were handed out
+ */
+
+const MNIST_PrefetchBatch *acquireMNISTBatch(MNIST_Prefetcher *p);
+
+
+
+
+/**
+ * @brief Hands a batch slot back to the loaders once its images have been processed
+ * @param p A pointer to the prefetcher
+ * @param b A pointer to the batch returned by acquireMNISTBatch()
+ */
+
+void releaseMNISTBatch(MNIST_Prefetcher *p, const MNIST_PrefetchBatch *b);
+
+
+
+
+/**
+ * @brief Returns the bitset of image i of a batch
+ * @param b A pointer to the batch
+ * @param i Index of the image in the batch
+ */
+
+static inline const uint64_t *getPrefetchBitset(const MNIST_PrefetchBatch *b, int i){
+    return b->bits + (size_t)i * MNIST_BITSET_WORDS;
+}
+
+
+
+
+/**
+ * @brief Returns the gray values of image i of a batch (if the prefetcher hands out gray values)
+ * @param b A pointer to the batch
+ * @param i Index of the image in the batch
+ */
+
+static inline const uint8_t *getPrefetchPixels(const MNIST_PrefetchBatch *b, int i){
+    return b->pixels + (size_t)i * MNIST_IMG_WIDTH*MNIST_IMG_HEIGHT;
+}
+
+
+#endif
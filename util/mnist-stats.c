@@ -10,6 +10,7 @@
 #include "screen.h"
 #include "mnist-utils.h"
 #include "mnist-stats.h"
+#include "alloc-stats.h"
 
 
 
@@ -71,13 +72,13 @@ void displayImage(MNIST_Image *img, int lbl, int cls, int row, int col){
  * @details Outputs reading progress while processing MNIST training images
  */
 
-void displayTrainingProgress(int imgCount, int errCount, int y, int x){
+void displayTrainingProgress(int imgCount, int imgTotal, int errCount, int y, int x){
     
-    double progress = (double)(imgCount+1)/(double)(MNIST_MAX_TRAINING_IMAGES)*100;
+    double progress = (double)(imgCount+1)/(double)(imgTotal)*100;
     
     if (x!=0 && y!=0) locateCursor(y, x);
     
-    printf("1: TRAINING: Reading image No. %5d of %5d images [%3d%%]  ",(imgCount+1),MNIST_MAX_TRAINING_IMAGES,(int)progress);
+    printf("1: TRAINING: Reading image No. %5d of %5d images [%3d%%]  ",(imgCount+1),imgTotal,(int)progress);
 
     
     double accuracy = 1 - ((double)errCount/(double)(imgCount+1));
@@ -106,4 +107,19 @@ void displayTestingProgress(int imgCount, int errCount, int y, int x){
 
 
 
+/**
+ * @details Outputs the number of heap allocations made while training and testing
+ */
 
+void displayAllocationStats(unsigned long trainAllocCount, unsigned long testAllocCount, int y, int x){
+    
+    if (x!=0 && y!=0) locateCursor(y, x);
+    
+    if (!isAllocationCountAvailable()){
+        printf("3: HEAP:     Allocation counting is not available in this build\n");
+        return;
+    }
+    
+    printf("3: HEAP:     Allocations while training=%lu  while testing=%lu  (total=%lu)\n", trainAllocCount, testAllocCount, getAllocationCount());
+    
+}
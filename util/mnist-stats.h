@@ -37,15 +37,27 @@ void displayImage(MNIST_Image *img, int lbl, int cls, int row, int col);
 /**
  * @brief Outputs reading progress while processing MNIST training images
  * @param imgCount Number of images already read from the MNIST file
+ * @param imgTotal Number of images that are trained with per epoch
  * @param errCount Number of errors (images incorrectly classified)
  * @param y Row of terminal screen
  * @param x Column of terminal screen
  */
 
-void displayTrainingProgress(int imgCount, int errCount, int y, int x);
+void displayTrainingProgress(int imgCount, int imgTotal, int errCount, int y, int x);
 
 
 
 void displayTestingProgress(int imgCount, int errCount, int y, int x);
 
 
+
+
+/**
+ * @brief Outputs the number of heap allocations made while training and testing
+ * @param trainAllocCount Number of heap allocations made in the training loop
+ * @param testAllocCount Number of heap allocations made in the testing loop
+ * @param y Row of terminal screen
+ * @param x Column of terminal screen
+ */
+
+void displayAllocationStats(unsigned long trainAllocCount, unsigned long testAllocCount, int y, int x);
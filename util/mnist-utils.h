@@ -6,6 +6,9 @@
  * @date July 2015
  */
 
+#ifndef MNIST_UTILS_H
+#define MNIST_UTILS_H
+
 #include <stdint.h>
 #include <stdio.h>
 
@@ -123,3 +126,6 @@ MNIST_Label getLabel(FILE *labelFile);
 
 
 int getStandardDigitPixel(int num, int pixelId);
+
+
+#endif
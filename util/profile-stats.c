@@ -0,0 +1,154 @@
+/**
+ * @file profile-stats.c
+ * @brief Utilities for measuring where the time of a run goes (per-phase timers and hardware counters)
+ * @details The hardware counters are read once for the whole run rather than per phase: every read is a
+ * system call, which would cost more than most phases take per image. The counters are inherited by all
+ * threads created after startHardwareCounters(), and those threads are joined before the counters are read.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#ifdef MNIST_PROFILE
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define PROFILE_PERF_EVENT
+#endif
+#endif
+
+#include "profile-stats.h"
+
+
+#define PROFILE_COUNTER_COUNT 3         ///< Cycles, instructions, cache misses
+
+
+static uint64_t phaseTime[PROFILE_PHASE_COUNT];
+static uint64_t phaseCalls[PROFILE_PHASE_COUNT];
+
+static const char *phaseNames[PROFILE_PHASE_COUNT] = {
+    "read", "vectorize", "augment", "feedInput", "hidden forward", "output forward", "output backprop", "hidden backprop", "classify", "display"
+};
+
+static int counterFds[PROFILE_COUNTER_COUNT] = {-1, -1, -1};
+static int counterErrno = 0;            ///< errno of a failed perf_event_open()
+
+
+
+
+/**
+ * @details Returns the current value of the monotonic clock in nanoseconds
+ */
+
+uint64_t getProfileTime(void){
+    
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    
+    return (uint64_t)t.tv_sec*1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+
+
+
+/**
+ * @details Adds the time since startTime and one call to a phase (thread-safe)
+ */
+
+void addProfileTime(ProfilePhase phase, uint64_t startTime){
+    
+    __atomic_add_fetch(&phaseTime[phase], getProfileTime() - startTime, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&phaseCalls[phase], 1, __ATOMIC_RELAXED);
+    
+}
+
+
+
+
+/**
+ * @details Opens one user-space counter per event for the calling thread and its future threads
+ */
+
+void startHardwareCounters(void){
+    
+#ifdef PROFILE_PERF_EVENT
+    const uint64_t configs[PROFILE_COUNTER_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+    
+    for (int c=0; c<PROFILE_COUNTER_COUNT; c++){
+        
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[c];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        
+        counterFds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counterFds[c]<0 && counterErrno==0) counterErrno = errno;
+    }
+#endif
+    
+}
+
+
+
+
+/**
+ * @details Returns the value of hardware counter c, or -1 if it is not available
+ */
+
+long long readHardwareCounter(int c){
+    
+#ifdef PROFILE_PERF_EVENT
+    uint64_t value;
+    if (counterFds[c]>=0 && read(counterFds[c], &value, sizeof(value))==sizeof(value)) return (long long)value;
+#else
+    (void)c;
+#endif
+    
+    return -1;
+}
+
+
+
+
+/**
+ * @details Outputs one line per phase that was entered at least once, then the hardware counters
+ */
+
+void displayProfileStats(double totalTime){
+    
+#ifdef MNIST_PROFILE
+    printf("    PROFILE:   %-16s %10s %12s %10s %7s\n", "phase", "calls", "total ms", "ns/call", "share");
+    
+    for (int p=0; p<PROFILE_PHASE_COUNT; p++){
+        if (phaseCalls[p]==0) continue;
+        printf("               %-16s %10llu %12.1f %10.1f %6.1f%%\n", phaseNames[p], (unsigned long long)phaseCalls[p], phaseTime[p]/1e6,
+               (double)phaseTime[p]/phaseCalls[p], (totalTime>0) ? 100 * phaseTime[p]/1e9/totalTime : 0);
+    }
+    
+    long long cycles = readHardwareCounter(0);
+    long long instructions = readHardwareCounter(1);
+    long long misses = readHardwareCounter(2);
+    
+    if (cycles<0 || instructions<0){
+        printf("    COUNTERS:  not available (perf_event_open: %s)\n\n", (counterErrno!=0) ? strerror(counterErrno) : "not supported on this platform");
+        return;
+    }
+    
+    printf("    COUNTERS:  cycles=%lld  instructions=%lld (%.2f per cycle)", cycles, instructions, (cycles>0) ? (double)instructions/cycles : 0);
+    if (misses>=0) printf("  cache misses=%lld (%.2f per 1000 instructions)", misses, (instructions>0) ? 1000.0*misses/instructions : 0);
+    printf("\n\n");
+#else
+    (void)totalTime;
+    (void)phaseNames;
+    (void)counterFds;
+    (void)counterErrno;
+#endif
+    
+}
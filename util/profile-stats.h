@@ -0,0 +1,81 @@
+/**
+ * @file profile-stats.h
+ * @brief Utilities for measuring where the time of a run goes (per-phase timers and hardware counters)
+ * @details When built with MNIST_PROFILE (make PROFILE=1), the hot paths are bracketed by PROFILE_START()
+ * and PROFILE_STOP(), which add the elapsed time and one call to the phase's counters. In all other builds
+ * both macros expand to nothing, so the instrumentation costs nothing. Where the kernel permits it, the
+ * cycles, instructions and cache misses of the whole run are read via perf_event.
+ */
+
+#ifndef MNIST_PROFILE_STATS_H
+#define MNIST_PROFILE_STATS_H
+
+#include <stdint.h>
+
+
+typedef enum ProfilePhase {
+    PROFILE_READ,                   ///< Waiting for the next batch of images (reading the mapped files)
+    PROFILE_VECTORIZE,              ///< Binarizing images (any thread)
+    PROFILE_AUGMENT,                ///< Transforming training images (any thread)
+    PROFILE_FEED_INPUT,             ///< Unpacking a bitset into the INPUT layer
+    PROFILE_HIDDEN_FORWARD,         ///< Calculating the outputs of a HIDDEN layer
+    PROFILE_OUTPUT_FORWARD,         ///< Calculating the outputs of the OUTPUT layer
+    PROFILE_OUTPUT_BACKPROP,        ///< Output deltas and OUTPUT layer weight update
+    PROFILE_HIDDEN_BACKPROP,        ///< Hidden deltas and HIDDEN layer weight updates
+    PROFILE_CLASSIFY,               ///< Picking the output node with the highest output
+    PROFILE_DISPLAY,                ///< Publishing and rendering the progress (any thread)
+    PROFILE_PHASE_COUNT
+} ProfilePhase;
+
+
+#ifdef MNIST_PROFILE
+#define PROFILE_START(var) uint64_t var = getProfileTime()
+#define PROFILE_STOP(phase, var) addProfileTime(phase, var)
+#else
+#define PROFILE_START(var)
+#define PROFILE_STOP(phase, var)
+#endif
+
+
+
+
+/**
+ * @brief Returns the current value of the monotonic clock in nanoseconds
+ */
+
+uint64_t getProfileTime(void);
+
+
+
+
+/**
+ * @brief Adds the time since startTime and one call to a phase (thread-safe)
+ * @param phase The phase
+ * @param startTime Value of getProfileTime() at the start of the phase
+ */
+
+void addProfileTime(ProfilePhase phase, uint64_t startTime);
+
+
+
+
+/**
+ * @brief Starts counting cycles, instructions and cache misses of all threads (created from now on)
+ * @details Does nothing unless built with MNIST_PROFILE.
+ */
+
+void startHardwareCounters(void);
+
+
+
+
+/**
+ * @brief Outputs the time and calls per phase and the hardware counters of the run
+ * @details Does nothing unless built with MNIST_PROFILE.
+ * @param totalTime Execution time of the run in seconds (= 100% of the breakdown)
+ */
+
+void displayProfileStats(double totalTime);
+
+
+#endif
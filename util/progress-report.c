@@ -0,0 +1,222 @@
+/**
+ * @file progress-report.c
+ * @brief Utilities for reporting the progress of the training and testing loops at a limited rate
+ * @details All state is process-wide, like the allocation counter. The counters are written by the
+ * loop's thread and read by the render thread without locking; a rendering may therefore combine
+ * counters of two neighbouring images, which only matters until the final state is rendered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "screen.h"
+#include "mnist-utils.h"
+#include "mnist-stats.h"
+#include "progress-report.h"
+#include "profile-stats.h"
+
+
+typedef struct ProgressReporter{
+    ProgressMode mode;
+    int intervalMs;
+    pthread_t thread;
+    int threadRunning;              ///< 1 if the render thread was started
+    pthread_mutex_t lock;           ///< Serializes the renderings of both threads
+    pthread_cond_t wake;            ///< Signals the render thread to stop
+    int shutdown;
+    int active;                     ///< 1 while a phase is reported
+    ProgressPhase phase;
+    int total;
+    int y, x;
+    struct timespec startTime;      ///< Start of the current phase
+    int imgCount;                   ///< Published by updateProgress()
+    int errCount;                   ///< Published by updateProgress()
+    int renderedCount;              ///< imgCount of the last rendering
+} ProgressReporter;
+
+static ProgressReporter reporter = {.mode = PROGRESS_ANSI, .intervalMs = 100, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+
+
+
+/**
+ * @details Outputs the given counters of the current phase in the selected mode (lock held)
+ */
+
+void renderProgress(int imgCount, int errCount, int final){
+    
+    ProgressReporter *r = &reporter;
+    
+    if (imgCount<1) return;
+    if (r->mode==PROGRESS_SILENT && !final) return;
+    
+    PROFILE_START(startTime);
+    
+    if (r->mode==PROGRESS_JSON){
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double seconds = (now.tv_sec - r->startTime.tv_sec) + (now.tv_nsec - r->startTime.tv_nsec)/1e9;
+        printf("{\"phase\":\"%s\",\"images\":%d,\"total\":%d,\"errors\":%d,\"accuracy\":%.4f,\"seconds\":%.3f,\"imagesPerSec\":%.0f,\"final\":%s}\n",
+               (r->phase==PHASE_TRAINING) ? "training" : "testing", imgCount, r->total, errCount,
+               100 * (1 - (double)errCount/imgCount), seconds, (seconds>0) ? imgCount/seconds : 0, final ? "true" : "false");
+    }
+    else {
+        // Without escape sequences every rendering is a line of its own
+        int y = (r->mode==PROGRESS_ANSI) ? r->y : 0;
+        int x = (r->mode==PROGRESS_ANSI) ? r->x : 0;
+        if (r->phase==PHASE_TRAINING) displayTrainingProgress(imgCount-1, r->total, errCount, y, x);
+        else displayTestingProgress(imgCount-1, errCount, y, x);
+    }
+    
+    fflush(stdout);
+    r->renderedCount = imgCount;
+    
+    PROFILE_STOP(PROFILE_DISPLAY, startTime);
+}
+
+
+
+
+/**
+ * @details Main loop of the render thread: renders the latest counters once per interval if they changed
+ */
+
+void *runProgressRenderer(void *arg){
+    
+    ProgressReporter *r = (ProgressReporter*)arg;
+    
+    pthread_mutex_lock(&r->lock);
+    
+    while (!r->shutdown){
+        
+        struct timespec wakeTime;
+        clock_gettime(CLOCK_REALTIME, &wakeTime);
+        wakeTime.tv_nsec += (long)r->intervalMs * 1000000L;
+        wakeTime.tv_sec  += wakeTime.tv_nsec / 1000000000L;
+        wakeTime.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&r->wake, &r->lock, &wakeTime);
+        
+        if (r->shutdown || !r->active) continue;
+        
+        int errCount = __atomic_load_n(&r->errCount, __ATOMIC_RELAXED);
+        int imgCount = __atomic_load_n(&r->imgCount, __ATOMIC_RELAXED);
+        if (imgCount!=r->renderedCount) renderProgress(imgCount, errCount, 0);
+    }
+    
+    pthread_mutex_unlock(&r->lock);
+    
+    return NULL;
+}
+
+
+
+
+/**
+ * @details The render thread is not needed if only the final lines are printed
+ */
+
+void initProgressReporting(ProgressMode mode, int intervalMs){
+    
+    ProgressReporter *r = &reporter;
+    
+    r->mode = mode;
+    r->intervalMs = (intervalMs>0) ? intervalMs : 1;
+    r->shutdown = 0;
+    r->active = 0;
+    
+    setScreenEscapes(mode==PROGRESS_ANSI);
+    
+    if (mode==PROGRESS_SILENT) return;
+    
+    if (pthread_create(&r->thread, NULL, runProgressRenderer, r)!=0){
+        printf("Abort! Could not create progress render thread\n");
+        exit(1);
+    }
+    r->threadRunning = 1;
+}
+
+
+
+
+/**
+ * @details Wakes up the render thread and waits until it has stopped
+ */
+
+void stopProgressReporting(void){
+    
+    ProgressReporter *r = &reporter;
+    
+    if (!r->threadRunning) return;
+    
+    pthread_mutex_lock(&r->lock);
+    r->shutdown = 1;
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+    
+    pthread_join(r->thread, NULL);
+    r->threadRunning = 0;
+}
+
+
+
+
+/**
+ * @details Resets the counters, the render thread picks up the new phase with its next interval
+ */
+
+void startProgress(ProgressPhase phase, int total, int y, int x){
+    
+    ProgressReporter *r = &reporter;
+    
+    pthread_mutex_lock(&r->lock);
+    
+    r->phase = phase;
+    r->total = total;
+    r->y = y;
+    r->x = x;
+    clock_gettime(CLOCK_MONOTONIC, &r->startTime);
+    __atomic_store_n(&r->imgCount, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->errCount, 0, __ATOMIC_RELAXED);
+    r->renderedCount = 0;
+    r->active = 1;
+    
+    pthread_mutex_unlock(&r->lock);
+}
+
+
+
+
+/**
+ * @details Only stores the counters, rendering is left to the render thread
+ */
+
+void updateProgress(int imgCount, int errCount){
+    
+    PROFILE_START(startTime);
+    
+    __atomic_store_n(&reporter.errCount, errCount, __ATOMIC_RELAXED);
+    __atomic_store_n(&reporter.imgCount, imgCount, __ATOMIC_RELAXED);
+    
+    PROFILE_STOP(PROFILE_DISPLAY, startTime);
+}
+
+
+
+
+/**
+ * @details Called by the thread that updated the counters, so their final values are visible here
+ */
+
+void finishProgress(void){
+    
+    ProgressReporter *r = &reporter;
+    
+    pthread_mutex_lock(&r->lock);
+    
+    r->active = 0;
+    renderProgress(r->imgCount, r->errCount, 1);
+    
+    pthread_mutex_unlock(&r->lock);
+}
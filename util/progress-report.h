@@ -0,0 +1,74 @@
+/**
+ * @file progress-report.h
+ * @brief Utilities for reporting the progress of the training and testing loops at a limited rate
+ * @details The loops only publish their counters via updateProgress() (two relaxed atomic stores). A
+ * background thread renders the latest counters once per interval, so the terminal output no longer
+ * costs time per image and a slow terminal or pipe never blocks the loops. The final state of every
+ * phase is rendered synchronously by finishProgress().
+ */
+
+#ifndef MNIST_PROGRESS_REPORT_H
+#define MNIST_PROGRESS_REPORT_H
+
+
+typedef enum ProgressMode {PROGRESS_ANSI, PROGRESS_PLAIN, PROGRESS_JSON, PROGRESS_SILENT} ProgressMode;
+typedef enum ProgressPhase {PHASE_TRAINING, PHASE_TESTING} ProgressPhase;
+
+
+
+
+/**
+ * @brief Selects the output mode and starts the render thread
+ * @details PROGRESS_ANSI redraws the progress lines in place via escape sequences, PROGRESS_PLAIN prints
+ * them as new lines without any escape sequences (also disabling those of screen.h), PROGRESS_JSON prints
+ * one JSON object per line instead, and PROGRESS_SILENT only prints the final line of each phase.
+ * @param mode Output mode
+ * @param intervalMs Number of milliseconds between two renderings
+ */
+
+void initProgressReporting(ProgressMode mode, int intervalMs);
+
+
+
+
+/**
+ * @brief Stops the render thread
+ */
+
+void stopProgressReporting(void);
+
+
+
+
+/**
+ * @brief Starts reporting a new phase (e.g. one training epoch)
+ * @param phase Training or testing
+ * @param total Number of images of the phase
+ * @param y Row of terminal screen (ANSI mode)
+ * @param x Column of terminal screen (ANSI mode)
+ */
+
+void startProgress(ProgressPhase phase, int total, int y, int x);
+
+
+
+
+/**
+ * @brief Publishes the counters of the current phase, callable from the hot loop
+ * @param imgCount Number of images processed so far
+ * @param errCount Number of errors (images incorrectly classified) so far
+ */
+
+void updateProgress(int imgCount, int errCount);
+
+
+
+
+/**
+ * @brief Ends the current phase and renders its final counters
+ */
+
+void finishProgress(void);
+
+
+#endif
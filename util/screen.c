@@ -10,6 +10,20 @@
 #include "screen.h"
 
 
+static int escapesEnabled = 1;
+
+
+
+
+/**
+ * @details Enables or disables all escape sequences, e.g. when the output goes to a log file
+ */
+
+void setScreenEscapes(int enabled){
+    escapesEnabled = enabled;
+}
+
+
 
 
 /**
@@ -17,6 +31,7 @@
  */
 
 void clearScreen(){
+    if (!escapesEnabled) return;
     printf("\e[1;1H\e[2J");
 }
 
@@ -28,6 +43,7 @@ void clearScreen(){
  */
 
 void setColor(Color c){
+    if (!escapesEnabled) return;
     char esc[5];
     strcpy(esc, "0;00");    // default WHITE
     switch (c) {
@@ -55,5 +71,6 @@ void setColor(Color c){
  */
 
 void locateCursor(const int row, const int col){
+    if (!escapesEnabled) return;
     printf("%c[%d;%dH",27,row,col);
 }
@@ -12,6 +12,16 @@ static const Color DEFAULT_TEXT_COLOR = WHITE;
 
 
 
+/**
+ * @brief Enables or disables all escape sequences, e.g. when the output goes to a log file
+ * @param enabled 0 = the functions below print nothing
+ */
+
+void setScreenEscapes(int enabled);
+
+
+
+
 /**
  * @brief Clear terminal screen by printing an escape sequence
  */
@@ -0,0 +1,219 @@
+/**
+ * @file thread-pool.c
+ * @brief Utilities for running a function on a fixed set of worker threads (fork-join)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "thread-pool.h"
+
+
+
+
+/**
+ * @brief Data structure holding the worker threads and their synchronization state
+ */
+
+struct ThreadPool{
+    int threadCount;                ///< Number of threads including the calling thread
+    pthread_t *threads;             ///< threadCount-1 worker threads
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            ///< Signals the workers that a new function is to be run
+    pthread_cond_t done;            ///< Signals the calling thread that all workers are done
+    ThreadPoolFct fct;              ///< Function of the current run
+    void *arg;                      ///< Argument of the current run
+    unsigned long generation;       ///< Incremented with every run
+    int running;                    ///< Number of workers still busy with the current run
+    int shutdown;                   ///< Set to stop all workers
+    pthread_mutex_t barrierLock;
+    pthread_cond_t barrierCond;
+    int barrierCount;               ///< Number of threads waiting at the barrier
+    unsigned long barrierPhase;     ///< Incremented whenever all threads have reached the barrier
+};
+
+
+typedef struct ThreadPoolWorker{
+    ThreadPool *tp;
+    int threadId;
+} ThreadPoolWorker;
+
+
+
+
+/**
+ * @details Main loop of a worker thread: waits for a new run, executes it and reports back
+ */
+
+void *runThreadPoolWorker(void *workerArg){
+    
+    ThreadPoolWorker *worker = (ThreadPoolWorker*)workerArg;
+    ThreadPool *tp = worker->tp;
+    unsigned long generation = 0;
+    
+    for (;;){
+        
+        pthread_mutex_lock(&tp->lock);
+        while (!tp->shutdown && tp->generation==generation) pthread_cond_wait(&tp->wake, &tp->lock);
+        if (tp->shutdown){
+            pthread_mutex_unlock(&tp->lock);
+            break;
+        }
+        generation = tp->generation;
+        ThreadPoolFct fct = tp->fct;
+        void *arg = tp->arg;
+        pthread_mutex_unlock(&tp->lock);
+        
+        fct(arg, worker->threadId, tp->threadCount);
+        
+        pthread_mutex_lock(&tp->lock);
+        if (--tp->running==0) pthread_cond_signal(&tp->done);
+        pthread_mutex_unlock(&tp->lock);
+    }
+    
+    free(worker);
+    
+    return NULL;
+}
+
+
+
+
+/**
+ * @details Creates a pool of threadCount threads (including the calling thread)
+ */
+
+ThreadPool *createThreadPool(int threadCount){
+    
+    if (threadCount<1) threadCount = 1;
+    
+    ThreadPool *tp = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    tp->threadCount = threadCount;
+    tp->threads = (pthread_t*)malloc(threadCount * sizeof(pthread_t));
+    
+    pthread_mutex_init(&tp->lock, NULL);
+    pthread_cond_init(&tp->wake, NULL);
+    pthread_cond_init(&tp->done, NULL);
+    pthread_mutex_init(&tp->barrierLock, NULL);
+    pthread_cond_init(&tp->barrierCond, NULL);
+    
+    for (int i=1; i<threadCount; i++){
+        ThreadPoolWorker *worker = (ThreadPoolWorker*)malloc(sizeof(ThreadPoolWorker));
+        worker->tp = tp;
+        worker->threadId = i;
+        if (pthread_create(&tp->threads[i-1], NULL, runThreadPoolWorker, worker) != 0){
+            printf("Abort! Could not create worker thread %d\n", i);
+            exit(1);
+        }
+    }
+    
+    return tp;
+}
+
+
+
+
+/**
+ * @details Stops all worker threads and frees the pool
+ */
+
+void freeThreadPool(ThreadPool *tp){
+    
+    pthread_mutex_lock(&tp->lock);
+    tp->shutdown = 1;
+    pthread_cond_broadcast(&tp->wake);
+    pthread_mutex_unlock(&tp->lock);
+    
+    for (int i=1; i<tp->threadCount; i++) pthread_join(tp->threads[i-1], NULL);
+    
+    pthread_cond_destroy(&tp->barrierCond);
+    pthread_mutex_destroy(&tp->barrierLock);
+    pthread_cond_destroy(&tp->done);
+    pthread_cond_destroy(&tp->wake);
+    pthread_mutex_destroy(&tp->lock);
+    
+    free(tp->threads);
+    free(tp);
+    
+}
+
+
+
+
+/**
+ * @details Returns the number of threads in the pool (including the calling thread)
+ */
+
+int getThreadPoolSize(ThreadPool *tp){
+    
+    return tp->threadCount;
+}
+
+
+
+
+/**
+ * @details Runs fct on all threads of the pool (the calling thread being thread 0) and waits for all of them
+ */
+
+void runOnThreadPool(ThreadPool *tp, ThreadPoolFct fct, void *arg){
+    
+    pthread_mutex_lock(&tp->lock);
+    tp->fct = fct;
+    tp->arg = arg;
+    tp->running = tp->threadCount - 1;
+    tp->generation++;
+    pthread_cond_broadcast(&tp->wake);
+    pthread_mutex_unlock(&tp->lock);
+    
+    fct(arg, 0, tp->threadCount);
+    
+    pthread_mutex_lock(&tp->lock);
+    while (tp->running>0) pthread_cond_wait(&tp->done, &tp->lock);
+    pthread_mutex_unlock(&tp->lock);
+    
+}
+
+
+
+
+/**
+ * @details Blocks until all threads of the pool have reached this barrier
+ */
+
+void waitThreadPoolBarrier(ThreadPool *tp){
+    
+    if (tp->threadCount==1) return;
+    
+    pthread_mutex_lock(&tp->barrierLock);
+    
+    unsigned long phase = tp->barrierPhase;
+    
+    if (++tp->barrierCount==tp->threadCount){
+        tp->barrierCount = 0;
+        tp->barrierPhase++;
+        pthread_cond_broadcast(&tp->barrierCond);
+    }
+    else {
+        while (tp->barrierPhase==phase) pthread_cond_wait(&tp->barrierCond, &tp->barrierLock);
+    }
+    
+    pthread_mutex_unlock(&tp->barrierLock);
+    
+}
+
+
+
+
+/**
+ * @details Returns the number of CPU cores that are online
+ */
+
+int getCPUCoreCount(void){
+    
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    return (count<1) ? 1 : (int)count;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file thread-pool.h
+ * @brief Utilities for running a function on a fixed set of worker threads (fork-join)
+ * @details The calling thread takes part in every run as thread 0, so a pool of N threads starts N-1 extra threads.
+ */
+
+#ifndef MNIST_THREAD_POOL_H
+#define MNIST_THREAD_POOL_H
+
+
+typedef struct ThreadPool ThreadPool;
+
+typedef void (*ThreadPoolFct)(void *arg, int threadId, int threadCount);
+
+
+
+
+/**
+ * @brief Creates a pool of threadCount threads (including the calling thread)
+ * @param threadCount Number of threads that run each function
+ */
+
+ThreadPool *createThreadPool(int threadCount);
+
+
+
+
+/**
+ * @brief Stops all worker threads and frees the pool
+ * @param tp A pointer to the thread pool
+ */
+
+void freeThreadPool(ThreadPool *tp);
+
+
+
+
+/**
+ * @brief Returns the number of threads in the pool (including the calling thread)
+ * @param tp A pointer to the thread pool
+ */
+
+int getThreadPoolSize(ThreadPool *tp);
+
+
+
+
+/**
+ * @brief Runs fct(arg, threadId, threadCount) on all threads of the pool and returns when all of them are done
+ * @param tp A pointer to the thread pool
+ * @param fct Function to be run
+ * @param arg Argument passed to every call of fct
+ */
+
+void runOnThreadPool(ThreadPool *tp, ThreadPoolFct fct, void *arg);
+
+
+
+
+/**
+ * @brief Blocks until all threads of the pool have reached this barrier (only to be called from inside a running fct)
+ * @param tp A pointer to the thread pool
+ */
+
+void waitThreadPoolBarrier(ThreadPool *tp);
+
+
+
+
+/**
+ * @brief Returns the number of CPU cores that are online
+ */
+
+int getCPUCoreCount(void);
+
+
+#endif